@@ -0,0 +1,595 @@
+/*
+ * Scan all block devices (e.g. the modules attached to a gang programmer) for
+ * Toradex config blocks, NVIDIA Tegra partition tables and GPTs and print a
+ * consolidated table.
+ *
+ * Every device is probed by its own thread, the number of requests in flight
+ * per USB hub (or MMC host) is bounded so a tray of modules behind the same
+ * hub doesn't drown it. The time each device took to answer is reported, so
+ * slow slots stand out.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "image.h"
+#include "json.h"
+#include "libapalis.h"
+#include "outbuf.h"
+#include "probe.h"
+#include "tool.h"
+
+#define SYS_BLOCK		"/sys/block"
+#define DEFAULT_DEPTH		8	/* requests in flight per hub */
+#define SLOW_FACTOR		2	/* slower than SLOW_FACTOR * median is slow */
+
+#define NAME_LEN		64
+
+/* Kernel block devices which can't be a module */
+static const char *const skip_prefixes[] = {
+	"loop", "ram", "zram", "dm-", "md", "sr", "nbd", "fd", "zd",
+};
+
+static enum {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+} output_format = FORMAT_TEXT;
+
+/* Devices sharing a hub share its queue depth */
+struct hub {
+	char		name[NAME_LEN];
+	unsigned int	depth;
+	unsigned int	inflight;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	struct hub	*next;
+};
+
+struct scan_dev {
+	char		path[PATH_MAX];
+	char		slot[NAME_LEN];
+	struct hub	*hub;
+	pthread_t	thread;
+
+	/* results */
+	struct dev_probe dp;
+	uint64_t	latency_ns;		/* time spent on I/O, without queueing */
+	bool		slow;
+};
+
+static const char *short_opts = "d:f:h";
+static const struct option long_opts[] = {
+	{ "depth",	required_argument,	NULL, 'd' },
+	{ "format",	required_argument,	NULL, 'f' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ NULL,		0,			NULL, 0 }
+};
+
+static void __attribute__((noreturn)) usage_and_exit(int ret)
+{
+	printf("Usage: apalis-scan [OPTIONS...] [DEV...]\n"
+	       "\n"
+	       "Probe DEVs (default: all block devices found in " SYS_BLOCK ") for config\n"
+	       "blocks, partition tables and GPTs in parallel.\n"
+	       "\n"
+	       "Options:\n"
+	       "  -d, --depth N          Number of requests in flight per USB hub or MMC host\n"
+	       "                         (default %u)\n"
+	       "  -f, --format FORMAT    Output format: text (default) or json\n"
+	       "  -h, --help             Show this message and exit\n",
+	       DEFAULT_DEPTH);
+	exit(ret);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct hub *hubs;
+
+static struct hub *hub_get(const char *name, unsigned int depth)
+{
+	struct hub *h;
+
+	for (h = hubs; h; h = h->next)
+		if (strcmp(h->name, name) == 0)
+			return h;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return NULL;
+	snprintf(h->name, sizeof(h->name), "%s", name);
+	h->depth = depth;
+	pthread_mutex_init(&h->lock, NULL);
+	pthread_cond_init(&h->cond, NULL);
+	h->next = hubs;
+	hubs = h;
+	return h;
+}
+
+static void hubs_free(void)
+{
+	struct hub *h, *next;
+
+	for (h = hubs; h; h = next) {
+		next = h->next;
+		pthread_cond_destroy(&h->cond);
+		pthread_mutex_destroy(&h->lock);
+		free(h);
+	}
+	hubs = NULL;
+}
+
+/* Wait for n request slots on hub h. A batch larger than the depth runs alone. */
+static void hub_acquire(struct hub *h, unsigned int n)
+{
+	pthread_mutex_lock(&h->lock);
+	while (h->inflight > 0 && h->inflight + n > h->depth)
+		pthread_cond_wait(&h->cond, &h->lock);
+	h->inflight += n;
+	pthread_mutex_unlock(&h->lock);
+}
+
+static void hub_release(struct hub *h, unsigned int n)
+{
+	pthread_mutex_lock(&h->lock);
+	h->inflight -= n;
+	pthread_cond_broadcast(&h->cond);
+	pthread_mutex_unlock(&h->lock);
+}
+
+/* Read a batch of requests within the hub's queue depth, accounting the time */
+static int scan_read(void *arg, struct image_io *io, struct image_req *reqs, unsigned int n)
+{
+	struct scan_dev *sd = arg;
+	uint64_t start;
+	int failed;
+
+	hub_acquire(sd->hub, n);
+	start = now_ns();
+	failed = image_io_read(io, reqs, n);
+	sd->latency_ns += now_ns() - start;
+	hub_release(sd->hub, n);
+	return failed;
+}
+
+static bool is_usb_dev(const char *comp, size_t len)
+{
+	size_t i = 0;
+
+	/* bus-port[.port...], e.g. 1-2.3 */
+	while (i < len && isdigit((unsigned char)comp[i]))
+		i++;
+	if (i == 0 || i >= len || comp[i++] != '-')
+		return false;
+	if (i >= len)
+		return false;
+	for (; i < len; i++)
+		if (!isdigit((unsigned char)comp[i]) && comp[i] != '.')
+			return false;
+	return true;
+}
+
+/*
+ * Derive hub and slot from the sysfs device path of a block device. For USB
+ * mass storage the slot is the USB device (plus the LUN, the boot areas of a
+ * module appear as separate LUNs) and the hub its parent. For MMC devices the
+ * host is used as hub.
+ */
+static void sysfs_topology(const char *syspath, const char *name, char *hub, char *slot)
+{
+	const char *comp, *end, *usb = NULL, *mmc = NULL, *scsi = NULL;
+	size_t usb_len = 0, mmc_len = 0, scsi_len = 0;
+
+	snprintf(hub, NAME_LEN, "-");
+	snprintf(slot, NAME_LEN, "%s", name);
+
+	for (comp = syspath; *comp; comp = *end ? end + 1 : end) {
+		size_t len;
+
+		end = strchrnul(comp, '/');
+		len = end - comp;
+		if (is_usb_dev(comp, len)) {
+			usb = comp;
+			usb_len = len;
+		} else if (len > 3 && strncmp(comp, "mmc", 3) == 0 &&
+			   strspn(comp + 3, "0123456789") == len - 3) {
+			mmc = comp;
+			mmc_len = len;
+		} else if (memchr(comp, ':', len) && strspn(comp, "0123456789:") == len) {
+			scsi = comp;	/* host:channel:target:lun */
+			scsi_len = len;
+		}
+	}
+
+	if (usb && usb_len < NAME_LEN) {
+		const char *lun = scsi ? memrchr(scsi, ':', scsi_len) : NULL;
+		const char *dot = memrchr(usb, '.', usb_len);
+
+		if (dot)
+			snprintf(hub, NAME_LEN, "%.*s", (int)(dot - usb), usb);
+		else
+			snprintf(hub, NAME_LEN, "usb%.*s", (int)strcspn(usb, "-"), usb);
+		if (lun)
+			snprintf(slot, NAME_LEN, "%.*s:%.*s", (int)usb_len, usb,
+				 (int)(scsi + scsi_len - lun - 1), lun + 1);
+		else
+			snprintf(slot, NAME_LEN, "%.*s", (int)usb_len, usb);
+	} else if (mmc && mmc_len < NAME_LEN) {
+		snprintf(hub, NAME_LEN, "%.*s", (int)mmc_len, mmc);
+	}
+}
+
+static int scan_dev_add(struct scan_dev **devs, size_t *num, size_t *size, const char *path,
+			unsigned int depth)
+{
+	char syspath[PATH_MAX], link[PATH_MAX], hub[NAME_LEN];
+	struct scan_dev *sd;
+	struct stat st;
+	const char *name;
+
+	if (*num == *size) {
+		size_t new_size = *size ? *size * 2 : 32;
+		struct scan_dev *new_devs = realloc(*devs, new_size * sizeof(**devs));
+
+		if (!new_devs)
+			return -1;
+		*devs = new_devs;
+		*size = new_size;
+	}
+
+	sd = &(*devs)[*num];
+	memset(sd, 0, sizeof(*sd));
+	snprintf(sd->path, sizeof(sd->path), "%s", path);
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+
+	if (stat(path, &st) == 0 && S_ISBLK(st.st_mode)) {
+		snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major(st.st_rdev),
+			 minor(st.st_rdev));
+		if (realpath(link, syspath)) {
+			const char *kname = strrchr(syspath, '/');
+
+			sysfs_topology(syspath, kname ? kname + 1 : name, hub, sd->slot);
+		} else
+			sysfs_topology("", name, hub, sd->slot);
+	} else
+		sysfs_topology("", name, hub, sd->slot);
+
+	sd->hub = hub_get(hub, depth);
+	if (!sd->hub)
+		return -1;
+
+	(*num)++;
+	return 0;
+}
+
+static bool skip_block_dev(const char *name)
+{
+	char path[PATH_MAX];
+	unsigned long long sectors = 0;
+	unsigned int i;
+	FILE *fp;
+
+	if (name[0] == '.')
+		return true;
+	for (i = 0; i < sizeof(skip_prefixes) / sizeof(skip_prefixes[0]); i++)
+		if (strncmp(name, skip_prefixes[i], strlen(skip_prefixes[i])) == 0)
+			return true;
+
+	/* Empty slots of card readers have size 0 */
+	snprintf(path, sizeof(path), SYS_BLOCK "/%s/size", name);
+	fp = fopen(path, "r");
+	if (!fp)
+		return true;
+	if (fscanf(fp, "%llu", &sectors) != 1)
+		sectors = 0;
+	fclose(fp);
+	return sectors == 0;
+}
+
+static int scan_sysfs(struct scan_dev **devs, size_t *num, size_t *size, unsigned int depth)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+	int ret = 0;
+
+	dir = opendir(SYS_BLOCK);
+	if (!dir) {
+		err("Failed to open " SYS_BLOCK ": %s\n", strerror(errno));
+		return -1;
+	}
+
+	while ((de = readdir(dir))) {
+		if (skip_block_dev(de->d_name))
+			continue;
+		snprintf(path, sizeof(path), "/dev/%s", de->d_name);
+		if (scan_dev_add(devs, num, size, path, depth) != 0) {
+			err("Failed to allocate memory\n");
+			ret = -1;
+			break;
+		}
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+static void *scan_dev_probe(void *arg)
+{
+	struct scan_dev *sd = arg;
+	struct image_io io;
+
+	image_io_init(&io);
+	dev_probe(&sd->dp, sd->path, &io, scan_read, sd);
+	/* only the counts and the config block are printed */
+	dev_probe_free(&sd->dp);
+	image_io_exit(&io);
+	return NULL;
+}
+
+static int scan_dev_cmp(const void *a, const void *b)
+{
+	const struct scan_dev *da = a, *db = b;
+	int ret;
+
+	ret = strverscmp(da->hub->name, db->hub->name);
+	if (ret == 0)
+		ret = strverscmp(da->slot, db->slot);
+	if (ret == 0)
+		ret = strverscmp(da->path, db->path);
+	return ret;
+}
+
+static int latency_cmp(const void *a, const void *b)
+{
+	uint64_t la = *(const uint64_t *)a, lb = *(const uint64_t *)b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+/* Mark devices which took much longer than the median of all devices */
+static void mark_slow(struct scan_dev *devs, size_t num)
+{
+	uint64_t *lat, median;
+	size_t i, n = 0;
+
+	lat = malloc(num * sizeof(*lat));
+	if (!lat)
+		return;
+	for (i = 0; i < num; i++)
+		if (!devs[i].dp.error && devs[i].latency_ns)
+			lat[n++] = devs[i].latency_ns;
+	if (n >= 2) {
+		qsort(lat, n, sizeof(*lat), latency_cmp);
+		median = lat[n / 2];
+		for (i = 0; i < num; i++)
+			devs[i].slow = devs[i].latency_ns > SLOW_FACTOR * median;
+	}
+	free(lat);
+}
+
+static void size_str(uint64_t size, char *str, size_t len)
+{
+	static const char units[] = "KMGTP";
+	double s = size;
+	int i = -1;
+
+	while (s >= 1024 && i < (int)sizeof(units) - 2) {
+		s /= 1024;
+		i++;
+	}
+	if (i < 0)
+		snprintf(str, len, "%" PRIu64 "B", size);
+	else
+		snprintf(str, len, "%.1f%c", s, units[i]);
+}
+
+static void print_text(struct outbuf *ob, const struct scan_dev *devs, size_t num,
+		       uint64_t elapsed_ns)
+{
+	int path_w = strlen("DEVICE"), hub_w = strlen("HUB"), slot_w = strlen("SLOT");
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		int len;
+
+		if ((len = strlen(devs[i].path)) > path_w)
+			path_w = len;
+		if ((len = strlen(devs[i].hub->name)) > hub_w)
+			hub_w = len;
+		if ((len = strlen(devs[i].slot)) > slot_w)
+			slot_w = len;
+	}
+
+	outbuf_printf(ob, "%-*s  %-*s  %-*s  %8s  %8s  %4s  %4s  %-8s  %s\n",
+		      path_w, "DEVICE", hub_w, "HUB", slot_w, "SLOT", "SIZE", "LAT(ms)",
+		      "PT", "GPT", "SERIAL", "MODEL");
+
+	for (i = 0; i < num; i++) {
+		const struct scan_dev *sd = &devs[i];
+		char size[16], pt[16] = "-", gpt[16] = "-", serial[16] = "-";
+
+		size_str(sd->dp.size, size, sizeof(size));
+		outbuf_printf(ob, "%-*s  %-*s  %-*s  %8s  %8.2f  ", path_w, sd->path,
+			      hub_w, sd->hub->name, slot_w, sd->slot, sd->dp.error ? "-" : size,
+			      sd->latency_ns / 1e6);
+		if (sd->dp.error) {
+			outbuf_printf(ob, "error: %s\n", strerror(sd->dp.error));
+			continue;
+		}
+
+		if (sd->dp.pt_found)
+			snprintf(pt, sizeof(pt), "%u", sd->dp.pt.num_parts);
+		if (sd->dp.gpt_found)
+			snprintf(gpt, sizeof(gpt), "%u", sd->dp.gpt_num_used);
+		if (sd->dp.cb_found)
+			snprintf(serial, sizeof(serial), "%08u", sd->dp.cb.serial);
+		outbuf_printf(ob, "%4s  %4s  %-8s  ", pt, gpt, serial);
+		if (sd->dp.cb_found) {
+			const struct toradex_hw *hw = &sd->dp.cb.hw;
+
+			outbuf_printf(ob, "%s V%d.%d%c", trdx_module_name(hw->prodid),
+				      hw->ver_major, hw->ver_minor, hw->ver_assembly + 'A');
+		} else
+			outbuf_puts(ob, "-");
+		outbuf_puts(ob, sd->slow ? "  (slow)\n" : "\n");
+	}
+
+	outbuf_printf(ob, "\n%zu devices scanned in %.2f ms\n", num, elapsed_ns / 1e6);
+}
+
+static void print_json(struct outbuf *ob, const struct scan_dev *devs, size_t num,
+		       uint64_t elapsed_ns)
+{
+	size_t i;
+
+	outbuf_puts(ob, "{\"devices\":[");
+	for (i = 0; i < num; i++) {
+		const struct scan_dev *sd = &devs[i];
+
+		if (i > 0)
+			outbuf_puts(ob, ",");
+		outbuf_puts(ob, "{");
+		json_key_str(ob, "device", sd->path);
+		outbuf_puts(ob, ",");
+		json_key_str(ob, "hub", sd->hub->name);
+		outbuf_puts(ob, ",");
+		json_key_str(ob, "slot", sd->slot);
+		outbuf_printf(ob, ",\"size\":%" PRIu64 ",\"latency_ms\":%.3f,\"slow\":%s,",
+			      sd->dp.size, sd->latency_ns / 1e6, sd->slow ? "true" : "false");
+		json_key_str(ob, "error", sd->dp.error ? strerror(sd->dp.error) : NULL);
+
+		if (sd->dp.pt_found)
+			outbuf_printf(ob, ",\"ptable\":{\"partitions\":%u}", sd->dp.pt.num_parts);
+		else
+			outbuf_puts(ob, ",\"ptable\":null");
+		if (sd->dp.gpt_found)
+			outbuf_printf(ob, ",\"gpt\":{\"entries\":%u}", sd->dp.gpt_num_used);
+		else
+			outbuf_puts(ob, ",\"gpt\":null");
+		if (sd->dp.cb_found) {
+			outbuf_printf(ob, ",\"cfgblock\":{\"offset\":%" PRIu64 ",", sd->dp.cb_off);
+			json_cfgblock(ob, &sd->dp.cb);
+			outbuf_puts(ob, "}");
+		} else
+			outbuf_puts(ob, ",\"cfgblock\":null");
+		outbuf_puts(ob, "}");
+	}
+	outbuf_printf(ob, "],\"elapsed_ms\":%.3f}\n", elapsed_ns / 1e6);
+}
+
+int TOOL_MAIN(apalis_scan)(int argc, char **argv)
+{
+	struct scan_dev *devs = NULL;
+	size_t num = 0, size = 0, i, started;
+	unsigned long depth = DEFAULT_DEPTH;
+	struct outbuf ob;
+	uint64_t start, elapsed;
+	char *end;
+	int c, ret = EXIT_FAILURE;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			errno = 0;
+			depth = strtoul(optarg, &end, 0);
+			if (errno || *end || depth == 0 || depth > UINT_MAX) {
+				err("Invalid queue depth: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'f':
+			if (strcmp(optarg, "text") == 0)
+				output_format = FORMAT_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				output_format = FORMAT_JSON;
+			else {
+				err("Unknown output format: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			usage_and_exit(EXIT_SUCCESS);
+		default:
+			usage_and_exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind < argc) {
+		for (; optind < argc; optind++) {
+			if (scan_dev_add(&devs, &num, &size, argv[optind], depth) != 0) {
+				err("Failed to allocate memory\n");
+				goto out;
+			}
+		}
+	} else if (scan_sysfs(&devs, &num, &size, depth) != 0)
+		goto out;
+
+	if (num == 0) {
+		err("No block devices found\n");
+		goto out;
+	}
+
+	start = now_ns();
+	for (started = 0; started < num; started++) {
+		int rc = pthread_create(&devs[started].thread, NULL, scan_dev_probe,
+					&devs[started]);
+
+		if (rc != 0) {
+			err("Failed to create thread: %s\n", strerror(rc));
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(devs[i].thread, NULL);
+	elapsed = now_ns() - start;
+	if (started < num)
+		goto out;
+
+	mark_slow(devs, num);
+	qsort(devs, num, sizeof(*devs), scan_dev_cmp);
+
+	outbuf_init(&ob);
+	if (output_format == FORMAT_JSON)
+		print_json(&ob, devs, num, elapsed);
+	else
+		print_text(&ob, devs, num, elapsed);
+	outbuf_flush(&ob, STDOUT_FILENO);
+	outbuf_free(&ob);
+
+	ret = EXIT_SUCCESS;
+	for (i = 0; i < num; i++)
+		if (devs[i].dp.error)
+			ret = EXIT_FAILURE;
+out:
+	free(devs);
+	hubs_free();
+	return ret;
+}
@@ -0,0 +1,243 @@
+/*
+ * Multi-call binary combining all tools, dispatching on the name it was called
+ * by (e.g. through a symlink named nvtegraparts) or on the first argument.
+ *
+ * The report command prints the PT, GPT and config block of each device in
+ * one go, reading all of them with a single open and batch per device.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "json.h"
+#include "libapalis.h"
+#include "outbuf.h"
+#include "probe.h"
+#include "text.h"
+#include "tool.h"
+
+static int report_main(int argc, char **argv);
+
+static const struct {
+	const char	*name;
+	int		(*main)(int argc, char **argv);
+} tools[] = {
+	{ "nvtegraparts",	nvtegraparts_main },
+	{ "trdx-configblock",	trdx_configblock_main },
+	{ "apalisd",		apalisd_main },
+	{ "apalis-scan",	apalis_scan_main },
+	{ "report",		report_main },
+};
+
+static const char *default_devs[] = {
+	"/dev/mmcblk0boot0", "/dev/mmcblk0boot1", "/dev/mmcblk0",
+};
+
+static enum {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+} output_format = FORMAT_TEXT;
+
+struct report {
+	const char		*path;
+	struct dev_probe	dp;
+};
+
+static void __attribute__((noreturn)) usage_and_exit(int ret)
+{
+	unsigned int i;
+
+	printf("Usage: apalis-tools TOOL [ARGS...]\n"
+	       "       apalis-tools report [-f text|json] [DEV...]\n"
+	       "\n"
+	       "Run TOOL, which is one of:");
+	for (i = 0; i < sizeof(tools) / sizeof(tools[0]); i++)
+		printf(" %s", tools[i].name);
+	printf("\n"
+	       "The tools are also run if apalis-tools is called by their name (e.g. through\n"
+	       "a symlink).\n"
+	       "\n"
+	       "report prints the partition table, GPT and config block found on each DEV\n"
+	       "(default: /dev/mmcblk0boot0 /dev/mmcblk0boot1 /dev/mmcblk0).\n"
+	       "\n"
+	       "Report options:\n"
+	       "  -f, --format FORMAT    Output format: text (default) or json\n"
+	       "  -h, --help             Show this message and exit\n");
+	exit(ret);
+}
+
+static void report_print_text(struct outbuf *ob, const struct report *r)
+{
+	unsigned int i, n;
+
+	if (r->dp.error) {
+		err("Failed to read %s: %s\n", r->path, strerror(r->dp.error));
+		return;
+	}
+
+	outbuf_printf(ob, "%s:\n", r->path);
+
+	if (r->dp.pt_found) {
+		outbuf_printf(ob, "nvtegra partition table (%u partitions, size=%zu)\n",
+			      r->dp.pt.num_parts, r->dp.pt.size);
+		for (i = 0; i < r->dp.pt.num_parts; i++)
+			text_pt_entry(ob, i, &r->dp.pt.pt->partitions[i]);
+	}
+
+	if (r->dp.gpt_found) {
+		n = r->dp.gpt.num_entries;
+		outbuf_printf(ob, "GUID partition table (%u partitions, %u used)\n",
+			      n, r->dp.gpt_num_used);
+		for (i = gpt_next_used(r->dp.gpt_used, n, 0); i < n;
+		     i = gpt_next_used(r->dp.gpt_used, n, i + 1))
+			text_gpt_entry(ob, i, gpt_entry_get(&r->dp.gpt, i));
+	}
+
+	if (r->dp.cb_found) {
+		outbuf_printf(ob, "Toradex config block at 0x%08jx\n", (uintmax_t)r->dp.cb_off);
+		text_cfgblock(ob, &r->dp.cb);
+	}
+
+	if (!r->dp.pt_found && !r->dp.gpt_found && !r->dp.cb_found)
+		outbuf_puts(ob, "Nothing found\n");
+	outbuf_puts(ob, "\n");
+}
+
+static void report_print_json(struct outbuf *ob, const struct report *r)
+{
+	outbuf_puts(ob, "{");
+	json_key_str(ob, "device", r->path);
+	outbuf_printf(ob, ",\"status\":\"%s\"", r->dp.error ? "error" : "ok");
+	if (r->dp.error) {
+		outbuf_puts(ob, ",");
+		json_key_str(ob, "error", strerror(r->dp.error));
+	}
+
+	if (r->dp.pt_found) {
+		outbuf_puts(ob, ",\"ptable\":");
+		json_ptable(ob, r->dp.pt.pt, r->dp.pt.num_parts);
+	}
+
+	if (r->dp.gpt_found) {
+		outbuf_puts(ob, ",\"gpt\":");
+		json_gpt(ob, &r->dp.gpt, r->dp.gpt_used, false);
+	}
+
+	if (r->dp.cb_found) {
+		outbuf_printf(ob, ",\"cfgblock\":{\"offset\":%ju,", (uintmax_t)r->dp.cb_off);
+		json_cfgblock(ob, &r->dp.cb);
+		outbuf_puts(ob, "}");
+	}
+
+	outbuf_puts(ob, "}\n");
+}
+
+static int report_main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "format",	required_argument,	NULL, 'f' },
+		{ "help",	no_argument,		NULL, 'h' },
+		{ NULL,		0,			NULL, 0 }
+	};
+	const char **devs = (const char **)default_devs;
+	int c, i, num = sizeof(default_devs) / sizeof(default_devs[0]);
+	int ret = EXIT_SUCCESS;
+	struct outbuf ob;
+
+	while ((c = getopt_long(argc, argv, "f:h", long_opts, NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			if (strcmp(optarg, "text") == 0)
+				output_format = FORMAT_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				output_format = FORMAT_JSON;
+			else {
+				err("Unknown output format: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			usage_and_exit(EXIT_SUCCESS);
+		default:
+			usage_and_exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind < argc) {
+		devs = (const char **)argv + optind;
+		num = argc - optind;
+	}
+
+	outbuf_init(&ob);
+	for (i = 0; i < num; i++) {
+		struct report *r = calloc(1, sizeof(*r));
+
+		if (!r) {
+			err("Failed to allocate memory\n");
+			ret = EXIT_FAILURE;
+			break;
+		}
+		r->path = devs[i];
+
+		dev_probe(&r->dp, r->path, NULL, NULL, NULL);
+		if (r->dp.error)
+			ret = EXIT_FAILURE;
+		if (output_format == FORMAT_JSON)
+			report_print_json(&ob, r);
+		else
+			report_print_text(&ob, r);
+		outbuf_flush(&ob, STDOUT_FILENO);
+
+		dev_probe_free(&r->dp);
+		free(r);
+	}
+	outbuf_free(&ob);
+
+	return ret;
+}
+
+static int (*tool_find(const char *name))(int, char **)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(tools) / sizeof(tools[0]); i++)
+		if (strcmp(name, tools[i].name) == 0)
+			return tools[i].main;
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int (*tool)(int, char **);
+	const char *name;
+
+	name = strrchr(argv[0], '/');
+	name = name ? name + 1 : argv[0];
+	tool = tool_find(name);
+	if (tool)
+		return tool(argc, argv);
+
+	if (argc < 2)
+		usage_and_exit(EXIT_FAILURE);
+	if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)
+		usage_and_exit(EXIT_SUCCESS);
+
+	tool = tool_find(argv[1]);
+	if (!tool) {
+		err("Unknown tool: %s\n", argv[1]);
+		usage_and_exit(EXIT_FAILURE);
+	}
+	return tool(argc - 1, argv + 1);
+}
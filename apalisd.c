@@ -0,0 +1,863 @@
+/*
+ * Daemon serving the partition layout and config block of a Toradex Apalis
+ * over a Unix socket.
+ *
+ * The parsed PT, GPT and config block are cached as ready-to-send JSON, so a
+ * query doesn't cause any I/O on the eMMC. The cache of a device is dropped
+ * when a uevent for it is received or, checked periodically, its fingerprint
+ * (size and CRC of the sectors holding the metadata) changes.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <linux/netlink.h>
+
+#include "crc32.h"
+#include "image.h"
+#include "json.h"
+#include "libapalis.h"
+#include "outbuf.h"
+#include "tool.h"
+
+#define DEFAULT_SOCKET		"/run/apalisd.sock"
+#define DEFAULT_BOOTDEV		"/dev/mmcblk0boot1"
+#define DEFAULT_GPTDEV		"/dev/mmcblk0"
+#define DEFAULT_CFGDEV		"/dev/mmcblk0boot0"
+#define DEFAULT_CFG_OFF		TRDX_CFG_EMMC_BOOT_OFF
+#define DEFAULT_INTERVAL	30	/* seconds between fingerprint checks */
+
+#define MAX_CLIENTS		32
+#define CMD_MAX			64	/* maximum length of a command line */
+#define UEVENT_BUF_SIZE		4096
+
+/* Cheap fingerprint of the metadata on a device */
+struct fingerprint {
+	bool		valid;		/* device could be read */
+	uint64_t	size;
+	uint32_t	crc;
+};
+
+struct dev {
+	const char		*path;
+	char			name[NAME_MAX + 1];	/* kernel name if a block device */
+	int64_t			fp_off;		/* metadata region, < 0: from the end */
+	size_t			fp_len;
+	struct fingerprint	fp;		/* as of the last refresh */
+};
+
+enum {
+	DEV_BOOT,
+	DEV_GPT,
+	DEV_CFG,
+	DEV_MAX,
+};
+
+struct apalisd;
+
+struct view {
+	const char	*name;
+	unsigned int	devs;		/* mask of devices the view depends on */
+	bool		stale;
+	struct outbuf	json;		/* cached response, without newline */
+	void		(*refresh)(struct apalisd *d, struct view *v);
+};
+
+enum {
+	VIEW_PTABLE,
+	VIEW_CFGBLOCK,
+	VIEW_MAX,
+};
+
+struct client {
+	int		fd;
+	char		in[CMD_MAX];
+	size_t		in_len;
+	struct outbuf	out;
+	size_t		out_off;	/* already sent part of out */
+};
+
+struct apalisd {
+	struct dev	devs[DEV_MAX];
+	struct view	views[VIEW_MAX];
+	struct client	clients[MAX_CLIENTS];
+	unsigned int	num_clients;
+	unsigned int	interval;
+	uint8_t		*buf;		/* read buffer for non-mapped images */
+	size_t		buf_size;
+	uint8_t		*pt_buf;	/* copies kept while reading on */
+	size_t		pt_buf_size;
+	uint8_t		hdr_buf[GPT_BLOCK_SIZE];
+	unsigned long	queries, refreshes, uevents, checks;
+};
+
+static volatile sig_atomic_t stop;
+
+static const char *short_opts = "S:b:g:c:o:i:Q:h";
+static const struct option long_opts[] = {
+	{ "socket",	required_argument,	NULL, 'S' },
+	{ "boot-dev",	required_argument,	NULL, 'b' },
+	{ "gpt-dev",	required_argument,	NULL, 'g' },
+	{ "cfg-dev",	required_argument,	NULL, 'c' },
+	{ "cfg-offset",	required_argument,	NULL, 'o' },
+	{ "interval",	required_argument,	NULL, 'i' },
+	{ "query",	required_argument,	NULL, 'Q' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ NULL,		0,			NULL, 0 }
+};
+
+static void __attribute__((noreturn)) usage_and_exit(int ret)
+{
+	printf("Usage: apalisd [OPTIONS...]\n"
+	       "       apalisd [-S PATH] -Q COMMAND\n"
+	       "\n"
+	       "Options:\n"
+	       "  -S, --socket PATH      Unix socket to listen on (default " DEFAULT_SOCKET ")\n"
+	       "  -b, --boot-dev DEV     Device holding the PT (default " DEFAULT_BOOTDEV ")\n"
+	       "  -g, --gpt-dev DEV      Device holding the GPT (default " DEFAULT_GPTDEV ")\n"
+	       "  -c, --cfg-dev DEV      Device holding the config block (default " DEFAULT_CFGDEV ")\n"
+	       "  -o, --cfg-offset N     Offset of the config block in bytes, negative values are\n"
+	       "                         relative to the end of the device (default -512)\n"
+	       "  -i, --interval SEC     Check the device fingerprints every SEC seconds, 0 to\n"
+	       "                         only rely on uevents (default 30)\n"
+	       "  -Q, --query COMMAND    Send COMMAND to a running apalisd and print the reply\n"
+	       "  -h, --help             Show this message and exit\n"
+	       "\n"
+	       "Commands (one per line, each answered with a line of JSON):\n"
+	       "  all (or an empty line), ptable, cfgblock, refresh, stats\n");
+	exit(ret);
+}
+
+static void sig_stop(int sig)
+{
+	(void) sig;
+	stop = 1;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Get len bytes at off of img, reading into the daemon's buffer if needed */
+static const void *apalisd_read(struct apalisd *d, struct image *img, uint64_t off, size_t len)
+{
+	if (!img->map && len > d->buf_size) {
+		uint8_t *buf = realloc(d->buf, len);
+		if (!buf) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		d->buf = buf;
+		d->buf_size = len;
+	}
+	return image_read(img, off, len, d->buf);
+}
+
+static int dev_region(const struct dev *dev, const struct image *img, uint64_t *off)
+{
+	if (dev->fp_off < 0) {
+		if ((uint64_t)-dev->fp_off > img->size)
+			return -1;
+		*off = img->size + dev->fp_off;
+	} else {
+		*off = dev->fp_off;
+	}
+	return *off + dev->fp_len <= img->size ? 0 : -1;
+}
+
+static void dev_fingerprint(struct apalisd *d, struct dev *dev, struct fingerprint *fp)
+{
+	struct image img;
+	const void *data;
+	uint64_t off;
+
+	memset(fp, 0, sizeof(*fp));
+	if (image_open(&img, dev->path) != 0)
+		return;
+
+	fp->size = img.size;
+	if (dev_region(dev, &img, &off) == 0) {
+		data = apalisd_read(d, &img, off, dev->fp_len);
+		if (data) {
+			fp->crc = crc32_update(0, data, dev->fp_len);
+			fp->valid = true;
+		}
+	}
+	image_close(&img);
+}
+
+static bool fingerprint_equal(const struct fingerprint *a, const struct fingerprint *b)
+{
+	return a->valid == b->valid && a->size == b->size && a->crc == b->crc;
+}
+
+static void dev_init(struct dev *dev, const char *path, int64_t fp_off, size_t fp_len)
+{
+	char real[PATH_MAX];
+	struct stat st;
+	const char *base;
+
+	dev->path = path;
+	dev->fp_off = fp_off;
+	dev->fp_len = fp_len;
+	dev->name[0] = '\0';
+
+	/* uevents refer to block devices by their kernel name */
+	if (stat(path, &st) == 0 && S_ISBLK(st.st_mode) && realpath(path, real)) {
+		base = strrchr(real, '/');
+		base = base ? base + 1 : real;
+		if (strlen(base) < sizeof(dev->name))
+			strcpy(dev->name, base);
+	}
+}
+
+static void views_invalidate(struct apalisd *d, unsigned int devs)
+{
+	unsigned int i;
+
+	for (i = 0; i < VIEW_MAX; i++)
+		if (d->views[i].devs & devs)
+			d->views[i].stale = true;
+}
+
+static void view_ptable_refresh(struct apalisd *d, struct view *v)
+{
+	struct dev *boot = &d->devs[DEV_BOOT], *gdev = &d->devs[DEV_GPT];
+	struct outbuf *ob = &v->json, errs;
+	struct image img, gimg;
+	struct nvtegra_ptable_info info;
+	struct gpt_info gpt;
+	bool img_opened = false, gimg_opened = false, gpt_found = false;
+	const void *data;
+	int sector_size, ret = -1, pt_ret = APALIS_E_SHORT;
+	size_t pt_size;
+
+	outbuf_init(&errs);
+	outbuf_reset(ob);
+
+	if (image_open(&img, boot->path) != 0) {
+		outbuf_printf(&errs, "Failed to open file %s: %s\n", boot->path, strerror(errno));
+		goto out;
+	}
+	img_opened = true;
+
+	/* read the start of the PT, then the rest if it doesn't fit */
+	pt_size = NVTEGRA_PT_MIN_READ;
+	data = apalisd_read(d, &img, 0, pt_size);
+	if (data && nvtegra_ptable_size(data, pt_size, &pt_size) == APALIS_OK &&
+	    pt_size > NVTEGRA_PT_MIN_READ)
+		data = apalisd_read(d, &img, 0, pt_size);
+	else
+		pt_size = NVTEGRA_PT_MIN_READ;
+	if (!data) {
+		outbuf_printf(&errs, "Failed to read %zu bytes from file: %s\n", pt_size,
+			      strerror(errno));
+		goto out;
+	}
+	/* keep the PT around while the GPT is read into the same buffer */
+	if (!img.map) {
+		if (pt_size > d->pt_buf_size) {
+			uint8_t *buf = realloc(d->pt_buf, pt_size);
+			if (!buf) {
+				outbuf_printf(&errs, "Failed to allocate memory\n");
+				goto out;
+			}
+			d->pt_buf = buf;
+			d->pt_buf_size = pt_size;
+		}
+		memcpy(d->pt_buf, data, pt_size);
+		data = d->pt_buf;
+	}
+
+	pt_ret = nvtegra_ptable_parse(data, pt_size, &info);
+	if (pt_ret == APALIS_E_PT_PART_ID) {
+		outbuf_printf(&errs, "Invalid id %u\n", info.bad_id);
+	} else if (pt_ret != APALIS_OK) {
+		outbuf_printf(&errs, "%s\n", apalis_strerror(pt_ret));
+		goto out;
+	}
+
+	if (!info.gpt) {
+		ret = 0;
+		goto out;
+	}
+
+	if (image_open(&gimg, gdev->path) != 0) {
+		outbuf_printf(&errs, "Failed to open file %s: %s\n", gdev->path, strerror(errno));
+		goto out;
+	}
+	gimg_opened = true;
+
+	errno = EINVAL;
+	if (gimg.size < GPT_BLOCK_SIZE ||
+	    !(data = apalisd_read(d, &gimg, gimg.size - GPT_BLOCK_SIZE, GPT_BLOCK_SIZE))) {
+		outbuf_printf(&errs, "Failed to read GPT header: %s\n", strerror(errno));
+		goto out;
+	}
+	ret = gpt_header_parse(data, GPT_BLOCK_SIZE, gimg.size, &gpt);
+	if (ret == APALIS_OK) {
+		uint64_t table_off;
+
+		if (!gimg.map) {
+			memcpy(d->hdr_buf, data, sizeof(d->hdr_buf));
+			gpt.hdr = (const void *)d->hdr_buf;
+		}
+
+		if (ioctl(gimg.fd, BLKSSZGET, &sector_size) != 0)
+			sector_size = 512;
+		table_off = gpt.lba_table * sector_size;
+		errno = EINVAL;
+		if (table_off + gpt.table_size > gimg.size ||
+		    !(data = apalisd_read(d, &gimg, table_off, gpt.table_size))) {
+			outbuf_printf(&errs, "Failed to read GPT table: %s\n", strerror(errno));
+			ret = -1;
+			goto out;
+		}
+		ret = gpt_table_parse(&gpt, data, gpt.table_size);
+	}
+	if (ret != APALIS_OK) {
+		outbuf_printf(&errs, "%s\n", apalis_strerror(ret));
+		ret = -1;
+		goto out;
+	}
+	gpt_found = true;
+out:
+	outbuf_puts(ob, "{");
+	json_key_str(ob, "boot_dev", boot->path);
+	outbuf_puts(ob, ",");
+	json_key_str(ob, "gpt_dev", gdev->path);
+	outbuf_printf(ob, ",\"status\":\"%s\",", ret == 0 ? "ok" : "error");
+	json_errors(ob, errs.buf, errs.len);
+	if (pt_ret == APALIS_OK || pt_ret == APALIS_E_PT_PART_ID) {
+		outbuf_puts(ob, ",\"ptable\":");
+		json_ptable(ob, info.pt, info.num_parts);
+	}
+	if (gpt_found) {
+		outbuf_puts(ob, ",\"gpt\":");
+		json_gpt(ob, &gpt, NULL, false);
+	}
+	outbuf_puts(ob, "}");
+
+	if (gimg_opened)
+		image_close(&gimg);
+	if (img_opened)
+		image_close(&img);
+	outbuf_free(&errs);
+}
+
+static void view_cfgblock_refresh(struct apalisd *d, struct view *v)
+{
+	struct dev *dev = &d->devs[DEV_CFG];
+	struct outbuf *ob = &v->json;
+	struct trdx_cfgblock cb;
+	struct image img;
+	const void *data = NULL;
+	uint64_t off = 0;
+	const char *error = NULL;
+	bool opened = false, valid = false;
+
+	outbuf_reset(ob);
+
+	if (image_open(&img, dev->path) != 0) {
+		error = strerror(errno);
+		goto out;
+	}
+	opened = true;
+
+	if (dev_region(dev, &img, &off) != 0) {
+		error = strerror(EINVAL);
+		goto out;
+	}
+	data = apalisd_read(d, &img, off, TRDX_CFG_BLOCK_MAX_SIZE);
+	if (!data) {
+		error = strerror(errno);
+		goto out;
+	}
+	valid = trdx_cfgblock_parse(data, TRDX_CFG_BLOCK_MAX_SIZE, &cb) == APALIS_OK;
+out:
+	outbuf_puts(ob, "{\"device\":");
+	outbuf_json_str(ob, dev->path, strlen(dev->path));
+	outbuf_printf(ob, ",\"offset\":%" PRIu64 ",\"status\":\"%s\",\"valid\":%s", off,
+		      error ? "error" : "ok", valid ? "true" : "false");
+	if (error) {
+		outbuf_puts(ob, ",");
+		json_key_str(ob, "error", error);
+	}
+	if (valid) {
+		outbuf_puts(ob, ",");
+		json_cfgblock(ob, &cb);
+	}
+	outbuf_puts(ob, "}");
+
+	if (opened)
+		image_close(&img);
+}
+
+/* Get the view up to date, re-reading the devices only if it is stale */
+static const struct outbuf *view_get(struct apalisd *d, struct view *v)
+{
+	unsigned int i;
+
+	if (!v->stale)
+		return &v->json;
+
+	/* Take the fingerprints first, so concurrent changes are detected later */
+	for (i = 0; i < DEV_MAX; i++)
+		if (v->devs & (1U << i))
+			dev_fingerprint(d, &d->devs[i], &d->devs[i].fp);
+
+	v->refresh(d, v);
+	v->stale = false;
+	d->refreshes++;
+	return &v->json;
+}
+
+/* Compare the fingerprints of all devices and drop the cache of changed ones */
+static void apalisd_check(struct apalisd *d)
+{
+	struct fingerprint fp;
+	unsigned int i, changed = 0;
+
+	for (i = 0; i < DEV_MAX; i++) {
+		dev_fingerprint(d, &d->devs[i], &fp);
+		if (!fingerprint_equal(&fp, &d->devs[i].fp))
+			changed |= 1U << i;
+	}
+	views_invalidate(d, changed);
+	d->checks++;
+}
+
+static void apalisd_uevent(struct apalisd *d, int fd)
+{
+	char buf[UEVENT_BUF_SIZE];
+	ssize_t len;
+
+	while ((len = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+		const char *p, *end = buf + len, *devname = NULL;
+		bool block = false;
+		unsigned int i, changed = 0;
+
+		buf[len] = '\0';
+		for (p = buf; p < end; p += strlen(p) + 1) {
+			if (strcmp(p, "SUBSYSTEM=block") == 0)
+				block = true;
+			else if (strncmp(p, "DEVNAME=", 8) == 0)
+				devname = p + 8;
+		}
+		if (!block || !devname)
+			continue;
+
+		d->uevents++;
+		for (i = 0; i < DEV_MAX; i++) {
+			const char *name = d->devs[i].name;
+			size_t n = strlen(name);
+
+			/* the device itself or one of its partitions */
+			if (n > 0 && strncmp(devname, name, n) == 0 &&
+			    (devname[n] == '\0' || devname[n] == 'p'))
+				changed |= 1U << i;
+		}
+		views_invalidate(d, changed);
+	}
+}
+
+static int uevent_open(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;	/* kernel uevents */
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void client_reply_view(struct apalisd *d, struct client *c, unsigned int view)
+{
+	const struct outbuf *json = view_get(d, &d->views[view]);
+
+	outbuf_write(&c->out, json->buf, json->len);
+}
+
+static void client_command(struct apalisd *d, struct client *c, const char *cmd)
+{
+	unsigned int i;
+
+	d->queries++;
+
+	for (i = 0; i < VIEW_MAX; i++) {
+		if (strcmp(cmd, d->views[i].name) == 0) {
+			client_reply_view(d, c, i);
+			outbuf_puts(&c->out, "\n");
+			return;
+		}
+	}
+
+	if (*cmd == '\0' || strcmp(cmd, "all") == 0) {
+		outbuf_puts(&c->out, "{\"ptable\":");
+		client_reply_view(d, c, VIEW_PTABLE);
+		outbuf_puts(&c->out, ",\"cfgblock\":");
+		client_reply_view(d, c, VIEW_CFGBLOCK);
+		outbuf_puts(&c->out, "}");
+	} else if (strcmp(cmd, "refresh") == 0) {
+		views_invalidate(d, ~0U);
+		outbuf_puts(&c->out, "{\"status\":\"ok\"}");
+	} else if (strcmp(cmd, "stats") == 0) {
+		outbuf_printf(&c->out, "{\"queries\":%lu,\"refreshes\":%lu,\"uevents\":%lu,\"checks\":%lu}",
+			      d->queries, d->refreshes, d->uevents, d->checks);
+	} else {
+		outbuf_puts(&c->out, "{\"status\":\"error\",\"errors\":[\"Unknown command\"]}");
+	}
+	outbuf_puts(&c->out, "\n");
+}
+
+static void client_close(struct apalisd *d, unsigned int i)
+{
+	struct client *c = &d->clients[i];
+
+	close(c->fd);
+	outbuf_free(&c->out);
+	d->clients[i] = d->clients[--d->num_clients];
+}
+
+/* Send as much of the pending output as possible, returns -1 on error */
+static int client_send(struct client *c)
+{
+	while (c->out_off < c->out.len) {
+		ssize_t n = send(c->fd, c->out.buf + c->out_off, c->out.len - c->out_off,
+				 MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		c->out_off += n;
+	}
+	outbuf_reset(&c->out);
+	c->out_off = 0;
+	return 0;
+}
+
+/* Read and handle the commands sent by client c, returns -1 to close it */
+static int client_input(struct apalisd *d, struct client *c)
+{
+	ssize_t n;
+	char *nl;
+
+	n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, MSG_DONTWAIT);
+	if (n < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : -1;
+	if (n == 0)
+		return -1;
+	c->in_len += n;
+
+	while ((nl = memchr(c->in, '\n', c->in_len))) {
+		size_t len = nl - c->in;
+
+		*nl = '\0';
+		if (len > 0 && c->in[len - 1] == '\r')
+			c->in[len - 1] = '\0';
+		client_command(d, c, c->in);
+		c->in_len -= len + 1;
+		memmove(c->in, nl + 1, c->in_len);
+	}
+
+	/* command line too long */
+	if (c->in_len == sizeof(c->in))
+		return -1;
+
+	return client_send(c);
+}
+
+static int socket_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		err("Socket path %s too long\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		err("Failed to create socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* remove a stale socket left behind by a previous instance */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+		err("Failed to listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int apalisd_run(struct apalisd *d, const char *sock_path)
+{
+	struct pollfd pfds[2 + MAX_CLIENTS];
+	uint64_t next_check;
+	int lfd, ufd, ret = EXIT_FAILURE;
+	unsigned int i;
+
+	lfd = socket_listen(sock_path);
+	if (lfd < 0)
+		return EXIT_FAILURE;
+
+	ufd = uevent_open();
+	if (ufd < 0)
+		warn("Failed to listen for uevents: %s\n", strerror(errno));
+
+	next_check = now_ms() + d->interval * 1000ULL;
+
+	while (!stop) {
+		unsigned int nfds = 2, nclients = d->num_clients;
+		int timeout = -1;
+
+		pfds[0].fd = lfd;
+		pfds[0].events = d->num_clients < MAX_CLIENTS ? POLLIN : 0;
+		pfds[1].fd = ufd;
+		pfds[1].events = POLLIN;
+		for (i = 0; i < nclients; i++) {
+			struct client *c = &d->clients[i];
+
+			pfds[nfds].fd = c->fd;
+			pfds[nfds].events = c->out.len > c->out_off ? POLLOUT : POLLIN;
+			nfds++;
+		}
+
+		if (d->interval) {
+			uint64_t now = now_ms();
+
+			timeout = next_check > now ? (int)(next_check - now) : 0;
+		}
+
+		if (poll(pfds, nfds, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			err("poll failed: %s\n", strerror(errno));
+			goto out;
+		}
+
+		if (d->interval && now_ms() >= next_check) {
+			apalisd_check(d);
+			next_check = now_ms() + d->interval * 1000ULL;
+		}
+
+		if (pfds[1].revents & POLLIN)
+			apalisd_uevent(d, ufd);
+
+		/* walk backwards, client_close() moves the last client into the slot */
+		for (i = nclients; i-- > 0; ) {
+			struct client *c = &d->clients[i];
+			short revents = pfds[2 + i].revents;
+			int r = 0;
+
+			if (revents & POLLOUT)
+				r = client_send(c);
+			else if (revents & (POLLIN | POLLHUP | POLLERR))
+				r = client_input(d, c);
+			if (r != 0)
+				client_close(d, i);
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			int cfd;
+
+			while (d->num_clients < MAX_CLIENTS &&
+			       (cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+				struct client *c = &d->clients[d->num_clients++];
+
+				memset(c, 0, sizeof(*c));
+				c->fd = cfd;
+				outbuf_init(&c->out);
+			}
+		}
+	}
+	ret = EXIT_SUCCESS;
+out:
+	while (d->num_clients > 0)
+		client_close(d, d->num_clients - 1);
+	if (ufd >= 0)
+		close(ufd);
+	close(lfd);
+	unlink(sock_path);
+	return ret;
+}
+
+/* Client side: send cmd to the daemon listening on sock_path, print the reply */
+static int apalisd_query(const char *sock_path, const char *cmd)
+{
+	struct sockaddr_un addr;
+	struct outbuf ob;
+	char buf[4096];
+	ssize_t n;
+	int fd, ret = EXIT_FAILURE;
+
+	if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+		err("Socket path %s too long\n", sock_path);
+		return EXIT_FAILURE;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		err("Failed to create socket: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sock_path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		err("Failed to connect to %s: %s\n", sock_path, strerror(errno));
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	outbuf_init(&ob);
+	outbuf_puts(&ob, cmd);
+	outbuf_puts(&ob, "\n");
+	if (outbuf_flush(&ob, fd) != 0) {
+		err("Failed to send command: %s\n", strerror(errno));
+		goto out;
+	}
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		outbuf_write(&ob, buf, n);
+		if (memchr(buf, '\n', n))
+			break;
+	}
+	if (n < 0) {
+		err("Failed to read reply: %s\n", strerror(errno));
+		goto out;
+	}
+	if (outbuf_flush(&ob, STDOUT_FILENO) == 0)
+		ret = EXIT_SUCCESS;
+out:
+	outbuf_free(&ob);
+	close(fd);
+	return ret;
+}
+
+int TOOL_MAIN(apalisd)(int argc, char **argv)
+{
+	static struct apalisd d;
+	const char *sock_path = DEFAULT_SOCKET, *query = NULL;
+	const char *boot_dev = DEFAULT_BOOTDEV, *gpt_dev = DEFAULT_GPTDEV, *cfg_dev = DEFAULT_CFGDEV;
+	int64_t cfg_off = DEFAULT_CFG_OFF;
+	struct sigaction sa;
+	unsigned int i;
+	int c, ret;
+
+	d.interval = DEFAULT_INTERVAL;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch (c) {
+		case 'S':
+			sock_path = optarg;
+			break;
+		case 'b':
+			boot_dev = optarg;
+			break;
+		case 'g':
+			gpt_dev = optarg;
+			break;
+		case 'c':
+			cfg_dev = optarg;
+			break;
+		case 'o':
+			cfg_off = strtoll(optarg, NULL, 0);
+			break;
+		case 'i':
+			d.interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'Q':
+			query = optarg;
+			break;
+		case 'h':
+			usage_and_exit(EXIT_SUCCESS);
+		default:
+			usage_and_exit(EXIT_FAILURE);
+		}
+	}
+
+	if (query)
+		return apalisd_query(sock_path, query);
+
+	/*
+	 * The fingerprinted regions hold the PT, the backup GPT header (which
+	 * includes the table CRC) and the config block.
+	 */
+	dev_init(&d.devs[DEV_BOOT], boot_dev, 0, NVTEGRA_PT_SIZE);
+	dev_init(&d.devs[DEV_GPT], gpt_dev, -GPT_BLOCK_SIZE, GPT_BLOCK_SIZE);
+	dev_init(&d.devs[DEV_CFG], cfg_dev, cfg_off, TRDX_CFG_BLOCK_MAX_SIZE);
+
+	d.views[VIEW_PTABLE].name = "ptable";
+	d.views[VIEW_PTABLE].devs = (1U << DEV_BOOT) | (1U << DEV_GPT);
+	d.views[VIEW_PTABLE].refresh = view_ptable_refresh;
+	d.views[VIEW_CFGBLOCK].name = "cfgblock";
+	d.views[VIEW_CFGBLOCK].devs = 1U << DEV_CFG;
+	d.views[VIEW_CFGBLOCK].refresh = view_cfgblock_refresh;
+	for (i = 0; i < VIEW_MAX; i++) {
+		outbuf_init(&d.views[i].json);
+		d.views[i].stale = true;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	ret = apalisd_run(&d, sock_path);
+
+	for (i = 0; i < VIEW_MAX; i++)
+		outbuf_free(&d.views[i].json);
+	free(d.buf);
+	free(d.pt_buf);
+	return ret;
+}
@@ -0,0 +1,78 @@
+/*
+ * Bump allocator for many small, equally long-lived allocations
+ *
+ * Memory is taken from large chunks which are only freed all at once by
+ * arena_free(), so there is neither per-allocation overhead nor a free().
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE	(1024 * 1024)
+#define ARENA_ALIGN		8
+
+struct arena_chunk {
+	struct arena_chunk	*next;
+	uint64_t		data[];
+};
+
+void arena_init(struct arena *a)
+{
+	memset(a, 0, sizeof(*a));
+}
+
+void arena_free(struct arena *a)
+{
+	struct arena_chunk *c = a->chunks;
+
+	while (c) {
+		struct arena_chunk *next = c->next;
+
+		free(c);
+		c = next;
+	}
+	arena_init(a);
+}
+
+void *arena_alloc(struct arena *a, size_t len)
+{
+	struct arena_chunk *c;
+	size_t size;
+	void *p;
+
+	len = (len + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+	if (!a->chunks || a->size - a->used < len) {
+		/* allocations larger than a chunk get one of their own */
+		size = len > ARENA_CHUNK_SIZE ? len : ARENA_CHUNK_SIZE;
+		c = malloc(sizeof(*c) + size);
+		if (!c)
+			return NULL;
+		c->next = a->chunks;
+		a->chunks = c;
+		a->used = 0;
+		a->size = size;
+	}
+
+	p = (uint8_t *)a->chunks->data + a->used;
+	a->used += len;
+	return p;
+}
+
+char *arena_strndup(struct arena *a, const char *str, size_t len)
+{
+	char *s = arena_alloc(a, len + 1);
+
+	if (s) {
+		memcpy(s, str, len);
+		s[len] = '\0';
+	}
+	return s;
+}
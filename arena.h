@@ -0,0 +1,33 @@
+/*
+ * Bump allocator for many small, equally long-lived allocations
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+struct arena {
+	struct arena_chunk	*chunks;	/* most recent first */
+	size_t			used;		/* bytes used in the first chunk */
+	size_t			size;		/* size of the first chunk's data */
+};
+
+void arena_init(struct arena *a);
+
+/* Free everything allocated from a at once */
+void arena_free(struct arena *a);
+
+/* Allocate len bytes, aligned to 8 bytes. Returns NULL on failure. */
+void *arena_alloc(struct arena *a, size_t len);
+
+/* Copy the len bytes at str to a, adding a terminating '\0' */
+char *arena_strndup(struct arena *a, const char *str, size_t len);
+
+#endif /* ARENA_H */
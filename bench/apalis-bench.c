@@ -0,0 +1,511 @@
+/*
+ * Benchmark harness for the parsing and I/O paths: times the open, read, CRC,
+ * decode and print stages on a set of images with a warm and a cold page
+ * cache.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "image.h"
+#include "json.h"
+#include "libapalis.h"
+#include "outbuf.h"
+
+#define err(fmt, args...)	fprintf(stderr, "Error: " fmt, ##args)
+
+#define DEFAULT_ITER		100
+#define PAGE_SIZE		4096
+
+/* --check-crc: random buffers of up to CHECK_MAX_LEN bytes at up to CHECK_MAX_ALIGN */
+#define CHECK_ROUNDS		20000
+#define CHECK_MAX_LEN		8192
+#define CHECK_MAX_ALIGN		64
+
+enum {
+	STAGE_OPEN,		/* open and close (incl. mapping) */
+	STAGE_READ,		/* get the metadata regions, incl. page faults */
+	STAGE_CRC,		/* CRC32 over all bytes read */
+	STAGE_DECODE,		/* PT, GPT and config block parsers, GPT names */
+	STAGE_PRINT,		/* JSON and hexdump to /dev/null */
+	STAGE_MAX,
+};
+
+static const char *const stage_names[STAGE_MAX] = {
+	[STAGE_OPEN]	= "open",
+	[STAGE_READ]	= "read",
+	[STAGE_CRC]	= "crc",
+	[STAGE_DECODE]	= "decode",
+	[STAGE_PRINT]	= "print",
+};
+
+/* Regions read from an image */
+enum {
+	REGION_PT,
+	REGION_TAIL,		/* last sector: backup GPT header or config block */
+	REGION_TABLE,		/* backup GPT table */
+	REGION_MAX,
+};
+
+struct region {
+	const uint8_t	*data;
+	size_t		len;
+	uint8_t		*buf;	/* for non-mapped images */
+	size_t		size;
+};
+
+struct bench {
+	unsigned int	iter;
+	bool		verbose;
+	bool		warmup;
+	int		null_fd;
+	struct outbuf	ob;
+	struct region	regions[REGION_MAX];
+	uint64_t	*samples[STAGE_MAX];	/* per iteration, summed over all images */
+	uint64_t	bytes;			/* read per iteration */
+	volatile uint32_t sink;			/* keeps results alive */
+};
+
+static const char *short_opts = "n:m:c:Cvh";
+static const struct option long_opts[] = {
+	{ "iterations",	required_argument,	NULL, 'n' },
+	{ "cache",	required_argument,	NULL, 'm' },
+	{ "crc",	required_argument,	NULL, 'c' },
+	{ "check-crc",	no_argument,		NULL, 'C' },
+	{ "verbose",	no_argument,		NULL, 'v' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ NULL,		0,			NULL, 0 }
+};
+
+static void __attribute__((noreturn)) usage_and_exit(int ret)
+{
+	printf("Usage: apalis-bench [OPTIONS...] IMAGE...\n"
+	       "       apalis-bench --check-crc\n"
+	       "\n"
+	       "Options:\n"
+	       "  -n, --iterations N     Number of iterations (default %u)\n"
+	       "  -m, --cache MODE       Page cache: warm, cold or both (default)\n"
+	       "  -c, --crc IMPL         CRC32 implementation to use (default: fastest)\n"
+	       "  -C, --check-crc        Check all supported CRC32 implementations against\n"
+	       "                         the bytewise reference instead of benchmarking\n"
+	       "  -v, --verbose          Show the stages of each image\n"
+	       "  -h, --help             Show this message and exit\n",
+	       DEFAULT_ITER);
+	exit(ret);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t check_rand(uint64_t *state)
+{
+	/* xorshift64* */
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Compare each supported CRC32 implementation with crc32_bytewise() over
+ * random lengths, alignments and initial CRCs. Returns -1 on a mismatch.
+ */
+static int crc_check(void)
+{
+	static const char *const impls[] = { "bytewise", "slice8", "pclmul", "armv8" };
+	uint64_t seed = now_ns() | 1, state = seed;
+	unsigned int i, r, failed = 0;
+	uint8_t *buf;
+
+	buf = malloc(CHECK_MAX_ALIGN + CHECK_MAX_LEN);
+	if (!buf) {
+		err("Failed to allocate memory\n");
+		return -1;
+	}
+	for (i = 0; i < CHECK_MAX_ALIGN + CHECK_MAX_LEN; i++)
+		buf[i] = check_rand(&state);
+
+	printf("crc32 check, seed 0x%016" PRIx64 "\n", seed);
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		if (crc32_select(impls[i]) != 0) {
+			printf("  %-8s  not supported\n", impls[i]);
+			continue;
+		}
+
+		for (r = 0; r < CHECK_ROUNDS; r++) {
+			size_t off = check_rand(&state) % CHECK_MAX_ALIGN;
+			/* every other round a short one, to cover the tails */
+			size_t len = check_rand(&state) % (r & 1 ? 128 : CHECK_MAX_LEN + 1);
+			uint32_t crc = r & 2 ? check_rand(&state) : 0;
+			uint32_t want = crc32_bytewise(crc, buf + off, len);
+			uint32_t got = crc32_update(crc, buf + off, len);
+
+			if (got != want) {
+				err("crc32 %s: 0x%08x instead of 0x%08x for %zu bytes at offset %zu, "
+				    "crc 0x%08x\n", impls[i], got, want, len, off, crc);
+				failed++;
+				break;
+			}
+		}
+		if (r == CHECK_ROUNDS)
+			printf("  %-8s  OK\n", impls[i]);
+	}
+
+	crc32_select(NULL);
+	free(buf);
+	return failed ? -1 : 0;
+}
+
+/* Drop the cached pages of the file at path */
+static void drop_cache(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static int region_read(struct bench *b, struct image *img, unsigned int idx, uint64_t off,
+		       size_t len)
+{
+	struct region *r = &b->regions[idx];
+	size_t i;
+
+	r->data = NULL;
+	r->len = 0;
+	if (off + len > img->size)
+		return -1;
+
+	if (!img->map && len > r->size) {
+		uint8_t *buf = realloc(r->buf, len);
+		if (!buf)
+			return -1;
+		r->buf = buf;
+		r->size = len;
+	}
+
+	r->data = image_read(img, off, len, r->buf);
+	if (!r->data)
+		return -1;
+	r->len = len;
+
+	/* fault in mapped pages here rather than in a later stage */
+	for (i = 0; img->map && i < len; i += PAGE_SIZE)
+		b->sink += r->data[i];
+	return 0;
+}
+
+static void stage_read(struct bench *b, struct image *img)
+{
+	struct region *pt = &b->regions[REGION_PT], *tail = &b->regions[REGION_TAIL];
+	struct gpt_info gpt;
+	size_t size = NVTEGRA_PT_MIN_READ;
+
+	if (region_read(b, img, REGION_PT, 0, NVTEGRA_PT_MIN_READ) == 0 &&
+	    nvtegra_ptable_size(pt->data, pt->len, &size) == APALIS_OK && size > pt->len)
+		region_read(b, img, REGION_PT, 0, size);
+
+	b->regions[REGION_TABLE].len = 0;
+	if (img->size < GPT_BLOCK_SIZE ||
+	    region_read(b, img, REGION_TAIL, img->size - GPT_BLOCK_SIZE, GPT_BLOCK_SIZE) != 0)
+		return;
+
+	/* only locates the table, it's parsed again in the decode stage */
+	if (gpt_header_parse(tail->data, tail->len, img->size, &gpt) == APALIS_OK)
+		region_read(b, img, REGION_TABLE, gpt.lba_table * GPT_BLOCK_SIZE, gpt.table_size);
+}
+
+static void stage_crc(struct bench *b)
+{
+	unsigned int i;
+	uint32_t crc = 0;
+
+	for (i = 0; i < REGION_MAX; i++) {
+		crc = crc32_update(crc, b->regions[i].data, b->regions[i].len);
+		b->bytes += b->regions[i].len;
+	}
+	b->sink += crc;
+}
+
+struct decoded {
+	struct nvtegra_ptable_info pt;
+	bool pt_valid;
+	struct gpt_info gpt;
+	bool gpt_valid;
+	struct trdx_cfgblock cb;
+	bool cb_valid;
+};
+
+static void stage_decode(struct bench *b, const struct image *img, struct decoded *d)
+{
+	const struct region *pt = &b->regions[REGION_PT], *tail = &b->regions[REGION_TAIL];
+	const struct region *table = &b->regions[REGION_TABLE];
+	unsigned int i;
+	int ret;
+
+	ret = nvtegra_ptable_parse(pt->data, pt->len, &d->pt);
+	d->pt_valid = ret == APALIS_OK || ret == APALIS_E_PT_PART_ID;
+
+	d->gpt_valid = tail->len && table->len &&
+		       gpt_parse(tail->data, tail->len, table->data, table->len, img->size,
+				 &d->gpt) == APALIS_OK;
+	for (i = 0; d->gpt_valid && i < d->gpt.num_entries; i++) {
+		char name[40];
+
+		gpt_entry_name(gpt_entry_get(&d->gpt, i), name, sizeof(name));
+		b->sink += name[0];
+	}
+
+	d->cb_valid = tail->len &&
+		      trdx_cfgblock_parse(tail->data, tail->len, &d->cb) == APALIS_OK;
+}
+
+static void stage_print(struct bench *b, const struct decoded *d)
+{
+	struct outbuf *ob = &b->ob;
+	const struct region *table = &b->regions[REGION_TABLE];
+
+	outbuf_reset(ob);
+	outbuf_puts(ob, "{");
+	if (d->pt_valid) {
+		outbuf_puts(ob, "\"ptable\":");
+		json_ptable(ob, d->pt.pt, d->pt.num_parts);
+		outbuf_puts(ob, ",");
+	}
+	if (d->gpt_valid) {
+		outbuf_puts(ob, "\"gpt\":");
+		json_gpt(ob, &d->gpt, NULL, false);
+		outbuf_puts(ob, ",");
+	}
+	if (d->cb_valid) {
+		outbuf_puts(ob, "\"cfgblock\":{");
+		json_cfgblock(ob, &d->cb);
+		outbuf_puts(ob, "},");
+	}
+	outbuf_puts(ob, "\"end\":null}\n");
+
+	/* as with nvtegraparts -v */
+	if (d->pt_valid)
+		outbuf_hexdump(ob, (const uint8_t *)d->pt.pt, d->pt.size);
+	if (d->gpt_valid)
+		outbuf_hexdump(ob, table->data, table->len);
+
+	outbuf_flush(ob, b->null_fd);
+}
+
+static uint64_t bench_image(struct bench *b, const char *path, unsigned int iter, bool cold)
+{
+	uint64_t t[STAGE_MAX + 1], total;
+	struct decoded d;
+	struct image img;
+	unsigned int s;
+
+	if (cold)
+		drop_cache(path);
+
+	t[0] = now_ns();
+	if (image_open(&img, path) != 0) {
+		err("Failed to open file %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	t[1] = now_ns();
+	stage_read(b, &img);
+	t[2] = now_ns();
+	stage_crc(b);
+	t[3] = now_ns();
+	stage_decode(b, &img, &d);
+	t[4] = now_ns();
+	stage_print(b, &d);
+	t[5] = now_ns();
+	image_close(&img);
+	/* closing is accounted to the open stage */
+	t[0] -= now_ns() - t[5];
+
+	total = 0;
+	for (s = 0; s < STAGE_MAX; s++) {
+		b->samples[s][iter] += t[s + 1] - t[s];
+		total += t[s + 1] - t[s];
+	}
+
+	if (b->verbose && !b->warmup && iter == 0) {
+		printf("  %-24s", path);
+		for (s = 0; s < STAGE_MAX; s++)
+			printf(" %s=%.1f", stage_names[s], (t[s + 1] - t[s]) / 1e3);
+		printf(" us (pt=%s gpt=%s cfg=%s)\n", d.pt_valid ? "ok" : "-",
+		       d.gpt_valid ? "ok" : "-", d.cb_valid ? "ok" : "-");
+	}
+	return total;
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+	uint64_t ua = *(const uint64_t *)a, ub = *(const uint64_t *)b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+static void report_stage(const char *mode, const char *name, uint64_t *samples, unsigned int n)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	qsort(samples, n, sizeof(*samples), u64_cmp);
+	for (i = 0; i < n; i++)
+		sum += samples[i];
+
+	printf("%-5s  %-6s  %10.1f  %10.1f  %10.1f  %10.1f\n", mode, name,
+	       samples[0] / 1e3, samples[n / 2] / 1e3, samples[(n - 1) * 99 / 100] / 1e3,
+	       (double)sum / n / 1e3);
+}
+
+static int bench_run(struct bench *b, char **paths, int num, bool cold)
+{
+	const char *mode = cold ? "cold" : "warm";
+	uint64_t *total;
+	unsigned int i, s;
+	int p;
+
+	total = calloc(b->iter, sizeof(*total));
+	if (!total)
+		return -1;
+	for (s = 0; s < STAGE_MAX; s++)
+		memset(b->samples[s], 0, b->iter * sizeof(*b->samples[s]));
+
+	/* warm up, so the first iteration isn't an outlier */
+	if (!cold) {
+		b->warmup = true;
+		for (p = 0; p < num; p++)
+			bench_image(b, paths[p], 0, false);
+		for (s = 0; s < STAGE_MAX; s++)
+			b->samples[s][0] = 0;
+		b->warmup = false;
+	}
+
+	if (b->verbose)
+		printf("%s:\n", mode);
+	b->bytes = 0;
+	for (i = 0; i < b->iter; i++)
+		for (p = 0; p < num; p++)
+			total[i] += bench_image(b, paths[p], i, cold);
+
+	for (s = 0; s < STAGE_MAX; s++)
+		report_stage(mode, stage_names[s], b->samples[s], b->iter);
+	report_stage(mode, "total", total, b->iter);
+	printf("%-5s  %" PRIu64 " bytes per iteration\n", mode, b->bytes / b->iter);
+
+	free(total);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b;
+	bool warm = true, cold = true;
+	unsigned long iter = DEFAULT_ITER;
+	const char *crc_impl = NULL;
+	bool check = false;
+	unsigned int s, i;
+	char *end;
+	int c, ret = EXIT_FAILURE;
+
+	memset(&b, 0, sizeof(b));
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			errno = 0;
+			iter = strtoul(optarg, &end, 0);
+			if (errno || *end || iter == 0 || iter > UINT32_MAX) {
+				err("Invalid number of iterations: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'm':
+			warm = strcmp(optarg, "cold") != 0;
+			cold = strcmp(optarg, "warm") != 0;
+			if (strcmp(optarg, "warm") && strcmp(optarg, "cold") && strcmp(optarg, "both"))
+				usage_and_exit(EXIT_FAILURE);
+			break;
+		case 'c':
+			crc_impl = optarg;
+			break;
+		case 'C':
+			check = true;
+			break;
+		case 'v':
+			b.verbose = true;
+			break;
+		case 'h':
+			usage_and_exit(EXIT_SUCCESS);
+		default:
+			usage_and_exit(EXIT_FAILURE);
+		}
+	}
+
+	if (check)
+		return crc_check() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (optind >= argc)
+		usage_and_exit(EXIT_FAILURE);
+
+	if (crc_impl && crc32_select(crc_impl) != 0) {
+		err("Unsupported CRC32 implementation: %s\n", crc_impl);
+		return EXIT_FAILURE;
+	}
+
+	b.iter = iter;
+	b.null_fd = open("/dev/null", O_WRONLY);
+	if (b.null_fd < 0) {
+		err("Failed to open /dev/null: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	outbuf_init(&b.ob);
+	for (s = 0; s < STAGE_MAX; s++) {
+		b.samples[s] = calloc(b.iter, sizeof(*b.samples[s]));
+		if (!b.samples[s]) {
+			err("Failed to allocate memory\n");
+			goto out;
+		}
+	}
+
+	printf("crc32: %s, %d images, %u iterations, times in us per iteration\n",
+	       crc32_impl_name(), argc - optind, b.iter);
+	printf("%-5s  %-6s  %10s  %10s  %10s  %10s\n", "cache", "stage", "min", "median",
+	       "p99", "mean");
+
+	if (warm && bench_run(&b, argv + optind, argc - optind, false) != 0)
+		goto out;
+	if (cold && bench_run(&b, argv + optind, argc - optind, true) != 0)
+		goto out;
+	ret = EXIT_SUCCESS;
+out:
+	for (s = 0; s < STAGE_MAX; s++)
+		free(b.samples[s]);
+	for (i = 0; i < REGION_MAX; i++)
+		free(b.regions[i].buf);
+	outbuf_free(&b.ob);
+	close(b.null_fd);
+	return ret;
+}
@@ -0,0 +1,386 @@
+/*
+ * Generate synthetic PT, GPT and config block images for benchmarking
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _DEFAULT_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "libapalis.h"
+
+#define err(fmt, args...)	fprintf(stderr, "Error: " fmt, ##args)
+
+#define DEFAULT_PARTS		8
+#define DEFAULT_GPT_ENTRIES	128
+#define DEFAULT_GPT_SIZE	(64 * 1024 * 1024)
+#define DEFAULT_CFG_SIZE	(4 * 1024 * 1024)
+#define DEFAULT_SERIAL		2751234
+#define DEFAULT_PRODID		26	/* Apalis T30 1GB */
+
+enum {
+	CORRUPT_NONE,
+	CORRUPT_HDR_CRC,	/* GPT header CRC */
+	CORRUPT_TABLE_CRC,	/* GPT table CRC, PT copy */
+	CORRUPT_TRUNCATE,	/* image ends within the table */
+	CORRUPT_ID,		/* invalid PT partition id, invalid config block */
+};
+
+struct mkimage {
+	unsigned int	parts;		/* PT partitions resp. used GPT entries */
+	unsigned int	entries;	/* GPT entries */
+	uint64_t	size;		/* image size, 0 for the default */
+	uint32_t	serial;
+	uint16_t	prodid;
+	bool		copy;		/* repeat the PT at the next 0x1000 boundary */
+	int		corrupt;
+};
+
+static const char *short_opts = "n:e:s:S:P:rx:h";
+static const struct option long_opts[] = {
+	{ "parts",	required_argument,	NULL, 'n' },
+	{ "entries",	required_argument,	NULL, 'e' },
+	{ "size",	required_argument,	NULL, 's' },
+	{ "serial",	required_argument,	NULL, 'S' },
+	{ "prodid",	required_argument,	NULL, 'P' },
+	{ "copy",	no_argument,		NULL, 'r' },
+	{ "corrupt",	required_argument,	NULL, 'x' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ NULL,		0,			NULL, 0 }
+};
+
+static void __attribute__((noreturn)) usage_and_exit(int ret)
+{
+	printf("Usage: mkimage pt|gpt|cfg [OPTIONS...] FILE\n"
+	       "\n"
+	       "Options:\n"
+	       "  -n, --parts N          Number of PT partitions or used GPT entries (default 8)\n"
+	       "  -e, --entries N        Number of GPT entries (default 128)\n"
+	       "  -s, --size BYTES       Image size (default: PT and copy, 64 MiB GPT, 4 MiB cfg)\n"
+	       "  -S, --serial N         Config block serial number (default %u)\n"
+	       "  -P, --prodid N         Config block product id (default %u)\n"
+	       "  -r, --copy             Repeat the PT at the next 0x1000 boundary\n"
+	       "  -x, --corrupt WHAT     hdr-crc, table-crc, truncate or id\n"
+	       "  -h, --help             Show this message and exit\n",
+	       DEFAULT_SERIAL, DEFAULT_PRODID);
+	exit(ret);
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, uint64_t off)
+{
+	const uint8_t *p = buf;
+
+	while (len > 0) {
+		ssize_t n = pwrite(fd, p, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+static void pt_entry(struct nvtegra_partinfo *p, uint32_t id, const char *name,
+		     uint32_t start, uint32_t size)
+{
+	size_t len = strnlen(name, sizeof(p->name));
+
+	memset(p, 0, sizeof(*p));
+	p->id = htole32(id);
+	/* fixed width, not NUL terminated */
+	memcpy(p->name, name, len);
+	memcpy(p->name2, name, len);
+	p->allocation_policy = htole32(2);
+	p->__unknown1 = htole32(0x03000000);
+	p->fs_type = htole32(1);
+	p->virt_start_sector = htole32(start);
+	p->virt_size = htole32(size);
+	p->start_sector = htole32(start);
+	p->end_sector = htole32(start + size - 1);
+	p->type = htole32(1);
+}
+
+static int mk_pt(const struct mkimage *mk, int fd)
+{
+	unsigned int i, n = mk->parts ? mk->parts : 1;
+	size_t size = NVTEGRA_PT_HDR_SIZE + (size_t)n * NVTEGRA_PT_ENTRY_SIZE;
+	size_t copy_off = (size + NVTEGRA_PT_SIZE - 1) / NVTEGRA_PT_SIZE * NVTEGRA_PT_SIZE;
+	uint64_t img_size = mk->size ? mk->size : 2 * copy_off;
+	struct nvtegra_ptable *pt;
+	uint32_t start = 0x800;
+	int ret = -1;
+
+	pt = calloc(1, size);
+	if (!pt)
+		return -1;
+
+	pt->__unknown1 = htole32(0x08b8d9e8);
+	pt->__unknown2 = htole32(0x0fffffff);
+	pt->version = htole32(NVTEGRA_PT_VERSION);
+	pt->table_size = htole32(size);
+	pt->num_parts = htole32(n);
+	memset(pt->__unknown3, 0x11, sizeof(pt->__unknown3));
+	memset(pt->__unknown5, 0x11, sizeof(pt->__unknown5));
+
+	pt_entry(&pt->partitions[0], NVTEGRA_BCT_ID, "BCT", 0, 0x800);
+	for (i = 1; i < n; i++) {
+		char name[5];
+
+		if (i == n - 1)
+			strcpy(name, "GPT");
+		else
+			snprintf(name, sizeof(name), "P%02u", i % 100);
+		pt_entry(&pt->partitions[i], 3 + i % (NVTEGRA_MAX_PART_ID - 3), name, start, 0x800);
+		start += 0x800;
+	}
+	if (mk->corrupt == CORRUPT_ID && n > 1)
+		pt->partitions[n / 2].id = htole32(NVTEGRA_MAX_PART_ID);
+
+	if (mk->corrupt == CORRUPT_TRUNCATE)
+		img_size = size / 2;
+	if (ftruncate(fd, img_size) != 0)
+		goto out;
+	if (pwrite_all(fd, pt, size < img_size ? size : img_size, 0) != 0)
+		goto out;
+
+	if (mk->copy && copy_off + size <= img_size) {
+		if (mk->corrupt == CORRUPT_TABLE_CRC)
+			pt->partitions[0].virt_size ^= htole32(1);
+		if (pwrite_all(fd, pt, size, copy_off) != 0)
+			goto out;
+	}
+	ret = 0;
+out:
+	free(pt);
+	return ret;
+}
+
+static void gpt_header_init(struct gpt_header *h, uint64_t self, uint64_t alt,
+			    uint64_t last, uint64_t table, const struct mkimage *mk,
+			    uint32_t table_crc)
+{
+	memset(h, 0, GPT_BLOCK_SIZE);
+	memcpy(h->signature, "EFI PART", sizeof(h->signature));
+	h->version = htole32(0x00010000);
+	h->size = htole32(92);
+	h->lba_self = htole64(self);
+	h->lba_alt = htole64(alt);
+	h->lba_start = htole64(2 + (mk->entries * 128 + GPT_BLOCK_SIZE - 1) / GPT_BLOCK_SIZE);
+	h->lba_end = htole64(last - 1 - (mk->entries * 128 + GPT_BLOCK_SIZE - 1) / GPT_BLOCK_SIZE);
+	h->uuid.time_low = htole32(0x12345678);
+	h->uuid.node[5] = 0x42;
+	h->lba_table = htole64(table);
+	h->num_entries = htole32(mk->entries);
+	h->entry_size = htole32(128);
+	h->crc_table = htole32(table_crc);
+	h->crc_self = htole32(crc32_update(0, h, 92));
+}
+
+static int mk_gpt(const struct mkimage *mk, int fd)
+{
+	uint64_t size = mk->size ? mk->size : DEFAULT_GPT_SIZE;
+	uint64_t last = size / GPT_BLOCK_SIZE - 1, table_lbas, back_table;
+	size_t table_size = (size_t)mk->entries * 128;
+	struct gpt_header *hdr;
+	uint8_t *table;
+	uint32_t crc;
+	unsigned int i;
+	int ret = -1;
+
+	table_lbas = (table_size + GPT_BLOCK_SIZE - 1) / GPT_BLOCK_SIZE;
+	if (last < 2 * table_lbas + 4) {
+		err("Image too small for %u GPT entries\n", mk->entries);
+		return -1;
+	}
+	back_table = last - table_lbas;
+
+	table = calloc(1, table_lbas * GPT_BLOCK_SIZE);
+	hdr = calloc(1, GPT_BLOCK_SIZE);
+	if (!table || !hdr)
+		goto out;
+
+	for (i = 0; i < mk->parts && i < mk->entries; i++) {
+		struct gpt_entry *e = (struct gpt_entry *)(table + (size_t)i * 128);
+		char name[16];
+		unsigned int j;
+
+		e->type.time_low = htole32(0xebd0a0a2);
+		e->uuid.time_low = htole32(i + 1);
+		e->lba_start = htole64(2048 + (uint64_t)i * 2048);
+		e->lba_end = htole64(2048 + (uint64_t)i * 2048 + 2047);
+		snprintf(name, sizeof(name), "part%u", i);
+		for (j = 0; name[j]; j++)
+			e->name[j] = htole16(name[j]);
+	}
+
+	crc = crc32_update(0, table, table_size);
+	if (mk->corrupt == CORRUPT_TABLE_CRC)
+		crc ^= 1;
+
+	if (ftruncate(fd, size) != 0)
+		goto out;
+
+	gpt_header_init(hdr, 1, last, last, 2, mk, crc);
+	if (mk->corrupt == CORRUPT_HDR_CRC)
+		hdr->crc_self ^= htole32(1);
+	if (pwrite_all(fd, hdr, GPT_BLOCK_SIZE, GPT_BLOCK_SIZE) != 0 ||
+	    pwrite_all(fd, table, table_size, 2 * GPT_BLOCK_SIZE) != 0)
+		goto out;
+
+	gpt_header_init(hdr, last, 1, last, back_table, mk, crc);
+	if (mk->corrupt == CORRUPT_HDR_CRC)
+		hdr->crc_self ^= htole32(1);
+	if (pwrite_all(fd, table, table_size, back_table * GPT_BLOCK_SIZE) != 0 ||
+	    pwrite_all(fd, hdr, GPT_BLOCK_SIZE, last * GPT_BLOCK_SIZE) != 0)
+		goto out;
+
+	/* cut the image in the middle of the backup table, header at the end */
+	if (mk->corrupt == CORRUPT_TRUNCATE) {
+		uint64_t cut = back_table * GPT_BLOCK_SIZE + table_size / 2;
+
+		if (pwrite_all(fd, hdr, GPT_BLOCK_SIZE, cut) != 0 ||
+		    ftruncate(fd, cut + GPT_BLOCK_SIZE) != 0)
+			goto out;
+	}
+	ret = 0;
+out:
+	free(hdr);
+	free(table);
+	return ret;
+}
+
+static int mk_cfg(const struct mkimage *mk, int fd)
+{
+	uint64_t size = mk->size ? mk->size : DEFAULT_CFG_SIZE;
+	uint8_t buf[TRDX_CFG_BLOCK_MAX_SIZE];
+	struct trdx_cfgblock cb;
+
+	if (size < TRDX_CFG_BLOCK_MAX_SIZE) {
+		err("Image too small for a config block\n");
+		return -1;
+	}
+
+	memset(&cb, 0, sizeof(cb));
+	cb.hw.ver_major = 1;
+	cb.hw.ver_minor = 1;
+	cb.hw.prodid = mk->prodid;
+	cb.has_hw = true;
+	trdx_cfgblock_set_serial(&cb, mk->serial);
+	trdx_cfgblock_build(&cb, buf, sizeof(buf));
+	if (mk->corrupt == CORRUPT_ID)
+		buf[2] ^= 0xff;
+
+	if (ftruncate(fd, size) != 0)
+		return -1;
+	/* in the last sector, as on the 1st eMMC boot area */
+	return pwrite_all(fd, buf, mk->corrupt == CORRUPT_TRUNCATE ? sizeof(buf) / 2 : sizeof(buf),
+			  size - TRDX_CFG_BLOCK_MAX_SIZE);
+}
+
+static unsigned long parse_num(const char *str, unsigned long max)
+{
+	unsigned long val;
+	char *end;
+
+	errno = 0;
+	val = strtoul(str, &end, 0);
+	if (errno || *end || val > max) {
+		err("Invalid number: %s\n", str);
+		exit(EXIT_FAILURE);
+	}
+	return val;
+}
+
+int main(int argc, char **argv)
+{
+	struct mkimage mk = {
+		.parts = DEFAULT_PARTS,
+		.entries = DEFAULT_GPT_ENTRIES,
+		.serial = DEFAULT_SERIAL,
+		.prodid = DEFAULT_PRODID,
+	};
+	const char *type, *path;
+	int c, fd, ret;
+
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			mk.parts = parse_num(optarg, NVTEGRA_PT_MAX_SIZE / NVTEGRA_PT_ENTRY_SIZE);
+			break;
+		case 'e':
+			mk.entries = parse_num(optarg, 65536);
+			break;
+		case 's':
+			mk.size = parse_num(optarg, ULONG_MAX);
+			break;
+		case 'S':
+			mk.serial = parse_num(optarg, TRDX_SERIAL_MAX);
+			break;
+		case 'P':
+			mk.prodid = parse_num(optarg, UINT16_MAX);
+			break;
+		case 'r':
+			mk.copy = true;
+			break;
+		case 'x':
+			if (strcmp(optarg, "hdr-crc") == 0)
+				mk.corrupt = CORRUPT_HDR_CRC;
+			else if (strcmp(optarg, "table-crc") == 0)
+				mk.corrupt = CORRUPT_TABLE_CRC;
+			else if (strcmp(optarg, "truncate") == 0)
+				mk.corrupt = CORRUPT_TRUNCATE;
+			else if (strcmp(optarg, "id") == 0)
+				mk.corrupt = CORRUPT_ID;
+			else
+				usage_and_exit(EXIT_FAILURE);
+			break;
+		case 'h':
+			usage_and_exit(EXIT_SUCCESS);
+		default:
+			usage_and_exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind + 2 != argc)
+		usage_and_exit(EXIT_FAILURE);
+	type = argv[optind];
+	path = argv[optind + 1];
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		err("Failed to open file %s: %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (strcmp(type, "pt") == 0)
+		ret = mk_pt(&mk, fd);
+	else if (strcmp(type, "gpt") == 0)
+		ret = mk_gpt(&mk, fd);
+	else if (strcmp(type, "cfg") == 0)
+		ret = mk_cfg(&mk, fd);
+	else
+		usage_and_exit(EXIT_FAILURE);
+
+	if (ret != 0)
+		err("Failed to write %s: %s\n", path, strerror(errno));
+	if (close(fd) != 0)
+		ret = -1;
+	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,31 @@
+/*
+ * CRC32 (IEEE 802.3, as used by GPT) with runtime selected implementation
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Update crc with len bytes of buf. Start with crc = 0, like zlib's crc32().
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+/* Reference byte-at-a-time implementation, always available */
+uint32_t crc32_bytewise(uint32_t crc, const void *buf, size_t len);
+
+/*
+ * Select the implementation by name ("bytewise", "slice8", "armv8", "pclmul")
+ * or pick the fastest supported one if name is NULL. Returns -1 if the named
+ * implementation is unknown or not supported on this CPU.
+ */
+int crc32_select(const char *name);
+const char *crc32_impl_name(void);
+
+#endif /* CRC32_H */
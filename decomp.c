@@ -0,0 +1,711 @@
+/*
+ * Compressed images (gzip, xz and zstd), read without decompressing them to a
+ * temporary file
+ *
+ * The image is split into frames which can be decompressed on their own: the
+ * blocks of an xz file (listed in its index) or the frames of a zstd file in
+ * the seekable format (listed in the seek table at its end). A read only
+ * decompresses the frame covering it, from its start up to the data needed.
+ * Gzip files and zstd files without a seek table are a single frame, they are
+ * decompressed once when opened to get the size.
+ *
+ * The decompressed data goes to a ring buffer holding the last DECOMP_WINDOW
+ * bytes, so memory use doesn't depend on the size of the image. Reads going
+ * forward continue decompressing, as do reads of data still in the window
+ * (e.g. the backup GPT table after the header in the last sector). Reads
+ * further back restart at the start of the frame.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _DEFAULT_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+# include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+# include <zstd_errors.h>
+#endif
+
+#include "decomp.h"
+#include "image.h"
+
+#define DECOMP_WINDOW		(1024 * 1024)	/* decompressed data kept */
+#define DECOMP_IN_SIZE		(64 * 1024)	/* compressed data read at once */
+
+/* zstd seekable format, see contrib/seekable_format in the zstd sources */
+#define ZSTD_SKIPPABLE_MAGIC	0x184d2a5e
+#define ZSTD_SEEKABLE_MAGIC	0x8f92eab1
+#define ZSTD_SEEK_FOOTER_LEN	9
+#define ZSTD_SEEK_CHECKSUM	0x80
+
+/* A part of the image which can be decompressed on its own */
+struct decomp_frame {
+	uint64_t	coff;		/* offset of the compressed data in the file */
+	uint64_t	clen;
+	uint64_t	uoff;		/* offset of the decompressed data in the image */
+	uint64_t	ulen;		/* UINT64_MAX until known */
+	unsigned int	check;		/* xz integrity check of the stream */
+};
+
+struct decomp {
+	enum decomp_format	fmt;
+	struct image		*base;
+	uint64_t		size;
+	struct decomp_frame	*frames;
+	unsigned int		num_frames;
+
+	/* frame being decompressed, num_frames if none */
+	unsigned int		cur;
+	uint64_t		in_pos;		/* next compressed byte to read */
+	uint64_t		in_end;		/* end of the compressed frame */
+	const uint8_t		*in;		/* compressed data not consumed yet */
+	size_t			in_len;
+	uint64_t		out_pos;	/* decompressed up to here */
+	size_t			win_len;	/* data before out_pos in win */
+	uint8_t			*win;		/* ring buffer of DECOMP_WINDOW bytes */
+	uint8_t			*inbuf;		/* for images which aren't mapped */
+
+#ifdef HAVE_ZLIB
+	z_stream		z;
+	bool			z_init;
+#endif
+#ifdef HAVE_LZMA
+	lzma_stream		xz;
+	lzma_block		xz_block;
+	lzma_filter		xz_filters[LZMA_FILTERS_MAX + 1];
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DCtx		*zstd;
+#endif
+};
+
+enum decomp_format decomp_detect(const void *buf, size_t len)
+{
+	static const uint8_t gzip_magic[] = { 0x1f, 0x8b };
+	static const uint8_t xz_magic[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+	static const uint8_t zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+	if (len >= sizeof(xz_magic) && memcmp(buf, xz_magic, sizeof(xz_magic)) == 0)
+		return DECOMP_XZ;
+	if (len >= sizeof(zstd_magic) && memcmp(buf, zstd_magic, sizeof(zstd_magic)) == 0)
+		return DECOMP_ZSTD;
+	if (len >= sizeof(gzip_magic) && memcmp(buf, gzip_magic, sizeof(gzip_magic)) == 0)
+		return DECOMP_GZIP;
+	return DECOMP_NONE;
+}
+
+static int decomp_add_frame(struct decomp *d, unsigned int *size, uint64_t coff,
+			    uint64_t clen, uint64_t uoff, uint64_t ulen, unsigned int check)
+{
+	struct decomp_frame *f;
+
+	/* frames without data are never read */
+	if (ulen == 0)
+		return 0;
+
+	if (d->num_frames == *size) {
+		unsigned int n = *size ? *size * 2 : 16;
+
+		f = realloc(d->frames, n * sizeof(*f));
+		if (!f)
+			return -1;
+		d->frames = f;
+		*size = n;
+	}
+
+	f = &d->frames[d->num_frames++];
+	f->coff = coff;
+	f->clen = clen;
+	f->uoff = uoff;
+	f->ulen = ulen;
+	f->check = check;
+	return 0;
+}
+
+/* Read compressed bytes at off, into the input buffer if needed */
+static const uint8_t *decomp_read_in(struct decomp *d, uint64_t off, size_t len)
+{
+	const uint8_t *data = image_read(d->base, off, len, d->inbuf);
+
+	if (!data && errno == 0)
+		errno = EIO;
+	return data;
+}
+
+/* Format specific part: start decompressing frame f, decompress some data */
+
+#ifdef HAVE_ZLIB
+static int gzip_start(struct decomp *d, const struct decomp_frame *f)
+{
+	(void) f;
+
+	if (d->z_init)
+		return inflateReset(&d->z) == Z_OK ? 0 : -1;
+	/* gzip header, 32K window */
+	if (inflateInit2(&d->z, 16 + MAX_WBITS) != Z_OK) {
+		errno = ENOMEM;
+		return -1;
+	}
+	d->z_init = true;
+	return 0;
+}
+
+static ssize_t gzip_step(struct decomp *d, uint8_t *out, size_t len, bool *end)
+{
+	size_t in_len = d->in_len;
+	ssize_t n;
+	int ret;
+
+	d->z.next_in = (Bytef *)d->in;
+	d->z.avail_in = in_len;
+	d->z.next_out = out;
+	d->z.avail_out = len;
+	ret = inflate(&d->z, Z_NO_FLUSH);
+	d->in += in_len - d->z.avail_in;
+	d->in_len = d->z.avail_in;
+	n = len - d->z.avail_out;
+
+	if (ret == Z_STREAM_END) {
+		/* concatenated gzip members, as written by e.g. pigz -i */
+		if (d->in_len > 0 || d->in_pos < d->in_end) {
+			if (inflateReset(&d->z) != Z_OK)
+				return -1;
+		} else {
+			*end = true;
+		}
+	} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+		errno = ret == Z_MEM_ERROR ? ENOMEM : EIO;
+		return -1;
+	}
+	return n;
+}
+#endif /* HAVE_ZLIB */
+
+#ifdef HAVE_LZMA
+static void xz_free_filters(struct decomp *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < LZMA_FILTERS_MAX && d->xz_filters[i].id != LZMA_VLI_UNKNOWN; i++) {
+		free(d->xz_filters[i].options);
+		d->xz_filters[i].options = NULL;
+	}
+}
+
+/* Decode the header of the block at f, then start the block decoder after it */
+static int xz_start(struct decomp *d, const struct decomp_frame *f)
+{
+	const uint8_t *hdr;
+	uint32_t hdr_size;
+	lzma_ret ret;
+
+	hdr = decomp_read_in(d, f->coff, 1);
+	if (!hdr)
+		return -1;
+	hdr_size = lzma_block_header_size_decode(hdr[0]);
+	if (hdr[0] == 0 || hdr_size > f->clen)
+		goto corrupt;
+	hdr = decomp_read_in(d, f->coff, hdr_size);
+	if (!hdr)
+		return -1;
+
+	memset(&d->xz_block, 0, sizeof(d->xz_block));
+	d->xz_block.version = 1;
+	d->xz_block.header_size = hdr_size;
+	d->xz_block.check = f->check;
+	d->xz_block.filters = d->xz_filters;
+	if (lzma_block_header_decode(&d->xz_block, NULL, hdr) != LZMA_OK)
+		goto corrupt;
+
+	/* the decoder keeps its own copy of the filter options */
+	ret = lzma_block_decoder(&d->xz, &d->xz_block);
+	xz_free_filters(d);
+	if (ret != LZMA_OK) {
+		errno = ret == LZMA_MEM_ERROR ? ENOMEM : EIO;
+		return -1;
+	}
+
+	d->in_pos += hdr_size;
+	return 0;
+corrupt:
+	errno = EIO;
+	return -1;
+}
+
+static ssize_t xz_step(struct decomp *d, uint8_t *out, size_t len, bool *end)
+{
+	size_t in_len = d->in_len;
+	lzma_ret ret;
+
+	d->xz.next_in = d->in;
+	d->xz.avail_in = in_len;
+	d->xz.next_out = out;
+	d->xz.avail_out = len;
+	ret = lzma_code(&d->xz, LZMA_RUN);
+	d->in += in_len - d->xz.avail_in;
+	d->in_len = d->xz.avail_in;
+
+	if (ret == LZMA_STREAM_END) {
+		*end = true;
+	} else if (ret != LZMA_OK && ret != LZMA_BUF_ERROR) {
+		errno = ret == LZMA_MEM_ERROR || ret == LZMA_MEMLIMIT_ERROR ? ENOMEM : EIO;
+		return -1;
+	}
+	return len - d->xz.avail_out;
+}
+
+/* Get the blocks of all streams from the index(es) at the end of the file */
+static int xz_index(struct decomp *d)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_index *idx = NULL;
+	lzma_index_iter iter;
+	uint64_t pos = 0;
+	unsigned int size = 0;
+	lzma_ret ret;
+
+	if (lzma_file_info_decoder(&strm, &idx, UINT64_MAX, d->base->size) != LZMA_OK) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	do {
+		if (strm.avail_in == 0) {
+			size_t len = d->base->size - pos < DECOMP_IN_SIZE ? d->base->size - pos
+									  : DECOMP_IN_SIZE;
+
+			strm.next_in = decomp_read_in(d, pos, len);
+			if (!strm.next_in) {
+				lzma_end(&strm);
+				return -1;
+			}
+			strm.avail_in = len;
+			pos += len;
+		}
+
+		ret = lzma_code(&strm, LZMA_RUN);
+		if (ret == LZMA_SEEK_NEEDED) {
+			pos = strm.seek_pos;
+			strm.avail_in = 0;
+		}
+	} while (ret == LZMA_OK || ret == LZMA_SEEK_NEEDED);
+	lzma_end(&strm);
+
+	if (ret != LZMA_STREAM_END) {
+		errno = ret == LZMA_MEM_ERROR ? ENOMEM : EIO;
+		return -1;
+	}
+
+	lzma_index_iter_init(&iter, idx);
+	while (!lzma_index_iter_next(&iter, LZMA_INDEX_ITER_NONEMPTY_BLOCK)) {
+		if (decomp_add_frame(d, &size, iter.block.compressed_file_offset,
+				     iter.block.total_size, iter.block.uncompressed_file_offset,
+				     iter.block.uncompressed_size,
+				     iter.stream.flags ? iter.stream.flags->check : LZMA_CHECK_NONE) != 0) {
+			lzma_index_end(idx, NULL);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	d->size = lzma_index_uncompressed_size(idx);
+	lzma_index_end(idx, NULL);
+	return 0;
+}
+#endif /* HAVE_LZMA */
+
+#ifdef HAVE_ZSTD
+static int zstd_start(struct decomp *d, const struct decomp_frame *f)
+{
+	(void) f;
+
+	if (!d->zstd) {
+		d->zstd = ZSTD_createDCtx();
+		if (!d->zstd) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	ZSTD_DCtx_reset(d->zstd, ZSTD_reset_session_only);
+	return 0;
+}
+
+static ssize_t zstd_step(struct decomp *d, uint8_t *out, size_t len, bool *end)
+{
+	ZSTD_inBuffer in = { d->in, d->in_len, 0 };
+	ZSTD_outBuffer o = { out, len, 0 };
+	size_t ret = ZSTD_decompressStream(d->zstd, &o, &in);
+
+	if (ZSTD_isError(ret)) {
+		errno = ZSTD_getErrorCode(ret) == ZSTD_error_memory_allocation ? ENOMEM : EIO;
+		return -1;
+	}
+	d->in += in.pos;
+	d->in_len -= in.pos;
+
+	/* end of a zstd frame, the next one (if any) is decoded right away */
+	if (ret == 0 && d->in_len == 0 && d->in_pos == d->in_end)
+		*end = true;
+	return o.pos;
+}
+
+/* Get the frames from the seek table, if there is one */
+static int zstd_seek_table(struct decomp *d)
+{
+	uint64_t size = d->base->size, table_len, coff = 0, uoff = 0;
+	const uint8_t *p;
+	uint8_t *table;
+	unsigned int i, num, esize, fsize = 0;
+	uint32_t v;
+
+	if (size < 8 + ZSTD_SEEK_FOOTER_LEN)
+		return 0;
+	p = decomp_read_in(d, size - ZSTD_SEEK_FOOTER_LEN, ZSTD_SEEK_FOOTER_LEN);
+	if (!p)
+		return -1;
+	memcpy(&v, p + 5, sizeof(v));
+	if (le32toh(v) != ZSTD_SEEKABLE_MAGIC || (p[4] & 0x7c))
+		return 0;
+
+	memcpy(&v, p, sizeof(v));
+	num = le32toh(v);
+	esize = p[4] & ZSTD_SEEK_CHECKSUM ? 12 : 8;
+	table_len = (uint64_t)num * esize;
+	if (8 + table_len + ZSTD_SEEK_FOOTER_LEN > size)
+		goto corrupt;
+
+	/* the seek table is a skippable frame, check its header */
+	p = decomp_read_in(d, size - ZSTD_SEEK_FOOTER_LEN - table_len - 8, 8);
+	if (!p)
+		return -1;
+	memcpy(&v, p, sizeof(v));
+	if (le32toh(v) != ZSTD_SKIPPABLE_MAGIC)
+		goto corrupt;
+	memcpy(&v, p + 4, sizeof(v));
+	if (le32toh(v) != table_len + ZSTD_SEEK_FOOTER_LEN)
+		goto corrupt;
+
+	table = malloc(table_len ? table_len : 1);
+	if (!table) {
+		errno = ENOMEM;
+		return -1;
+	}
+	p = image_read(d->base, size - ZSTD_SEEK_FOOTER_LEN - table_len, table_len, table);
+	if (!p) {
+		free(table);
+		return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		uint32_t clen, ulen;
+
+		memcpy(&clen, p + i * esize, sizeof(clen));
+		memcpy(&ulen, p + i * esize + 4, sizeof(ulen));
+		clen = le32toh(clen);
+		ulen = le32toh(ulen);
+		if (decomp_add_frame(d, &fsize, coff, clen, uoff, ulen, 0) != 0) {
+			free(table);
+			errno = ENOMEM;
+			return -1;
+		}
+		coff += clen;
+		uoff += ulen;
+	}
+	free(table);
+
+	if (coff != size - 8 - table_len - ZSTD_SEEK_FOOTER_LEN)
+		goto corrupt;
+	d->size = uoff;
+	return 1;
+corrupt:
+	free(d->frames);
+	d->frames = NULL;
+	d->num_frames = 0;
+	errno = EIO;
+	return -1;
+}
+#endif /* HAVE_ZSTD */
+
+static int decomp_start(struct decomp *d, unsigned int i)
+{
+	const struct decomp_frame *f = &d->frames[i];
+
+	d->cur = i;
+	d->in_pos = f->coff;
+	d->in_end = f->coff + f->clen;
+	d->in_len = 0;
+
+	switch (d->fmt) {
+#ifdef HAVE_ZLIB
+	case DECOMP_GZIP:
+		return gzip_start(d, f);
+#endif
+#ifdef HAVE_LZMA
+	case DECOMP_XZ:
+		return xz_start(d, f);
+#endif
+#ifdef HAVE_ZSTD
+	case DECOMP_ZSTD:
+		return zstd_start(d, f);
+#endif
+	default:
+		errno = ENOTSUP;
+		return -1;
+	}
+}
+
+static ssize_t decomp_step(struct decomp *d, uint8_t *out, size_t len, bool *end)
+{
+	switch (d->fmt) {
+#ifdef HAVE_ZLIB
+	case DECOMP_GZIP:
+		return gzip_step(d, out, len, end);
+#endif
+#ifdef HAVE_LZMA
+	case DECOMP_XZ:
+		return xz_step(d, out, len, end);
+#endif
+#ifdef HAVE_ZSTD
+	case DECOMP_ZSTD:
+		return zstd_step(d, out, len, end);
+#endif
+	default:
+		errno = ENOTSUP;
+		return -1;
+	}
+}
+
+/*
+ * Decompress the current frame (and the ones following it) until the data at
+ * off is in the window. Returns 1 if the end of the last frame is reached
+ * first.
+ */
+static int decomp_fill(struct decomp *d, uint64_t off)
+{
+	while (d->out_pos <= off) {
+		const struct decomp_frame *f = &d->frames[d->cur];
+		size_t ring = d->out_pos % DECOMP_WINDOW;
+		bool end = false;
+		ssize_t n;
+
+		if (d->in_len == 0 && d->in_pos < d->in_end) {
+			size_t len = d->in_end - d->in_pos < DECOMP_IN_SIZE ? d->in_end - d->in_pos
+									    : DECOMP_IN_SIZE;
+
+			d->in = decomp_read_in(d, d->in_pos, len);
+			if (!d->in)
+				return -1;
+			d->in_len = len;
+			d->in_pos += len;
+		}
+
+		n = decomp_step(d, d->win + ring, DECOMP_WINDOW - ring, &end);
+		if (n < 0)
+			return -1;
+		d->out_pos += n;
+		d->win_len = d->win_len + n < DECOMP_WINDOW ? d->win_len + n : DECOMP_WINDOW;
+
+		if (end) {
+			if (f->ulen != UINT64_MAX && d->out_pos != f->uoff + f->ulen)
+				goto corrupt;
+			if (d->cur + 1 == d->num_frames)
+				return d->out_pos > off ? 0 : 1;
+			if (decomp_start(d, d->cur + 1) != 0)
+				return -1;
+		} else if (n == 0 && d->in_len == 0 && d->in_pos == d->in_end) {
+			/* truncated */
+			goto corrupt;
+		}
+	}
+
+	return 0;
+corrupt:
+	errno = EIO;
+	return -1;
+}
+
+/* The frame holding the data at off */
+static unsigned int decomp_find(const struct decomp *d, uint64_t off)
+{
+	unsigned int lo = 0, hi = d->num_frames;
+
+	while (hi - lo > 1) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (d->frames[mid].uoff <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int decomp_readv(struct decomp *d, uint64_t off, const struct iovec *iov, int iovcnt)
+{
+	int i, ret;
+
+	for (i = 0; i < iovcnt; i++) {
+		uint8_t *buf = iov[i].iov_base;
+		size_t len = iov[i].iov_len;
+
+		if (off > d->size || len > d->size - off) {
+			errno = EIO;
+			return -1;
+		}
+
+		while (len > 0) {
+			size_t ring, n;
+
+			if (off >= d->out_pos || off < d->out_pos - d->win_len) {
+				unsigned int f = decomp_find(d, off);
+
+				/* restart unless going forward in the same frame */
+				if (f != d->cur || off < d->out_pos) {
+					if (decomp_start(d, f) != 0)
+						return -1;
+					d->out_pos = d->frames[f].uoff;
+					d->win_len = 0;
+				}
+				ret = decomp_fill(d, off);
+				if (ret != 0) {
+					if (ret > 0)
+						errno = EIO;
+					return -1;
+				}
+			}
+
+			ring = off % DECOMP_WINDOW;
+			n = d->out_pos - off;
+			if (n > DECOMP_WINDOW - ring)
+				n = DECOMP_WINDOW - ring;
+			if (n > len)
+				n = len;
+			memcpy(buf, d->win + ring, n);
+			buf += n;
+			off += n;
+			len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/* Decompress the whole single frame once to get its size */
+static int decomp_measure(struct decomp *d)
+{
+	unsigned int size = 0;
+
+	if (decomp_add_frame(d, &size, 0, d->base->size, 0, UINT64_MAX, 0) != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (decomp_start(d, 0) != 0 || decomp_fill(d, UINT64_MAX - 1) != 1)
+		return -1;
+
+	d->size = d->frames[0].ulen = d->out_pos;
+	return 0;
+}
+
+struct decomp *decomp_open(struct image *base, enum decomp_format fmt, uint64_t *size)
+{
+	struct decomp *d = calloc(1, sizeof(*d));
+	int ret = -1;
+
+	if (!d) {
+		image_close(base);
+		free(base);
+		errno = ENOMEM;
+		return NULL;
+	}
+	d->fmt = fmt;
+	d->base = base;
+	d->win = malloc(DECOMP_WINDOW);
+	if (!base->map)
+		d->inbuf = malloc(DECOMP_IN_SIZE);
+	if (!d->win || (!base->map && !d->inbuf)) {
+		errno = ENOMEM;
+		goto out;
+	}
+#ifdef HAVE_LZMA
+	d->xz = (lzma_stream) LZMA_STREAM_INIT;
+	d->xz_filters[0].id = LZMA_VLI_UNKNOWN;
+#endif
+
+	errno = 0;
+	switch (fmt) {
+#ifdef HAVE_ZLIB
+	case DECOMP_GZIP:
+		ret = decomp_measure(d);
+		break;
+#endif
+#ifdef HAVE_LZMA
+	case DECOMP_XZ:
+		ret = xz_index(d);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case DECOMP_ZSTD:
+		ret = zstd_seek_table(d);
+		if (ret == 0)
+			ret = decomp_measure(d);
+		else if (ret == 1)
+			ret = 0;
+		break;
+#endif
+	default:
+		errno = ENOTSUP;
+		break;
+	}
+	if (ret != 0) {
+		if (errno == 0)
+			errno = EIO;
+		goto out;
+	}
+
+	/* nothing decompressed yet, unless measured */
+	if (d->out_pos == 0)
+		d->cur = d->num_frames;
+	*size = d->size;
+	return d;
+out:
+	ret = errno;
+	decomp_close(d);
+	errno = ret;
+	return NULL;
+}
+
+void decomp_close(struct decomp *d)
+{
+	if (!d)
+		return;
+
+#ifdef HAVE_ZLIB
+	if (d->z_init)
+		inflateEnd(&d->z);
+#endif
+#ifdef HAVE_LZMA
+	lzma_end(&d->xz);
+	xz_free_filters(d);
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_freeDCtx(d->zstd);
+#endif
+	image_close(d->base);
+	free(d->base);
+	free(d->frames);
+	free(d->win);
+	free(d->inbuf);
+	free(d);
+}
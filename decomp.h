@@ -0,0 +1,48 @@
+/*
+ * Compressed images (gzip, xz and zstd), read without decompressing them to a
+ * temporary file
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef DECOMP_H
+#define DECOMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/uio.h>
+
+struct image;
+struct decomp;
+
+enum decomp_format {
+	DECOMP_NONE,
+	DECOMP_GZIP,
+	DECOMP_XZ,
+	DECOMP_ZSTD,
+};
+
+/* Bytes at the start of an image needed by decomp_detect() */
+#define DECOMP_MAGIC_LEN	6
+
+/* Format of the compressed data starting with the len bytes at buf */
+enum decomp_format decomp_detect(const void *buf, size_t len);
+
+/*
+ * Open the compressed image base (allocated with malloc(), closed and freed by
+ * decomp_close() or on error) and get its uncompressed size. Returns NULL and
+ * sets errno on error, ENOTSUP if support for the format isn't compiled in.
+ */
+struct decomp *decomp_open(struct image *base, enum decomp_format fmt, uint64_t *size);
+void decomp_close(struct decomp *d);
+
+/*
+ * Read the uncompressed bytes at off into the iovcnt buffers at iov. Returns
+ * -1 and sets errno on error.
+ */
+int decomp_readv(struct decomp *d, uint64_t off, const struct iovec *iov, int iovcnt);
+
+#endif /* DECOMP_H */
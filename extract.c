@@ -0,0 +1,369 @@
+/*
+ * Layout aware extraction of the allocated parts of an image
+ *
+ * Only the given ranges (the partitions and the GPT) are copied. Raw output
+ * files keep the layout of the image with holes in place of everything else,
+ * Android sparse images mark it as "don't care". Raw copies of whole ranges
+ * use copy_file_range() so the data doesn't pass through user space, if that
+ * isn't possible (e.g. the source is a block device or zero blocks are to be
+ * skipped) large aligned buffers are used.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/uio.h>
+
+#include "extract.h"
+#include "image.h"
+#include "stats.h"
+
+#define EXTRACT_BUF_SIZE	(1024 * 1024)
+
+/* Android sparse image format, as in system/core/libsparse/sparse_format.h */
+#define SPARSE_HEADER_MAGIC	0xed26ff3a
+#define CHUNK_TYPE_RAW		0xcac1
+#define CHUNK_TYPE_DONT_CARE	0xcac3
+
+struct sparse_header {
+	uint32_t	magic;
+	uint16_t	major_version;
+	uint16_t	minor_version;
+	uint16_t	file_hdr_sz;
+	uint16_t	chunk_hdr_sz;
+	uint32_t	blk_sz;
+	uint32_t	total_blks;
+	uint32_t	total_chunks;
+	uint32_t	image_checksum;
+} __attribute__((packed));
+
+struct sparse_chunk {
+	uint16_t	chunk_type;
+	uint16_t	reserved1;
+	uint32_t	chunk_sz;	/* in blocks */
+	uint32_t	total_sz;	/* in bytes, including this header */
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct sparse_header) == 28, "sparse header size");
+_Static_assert(sizeof(struct sparse_chunk) == 12, "sparse chunk header size");
+
+struct extract_out {
+	int			fd;
+	enum extract_format	format;
+	uint32_t		blk_sz;
+	uint64_t		pos;		/* image offset covered so far (sparse) */
+	uint64_t		file_off;	/* write offset in the output (sparse) */
+	uint32_t		chunks;
+	struct extract_result	*res;
+};
+
+static int fail(struct extract_result *res, const char *what)
+{
+	res->error = errno ? errno : EIO;
+	res->what = what;
+	return -1;
+}
+
+static int pwritev_full(int fd, struct iovec *iov, int iovcnt, uint64_t off)
+{
+	while (iovcnt > 0) {
+		uint64_t t = stats_start();
+		ssize_t n = pwritev(fd, iov, iovcnt, off);
+
+		stats_stop(STATS_WRITE, t, 1, n > 0 ? n : 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+
+		off += n;
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static int out_chunk(struct extract_out *out, uint16_t type, uint64_t len, const void *data)
+{
+	struct sparse_chunk chunk = {
+		.chunk_type	= htole16(type),
+		.chunk_sz	= htole32(len / out->blk_sz),
+		.total_sz	= htole32(sizeof(chunk) + (data ? len : 0)),
+	};
+	struct iovec iov[2] = {
+		{ &chunk, sizeof(chunk) },
+		{ (void *)data, data ? len : 0 },
+	};
+
+	if (pwritev_full(out->fd, iov, data ? 2 : 1, out->file_off) != 0)
+		return fail(out->res, "write");
+	out->file_off += sizeof(chunk) + (data ? len : 0);
+	out->pos += len;
+	out->chunks++;
+	return 0;
+}
+
+/* Mark everything up to off as "don't care" */
+static int out_skip_to(struct extract_out *out, uint64_t off)
+{
+	if (out->format != EXTRACT_ANDROID || off <= out->pos)
+		return 0;
+	return out_chunk(out, CHUNK_TYPE_DONT_CARE, off - out->pos, NULL);
+}
+
+static int out_data(struct extract_out *out, uint64_t off, const void *data, size_t len)
+{
+	struct iovec iov = { (void *)data, len };
+
+	out->res->copied += len;
+	if (out->format == EXTRACT_RAW) {
+		if (pwritev_full(out->fd, &iov, 1, off) != 0)
+			return fail(out->res, "write");
+		return 0;
+	}
+
+	if (out_skip_to(out, off) != 0)
+		return -1;
+	return out_chunk(out, CHUNK_TYPE_RAW, len, data);
+}
+
+static int out_finish(struct extract_out *out, uint64_t size)
+{
+	struct sparse_header hdr;
+	struct iovec iov = { &hdr, sizeof(hdr) };
+
+	if (out->format == EXTRACT_RAW) {
+		if (ftruncate(out->fd, size) != 0)
+			return fail(out->res, "truncate");
+		return 0;
+	}
+
+	if (out_skip_to(out, size) != 0)
+		return -1;
+
+	hdr.magic = htole32(SPARSE_HEADER_MAGIC);
+	hdr.major_version = htole16(1);
+	hdr.minor_version = htole16(0);
+	hdr.file_hdr_sz = htole16(sizeof(struct sparse_header));
+	hdr.chunk_hdr_sz = htole16(sizeof(struct sparse_chunk));
+	hdr.blk_sz = htole32(out->blk_sz);
+	hdr.total_blks = htole32(size / out->blk_sz);
+	hdr.total_chunks = htole32(out->chunks);
+	hdr.image_checksum = 0;
+	if (pwritev_full(out->fd, &iov, 1, 0) != 0)
+		return fail(out->res, "write");
+	return 0;
+}
+
+static bool block_is_zero(const uint8_t *p, size_t len)
+{
+	return len == 0 || (p[0] == 0 && memcmp(p, p + 1, len - 1) == 0);
+}
+
+/* Write the non-zero runs of blocks in the len bytes at data */
+static int out_nonzero(struct extract_out *out, uint64_t off, const uint8_t *data, size_t len)
+{
+	size_t i = 0, run = 0;
+
+	while (i < len) {
+		size_t blk = len - i < out->blk_sz ? len - i : out->blk_sz;
+
+		if (block_is_zero(data + i, blk)) {
+			if (i > run && out_data(out, off + run, data + run, i - run) != 0)
+				return -1;
+			out->res->zero += blk;
+			run = i + blk;
+		}
+		i += blk;
+	}
+
+	if (len > run)
+		return out_data(out, off + run, data + run, len - run);
+	return 0;
+}
+
+/*
+ * Copy a range with copy_file_range(). Returns 1 if it isn't supported for
+ * this source and destination, with nothing copied.
+ */
+static int copy_range(struct extract_out *out, int src_fd, uint64_t off, uint64_t len)
+{
+	loff_t in_off = off, out_off = off;
+
+	while (len > 0) {
+		uint64_t t = stats_start();
+		ssize_t n = copy_file_range(src_fd, &in_off, out->fd, &out_off,
+					    len > EXTRACT_BUF_SIZE * 64 ? EXTRACT_BUF_SIZE * 64 : len, 0);
+
+		stats_stop(STATS_WRITE, t, 1, n > 0 ? n : 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((uint64_t)in_off == off &&
+			    (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+			     errno == EOPNOTSUPP || errno == EBADF))
+				return 1;
+			return fail(out->res, "copy");
+		}
+		if (n == 0) {
+			errno = EIO;
+			return fail(out->res, "copy");
+		}
+		out->res->copied += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+unsigned int extract_ranges_merge(struct extract_range *ranges, unsigned int n)
+{
+	unsigned int i, j, m = 0;
+
+	/* insertion sort, there are only a few ranges */
+	for (i = 1; i < n; i++) {
+		struct extract_range r = ranges[i];
+
+		for (j = i; j > 0 && ranges[j - 1].off > r.off; j--)
+			ranges[j] = ranges[j - 1];
+		ranges[j] = r;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (ranges[i].len == 0)
+			continue;
+		if (m > 0 && ranges[i].off <= ranges[m - 1].off + ranges[m - 1].len) {
+			uint64_t end = ranges[i].off + ranges[i].len;
+
+			if (end > ranges[m - 1].off + ranges[m - 1].len)
+				ranges[m - 1].len = end - ranges[m - 1].off;
+			continue;
+		}
+		ranges[m++] = ranges[i];
+	}
+
+	return m;
+}
+
+int extract_image(const char *src, unsigned int image_flags, const char *dst,
+		  enum extract_format format, unsigned int flags,
+		  const struct extract_range *ranges, unsigned int n,
+		  struct extract_result *res)
+{
+	struct extract_out out = { .fd = -1, .format = format, .res = res };
+	struct image img;
+	uint64_t done = 0;
+	uint8_t *buf = NULL;
+	bool use_copy = format == EXTRACT_RAW && !(flags & EXTRACT_SKIP_ZERO) &&
+			!(image_flags & IMAGE_DIRECT);
+	unsigned int i;
+	int ret = -1;
+
+	memset(res, 0, sizeof(*res));
+
+	if (image_open_flags(&img, src, image_flags) != 0)
+		return fail(res, "open");
+	res->size = img.size;
+
+	/* the blocks of the sparse image, also used to find zero blocks */
+	out.blk_sz = img.size % 4096 == 0 ? 4096 : 512;
+	if (format == EXTRACT_ANDROID && img.size % out.blk_sz != 0) {
+		errno = EINVAL;
+		fail(res, "size");
+		goto out;
+	}
+
+	if (posix_memalign((void **)&buf, 4096, EXTRACT_BUF_SIZE) != 0) {
+		buf = NULL;
+		errno = ENOMEM;
+		fail(res, "allocate");
+		goto out;
+	}
+
+	out.fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out.fd < 0) {
+		fail(res, "create");
+		goto out;
+	}
+	out.file_off = format == EXTRACT_ANDROID ? sizeof(struct sparse_header) : 0;
+
+	for (i = 0; i < n; i++) {
+		/* round out to whole blocks, clipped to the image */
+		uint64_t off = ranges[i].off / out.blk_sz * out.blk_sz;
+		uint64_t end = (ranges[i].off + ranges[i].len + out.blk_sz - 1) / out.blk_sz * out.blk_sz;
+
+		/* ranges rounded out to the same block are only copied once */
+		if (off < done)
+			off = done;
+		if (end > img.size)
+			end = img.size;
+		if (end > done)
+			done = end;
+
+		if (use_copy && off < end) {
+			ret = copy_range(&out, img.fd, off, end - off);
+			if (ret < 0)
+				goto out;
+			use_copy = ret == 0;
+			if (use_copy)
+				off = end;
+			ret = -1;
+		}
+
+		while (off < end) {
+			size_t len = end - off > EXTRACT_BUF_SIZE ? EXTRACT_BUF_SIZE : end - off;
+			const uint8_t *data = image_read(&img, off, len, buf);
+
+			if (!data) {
+				fail(res, "read");
+				goto out;
+			}
+			if (flags & EXTRACT_SKIP_ZERO) {
+				if (out_nonzero(&out, off, data, len) != 0)
+					goto out;
+			} else if (out_data(&out, off, data, len) != 0) {
+				goto out;
+			}
+			off += len;
+		}
+	}
+
+	if (out_finish(&out, img.size) != 0)
+		goto out;
+	if (fsync(out.fd) != 0) {
+		fail(res, "sync");
+		goto out;
+	}
+	ret = 0;
+out:
+	if (out.fd >= 0 && close(out.fd) != 0 && ret == 0)
+		ret = fail(res, "close");
+	free(buf);
+	image_close(&img);
+	return ret;
+}
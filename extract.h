@@ -0,0 +1,53 @@
+/*
+ * Layout aware extraction of the allocated parts of an image
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include <stdint.h>
+
+enum extract_format {
+	EXTRACT_RAW,		/* sparse file, same layout as the image */
+	EXTRACT_ANDROID,	/* Android sparse image, see simg2img(1) */
+};
+
+/* Leave blocks which are all zero out of the output */
+#define EXTRACT_SKIP_ZERO	0x1
+
+/* A byte range to copy, ranges are sorted and don't overlap */
+struct extract_range {
+	uint64_t	off;
+	uint64_t	len;
+};
+
+struct extract_result {
+	uint64_t	size;		/* size of the image */
+	uint64_t	copied;		/* bytes of data written */
+	uint64_t	zero;		/* bytes skipped because they were zero */
+	int		error;		/* errno value on failure */
+	const char	*what;		/* the operation which failed */
+};
+
+/*
+ * Sort the n ranges by offset and merge overlapping or adjacent ones, returns
+ * the resulting number of ranges.
+ */
+unsigned int extract_ranges_merge(struct extract_range *ranges, unsigned int n);
+
+/*
+ * Copy the ranges of the image at src to the file dst. Anything outside of
+ * the ranges reads as zeros from a raw output file (or is a "don't care"
+ * chunk of an Android sparse image). Returns -1 on error with res->error and
+ * res->what set.
+ */
+int extract_image(const char *src, unsigned int image_flags, const char *dst,
+		  enum extract_format format, unsigned int flags,
+		  const struct extract_range *ranges, unsigned int n,
+		  struct extract_result *res);
+
+#endif /* EXTRACT_H */
@@ -0,0 +1,798 @@
+/*
+ * Image source: regular image files, block devices or MTD devices
+ *
+ * Regular files are mapped read-only so the partition tables and config
+ * blocks can be parsed straight from the mapping without copying. Block
+ * devices (and files which can't be mapped, e.g. multi-GB images on 32-bit
+ * hosts) are read using pread(). With IMAGE_DIRECT, images are opened with
+ * O_DIRECT and read through a bounce buffer aligned to the logical block size
+ * so the page cache is neither used nor polluted. MTD devices are read page by
+ * page through the same buffer, skipping bad erase blocks. HTTP and NBD URLs
+ * are read through remote.c, compressed image files through decomp.c.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <mtd/mtd-user.h>
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+#  if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#   define HAVE_IO_URING
+#  endif
+# endif
+#endif
+
+#include "decomp.h"
+#include "image.h"
+#include "remote.h"
+#include "stats.h"
+
+/* Fallback alignment for O_DIRECT if the logical block size is unknown */
+#define IMAGE_DIRECT_ALIGN	512
+
+/* Remote and compressed images are read through their own layer */
+static bool image_is_virt(const struct image *img)
+{
+	return img->remote || img->decomp;
+}
+
+static int image_readv_virt(struct image *img, uint64_t off, const struct iovec *iov, int iovcnt)
+{
+	if (img->decomp)
+		return decomp_readv(img->decomp, off, iov, iovcnt);
+	return remote_readv(img->remote, off, iov, iovcnt);
+}
+
+/*
+ * If the image just opened is compressed, move it to a base image the
+ * decompressor reads from. The image is closed on error.
+ */
+static int image_open_decomp(struct image *img)
+{
+	uint8_t magic[DECOMP_MAGIC_LEN];
+	enum decomp_format fmt;
+	struct image *base;
+	const void *data;
+	int err;
+
+	if (img->size < sizeof(magic))
+		return 0;
+	data = image_read(img, 0, sizeof(magic), magic);
+	if (!data)
+		goto err_close;
+	fmt = decomp_detect(data, sizeof(magic));
+	if (fmt == DECOMP_NONE)
+		return 0;
+
+	base = malloc(sizeof(*base));
+	if (!base) {
+		errno = ENOMEM;
+		goto err_close;
+	}
+	*base = *img;
+
+	img->fd = -1;
+	img->map = NULL;
+	img->align = 1;
+	img->dbuf = NULL;
+	img->dbuf_size = 0;
+	img->remote = NULL;
+	img->decomp = decomp_open(base, fmt, &img->size);
+	return img->decomp ? 0 : -1;
+
+err_close:
+	err = errno;
+	image_close(img);
+	errno = err;
+	return -1;
+}
+
+int image_open_flags(struct image *img, const char *path, unsigned int flags)
+{
+	struct stat st;
+	uint64_t t;
+	int ret;
+
+	img->map = NULL;
+	img->size = 0;
+	img->flags = flags;
+	img->align = 1;
+	img->dbuf = NULL;
+	img->dbuf_size = 0;
+	img->erasesize = 0;
+	img->writesize = 0;
+	img->blk_log = UINT64_MAX;
+	img->blk_phys = 0;
+	img->remote = NULL;
+	img->decomp = NULL;
+
+	if (remote_is_url(path)) {
+		img->fd = -1;
+		img->remote = remote_open(path, &img->size);
+		return img->remote ? image_open_decomp(img) : -1;
+	}
+
+	t = stats_start();
+	img->fd = open(path, O_RDONLY | (flags & IMAGE_DIRECT ? O_DIRECT : 0));
+	if (img->fd < 0) {
+		stats_stop(STATS_OPEN, t, 1, 0);
+		return -1;
+	}
+
+	ret = fstat(img->fd, &st);
+	stats_stop(STATS_OPEN, t, 2, 0);
+	if (ret != 0)
+		goto err_close;
+
+	if (S_ISREG(st.st_mode)) {
+		img->size = st.st_size;
+		if (flags & IMAGE_DIRECT) {
+			/* st_blksize is a multiple of the logical block size */
+			img->align = st.st_blksize >= IMAGE_DIRECT_ALIGN ? st.st_blksize
+									 : IMAGE_DIRECT_ALIGN;
+		} else if (img->size > 0 && img->size <= SIZE_MAX) {
+			void *map;
+
+			t = stats_start();
+			map = mmap(NULL, img->size, PROT_READ, MAP_SHARED, img->fd, 0);
+			stats_stop(STATS_OPEN, t, 1, 0);
+			if (map != MAP_FAILED)
+				img->map = map;
+		}
+		return image_open_decomp(img);
+	} else if (S_ISBLK(st.st_mode)) {
+		t = stats_start();
+		ret = ioctl(img->fd, BLKGETSIZE64, &img->size);
+		stats_stop(STATS_IOCTL, t, 1, 0);
+		if (ret != 0)
+			goto err_close;
+		if (flags & IMAGE_DIRECT) {
+			int sector_size;
+
+			t = stats_start();
+			ret = ioctl(img->fd, BLKSSZGET, &sector_size);
+			stats_stop(STATS_IOCTL, t, 1, 0);
+			if (ret != 0)
+				goto err_close;
+			img->align = sector_size > 0 ? sector_size : IMAGE_DIRECT_ALIGN;
+		}
+	} else {
+		struct mtd_info_user info;
+		off_t end;
+
+		if (S_ISCHR(st.st_mode)) {
+			t = stats_start();
+			ret = ioctl(img->fd, MEMGETINFO, &info);
+			stats_stop(STATS_IOCTL, t, 1, 0);
+			if (ret == 0 && info.erasesize > 0) {
+				img->size = info.size;
+				img->erasesize = info.erasesize;
+				img->writesize = info.writesize;
+				/* NOR flash is writable by the byte */
+				img->align = info.writesize >= IMAGE_DIRECT_ALIGN ? info.writesize
+										  : IMAGE_DIRECT_ALIGN;
+				return 0;
+			}
+		}
+
+		t = stats_start();
+		end = lseek(img->fd, 0, SEEK_END);
+		stats_stop(STATS_SEEK, t, 1, 0);
+		if (end < 0)
+			goto err_close;
+		img->size = end;
+		img->align = IMAGE_DIRECT_ALIGN;
+	}
+
+	return 0;
+
+err_close:
+	close(img->fd);
+	img->fd = -1;
+	return -1;
+}
+
+int image_open(struct image *img, const char *path)
+{
+	return image_open_flags(img, path, 0);
+}
+
+void image_close(struct image *img)
+{
+	uint64_t t = stats_start();
+
+	if (img->map)
+		munmap((void *)img->map, img->size);
+	if (img->fd >= 0)
+		close(img->fd);
+	stats_stop(STATS_OPEN, t, !!img->map + (img->fd >= 0), 0);
+	free(img->dbuf);
+	remote_close(img->remote);
+	decomp_close(img->decomp);
+	img->dbuf = NULL;
+	img->dbuf_size = 0;
+	img->map = NULL;
+	img->fd = -1;
+	img->remote = NULL;
+	img->decomp = NULL;
+}
+
+/* pread() len bytes at off into buf, retrying short reads */
+static int pread_full(int fd, void *buf, size_t len, uint64_t off)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		uint64_t t = stats_start();
+		ssize_t n = pread(fd, (uint8_t *)buf + done, len - done, off + done);
+
+		stats_stop(STATS_READ, t, 1, n > 0 ? n : 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+/*
+ * Read the aligned blocks covering [off, off + len) into the bounce buffer and
+ * copy the requested range to buf, unless buf and the range are aligned
+ * already. The last block may extend past the end of a regular file, only the
+ * part up to the end has to be read.
+ */
+static int image_read_direct(struct image *img, uint64_t off, size_t len, void *buf)
+{
+	uint64_t start = off / img->align * img->align;
+	uint64_t end = (off + len + img->align - 1) / img->align * img->align;
+	size_t need = off + len - start, done = 0;
+
+	if ((uintptr_t)buf % img->align == 0 && start == off && end == off + len)
+		return pread_full(img->fd, buf, len, off);
+
+	if (end - start > img->dbuf_size) {
+		void *dbuf;
+
+		if (posix_memalign(&dbuf, img->align, end - start) != 0) {
+			errno = ENOMEM;
+			return -1;
+		}
+		free(img->dbuf);
+		img->dbuf = dbuf;
+		img->dbuf_size = end - start;
+	}
+
+	while (done < need) {
+		uint64_t t = stats_start();
+		ssize_t n = pread(img->fd, img->dbuf + done, end - start - done, start + done);
+
+		stats_stop(STATS_READ, t, 1, n > 0 ? n : 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+		done += n;
+	}
+
+	memcpy(buf, img->dbuf + (off - start), len);
+	return 0;
+}
+
+/*
+ * Map logical erase block blk of an MTD device to a physical one, skipping bad
+ * blocks. The last mapping is kept, so sequential reads only check each block
+ * once.
+ */
+static int image_mtd_block(struct image *img, uint64_t blk, uint64_t *phys)
+{
+	uint64_t num = img->size / img->erasesize, l = 0, p = 0;
+
+	if (img->blk_log != UINT64_MAX && blk >= img->blk_log) {
+		if (blk == img->blk_log) {
+			*phys = img->blk_phys;
+			return 0;
+		}
+		l = img->blk_log + 1;
+		p = img->blk_phys + 1;
+	}
+
+	for (; p < num; p++) {
+		loff_t off = (loff_t)p * img->erasesize;
+		uint64_t t = stats_start();
+		int ret = ioctl(img->fd, MEMGETBADBLOCK, &off);
+
+		stats_stop(STATS_IOCTL, t, 1, 0);
+		/* NOR flash has no bad blocks */
+		if (ret < 0 && errno != EOPNOTSUPP)
+			return -1;
+		if (ret > 0)
+			continue;
+		if (l++ == blk) {
+			img->blk_log = blk;
+			img->blk_phys = p;
+			*phys = p;
+			return 0;
+		}
+	}
+
+	/* past the last good block */
+	errno = ENXIO;
+	return -1;
+}
+
+/* Read [off, off + len) of an MTD device, only the pages covering it are read */
+static int image_read_mtd(struct image *img, uint64_t off, size_t len, void *buf)
+{
+	while (len > 0) {
+		uint64_t blk = off / img->erasesize, phys;
+		size_t in_blk = off % img->erasesize;
+		size_t n = img->erasesize - in_blk < len ? img->erasesize - in_blk : len;
+
+		if (image_mtd_block(img, blk, &phys) != 0 ||
+		    image_read_direct(img, phys * img->erasesize + in_blk, n, buf) != 0)
+			return -1;
+
+		off += n;
+		len -= n;
+		buf = (uint8_t *)buf + n;
+	}
+
+	return 0;
+}
+
+const void *image_read(struct image *img, uint64_t off, size_t len, void *buf)
+{
+	if (off > img->size || len > img->size - off) {
+		errno = EIO;
+		return NULL;
+	}
+
+	if (img->map) {
+		stats_stop(STATS_READ, stats_start(), 0, len);
+		return img->map + off;
+	}
+
+	if (image_is_virt(img)) {
+		struct iovec iov = { buf, len };
+
+		return image_readv_virt(img, off, &iov, 1) == 0 ? buf : NULL;
+	}
+	if (image_is_mtd(img))
+		return image_read_mtd(img, off, len, buf) == 0 ? buf : NULL;
+	if (img->flags & IMAGE_DIRECT)
+		return image_read_direct(img, off, len, buf) == 0 ? buf : NULL;
+
+	return pread_full(img->fd, buf, len, off) == 0 ? buf : NULL;
+}
+
+/* Gaps of up to this size between requests are read into a scratch buffer */
+#define IMAGE_GAP_CHUNK	4096
+#define IMAGE_GAP_MAX	(16 * IMAGE_GAP_CHUNK)
+#define IMAGE_IOV_MAX	(IMAGE_BATCH_MAX * (1 + IMAGE_GAP_MAX / IMAGE_GAP_CHUNK))
+
+static void iov_advance(struct iovec **iov, int *iovcnt, size_t n)
+{
+	while (*iovcnt > 0 && n >= (*iov)->iov_len) {
+		n -= (*iov)->iov_len;
+		(*iov)++;
+		(*iovcnt)--;
+	}
+	if (*iovcnt > 0) {
+		(*iov)->iov_base = (uint8_t *)(*iov)->iov_base + n;
+		(*iov)->iov_len -= n;
+	}
+}
+
+static int preadv_full(int fd, struct iovec *iov, int iovcnt, uint64_t off)
+{
+	while (iovcnt > 0) {
+		uint64_t t = stats_start();
+		ssize_t n = preadv(fd, iov, iovcnt, off);
+
+		stats_stop(STATS_READ, t, 1, n > 0 ? n : 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = EIO;
+			return -1;
+		}
+
+		off += n;
+		iov_advance(&iov, &iovcnt, n);
+	}
+
+	return 0;
+}
+
+/* A single (p)readv covering one or more adjacent requests on the same image */
+struct image_read {
+	struct image	*img;
+	uint64_t	off;
+	struct iovec	*iov;
+	int		iovcnt;
+	size_t		len;
+	struct image_req **reqs;
+	unsigned int	nreqs;
+	int		error;
+	bool		done;
+};
+
+static void image_read_complete(struct image_read *rd, int error)
+{
+	unsigned int i;
+
+	for (i = 0; i < rd->nreqs; i++) {
+		rd->reqs[i]->error = error;
+		rd->reqs[i]->data = error ? NULL : rd->reqs[i]->buf;
+	}
+	rd->done = true;
+}
+
+#ifdef HAVE_IO_URING
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+			      unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void image_io_uring_init(struct image_io *io)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	fd = sys_io_uring_setup(IMAGE_BATCH_MAX, &p);
+	if (fd < 0)
+		return;
+
+	io->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	io->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (io->cq_len > io->sq_len)
+			io->sq_len = io->cq_len;
+		io->cq_len = 0;
+	}
+
+	io->sq_ring = mmap(NULL, io->sq_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (io->sq_ring == MAP_FAILED)
+		goto err_close;
+
+	if (io->cq_len) {
+		io->cq_ring = mmap(NULL, io->cq_len, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (io->cq_ring == MAP_FAILED)
+			goto err_unmap_sq;
+	} else
+		io->cq_ring = io->sq_ring;
+
+	io->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	io->sqes = mmap(NULL, io->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (io->sqes == MAP_FAILED)
+		goto err_unmap_cq;
+
+	sq = io->sq_ring;
+	cq = io->cq_ring;
+	io->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	io->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+	io->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	io->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	io->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	io->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+	io->cqes = cq + p.cq_off.cqes;
+	io->ring_fd = fd;
+	return;
+
+err_unmap_cq:
+	if (io->cq_len)
+		munmap(io->cq_ring, io->cq_len);
+err_unmap_sq:
+	munmap(io->sq_ring, io->sq_len);
+err_close:
+	close(fd);
+}
+
+static void image_io_uring_exit(struct image_io *io)
+{
+	munmap(io->sqes, io->sqes_len);
+	if (io->cq_len)
+		munmap(io->cq_ring, io->cq_len);
+	munmap(io->sq_ring, io->sq_len);
+	close(io->ring_fd);
+}
+
+/*
+ * Submit all reads at once and wait for them to complete. Reads which failed
+ * with an error other than an I/O error (e.g. IORING_OP_READV not supported)
+ * or were short are not marked done and left for the preadv() fallback.
+ */
+static void image_io_uring_read(struct image_io *io, struct image_read *rds, unsigned int n)
+{
+	struct io_uring_sqe *sqes = io->sqes;
+	struct io_uring_cqe *cqes = io->cqes;
+	unsigned int i, tail, head, submitted = 0, completed = 0, syscalls = 0;
+	uint64_t t = stats_start(), bytes = 0;
+	int ret;
+
+	tail = *io->sq_tail;
+	for (i = 0; i < n; i++) {
+		unsigned int idx = tail & io->sq_mask;
+		struct io_uring_sqe *sqe = &sqes[idx];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = rds[i].img->fd;
+		sqe->off = rds[i].off;
+		sqe->addr = (uintptr_t) rds[i].iov;
+		sqe->len = rds[i].iovcnt;
+		sqe->user_data = i;
+		io->sq_array[idx] = idx;
+		tail++;
+	}
+	__atomic_store_n(io->sq_tail, tail, __ATOMIC_RELEASE);
+
+	while (submitted < n) {
+		ret = sys_io_uring_enter(io->ring_fd, n - submitted, 0, 0);
+		syscalls++;
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		submitted += ret;
+	}
+
+	head = *io->cq_head;
+	while (completed < submitted) {
+		struct io_uring_cqe *cqe;
+		struct image_read *rd;
+
+		if (head == __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE)) {
+			ret = sys_io_uring_enter(io->ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+			syscalls++;
+			if (ret < 0 && errno != EINTR)
+				break;
+			continue;
+		}
+
+		cqe = &cqes[head & io->cq_mask];
+		rd = &rds[cqe->user_data];
+		if (cqe->res > 0)
+			bytes += cqe->res;
+
+		if (cqe->res > 0 && (size_t)cqe->res == rd->len) {
+			image_read_complete(rd, 0);
+		} else if (cqe->res > 0) {
+			/* short read, the fallback reads the rest */
+			iov_advance(&rd->iov, &rd->iovcnt, cqe->res);
+			rd->off += cqe->res;
+			rd->len -= cqe->res;
+		} else if (cqe->res == 0) {
+			image_read_complete(rd, EIO);
+		} else if (cqe->res != -EINVAL && cqe->res != -EOPNOTSUPP) {
+			image_read_complete(rd, -cqe->res);
+		}
+
+		head++;
+		__atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+		completed++;
+	}
+	stats_stop(STATS_READ, t, syscalls, bytes);
+
+	/*
+	 * Don't leave unsubmitted entries in the ring (or lose track of
+	 * submitted ones), stop using io_uring in that case.
+	 */
+	if (submitted < n || completed < submitted) {
+		if (completed == submitted)
+			image_io_uring_exit(io);
+		io->ring_fd = -1;
+	}
+}
+#endif /* HAVE_IO_URING */
+
+void image_io_init(struct image_io *io)
+{
+	memset(io, 0, sizeof(*io));
+	io->ring_fd = -1;
+#ifdef HAVE_IO_URING
+	image_io_uring_init(io);
+#endif
+}
+
+void image_io_exit(struct image_io *io)
+{
+#ifdef HAVE_IO_URING
+	if (io->ring_fd >= 0)
+		image_io_uring_exit(io);
+#endif
+	io->ring_fd = -1;
+}
+
+static bool image_req_before(const struct image_req *a, const struct image_req *b)
+{
+	if (a->img != b->img)
+		return (uintptr_t)a->img < (uintptr_t)b->img;
+	return a->off < b->off;
+}
+
+int image_io_read(struct image_io *io, struct image_req *reqs, unsigned int n)
+{
+	static __thread uint8_t scratch[IMAGE_GAP_CHUNK];	/* sink for gaps */
+	struct image_req *sorted[IMAGE_BATCH_MAX];
+	struct image_read rds[IMAGE_BATCH_MAX];
+	struct iovec iov[IMAGE_IOV_MAX];
+	unsigned int i, j, nsorted = 0, nrds = 0, failed = 0;
+	bool virt = false;
+	int iovcnt = 0;
+
+	if (n > IMAGE_BATCH_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct image_req *r = &reqs[i];
+		struct image *img = r->img;
+
+		r->error = 0;
+		r->data = NULL;
+		if (r->off > img->size || r->len > img->size - r->off) {
+			r->error = EIO;
+			continue;
+		}
+		if (img->map) {
+			r->data = img->map + r->off;
+			stats_stop(STATS_READ, stats_start(), 0, r->len);
+			continue;
+		}
+		if ((img->flags & IMAGE_DIRECT || image_is_mtd(img)) && !image_is_virt(img)) {
+			/* the request buffers are not aligned, read each on its own */
+			r->data = image_read(img, r->off, r->len, r->buf);
+			if (!r->data)
+				r->error = errno;
+			continue;
+		}
+
+		virt |= image_is_virt(img);
+
+		/* insertion sort by image and offset */
+		for (j = nsorted; j > 0 && image_req_before(r, sorted[j - 1]); j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = r;
+		nsorted++;
+	}
+
+	/* Coalesce adjacent requests on the same image into one read */
+	for (i = 0; i < nsorted; nrds++) {
+		struct image_read *rd = &rds[nrds];
+		uint64_t end = sorted[i]->off;
+
+		rd->img = sorted[i]->img;
+		rd->off = end;
+		rd->iov = &iov[iovcnt];
+		rd->iovcnt = 0;
+		rd->reqs = &sorted[i];
+		rd->nreqs = 0;
+		rd->done = false;
+
+		for (j = i; j < nsorted; j++) {
+			struct image_req *r = sorted[j];
+
+			/* other image, overlapping or too far away: new read */
+			if (r->img != rd->img || r->off < end || r->off - end > IMAGE_GAP_MAX)
+				break;
+
+			while (end < r->off) {
+				size_t gap = r->off - end;
+				if (gap > IMAGE_GAP_CHUNK)
+					gap = IMAGE_GAP_CHUNK;
+				iov[iovcnt].iov_base = scratch;
+				iov[iovcnt].iov_len = gap;
+				iovcnt++;
+				end += gap;
+			}
+
+			iov[iovcnt].iov_base = r->buf;
+			iov[iovcnt].iov_len = r->len;
+			iovcnt++;
+			end += r->len;
+		}
+
+		rd->iovcnt = &iov[iovcnt] - rd->iov;
+		rd->len = end - rd->off;
+		rd->nreqs = j - i;
+		i = j;
+	}
+
+#ifdef HAVE_IO_URING
+	if (io && io->ring_fd >= 0 && nrds > 1 && !virt)
+		image_io_uring_read(io, rds, nrds);
+#else
+	(void) io;
+#endif
+
+	for (i = 0; i < nrds; i++) {
+		struct image_read *rd = &rds[i];
+
+		if (rd->done)
+			continue;
+		if (image_is_virt(rd->img))
+			image_read_complete(rd, image_readv_virt(rd->img, rd->off, rd->iov, rd->iovcnt) ? errno : 0);
+		else
+			image_read_complete(rd, preadv_full(rd->img->fd, rd->iov, rd->iovcnt, rd->off) ? errno : 0);
+	}
+
+	for (i = 0; i < n; i++)
+		if (reqs[i].error)
+			failed++;
+
+	return failed;
+}
+
+int image_read_batch(struct image *img, struct image_req *reqs, unsigned int n)
+{
+	unsigned int i;
+
+	if (n > IMAGE_BATCH_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+		reqs[i].img = img;
+
+	if (image_io_read(NULL, reqs, n) == 0)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		if (reqs[i].error) {
+			errno = reqs[i].error;
+			break;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,111 @@
+/*
+ * Image source: regular image files, block devices, MTD devices or remote
+ * images (HTTP or NBD), optionally compressed
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct decomp;
+struct remote;
+
+struct image {
+	int		fd;	/* -1 for remote and compressed images */
+	uint64_t	size;
+	const uint8_t	*map;	/* read-only mapping of regular files, or NULL */
+	unsigned int	flags;
+	unsigned int	align;	/* offset and length alignment for IMAGE_DIRECT */
+	uint8_t		*dbuf;	/* aligned bounce buffer for IMAGE_DIRECT and MTD */
+	size_t		dbuf_size;
+	/* MTD devices, erasesize is 0 for anything else */
+	uint32_t	erasesize;
+	uint32_t	writesize;	/* NAND page size */
+	uint64_t	blk_log;	/* last logical erase block mapped (or UINT64_MAX) */
+	uint64_t	blk_phys;	/* and the physical block it is at */
+	struct remote	*remote;	/* http:// or nbd:// image, see remote.h */
+	struct decomp	*decomp;	/* compressed image, see decomp.h */
+};
+
+/*
+ * Read with O_DIRECT, bypassing the page cache. Images are never mapped,
+ * reads go through a bounce buffer aligned to the logical block size.
+ */
+#define IMAGE_DIRECT	0x1
+
+/*
+ * MTD character devices (/dev/mtdX) are read a page at a time. Like u-boot's
+ * nand_read_skip_bad(), offsets are logical, bad erase blocks are skipped. The
+ * size is that of the whole device, reads past the last good block fail with
+ * ENXIO.
+ */
+static inline bool image_is_mtd(const struct image *img)
+{
+	return img->erasesize != 0;
+}
+
+/*
+ * Paths starting with http:// or nbd:// are opened as remote images, only the
+ * ranges read are fetched (IMAGE_DIRECT has no effect on them). Image files
+ * (local or remote) compressed with gzip, xz or zstd are decompressed on the
+ * fly.
+ */
+int image_open(struct image *img, const char *path);
+int image_open_flags(struct image *img, const char *path, unsigned int flags);
+void image_close(struct image *img);
+
+/*
+ * Get len bytes at offset off. For mapped images a pointer into the mapping
+ * is returned and buf is not used (and may be NULL), otherwise the data is
+ * read into buf. Returns NULL and sets errno on error.
+ */
+const void *image_read(struct image *img, uint64_t off, size_t len, void *buf);
+
+/* A single read of a batch, see image_io_read() and image_read_batch() */
+struct image_req {
+	struct image	*img;
+	uint64_t	off;
+	size_t		len;
+	void		*buf;	/* destination for non-mapped images */
+	const void	*data;	/* set to the data on success */
+	int		error;	/* set to the errno value on failure */
+};
+
+#define IMAGE_BATCH_MAX	16
+
+/*
+ * Read a batch of up to IMAGE_BATCH_MAX requests. The requests are issued in
+ * ascending offset order, adjacent requests (or ones separated by a small gap)
+ * are coalesced into a single preadv(). Returns -1 and sets errno if any of
+ * the requests fails.
+ */
+int image_read_batch(struct image *img, struct image_req *reqs, unsigned int n);
+
+/* Asynchronous I/O context, one per thread */
+struct image_io {
+	int		ring_fd;	/* io_uring, or -1 to use preadv() */
+	void		*sq_ring, *cq_ring, *sqes, *cqes;
+	size_t		sq_len, cq_len, sqes_len;
+	unsigned int	*sq_tail, *sq_array, *cq_head, *cq_tail;
+	unsigned int	sq_mask, cq_mask;
+};
+
+void image_io_init(struct image_io *io);
+void image_io_exit(struct image_io *io);
+
+/*
+ * Read a batch of up to IMAGE_BATCH_MAX requests on any number of images
+ * (given by each request's img) all at once. The result of each request is
+ * given by its data and error. Returns the number of failed requests. io may
+ * be NULL to read synchronously.
+ */
+int image_io_read(struct image_io *io, struct image_req *reqs, unsigned int n);
+
+#endif /* IMAGE_H */
@@ -0,0 +1,117 @@
+/*
+ * JSON emitters for the parsed partition tables and config block
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _DEFAULT_SOURCE
+#include <endian.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "json.h"
+
+void json_key_str(struct outbuf *ob, const char *key, const char *str)
+{
+	outbuf_printf(ob, "\"%s\":", key);
+	if (str)
+		outbuf_json_str(ob, str, strlen(str));
+	else
+		outbuf_puts(ob, "null");
+}
+
+void json_errors(struct outbuf *ob, const char *msgs, size_t len)
+{
+	const char *p = msgs, *end = msgs + len;
+	bool first = true;
+
+	outbuf_puts(ob, "\"errors\":[");
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		size_t n = nl ? (size_t)(nl - p) : (size_t)(end - p);
+
+		if (n > 7 && memcmp(p, "Error: ", 7) == 0) {
+			p += 7;
+			n -= 7;
+		}
+		if (!first)
+			outbuf_puts(ob, ",");
+		outbuf_json_str(ob, p, n);
+		first = false;
+		p += n + 1;
+	}
+	outbuf_puts(ob, "]");
+}
+
+void json_ptable(struct outbuf *ob, const struct nvtegra_ptable *pt, unsigned int num_parts)
+{
+	unsigned int i;
+
+	outbuf_printf(ob, "{\"version\":%u,\"table_size\":%u,\"num_parts\":%u,\"partitions\":[",
+		      nvtegra_ptable_version(pt), nvtegra_ptable_table_size(pt),
+		      nvtegra_ptable_num_parts(pt));
+	for (i = 0; i < num_parts; i++) {
+		const struct nvtegra_partinfo *p = &pt->partitions[i];
+		char name[sizeof(p->name) + 1];
+
+		memcpy(name, p->name, sizeof(p->name));
+		name[sizeof(p->name)] = '\0';
+		outbuf_printf(ob, "%s{\"index\":%u,\"id\":%u,\"name\":", i ? "," : "", i,
+			      nvtegra_partinfo_id(p));
+		outbuf_json_str(ob, name, strlen(name));
+		outbuf_printf(ob, ",\"policy\":%u,\"fs_type\":%u,\"virt_start_sector\":%u,\"virt_size\":%u,"
+			      "\"start_sector\":%u,\"end_sector\":%u,\"type\":%u}",
+			      nvtegra_partinfo_allocation_policy(p), nvtegra_partinfo_fs_type(p),
+			      nvtegra_partinfo_virt_start_sector(p), nvtegra_partinfo_virt_size(p),
+			      nvtegra_partinfo_start_sector(p), nvtegra_partinfo_end_sector(p),
+			      nvtegra_partinfo_type(p));
+	}
+	outbuf_puts(ob, "]}");
+}
+
+void json_gpt(struct outbuf *ob, const struct gpt_info *gpt, const uint64_t *used, bool checked)
+{
+	char guid[GUID_STR_LEN + 1];
+	unsigned int i, n = 0;
+
+	guid_to_str((const uint8_t *)&gpt->hdr->uuid, guid);
+	outbuf_printf(ob, "{\"disk_guid\":\"%s\",\"lba_table\":%" PRIu64 ",\"num_entries\":%u,"
+		      "\"entry_size\":%u,\"checked\":%s,\"partitions\":[",
+		      guid, gpt->lba_table, gpt->num_entries, gpt->entry_size,
+		      checked ? "true" : "false");
+	for (i = 0; i < gpt->num_entries; i++) {
+		const struct gpt_entry *e = gpt_entry_get(gpt, i);
+		char name[GPT_NAME_STR_LEN + 1];
+
+		if (used && !gpt_entry_used(used, i))
+			continue;
+		gpt_entry_name(e, name, sizeof(name));
+		outbuf_printf(ob, "%s{\"index\":%u,\"name\":", n++ ? "," : "", i);
+		outbuf_json_str(ob, name, strlen(name));
+		guid_to_str((const uint8_t *)&e->type, guid);
+		outbuf_printf(ob, ",\"type\":\"%s\"", guid);
+		guid_to_str((const uint8_t *)&e->uuid, guid);
+		outbuf_printf(ob, ",\"uuid\":\"%s\",\"attr\":%" PRIu64 ",\"lba_start\":%" PRIu64 ",\"lba_end\":%" PRIu64 "}",
+			      guid, gpt_entry_attr(e), gpt_entry_lba_start(e), gpt_entry_lba_end(e));
+	}
+	outbuf_puts(ob, "]}");
+}
+
+void json_cfgblock(struct outbuf *ob, const struct trdx_cfgblock *cb)
+{
+	const struct toradex_hw *hw = &cb->hw;
+	const char *model = trdx_module_name(hw->prodid);
+	uint8_t mac[6];
+
+	trdx_cfgblock_mac(cb, mac);
+	outbuf_puts(ob, "\"model\":");
+	outbuf_json_str(ob, model, strlen(model));
+	outbuf_printf(ob, ",\"prodid\":%u,\"ver_major\":%u,\"ver_minor\":%u,\"ver_assembly\":%u,"
+		      "\"version\":\"%u.%u%c\",\"serial\":\"%08u\","
+		      "\"mac\":\"%02x:%02x:%02x:%02x:%02x:%02x\"",
+		      hw->prodid, hw->ver_major, hw->ver_minor, hw->ver_assembly,
+		      hw->ver_major, hw->ver_minor, (char)hw->ver_assembly + 'A',
+		      cb->serial, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
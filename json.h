@@ -0,0 +1,41 @@
+/*
+ * JSON emitters for the parsed partition tables and config block, shared by
+ * the tools and apalisd
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "libapalis.h"
+#include "outbuf.h"
+
+/* Append "key":"str", or "key":null if str is NULL */
+void json_key_str(struct outbuf *ob, const char *key, const char *str);
+
+/*
+ * Append "errors":[...] with one string per line of the len bytes of error
+ * messages at msgs. A leading "Error: " is stripped from each line.
+ */
+void json_errors(struct outbuf *ob, const char *msgs, size_t len);
+
+/* Append the first num_parts entries of pt as an object */
+void json_ptable(struct outbuf *ob, const struct nvtegra_ptable *pt, unsigned int num_parts);
+
+/*
+ * Append the parsed GPT as an object, checked tells whether it was
+ * cross-checked. If used is not NULL only the entries set in this bitmap (see
+ * gpt_used_entries()) are listed.
+ */
+void json_gpt(struct outbuf *ob, const struct gpt_info *gpt, const uint64_t *used, bool checked);
+
+/* Append the members (without braces) describing the parsed config block */
+void json_cfgblock(struct outbuf *ob, const struct trdx_cfgblock *cb);
+
+#endif /* JSON_H */
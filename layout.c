@@ -0,0 +1,541 @@
+/*
+ * Canonical partition layouts, fingerprints and an on-disk index of them
+ *
+ * The fingerprint of a layout is the first 64 bits of the SHA-256 of its
+ * canonical form. Index file layout (all fields little endian):
+ *
+ *   struct layout_index_hdr
+ *   struct layout_index_unit[num_units]	fingerprint, key hash, record
+ *   records				struct layout_index_rec, parts, key
+ *
+ * Records are only read when a unit is looked up by key or diffed, so
+ * comparing fingerprints only touches the table.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "layout.h"
+#include "sha256.h"
+
+#define LAYOUT_INDEX_MAGIC	0x494c564e	/* "NVLI" */
+#define LAYOUT_INDEX_VERSION	1
+#define LAYOUT_REC_ALIGN	8
+
+struct layout_index_hdr {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	part_size;	/* sizeof(struct layout_part) */
+	uint32_t	num_units;
+	uint32_t	__reserved;
+} __attribute__((packed));
+
+struct layout_index_unit {
+	uint64_t	fingerprint;
+	uint64_t	rec_off;
+	uint32_t	rec_size;
+	uint32_t	key_hash;
+} __attribute__((packed));
+
+/* Followed by num_parts struct layout_part and the key, padded to 8 bytes */
+struct layout_index_rec {
+	uint32_t	pt_version;
+	uint32_t	num_parts;
+	uint32_t	key_len;
+	uint32_t	__reserved;
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct layout_part) == 136, "canonical partition size");
+_Static_assert(sizeof(struct layout_index_unit) == 24, "index unit size");
+
+/* FNV-1a */
+static uint32_t key_hash(const char *key, unsigned int len)
+{
+	uint32_t h = 2166136261U;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (uint8_t)key[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static size_t rec_size(unsigned int num_parts, unsigned int key_len)
+{
+	size_t size = sizeof(struct layout_index_rec) + num_parts * sizeof(struct layout_part) + key_len;
+
+	return (size + LAYOUT_REC_ALIGN - 1) / LAYOUT_REC_ALIGN * LAYOUT_REC_ALIGN;
+}
+
+static uint64_t layout_fingerprint(uint32_t pt_version, const struct layout_part *parts,
+				   unsigned int num_parts)
+{
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	struct sha256_ctx ctx;
+	uint32_t v[2] = { htole32(pt_version), htole32(num_parts) };
+	uint64_t fp;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, v, sizeof(v));
+	sha256_update(&ctx, parts, num_parts * sizeof(*parts));
+	sha256_final(&ctx, digest);
+	memcpy(&fp, digest, sizeof(fp));
+	return le64toh(fp);
+}
+
+int layout_build(struct layout *l, const char *key, unsigned int key_len,
+		 const struct nvtegra_ptable *pt, unsigned int num_parts,
+		 const struct gpt_info *gpt, unsigned int num_gpt_entries)
+{
+	struct layout_part *parts;
+	unsigned int i, n = 0;
+	char *mem;
+
+	memset(l, 0, sizeof(*l));
+	mem = calloc(1, (num_parts + num_gpt_entries) * sizeof(*parts) + key_len);
+	if (!mem)
+		return -1;
+	parts = (struct layout_part *)mem;
+
+	for (i = 0; i < num_parts; i++) {
+		const struct nvtegra_partinfo *p = &pt->partitions[i];
+		struct layout_part *lp = &parts[n++];
+
+		lp->source = LAYOUT_SRC_PT;
+		lp->id = htole32(nvtegra_partinfo_id(p));
+		lp->start = htole64(nvtegra_partinfo_start_sector(p));
+		lp->end = htole64(nvtegra_partinfo_end_sector(p));
+		lp->type = htole32(nvtegra_partinfo_type(p));
+		lp->fs_type = htole32(nvtegra_partinfo_fs_type(p));
+		memcpy(lp->name, p->name, sizeof(p->name));
+	}
+
+	for (i = 0; gpt && i < num_gpt_entries; i++) {
+		const struct gpt_entry *e = gpt_entry_get(gpt, i);
+		static const uint8_t zero[16];
+		struct layout_part *lp;
+
+		if (memcmp(&e->type, zero, sizeof(zero)) == 0)
+			continue;
+
+		lp = &parts[n++];
+		lp->source = LAYOUT_SRC_GPT;
+		lp->id = htole32(i);
+		lp->start = htole64(gpt_entry_lba_start(e));
+		lp->end = htole64(gpt_entry_lba_end(e));
+		memcpy(lp->type_guid, &e->type, sizeof(lp->type_guid));
+		memcpy(lp->uuid, &e->uuid, sizeof(lp->uuid));
+		memcpy(lp->name, e->name, sizeof(lp->name));
+	}
+
+	l->key = mem + (num_parts + num_gpt_entries) * sizeof(*parts);
+	memcpy((char *)l->key, key, key_len);
+	l->key_len = key_len;
+	l->key_hash = key_hash(key, key_len);
+	l->pt_version = nvtegra_ptable_version(pt);
+	l->parts = parts;
+	l->num_parts = n;
+	l->fingerprint = layout_fingerprint(l->pt_version, parts, n);
+	l->mem = mem;
+	return 0;
+}
+
+void layout_free(struct layout *l)
+{
+	free(l->mem);
+	memset(l, 0, sizeof(*l));
+}
+
+/* Resolve the key and parts of a unit loaded from the index file */
+static int layout_resolve(const struct layout_index *idx, struct layout *l)
+{
+	const struct layout_index_rec *rec;
+	const uint8_t *p;
+	uint32_t num_parts, key_len;
+
+	if (l->key)
+		return 0;
+	if (l->rec_off > idx->map_len || l->rec_size < sizeof(*rec) ||
+	    l->rec_size > idx->map_len - l->rec_off)
+		goto inval;
+
+	p = (const uint8_t *)idx->map + l->rec_off;
+	rec = (const struct layout_index_rec *)p;
+	num_parts = le32toh(rec->num_parts);
+	key_len = le32toh(rec->key_len);
+	if (num_parts > l->rec_size / sizeof(struct layout_part) ||
+	    key_len > l->rec_size || rec_size(num_parts, key_len) != l->rec_size)
+		goto inval;
+
+	l->pt_version = le32toh(rec->pt_version);
+	l->num_parts = num_parts;
+	l->parts = (const struct layout_part *)(p + sizeof(*rec));
+	l->key = (const char *)(p + sizeof(*rec) + num_parts * sizeof(struct layout_part));
+	l->key_len = key_len;
+	return 0;
+inval:
+	errno = EINVAL;
+	return -1;
+}
+
+static int layout_index_rehash(struct layout_index *idx, unsigned int num_slots)
+{
+	unsigned int *slots, i;
+
+	slots = calloc(num_slots, sizeof(*slots));
+	if (!slots)
+		return -1;
+
+	for (i = 0; i < idx->num; i++) {
+		unsigned int s = idx->units[i].key_hash & (num_slots - 1);
+
+		while (slots[s])
+			s = (s + 1) & (num_slots - 1);
+		slots[s] = i + 1;
+	}
+
+	free(idx->slots);
+	idx->slots = slots;
+	idx->num_slots = num_slots;
+	return 0;
+}
+
+/* Slot of the unit with the given key, or of the empty slot to insert it */
+static unsigned int *layout_index_slot(struct layout_index *idx, const char *key,
+				       unsigned int key_len, uint32_t hash)
+{
+	unsigned int s = hash & (idx->num_slots - 1);
+
+	for (; idx->slots[s]; s = (s + 1) & (idx->num_slots - 1)) {
+		struct layout *u = &idx->units[idx->slots[s] - 1];
+
+		if (u->key_hash != hash || layout_resolve(idx, u) != 0)
+			continue;
+		if (u->key_len == key_len && memcmp(u->key, key, key_len) == 0)
+			break;
+	}
+
+	return &idx->slots[s];
+}
+
+int layout_index_load(struct layout_index *idx, const char *path)
+{
+	const struct layout_index_hdr *hdr;
+	const struct layout_index_unit *table;
+	struct stat st;
+	unsigned int i, num_slots = 16;
+	uint32_t num;
+	int fd, saved_errno;
+	void *map;
+
+	memset(idx, 0, sizeof(*idx));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			return -1;
+		return layout_index_rehash(idx, num_slots);
+	}
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	idx->map = map;
+	idx->map_len = st.st_size;
+
+	hdr = map;
+	num = le32toh(hdr->num_units);
+	if (le32toh(hdr->magic) != LAYOUT_INDEX_MAGIC ||
+	    le16toh(hdr->version) != LAYOUT_INDEX_VERSION ||
+	    le16toh(hdr->part_size) != sizeof(struct layout_part) ||
+	    num > (idx->map_len - sizeof(*hdr)) / sizeof(*table)) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	idx->units = calloc(num ? num : 1, sizeof(*idx->units));
+	if (!idx->units)
+		goto err;
+	idx->size = num;
+
+	table = (const struct layout_index_unit *)((const uint8_t *)map + sizeof(*hdr));
+	for (i = 0; i < num; i++) {
+		struct layout *u = &idx->units[i];
+
+		u->fingerprint = le64toh(table[i].fingerprint);
+		u->key_hash = le32toh(table[i].key_hash);
+		u->rec_off = le64toh(table[i].rec_off);
+		u->rec_size = le32toh(table[i].rec_size);
+	}
+	idx->num = num;
+
+	while (num_slots < 2 * num)
+		num_slots *= 2;
+	if (layout_index_rehash(idx, num_slots) != 0)
+		goto err;
+	return 0;
+err:
+	saved_errno = errno;
+	layout_index_free(idx);
+	errno = saved_errno;
+	return -1;
+}
+
+int layout_index_add(struct layout_index *idx, struct layout *l)
+{
+	unsigned int *slot;
+
+	if (2 * (idx->num + 1) > idx->num_slots &&
+	    layout_index_rehash(idx, 2 * idx->num_slots) != 0)
+		return -1;
+
+	slot = layout_index_slot(idx, l->key, l->key_len, l->key_hash);
+	if (*slot) {
+		layout_free(&idx->units[*slot - 1]);
+		idx->units[*slot - 1] = *l;
+		return 0;
+	}
+
+	if (idx->num == idx->size) {
+		unsigned int size = idx->size ? 2 * idx->size : 64;
+		struct layout *units = realloc(idx->units, size * sizeof(*units));
+
+		if (!units)
+			return -1;
+		idx->units = units;
+		idx->size = size;
+	}
+	idx->units[idx->num] = *l;
+	*slot = ++idx->num;
+	return 0;
+}
+
+struct layout *layout_index_get(struct layout_index *idx, unsigned int i)
+{
+	struct layout *u = &idx->units[i];
+
+	return layout_resolve(idx, u) == 0 ? u : NULL;
+}
+
+struct layout *layout_index_find(struct layout_index *idx, const char *key, unsigned int key_len)
+{
+	unsigned int *slot = layout_index_slot(idx, key, key_len, key_hash(key, key_len));
+
+	return *slot ? &idx->units[*slot - 1] : NULL;
+}
+
+int layout_index_save(struct layout_index *idx, const char *path)
+{
+	static const uint8_t pad[LAYOUT_REC_ALIGN];
+	struct layout_index_hdr hdr;
+	char *tmp;
+	uint64_t off;
+	unsigned int i;
+	FILE *fp;
+	int saved_errno;
+
+	for (i = 0; i < idx->num; i++)
+		if (!layout_index_get(idx, i))
+			return -1;
+
+	if (asprintf(&tmp, "%s.tmp", path) < 0)
+		return -1;
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		free(tmp);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = htole32(LAYOUT_INDEX_MAGIC);
+	hdr.version = htole16(LAYOUT_INDEX_VERSION);
+	hdr.part_size = htole16(sizeof(struct layout_part));
+	hdr.num_units = htole32(idx->num);
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	off = sizeof(hdr) + (uint64_t)idx->num * sizeof(struct layout_index_unit);
+	for (i = 0; i < idx->num; i++) {
+		const struct layout *u = &idx->units[i];
+		struct layout_index_unit unit = {
+			.fingerprint	= htole64(u->fingerprint),
+			.rec_off	= htole64(off),
+			.rec_size	= htole32(rec_size(u->num_parts, u->key_len)),
+			.key_hash	= htole32(u->key_hash),
+		};
+
+		fwrite(&unit, sizeof(unit), 1, fp);
+		off += rec_size(u->num_parts, u->key_len);
+	}
+
+	for (i = 0; i < idx->num; i++) {
+		const struct layout *u = &idx->units[i];
+		struct layout_index_rec rec = {
+			.pt_version	= htole32(u->pt_version),
+			.num_parts	= htole32(u->num_parts),
+			.key_len	= htole32(u->key_len),
+		};
+		size_t len = sizeof(rec) + u->num_parts * sizeof(struct layout_part) + u->key_len;
+
+		fwrite(&rec, sizeof(rec), 1, fp);
+		fwrite(u->parts, sizeof(struct layout_part), u->num_parts, fp);
+		fwrite(u->key, 1, u->key_len, fp);
+		fwrite(pad, 1, rec_size(u->num_parts, u->key_len) - len, fp);
+	}
+
+	if (ferror(fp) || fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+		saved_errno = errno ? errno : EIO;
+		fclose(fp);
+		goto err;
+	}
+	if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+		saved_errno = errno;
+		goto err;
+	}
+	free(tmp);
+	return 0;
+err:
+	unlink(tmp);
+	free(tmp);
+	errno = saved_errno;
+	return -1;
+}
+
+void layout_index_free(struct layout_index *idx)
+{
+	unsigned int i;
+
+	for (i = 0; i < idx->num; i++)
+		free(idx->units[i].mem);
+	free(idx->units);
+	free(idx->slots);
+	if (idx->map)
+		munmap(idx->map, idx->map_len);
+	memset(idx, 0, sizeof(*idx));
+}
+
+static void part_name(const struct layout_part *p, char *str, size_t len)
+{
+	struct gpt_entry e;
+
+	if (p->source == LAYOUT_SRC_PT) {
+		snprintf(str, len, "%.4s", (const char *)p->name);
+		return;
+	}
+	memset(&e, 0, sizeof(e));
+	memcpy(e.name, p->name, sizeof(e.name));
+	gpt_entry_name(&e, str, len);
+}
+
+/* "GPT #id [name]" */
+#define PART_LABEL_LEN	(GPT_NAME_STR_LEN + 24)
+
+static void part_label(const struct layout_part *p, char *str, size_t len)
+{
+	char name[GPT_NAME_STR_LEN + 1];
+
+	part_name(p, name, sizeof(name));
+	if (p->source == LAYOUT_SRC_PT)
+		snprintf(str, len, "PT id=%02u [%s]", le32toh(p->id), name);
+	else
+		snprintf(str, len, "GPT #%02u [%s]", le32toh(p->id), name);
+}
+
+static const struct layout_part *find_part(const struct layout *l, const struct layout_part *p)
+{
+	unsigned int i;
+
+	for (i = 0; i < l->num_parts; i++)
+		if (l->parts[i].source == p->source && l->parts[i].id == p->id)
+			return &l->parts[i];
+	return NULL;
+}
+
+static void diff_part(struct outbuf *ob, const struct layout_part *ref, const struct layout_part *p)
+{
+	char label[PART_LABEL_LEN], name[GPT_NAME_STR_LEN + 1];
+	char a[GUID_STR_LEN + 1], b[GUID_STR_LEN + 1];
+
+	part_label(ref, label, sizeof(label));
+
+	if (memcmp(ref->name, p->name, sizeof(p->name)) != 0) {
+		part_name(p, name, sizeof(name));
+		outbuf_printf(ob, "  %s: name %s\n", label, name);
+	}
+	if (ref->start != p->start)
+		outbuf_printf(ob, "  %s: start 0x%" PRIx64 " (reference 0x%" PRIx64 ")\n", label,
+			      le64toh(p->start), le64toh(ref->start));
+	if (ref->end != p->end)
+		outbuf_printf(ob, "  %s: end 0x%" PRIx64 " (reference 0x%" PRIx64 ")\n", label,
+			      le64toh(p->end), le64toh(ref->end));
+	if (ref->type != p->type)
+		outbuf_printf(ob, "  %s: type %u (reference %u)\n", label, le32toh(p->type),
+			      le32toh(ref->type));
+	if (ref->fs_type != p->fs_type)
+		outbuf_printf(ob, "  %s: fs %u (reference %u)\n", label, le32toh(p->fs_type),
+			      le32toh(ref->fs_type));
+	if (memcmp(ref->type_guid, p->type_guid, sizeof(p->type_guid)) != 0) {
+		guid_to_str(p->type_guid, a);
+		guid_to_str(ref->type_guid, b);
+		outbuf_printf(ob, "  %s: type %s (reference %s)\n", label, a, b);
+	}
+	if (memcmp(ref->uuid, p->uuid, sizeof(p->uuid)) != 0) {
+		guid_to_str(p->uuid, a);
+		guid_to_str(ref->uuid, b);
+		outbuf_printf(ob, "  %s: uuid %s (reference %s)\n", label, a, b);
+	}
+}
+
+void layout_diff(struct outbuf *ob, const struct layout *ref, const struct layout *l)
+{
+	char label[PART_LABEL_LEN];
+	unsigned int i;
+
+	if (ref->pt_version != l->pt_version)
+		outbuf_printf(ob, "  PT version 0x%08x (reference 0x%08x)\n", l->pt_version,
+			      ref->pt_version);
+
+	for (i = 0; i < ref->num_parts; i++) {
+		const struct layout_part *p = find_part(l, &ref->parts[i]);
+
+		if (p) {
+			diff_part(ob, &ref->parts[i], p);
+		} else {
+			part_label(&ref->parts[i], label, sizeof(label));
+			outbuf_printf(ob, "  %s: missing\n", label);
+		}
+	}
+
+	for (i = 0; i < l->num_parts; i++) {
+		if (find_part(ref, &l->parts[i]))
+			continue;
+		part_label(&l->parts[i], label, sizeof(label));
+		outbuf_printf(ob, "  %s: not in reference\n", label);
+	}
+}
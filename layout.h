@@ -0,0 +1,100 @@
+/*
+ * Canonical partition layouts, fingerprints and an on-disk index of them
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdint.h>
+
+#include "libapalis.h"
+#include "outbuf.h"
+
+#define LAYOUT_SRC_PT	1
+#define LAYOUT_SRC_GPT	2
+
+/*
+ * Canonical form of a PT partition or used GPT entry, all fields little
+ * endian. The fingerprint of a layout is computed over these, so anything
+ * not in here (e.g. the disk GUID or unused GPT entries) doesn't count.
+ */
+struct layout_part {
+	uint8_t		source;		/* LAYOUT_SRC_* */
+	uint8_t		__reserved[3];
+	uint32_t	id;		/* PT partition id or GPT entry index */
+	uint64_t	start;		/* PT start sector or GPT first LBA */
+	uint64_t	end;		/* PT end sector or GPT last LBA */
+	uint32_t	type;		/* PT partition type */
+	uint32_t	fs_type;	/* PT file system type */
+	uint8_t		type_guid[16];	/* GPT partition type GUID (on-disk) */
+	uint8_t		uuid[16];	/* GPT partition GUID (on-disk) */
+	uint8_t		name[72];	/* PT name or GPT UTF-16LE name, zero padded */
+} __attribute__((packed));
+
+struct layout {
+	const char		*key;		/* the input, BOOTDEV[,GPTDEV] */
+	unsigned int		key_len;
+	uint32_t		key_hash;
+	uint64_t		fingerprint;
+	uint32_t		pt_version;
+	unsigned int		num_parts;
+	const struct layout_part *parts;
+	void			*mem;		/* key and parts, if not in the index file */
+	/* record in the index file, key and parts are NULL until resolved */
+	uint64_t		rec_off;
+	uint32_t		rec_size;
+};
+
+/*
+ * Build the canonical layout of a PT and (optionally) GPT, keyed by the key_len
+ * bytes at key. Returns -1 and sets errno on allocation failure.
+ */
+int layout_build(struct layout *l, const char *key, unsigned int key_len,
+		 const struct nvtegra_ptable *pt, unsigned int num_parts,
+		 const struct gpt_info *gpt, unsigned int num_gpt_entries);
+void layout_free(struct layout *l);
+
+/*
+ * Index of layouts, one per key. On disk a fixed-size table of fingerprints
+ * and record offsets is followed by the records, so comparing fingerprints
+ * only reads the table.
+ */
+struct layout_index {
+	struct layout	*units;
+	unsigned int	num;
+	unsigned int	size;
+	unsigned int	*slots;		/* hash table of units by key */
+	unsigned int	num_slots;
+	void		*map;		/* the loaded index file */
+	size_t		map_len;
+};
+
+/*
+ * Load the index at path, a missing file is an empty index. Returns -1 and
+ * sets errno on error (EINVAL if the file is not a valid index).
+ */
+int layout_index_load(struct layout_index *idx, const char *path);
+
+/* Add l to the index (which takes ownership), replacing a unit with its key */
+int layout_index_add(struct layout_index *idx, struct layout *l);
+
+/* Write the index to path, atomically replacing it */
+int layout_index_save(struct layout_index *idx, const char *path);
+void layout_index_free(struct layout_index *idx);
+
+/*
+ * Get unit i or the unit with the given key, with its key and parts read from
+ * the index file. The fingerprint of idx->units[i] is available without.
+ * Returns NULL (and sets errno to EINVAL for a corrupt record) on error.
+ */
+struct layout *layout_index_get(struct layout_index *idx, unsigned int i);
+struct layout *layout_index_find(struct layout_index *idx, const char *key, unsigned int key_len);
+
+/* Append the differences of layout l to the reference layout ref to ob */
+void layout_diff(struct outbuf *ob, const struct layout *ref, const struct layout *l);
+
+#endif /* LAYOUT_H */
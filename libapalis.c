@@ -0,0 +1,754 @@
+/*
+ * libapalis: parsers for the NVIDIA Tegra partition table, the GPT and the
+ * Toradex config block.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * Config block parsing based on board/toradex/common/tdx-config-block.c from
+ * the Toradex u-boot which is:
+ *
+ * Copyright (c) 2016 Toradex, Inc.
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _DEFAULT_SOURCE
+#include <endian.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "crc32.h"
+#include "libapalis.h"
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof(a[0]))
+
+static const char * const apalis_errors[] = {
+	[APALIS_OK]		  = "Success",
+	[APALIS_E_SHORT]	  = "Buffer too short",
+	[APALIS_E_PT_VERSION]	  = "Invalid partition table version",
+	[APALIS_E_PT_BCT_ID]	  = "Invalid partition id in BCT",
+	[APALIS_E_PT_BCT_NAME]	  = "Invalid name for BCT",
+	[APALIS_E_PT_BCT_START]	  = "Invalid start sector for BCT",
+	[APALIS_E_PT_PART_ID]	  = "Invalid partition id",
+	[APALIS_E_PT_SIZE]	  = "Invalid partition table size",
+	[APALIS_E_PT_COPY]	  = "Partition table copy differs",
+	[APALIS_E_GPT_SIGNATURE]  = "Invalid GPT signature",
+	[APALIS_E_GPT_HDR_SIZE]	  = "Invalid GPT header size",
+	[APALIS_E_GPT_HDR_CRC]	  = "Invalid GPT header CRC",
+	[APALIS_E_GPT_ENTRY_SIZE] = "Invalid GPT entry size",
+	[APALIS_E_GPT_TABLE_CRC]  = "Invalid GPT table CRC",
+	[APALIS_E_GPT_MISMATCH]	  = "Primary and backup GPT differ",
+	[APALIS_E_CB_INVALID]	  = "No valid Toradex config block",
+	[APALIS_E_GPT_TABLE_SIZE] = "GPT table too large",
+};
+
+const char *apalis_strerror(int err)
+{
+	if (err < 0 || err >= APALIS_E_MAX)
+		return "Unknown error";
+	return apalis_errors[err];
+}
+
+static const uint8_t PT_BCT_NAME[4] = { 'B', 'C', 'T', '\0' };
+static const uint8_t PT_GPT_NAME[4] = { 'G', 'P', 'T', '\0' };
+
+_Static_assert(offsetof(struct nvtegra_ptable, partitions) == NVTEGRA_PT_HDR_SIZE,
+	       "nvtegra_ptable header size");
+_Static_assert(sizeof(struct nvtegra_partinfo) == NVTEGRA_PT_ENTRY_SIZE,
+	       "nvtegra_partinfo size");
+
+/* The field lists in libapalis.h have to agree with the structs */
+#define CHECK_FIELD(s, f, bits)							\
+	_Static_assert(sizeof(((struct s *)0)->f) * 8 == (bits), #s "." #f " width");
+NVTEGRA_PARTINFO_FIELDS(CHECK_FIELD)
+NVTEGRA_PTABLE_FIELDS(CHECK_FIELD)
+GPT_HEADER_FIELDS(CHECK_FIELD)
+GPT_ENTRY_FIELDS(CHECK_FIELD)
+TORADEX_TAG_FIELDS(CHECK_FIELD)
+TORADEX_HW_FIELDS(CHECK_FIELD)
+
+/* Field f of s at p, using the aligned accessor if the compile-time constant aligned is set */
+#define GET(s, f, p, aligned)	((aligned) ? s##_##f##_a(p) : s##_##f(p))
+
+int nvtegra_ptable_size(const void *buf, size_t len, size_t *size)
+{
+	const struct nvtegra_ptable *pt = buf;
+	uint32_t num_parts, table_size;
+	uint64_t needed;
+
+	if (len < NVTEGRA_PT_HDR_SIZE)
+		return APALIS_E_SHORT;
+	if (nvtegra_ptable_version(pt) != NVTEGRA_PT_VERSION)
+		return APALIS_E_PT_VERSION;
+
+	/* at least the BCT entry */
+	num_parts = nvtegra_ptable_num_parts(pt);
+	needed = NVTEGRA_PT_HDR_SIZE + (uint64_t)(num_parts ? num_parts : 1) * NVTEGRA_PT_ENTRY_SIZE;
+	if (needed > NVTEGRA_PT_MAX_SIZE)
+		return APALIS_E_PT_SIZE;
+	table_size = nvtegra_ptable_table_size(pt);
+	if (table_size > needed && table_size <= NVTEGRA_PT_MAX_SIZE)
+		needed = table_size;
+
+	*size = needed;
+	return APALIS_OK;
+}
+
+/*
+ * Validate the entries of pt, instantiated for tables aligned to APALIS_ALIGN
+ * (the usual case, any buffer from malloc() or mmap()) and for any others.
+ */
+static inline __attribute__((always_inline)) int
+nvtegra_ptable_scan(const struct nvtegra_ptable *pt, struct nvtegra_ptable_info *info,
+		    bool aligned)
+{
+	const struct nvtegra_partinfo *p;
+	unsigned int i, num_parts = nvtegra_ptable_num_parts(pt);
+
+	/* Validate partitioning information (as far as possible) */
+	p = &pt->partitions[0];
+	if (GET(nvtegra_partinfo, id, p, aligned) != NVTEGRA_BCT_ID)
+		return APALIS_E_PT_BCT_ID;
+	if ((memcmp(p->name, PT_BCT_NAME, sizeof(PT_BCT_NAME)) != 0) ||
+	    (memcmp(p->name2, PT_BCT_NAME, sizeof(PT_BCT_NAME)) != 0))
+		return APALIS_E_PT_BCT_NAME;
+	if (GET(nvtegra_partinfo, start_sector, p, aligned) != 0)
+		return APALIS_E_PT_BCT_START;
+
+	for (i = 1; i < num_parts; i++) {
+		uint32_t id;
+
+		p = &pt->partitions[i];
+		id = GET(nvtegra_partinfo, id, p, aligned);
+		if (id >= NVTEGRA_MAX_PART_ID) {
+			info->num_parts = i;
+			info->bad_id = id;
+			return APALIS_E_PT_PART_ID;
+		}
+		if ((memcmp(p->name, PT_GPT_NAME, sizeof(PT_GPT_NAME) - 1) == 0) &&
+		    (memcmp(p->name2, PT_GPT_NAME, sizeof(PT_GPT_NAME) - 1) == 0))
+			info->gpt = p;
+	}
+	info->num_parts = i;
+
+	return APALIS_OK;
+}
+
+int nvtegra_ptable_parse(const void *buf, size_t len, struct nvtegra_ptable_info *info)
+{
+	const struct nvtegra_ptable *pt = buf;
+	int ret;
+
+	memset(info, 0, sizeof(*info));
+
+	if (len < NVTEGRA_PT_HDR_SIZE)
+		return APALIS_E_SHORT;
+	info->pt = pt;
+
+	ret = nvtegra_ptable_size(buf, len, &info->size);
+	if (ret != APALIS_OK)
+		return ret;
+	if (len < info->size)
+		return APALIS_E_SHORT;
+
+	/* the entries follow the 72 byte header, so they are aligned if the table is */
+	if (apalis_aligned(pt))
+		return nvtegra_ptable_scan(pt, info, true);
+	return nvtegra_ptable_scan(pt, info, false);
+}
+
+int nvtegra_ptable_compare_copy(const struct nvtegra_ptable_info *info, const void *copy,
+				size_t len)
+{
+	if (len < info->size)
+		return APALIS_E_SHORT;
+	return memcmp(info->pt, copy, info->size) == 0 ? APALIS_OK : APALIS_E_PT_COPY;
+}
+
+static const uint8_t GPT_SIGNATURE[8] = { 'E', 'F', 'I', ' ', 'P', 'A', 'R', 'T' };
+
+/* CRC of the GPT header with the crc_self field taken as zero */
+static uint32_t gpt_header_crc(const struct gpt_header *gpt_h, size_t size)
+{
+	static const uint8_t zero[sizeof(gpt_h->crc_self)];
+	const uint8_t *p = (const uint8_t *)gpt_h;
+	size_t crc_off = offsetof(struct gpt_header, crc_self);
+	uint32_t crc;
+
+	crc = crc32_update(0, p, crc_off);
+	crc = crc32_update(crc, zero, sizeof(zero));
+	return crc32_update(crc, p + crc_off + sizeof(zero), size - crc_off - sizeof(zero));
+}
+
+int gpt_header_parse(const void *buf, size_t len, uint64_t dev_size, struct gpt_info *info)
+{
+	const struct gpt_header *gpt_h = buf;
+	uint64_t table_size;
+
+	memset(info, 0, sizeof(*info));
+
+	if (len < sizeof(*gpt_h))
+		return APALIS_E_SHORT;
+	info->hdr = gpt_h;
+
+	if (memcmp(gpt_h->signature, GPT_SIGNATURE, sizeof(GPT_SIGNATURE)) != 0)
+		return APALIS_E_GPT_SIGNATURE;
+
+	info->hdr_size = gpt_header_size(gpt_h);
+	if (info->hdr_size < sizeof(*gpt_h) || info->hdr_size > GPT_BLOCK_SIZE)
+		return APALIS_E_GPT_HDR_SIZE;
+	if (info->hdr_size > len)
+		return APALIS_E_SHORT;
+
+	info->crc_stored = gpt_header_crc_self(gpt_h);
+	info->crc_calc = gpt_header_crc(gpt_h, info->hdr_size);
+	if (info->crc_calc != info->crc_stored)
+		return APALIS_E_GPT_HDR_CRC;
+
+	info->num_entries = gpt_header_num_entries(gpt_h);
+	info->entry_size = gpt_header_entry_size(gpt_h);
+	info->lba_table = gpt_header_lba_table(gpt_h);
+	table_size = (uint64_t)info->num_entries * info->entry_size;
+	if (info->entry_size < sizeof(struct gpt_entry) || table_size > dev_size)
+		return APALIS_E_GPT_ENTRY_SIZE;
+	if (table_size > GPT_TABLE_MAX_SIZE)
+		return APALIS_E_GPT_TABLE_SIZE;
+	info->table_size = table_size;
+
+	return APALIS_OK;
+}
+
+int gpt_table_parse(struct gpt_info *info, const void *table, size_t len)
+{
+	if (len < info->table_size)
+		return APALIS_E_SHORT;
+
+	info->crc_stored = gpt_header_crc_table(info->hdr);
+	info->crc_calc = crc32_update(0, table, info->table_size);
+	if (info->crc_calc != info->crc_stored)
+		return APALIS_E_GPT_TABLE_CRC;
+
+	info->table = table;
+	return APALIS_OK;
+}
+
+int gpt_parse(const void *hdr, size_t hdr_len, const void *table, size_t table_len,
+	      uint64_t dev_size, struct gpt_info *info)
+{
+	int ret;
+
+	ret = gpt_header_parse(hdr, hdr_len, dev_size, info);
+	if (ret != APALIS_OK)
+		return ret;
+	return gpt_table_parse(info, table, table_len);
+}
+
+unsigned int gpt_used_entries(const struct gpt_info *info, uint64_t *used)
+{
+	unsigned int i, num = 0;
+
+	memset(used, 0, GPT_BITMAP_WORDS(info->num_entries) * sizeof(*used));
+
+	for (i = 0; i < info->num_entries; i++) {
+		uint64_t type[2];
+
+		/* the 16 byte type GUID as two words */
+		memcpy(type, &gpt_entry_get(info, i)->type, sizeof(type));
+		if (type[0] | type[1]) {
+			used[i / 64] |= 1ULL << (i % 64);
+			num++;
+		}
+	}
+
+	return num;
+}
+
+/* Append the UTF-8 encoding of code point c if it fits, returns its length or 0 */
+static size_t utf8_put(char *str, size_t pos, size_t len, uint32_t c)
+{
+	size_t n = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+	uint8_t *p = (uint8_t *)str + pos;
+
+	if (pos + n >= len)
+		return 0;
+
+	switch (n) {
+	case 1:
+		p[0] = c;
+		break;
+	case 2:
+		p[0] = 0xc0 | c >> 6;
+		p[1] = 0x80 | (c & 0x3f);
+		break;
+	case 3:
+		p[0] = 0xe0 | c >> 12;
+		p[1] = 0x80 | (c >> 6 & 0x3f);
+		p[2] = 0x80 | (c & 0x3f);
+		break;
+	default:
+		p[0] = 0xf0 | c >> 18;
+		p[1] = 0x80 | (c >> 12 & 0x3f);
+		p[2] = 0x80 | (c >> 6 & 0x3f);
+		p[3] = 0x80 | (c & 0x3f);
+		break;
+	}
+
+	return n;
+}
+
+/*
+ * Copy 8 UTF-16LE units at src to dst if they are all non-zero ASCII characters,
+ * which is the case for most every GPT name. Returns false otherwise.
+ */
+static inline bool utf16_ascii8(char *dst, const uint8_t *src)
+{
+#ifdef __SSE2__
+	__m128i v = _mm_loadu_si128((const __m128i *)src);
+	__m128i bad = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi16((short)0xff80)),
+				   _mm_cmpeq_epi16(v, _mm_setzero_si128()));
+
+	if (_mm_movemask_epi8(_mm_cmpeq_epi16(bad, _mm_setzero_si128())) != 0xffff)
+		return false;
+	_mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(v, v));
+	return true;
+#else
+	uint64_t w[2];
+	unsigned int i;
+
+	memcpy(w, src, sizeof(w));
+	for (i = 0; i < 2; i++) {
+		uint64_t v = le64toh(w[i]);
+
+		/* a unit >= 0x80, or a zero unit (exact as all units are < 0x80) */
+		if ((v & 0xff80ff80ff80ff80ULL) ||
+		    ((v - 0x0001000100010001ULL) & ~v & 0x8000800080008000ULL))
+			return false;
+		w[i] = v;
+	}
+	for (i = 0; i < 8; i++)
+		dst[i] = w[i / 4] >> (16 * (i % 4));
+	return true;
+#endif
+}
+
+void gpt_entry_name(const struct gpt_entry *e, char *str, size_t len)
+{
+	const uint8_t *name = (const uint8_t *)e->name;
+	size_t n = 0, pos = 0, num = ARRAY_SIZE(e->name);
+
+	if (len == 0)
+		return;
+
+	/* ASCII fast path, 8 characters at a time */
+	while (n + 8 <= num && pos + 8 < len && utf16_ascii8(str + pos, name + 2 * n)) {
+		n += 8;
+		pos += 8;
+	}
+
+	while (n < num) {
+		uint32_t c = name[2 * n] | name[2 * n + 1] << 8;
+		size_t ret;
+
+		if (c == 0)
+			break;
+		n++;
+		if (c >= 0xd800 && c <= 0xdfff) {
+			uint32_t lo = n < num ? (name[2 * n] | name[2 * n + 1] << 8) : 0;
+
+			/* a lone surrogate is replaced by U+FFFD */
+			if (c <= 0xdbff && lo >= 0xdc00 && lo <= 0xdfff) {
+				c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+				n++;
+			} else {
+				c = 0xfffd;
+			}
+		}
+
+		ret = utf8_put(str, pos, len, c);
+		if (ret == 0)
+			break;
+		pos += ret;
+	}
+	str[pos] = '\0';
+}
+
+static const char * const gpt_diffs[] = {
+	"header locations",
+	"usable LBA range",
+	"disk GUID",
+	"number or size of entries",
+	"partition entries",
+};
+
+const char *gpt_diff_str(unsigned int diff_bit)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(gpt_diffs); i++)
+		if (diff_bit == 1U << i)
+			return gpt_diffs[i];
+	return "unknown";
+}
+
+int gpt_compare(const struct gpt_info *prim, const struct gpt_info *back, unsigned int *diff)
+{
+	const struct gpt_header *ph = prim->hdr, *bh = back->hdr;
+	unsigned int d = 0;
+
+	if (gpt_header_lba_self(ph) != gpt_header_lba_alt(bh) ||
+	    gpt_header_lba_alt(ph) != gpt_header_lba_self(bh))
+		d |= GPT_DIFF_LOCATION;
+	if (gpt_header_lba_start(ph) != gpt_header_lba_start(bh) ||
+	    gpt_header_lba_end(ph) != gpt_header_lba_end(bh))
+		d |= GPT_DIFF_LBA_RANGE;
+	if (memcmp(&ph->uuid, &bh->uuid, sizeof(ph->uuid)) != 0)
+		d |= GPT_DIFF_DISK_GUID;
+	if (prim->num_entries != back->num_entries || prim->entry_size != back->entry_size)
+		d |= GPT_DIFF_ENTRY_LAYOUT;
+	if (gpt_header_crc_table(ph) != gpt_header_crc_table(bh) ||
+	    prim->table_size != back->table_size ||
+	    memcmp(prim->table, back->table, back->table_size) != 0)
+		d |= GPT_DIFF_ENTRIES;
+
+	if (diff)
+		*diff = d;
+	return d ? APALIS_E_GPT_MISMATCH : APALIS_OK;
+}
+
+static void lba_range_add(struct lba_range *r, unsigned int *n, uint64_t start, uint64_t end,
+			  uint32_t index, enum lba_source source)
+{
+	if (end < start)
+		return;
+	r[*n].start = start;
+	r[*n].end = end;
+	r[*n].index = index;
+	r[*n].source = source;
+	(*n)++;
+}
+
+static bool lba_range_less(const struct lba_range *a, const struct lba_range *b)
+{
+	if (a->start != b->start)
+		return a->start < b->start;
+	if (a->end != b->end)
+		return a->end < b->end;
+	return a->source < b->source;
+}
+
+/* Move r[i] down the max-heap of the first n ranges */
+static void lba_range_sift(struct lba_range *r, unsigned int i, unsigned int n)
+{
+	struct lba_range tmp = r[i];
+	unsigned int c;
+
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && lba_range_less(&r[c], &r[c + 1]))
+			c++;
+		if (!lba_range_less(&tmp, &r[c]))
+			break;
+		r[i] = r[c];
+		i = c;
+	}
+	r[i] = tmp;
+}
+
+/* Heapsort in place, qsort() may allocate */
+static void lba_range_sort(struct lba_range *r, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = n / 2; i-- > 0;)
+		lba_range_sift(r, i, n);
+	for (i = n; i-- > 1;) {
+		struct lba_range tmp = r[0];
+
+		r[0] = r[i];
+		r[i] = tmp;
+		lba_range_sift(r, 0, i);
+	}
+}
+
+int lba_index_build(struct lba_index *idx, struct lba_range *ranges, size_t len,
+		    const struct nvtegra_ptable *pt, unsigned int num_parts,
+		    const struct gpt_info *gpt)
+{
+	unsigned int i, n = 0;
+	uint64_t max_end = 0;
+
+	memset(idx, 0, sizeof(*idx));
+	if (len < LBA_INDEX_MAX_RANGES(pt ? num_parts : 0, gpt ? gpt->num_entries : 0))
+		return APALIS_E_SHORT;
+
+	for (i = 0; pt && i < num_parts; i++) {
+		const struct nvtegra_partinfo *p = &pt->partitions[i];
+		uint32_t virt_size = nvtegra_partinfo_virt_size(p);
+		uint64_t virt_start = nvtegra_partinfo_virt_start_sector(p);
+
+		lba_range_add(ranges, &n, nvtegra_partinfo_start_sector(p),
+			      nvtegra_partinfo_end_sector(p), i, LBA_SRC_PT);
+		if (virt_size)
+			lba_range_add(ranges, &n, virt_start, virt_start + virt_size - 1, i,
+				      LBA_SRC_PT_VIRT);
+	}
+
+	for (i = 0; gpt && i < gpt->num_entries; i++) {
+		const struct gpt_entry *e = gpt_entry_get(gpt, i);
+		uint64_t type[2];
+
+		memcpy(type, &e->type, sizeof(type));
+		if (type[0] | type[1])
+			lba_range_add(ranges, &n, gpt_entry_lba_start(e), gpt_entry_lba_end(e), i,
+				      LBA_SRC_GPT);
+	}
+
+	lba_range_sort(ranges, n);
+	for (i = 0; i < n; i++) {
+		if (ranges[i].end > max_end)
+			max_end = ranges[i].end;
+		ranges[i].max_end = max_end;
+	}
+
+	idx->ranges = ranges;
+	idx->num = n;
+	return APALIS_OK;
+}
+
+/* Number of ranges starting at or before lba, galloping from idx->hint */
+static unsigned int lba_index_upper(const struct lba_index *idx, uint64_t lba)
+{
+	const struct lba_range *r = idx->ranges;
+	unsigned int lo, hi, step = 1, h = idx->hint;
+
+	/* find [lo, hi) with all ranges before lo starting <= lba, from hi on > lba */
+	if (h < idx->num && r[h].start <= lba) {
+		lo = hi = h + 1;
+		while (hi < idx->num && r[hi].start <= lba) {
+			lo = hi + 1;
+			hi = idx->num - hi > step ? hi + step : idx->num;
+			step <<= 1;
+		}
+	} else {
+		lo = hi = h;
+		while (lo > 0 && r[lo - 1].start > lba) {
+			hi = lo - 1;
+			lo = lo > step ? lo - step : 0;
+			step <<= 1;
+		}
+	}
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (r[mid].start <= lba)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+unsigned int lba_index_lookup(struct lba_index *idx, uint64_t lba,
+			      const struct lba_range **matches, unsigned int max)
+{
+	unsigned int i, n = 0;
+
+	i = lba_index_upper(idx, lba);
+	idx->hint = i < idx->num ? i : idx->num - (idx->num > 0);
+
+	/* walk back as long as a preceding range can still reach lba */
+	while (i-- > 0 && idx->ranges[i].max_end >= lba) {
+		if (idx->ranges[i].end < lba)
+			continue;
+		if (n < max)
+			matches[n] = &idx->ranges[i];
+		n++;
+	}
+	return n;
+}
+
+static const char* const toradex_modules[] = {
+	 [0] = "unknown module",
+	 [1] = "Colibri PXA270 312MHz",
+	 [2] = "Colibri PXA270 520MHz",
+	 [3] = "Colibri PXA320 806MHz",
+	 [4] = "Colibri PXA300 208MHz",
+	 [5] = "Colibri PXA310 624MHz",
+	 [6] = "Colibri PXA320 806MHz IT",
+	 [7] = "Colibri PXA300 208MHz XT",
+	 [8] = "Colibri PXA270 312MHz",
+	 [9] = "Colibri PXA270 520MHz",
+	[10] = "Colibri VF50 128MB", /* not currently on sale */
+	[11] = "Colibri VF61 256MB",
+	[12] = "Colibri VF61 256MB IT",
+	[13] = "Colibri VF50 128MB IT",
+	[14] = "Colibri iMX6 Solo 256MB",
+	[15] = "Colibri iMX6 DualLite 512MB",
+	[16] = "Colibri iMX6 Solo 256MB IT",
+	[17] = "Colibri iMX6 DualLite 512MB IT",
+	[18] = "unknown module",
+	[19] = "unknown module",
+	[20] = "Colibri T20 256MB",
+	[21] = "Colibri T20 512MB",
+	[22] = "Colibri T20 512MB IT",
+	[23] = "Colibri T30 1GB",
+	[24] = "Colibri T20 256MB IT",
+	[25] = "Apalis T30 2GB",
+	[26] = "Apalis T30 1GB",
+	[27] = "Apalis iMX6 Quad 1GB",
+	[28] = "Apalis iMX6 Quad 2GB IT",
+	[29] = "Apalis iMX6 Dual 512MB",
+	[30] = "Colibri T30 1GB IT",
+	[31] = "Apalis T30 1GB IT",
+	[32] = "Colibri iMX7 Solo 256MB",
+	[33] = "Colibri iMX7 Dual 512MB",
+	[34] = "Apalis TK1 2GB",
+	[35] = "Apalis iMX6 Dual 1GB IT",
+	[36] = "Colibri iMX6ULL 256MB",
+	[37] = "Apalis iMX8 QuadMax 4GB Wi-Fi / Bluetooth",
+	[38] = "Colibri iMX8X",
+	[39] = "Colibri iMX7 Dual 1GB (eMMC)",
+	[40] = "Colibri iMX6ULL 512MB Wi-Fi / Bluetooth IT",
+	[41] = "Colibri iMX7 Dual 512MB EPDC",
+	[42] = "Apalis TK1 4GB",
+};
+
+const char *trdx_module_name(uint16_t prodid)
+{
+	if (prodid >= ARRAY_SIZE(toradex_modules))
+		return toradex_modules[0];
+	return toradex_modules[prodid];
+}
+
+bool trdx_module_known(uint16_t prodid)
+{
+	return prodid < ARRAY_SIZE(toradex_modules) &&
+	       strcmp(toradex_modules[prodid], toradex_modules[0]) != 0;
+}
+
+int trdx_cfgblock_parse(const void *buf, size_t len, struct trdx_cfgblock *cb)
+{
+	const uint8_t *config_block = buf;
+	const struct toradex_tag *tag;
+	size_t tag_off;
+
+	memset(cb, 0, sizeof(*cb));
+
+	if (len > TRDX_CFG_BLOCK_MAX_SIZE)
+		len = TRDX_CFG_BLOCK_MAX_SIZE;
+	if (len < sizeof(*tag))
+		return APALIS_E_SHORT;
+
+	tag = (const struct toradex_tag *) config_block;
+	if (toradex_tag_flags(tag) != TAG_FLAG_VALID || toradex_tag_id(tag) != TAG_VALID)
+		return APALIS_E_CB_INVALID;
+	tag_off = sizeof(*tag);
+
+	while (tag_off + sizeof(*tag) <= len) {
+		const struct toradex_hw *hw;
+		size_t tag_len;
+		uint16_t id;
+
+		tag = (const struct toradex_tag *)(config_block + tag_off);
+		if (toradex_tag_flags(tag) != TAG_FLAG_VALID)
+			break;
+
+		id = toradex_tag_id(tag);
+		tag_off += sizeof(*tag);
+		tag_len = toradex_tag_len(tag) * 4;
+		if (tag_off + tag_len > len) {
+			cb->truncated = true;
+			cb->truncated_id = id;
+			break;
+		}
+
+		switch (id) {
+		case TAG_MAC:
+			memcpy(&cb->eth_addr, config_block + tag_off, sizeof(cb->eth_addr));
+			/* NIC part of MAC address is serial number */
+			cb->serial = ntohl(cb->eth_addr.nic) >> 8;
+			cb->has_mac = true;
+			break;
+		case TAG_HW:
+			hw = (const struct toradex_hw *)(config_block + tag_off);
+			cb->hw.ver_major = toradex_hw_ver_major(hw);
+			cb->hw.ver_minor = toradex_hw_ver_minor(hw);
+			cb->hw.ver_assembly = toradex_hw_ver_assembly(hw);
+			cb->hw.prodid = toradex_hw_prodid(hw);
+			cb->has_hw = true;
+			break;
+		default:
+			if (cb->num_unknown < TRDX_CB_MAX_UNKNOWN)
+				cb->unknown_ids[cb->num_unknown] = id;
+			cb->num_unknown++;
+			break;
+		}
+
+		tag_off += tag_len;
+	}
+
+	return APALIS_OK;
+}
+
+void trdx_cfgblock_mac(const struct trdx_cfgblock *cb, uint8_t *mac)
+{
+	mac[0] = (cb->eth_addr.oui & 0x0000ff) >> 0;
+	mac[1] = (cb->eth_addr.oui & 0x00ff00) >> 8;
+	mac[2] = (cb->eth_addr.oui & 0xff0000) >> 16;
+	mac[3] = (cb->eth_addr.nic & 0x0000ff) >> 0;
+	mac[4] = (cb->eth_addr.nic & 0x00ff00) >> 8;
+	mac[5] = (cb->eth_addr.nic & 0xff0000) >> 16;
+}
+
+void trdx_cfgblock_set_serial(struct trdx_cfgblock *cb, uint32_t serial)
+{
+	cb->eth_addr.oui = htonl(TRDX_OUI << 8);
+	cb->eth_addr.nic = htonl(serial << 8);
+	cb->serial = serial;
+	cb->has_mac = true;
+}
+
+static size_t trdx_put_tag(uint8_t *buf, size_t off, uint16_t id, const void *data, size_t len)
+{
+	size_t words = (len + 3) / 4;
+
+	apalis_put_le16(buf + off + offsetof(struct toradex_tag, len_flags),
+			TAG_FLAG_VALID << 14 | words);
+	apalis_put_le16(buf + off + offsetof(struct toradex_tag, id), id);
+	off += sizeof(struct toradex_tag);
+
+	if (len)
+		memcpy(buf + off, data, len);
+	return off + words * 4;
+}
+
+int trdx_cfgblock_build(const struct trdx_cfgblock *cb, void *buf, size_t len)
+{
+	uint8_t *config_block = buf;
+	size_t off = 0;
+
+	if (len < TRDX_CFG_BLOCK_MAX_SIZE)
+		return APALIS_E_SHORT;
+
+	memset(config_block, 0xff, TRDX_CFG_BLOCK_MAX_SIZE);
+	off = trdx_put_tag(config_block, off, TAG_VALID, NULL, 0);
+	if (cb->has_hw) {
+		uint8_t hw[sizeof(struct toradex_hw)];
+
+		apalis_put_le16(hw + offsetof(struct toradex_hw, ver_major), cb->hw.ver_major);
+		apalis_put_le16(hw + offsetof(struct toradex_hw, ver_minor), cb->hw.ver_minor);
+		apalis_put_le16(hw + offsetof(struct toradex_hw, ver_assembly), cb->hw.ver_assembly);
+		apalis_put_le16(hw + offsetof(struct toradex_hw, prodid), cb->hw.prodid);
+		off = trdx_put_tag(config_block, off, TAG_HW, hw, sizeof(hw));
+	}
+	if (cb->has_mac)
+		off = trdx_put_tag(config_block, off, TAG_MAC, &cb->eth_addr, sizeof(cb->eth_addr));
+
+	return APALIS_OK;
+}
@@ -0,0 +1,517 @@
+/*
+ * libapalis: parsers for the NVIDIA Tegra partition table, the GPT and the
+ * Toradex config block as found on the eMMC of Toradex Apalis/Colibri modules.
+ *
+ * All functions work on caller supplied buffers and fill caller owned structs,
+ * they never allocate memory nor print anything. Functions return APALIS_OK (0)
+ * on success or one of the APALIS_E_* error codes, apalis_strerror() returns a
+ * description of the error. Pointers in the result structs point into the
+ * buffers passed by the caller.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef LIBAPALIS_H
+#define LIBAPALIS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef __packed
+# define __packed	__attribute__((packed))
+#endif
+
+/*
+ * Field accessors for the on-disk structs below, which are all little endian
+ * and __packed (so they can be overlaid on a buffer at any offset). Each
+ * struct has one list of its integer fields and their width, from which
+ * struct_field(p) (e.g. nvtegra_partinfo_id(p)) is generated, returning the
+ * field in host byte order. The loads go through memcpy(), which compiles to
+ * a single load where the target allows unaligned access and to byte loads
+ * otherwise. The struct_field_a(p) variants are for p known to be aligned to
+ * APALIS_ALIGN bytes (see apalis_aligned()), where every field is loaded with
+ * a single instruction.
+ */
+#define APALIS_ALIGN	8
+
+static inline bool apalis_aligned(const void *p)
+{
+	return ((uintptr_t)p & (APALIS_ALIGN - 1)) == 0;
+}
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+# define apalis_le16(v)	__builtin_bswap16(v)
+# define apalis_le32(v)	__builtin_bswap32(v)
+# define apalis_le64(v)	__builtin_bswap64(v)
+#else
+# define apalis_le16(v)	(v)
+# define apalis_le32(v)	(v)
+# define apalis_le64(v)	(v)
+#endif
+
+#define APALIS_LOAD(bits)						\
+static inline uint##bits##_t apalis_get_le##bits(const void *p)	\
+{									\
+	uint##bits##_t v;						\
+									\
+	memcpy(&v, p, sizeof(v));					\
+	return apalis_le##bits(v);					\
+}									\
+static inline void apalis_put_le##bits(void *p, uint##bits##_t v)	\
+{									\
+	v = apalis_le##bits(v);						\
+	memcpy(p, &v, sizeof(v));					\
+}
+APALIS_LOAD(16)
+APALIS_LOAD(32)
+APALIS_LOAD(64)
+#undef APALIS_LOAD
+
+#define APALIS_FIELD_GETTERS(s, f, bits)					\
+static inline uint##bits##_t s##_##f(const struct s *p)			\
+{										\
+	return apalis_get_le##bits((const uint8_t *)p + offsetof(struct s, f));	\
+}										\
+static inline uint##bits##_t s##_##f##_a(const struct s *p)			\
+{										\
+	const uint8_t *base = __builtin_assume_aligned(p, APALIS_ALIGN);	\
+										\
+	return apalis_get_le##bits(base + offsetof(struct s, f));		\
+}
+
+enum apalis_error {
+	APALIS_OK = 0,
+	APALIS_E_SHORT,			/* buffer too short */
+	APALIS_E_PT_VERSION,		/* invalid partition table version */
+	APALIS_E_PT_BCT_ID,		/* invalid partition id in BCT */
+	APALIS_E_PT_BCT_NAME,		/* invalid name for BCT */
+	APALIS_E_PT_BCT_START,		/* BCT doesn't start at sector 0 */
+	APALIS_E_PT_PART_ID,		/* invalid partition id */
+	APALIS_E_PT_SIZE,		/* invalid partition table size */
+	APALIS_E_PT_COPY,		/* partition table copy differs */
+	APALIS_E_GPT_SIGNATURE,		/* invalid GPT signature */
+	APALIS_E_GPT_HDR_SIZE,		/* invalid GPT header size */
+	APALIS_E_GPT_HDR_CRC,		/* GPT header CRC mismatch */
+	APALIS_E_GPT_ENTRY_SIZE,	/* invalid GPT entry size or count */
+	APALIS_E_GPT_TABLE_CRC,		/* GPT table CRC mismatch */
+	APALIS_E_GPT_MISMATCH,		/* primary and backup GPT differ */
+	APALIS_E_CB_INVALID,		/* no valid config block */
+	APALIS_E_GPT_TABLE_SIZE,	/* GPT table larger than GPT_TABLE_MAX_SIZE */
+	APALIS_E_MAX,
+};
+
+const char *apalis_strerror(int err);
+
+/*
+ * NVIDIA Tegra partition table
+ */
+
+#define NVTEGRA_PT_SIZE		4096	/* partition table repeats after 0x1000 */
+#define NVTEGRA_PT_HDR_SIZE	72	/* header preceding the entries */
+#define NVTEGRA_PT_ENTRY_SIZE	80
+#define NVTEGRA_PT_MIN_READ	512	/* header and the first 5 entries */
+#define NVTEGRA_PT_MAX_SIZE	(1024 * 1024)	/* sanity limit */
+#define NVTEGRA_PT_VERSION	0x00000100
+#define NVTEGRA_BCT_ID		2
+#define NVTEGRA_MAX_PART_ID	128
+
+struct nvtegra_partinfo {
+	uint32_t	id;
+	char		name[4];
+	uint32_t	allocation_policy;
+	uint32_t	__unknown1;		/* 0x03000000 (some kind of version?) */
+	uint32_t	__unknown2;		/* 0x00000000 */
+	char		name2[4];
+	uint32_t	fs_type;		/* filesystem type */
+	uint32_t	__unknown3[3];		/* 0x00000000 */
+	uint32_t 	virt_start_sector;	/* virtual start sector */
+	uint32_t	__unknown4;
+	uint32_t 	virt_size;		/* virtual size */
+	uint32_t	__unknown5;
+	uint32_t	start_sector;
+	uint32_t	__unknown6;
+	uint32_t	end_sector;
+	uint32_t	__unknown7;
+	uint32_t	 type;
+	uint32_t 	__unknown8;
+} __packed;
+
+#define NVTEGRA_PARTINFO_FIELDS(F)				\
+	F(nvtegra_partinfo, id,			32)		\
+	F(nvtegra_partinfo, allocation_policy,	32)		\
+	F(nvtegra_partinfo, fs_type,		32)		\
+	F(nvtegra_partinfo, virt_start_sector,	32)		\
+	F(nvtegra_partinfo, virt_size,		32)		\
+	F(nvtegra_partinfo, start_sector,	32)		\
+	F(nvtegra_partinfo, end_sector,		32)		\
+	F(nvtegra_partinfo, type,		32)
+NVTEGRA_PARTINFO_FIELDS(APALIS_FIELD_GETTERS)
+
+struct nvtegra_ptable {
+	uint32_t	__unknown1;	/* 0x8b8d9e8 */
+	uint32_t	__unknown2;	/* 0xfffffff */
+	uint32_t	version;	/* always 0x00010000 */
+	uint32_t	table_size;	/* actual size of the partition table in bytes */
+	uint8_t		__unknown3[16];	/* looks like a signature or checksum */
+	uint8_t		__unknown4[16];	/* always zero? */
+	uint8_t		__unknown5[16];	/* copy (backup?) of the first 16 bytes */
+	uint32_t	num_parts;	/* number of partitions (TODO: is this really 32 bit?) */
+	uint8_t		__unknown6[4];	/* always zero? */
+	struct nvtegra_partinfo partitions[];	/* num_parts entries */
+} __packed;
+
+#define NVTEGRA_PTABLE_FIELDS(F)				\
+	F(nvtegra_ptable, version,		32)		\
+	F(nvtegra_ptable, table_size,		32)		\
+	F(nvtegra_ptable, num_parts,		32)
+NVTEGRA_PTABLE_FIELDS(APALIS_FIELD_GETTERS)
+
+struct nvtegra_ptable_info {
+	const struct nvtegra_ptable *pt;
+	size_t size;			/* bytes occupied by the table */
+	unsigned int num_parts;		/* number of valid partition entries */
+	const struct nvtegra_partinfo *gpt;	/* the GPT partition, or NULL */
+	uint32_t bad_id;		/* offending id for APALIS_E_PT_PART_ID */
+};
+
+/*
+ * Get the number of bytes occupied by the partition table whose header is in
+ * the len (at least NVTEGRA_PT_HDR_SIZE) bytes at buf: enough for num_parts
+ * entries, or table_size if that is larger. Callers read NVTEGRA_PT_MIN_READ
+ * bytes first and the rest of the table only if needed.
+ */
+int nvtegra_ptable_size(const void *buf, size_t len, size_t *size);
+
+/*
+ * Parse the partition table in the len bytes at buf, which must hold the whole
+ * table (see nvtegra_ptable_size()). The BCT entry is validated, then the
+ * entries are scanned up to the first one with an invalid id. In that case
+ * APALIS_E_PT_PART_ID is returned while info still describes the valid
+ * entries preceding it. info->pt is set as soon as the buffer holds the
+ * header.
+ */
+int nvtegra_ptable_parse(const void *buf, size_t len, struct nvtegra_ptable_info *info);
+
+/* Offset of the repeated copy of the parsed table, at the next 0x1000 boundary */
+static inline uint64_t nvtegra_ptable_copy_off(const struct nvtegra_ptable_info *info)
+{
+	return (info->size + NVTEGRA_PT_SIZE - 1) / NVTEGRA_PT_SIZE * NVTEGRA_PT_SIZE;
+}
+
+/* Compare the parsed table to its copy in the len bytes at copy */
+int nvtegra_ptable_compare_copy(const struct nvtegra_ptable_info *info, const void *copy,
+				size_t len);
+
+/*
+ * GUID partition table
+ */
+
+#define GPT_BLOCK_SIZE		512		/* GPT logical block size */
+#define GPT_DEFAULT_TABLE_SIZE	(128 * 128)	/* 128 entries of 128 bytes */
+#define GPT_TABLE_MAX_SIZE	(1024 * 1024)	/* larger tables are rejected */
+
+struct gpt_uuid {
+	uint32_t 	time_low;
+	uint16_t 	time_mid;
+	uint16_t 	time_hi_and_version;
+	uint8_t		clock_seq_hi_and_reserved;
+	uint8_t		clock_seq_low;
+	uint8_t		node[6];
+} __packed;
+
+struct gpt_header {
+	uint8_t		signature[8];	/* EFI PART */
+	uint32_t	version;
+	uint32_t	size;
+	uint32_t	crc_self;
+	uint32_t	__reserved;
+	uint64_t	lba_self;
+	uint64_t	lba_alt;
+	uint64_t	lba_start;
+	uint64_t	lba_end;
+	struct gpt_uuid	uuid;
+	uint64_t	lba_table;
+	uint32_t	num_entries;
+	uint32_t	entry_size;
+	uint32_t	crc_table;
+} __packed;
+
+#define GPT_HEADER_FIELDS(F)					\
+	F(gpt_header, version,			32)		\
+	F(gpt_header, size,			32)		\
+	F(gpt_header, crc_self,			32)		\
+	F(gpt_header, lba_self,			64)		\
+	F(gpt_header, lba_alt,			64)		\
+	F(gpt_header, lba_start,		64)		\
+	F(gpt_header, lba_end,			64)		\
+	F(gpt_header, lba_table,		64)		\
+	F(gpt_header, num_entries,		32)		\
+	F(gpt_header, entry_size,		32)		\
+	F(gpt_header, crc_table,		32)
+GPT_HEADER_FIELDS(APALIS_FIELD_GETTERS)
+
+struct gpt_entry {
+	struct gpt_uuid	type;
+	struct gpt_uuid	uuid;
+	uint64_t	lba_start;
+	uint64_t	lba_end;
+	uint64_t	attr;
+	uint16_t	name[36];
+} __packed;
+
+#define GPT_ENTRY_FIELDS(F)					\
+	F(gpt_entry, lba_start,			64)		\
+	F(gpt_entry, lba_end,			64)		\
+	F(gpt_entry, attr,			64)
+GPT_ENTRY_FIELDS(APALIS_FIELD_GETTERS)
+
+/* A parsed GPT, all fields in host byte order */
+struct gpt_info {
+	const struct gpt_header *hdr;
+	const uint8_t *table;		/* set once the table is validated */
+	uint32_t hdr_size;
+	uint32_t num_entries;
+	uint32_t entry_size;
+	uint64_t lba_table;
+	size_t table_size;		/* num_entries * entry_size */
+	uint32_t crc_stored;		/* for APALIS_E_GPT_*_CRC */
+	uint32_t crc_calc;
+};
+
+/*
+ * Validate the GPT header in the len bytes at buf. dev_size is the size of
+ * the device, used to bound the table size along with GPT_TABLE_MAX_SIZE. On success info is filled in,
+ * except for info->table.
+ */
+int gpt_header_parse(const void *buf, size_t len, uint64_t dev_size, struct gpt_info *info);
+
+/*
+ * Validate the table (at least info->table_size bytes at table) described by
+ * the header parsed into info, and set info->table on success.
+ */
+int gpt_table_parse(struct gpt_info *info, const void *table, size_t len);
+
+/* Both of the above, for callers which have the header and table at hand */
+int gpt_parse(const void *hdr, size_t hdr_len, const void *table, size_t table_len,
+	      uint64_t dev_size, struct gpt_info *info);
+
+static inline const struct gpt_entry *gpt_entry_get(const struct gpt_info *info, unsigned int i)
+{
+	return (const struct gpt_entry *)(info->table + (size_t)i * info->entry_size);
+}
+
+/* Number of 64-bit words of a bitmap with a bit for each of n GPT entries */
+#define GPT_BITMAP_WORDS(n)	(((size_t)(n) + 63) / 64)
+
+/*
+ * Set the bit of every GPT entry with a non-zero type GUID (i.e. which is in
+ * use) in the GPT_BITMAP_WORDS(info->num_entries) words at used, clear the
+ * others. Returns the number of entries in use.
+ */
+unsigned int gpt_used_entries(const struct gpt_info *info, uint64_t *used);
+
+static inline bool gpt_entry_used(const uint64_t *used, unsigned int i)
+{
+	return used[i / 64] & (1ULL << (i % 64));
+}
+
+/* Index of the first entry at or after i set in used (of n entries), or n */
+static inline unsigned int gpt_next_used(const uint64_t *used, unsigned int n, unsigned int i)
+{
+	while (i < n) {
+		uint64_t w = used[i / 64] >> (i % 64);
+
+		if (w)
+			return i + __builtin_ctzll(w) < n ? i + __builtin_ctzll(w) : n;
+		i = (i / 64 + 1) * 64;
+	}
+	return n;
+}
+
+/* Maximum length of a GPT entry name in UTF-8, excluding the terminating '\0' */
+#define GPT_NAME_STR_LEN	(3 * 36)
+
+/*
+ * Convert the UTF-16LE name of GPT entry e to a '\0' terminated UTF-8 string in
+ * the len bytes at str, independent of the locale. Unpaired surrogates are
+ * replaced by U+FFFD, the name is truncated at the first character which
+ * doesn't fit.
+ */
+void gpt_entry_name(const struct gpt_entry *e, char *str, size_t len);
+
+/* Aspects in which a primary and backup GPT can differ, see gpt_compare() */
+enum {
+	GPT_DIFF_LOCATION	= 1 << 0,	/* header locations */
+	GPT_DIFF_LBA_RANGE	= 1 << 1,	/* usable LBA range */
+	GPT_DIFF_DISK_GUID	= 1 << 2,
+	GPT_DIFF_ENTRY_LAYOUT	= 1 << 3,	/* number or size of entries */
+	GPT_DIFF_ENTRIES	= 1 << 4,	/* partition entries */
+	GPT_DIFF_MAX		= 1 << 5,
+};
+
+const char *gpt_diff_str(unsigned int diff_bit);
+
+/*
+ * Cross-check the primary and backup GPT (both with parsed tables), they should
+ * describe the same layout. Returns APALIS_E_GPT_MISMATCH and sets the
+ * GPT_DIFF_* bits in *diff (if not NULL) if they don't.
+ */
+int gpt_compare(const struct gpt_info *prim, const struct gpt_info *back, unsigned int *diff);
+
+/*
+ * LBA resolver: a sorted interval index over the PT and GPT partitions, to
+ * map sector numbers (e.g. from I/O errors in kernel logs) to partitions.
+ * Sectors are taken in the units of the table they come from.
+ */
+
+enum lba_source {
+	LBA_SRC_PT,		/* start_sector..end_sector of a PT entry */
+	LBA_SRC_PT_VIRT,	/* virt_start_sector and virt_size of a PT entry */
+	LBA_SRC_GPT,		/* lba_start..lba_end of a used GPT entry */
+};
+
+struct lba_range {
+	uint64_t	start;
+	uint64_t	end;		/* inclusive */
+	uint64_t	max_end;	/* largest end of this and all preceding ranges */
+	uint32_t	index;		/* of the entry in the PT or GPT */
+	uint32_t	source;		/* enum lba_source */
+};
+
+struct lba_index {
+	struct lba_range *ranges;	/* sorted by start */
+	unsigned int	num;
+	unsigned int	hint;		/* position found by the last lookup */
+};
+
+/* Number of ranges lba_index_build() needs at most */
+#define LBA_INDEX_MAX_RANGES(num_parts, num_gpt_entries) \
+	(2 * (size_t)(num_parts) + (size_t)(num_gpt_entries))
+
+/*
+ * Build the index over the num_parts entries of pt and the used entries of
+ * gpt (either may be NULL) in the len ranges at ranges. Empty ranges are
+ * left out.
+ */
+int lba_index_build(struct lba_index *idx, struct lba_range *ranges, size_t len,
+		    const struct nvtegra_ptable *pt, unsigned int num_parts,
+		    const struct gpt_info *gpt);
+
+/*
+ * Find the ranges containing lba, the one starting last (i.e. the innermost
+ * partition) first. Up to max of them are stored at matches, the total
+ * number is returned. The search gallops from the position of the previous
+ * lookup, so ascending or clustered LBAs are found in a few steps.
+ */
+unsigned int lba_index_lookup(struct lba_index *idx, uint64_t lba,
+			      const struct lba_range **matches, unsigned int max);
+
+/*
+ * Toradex config block
+ */
+
+#define TRDX_CFG_BLOCK_MAX_SIZE	512
+
+/* Offset in the 1st eMMC boot area partition, from its end (BSP >= v2.3) */
+#define TRDX_CFG_EMMC_BOOT_OFF	(-512)
+/* Sector of the 'ARG' partition on the eMMC (pre v2.3 BSPs) */
+#define TRDX_CFG_ARG_PART_SECTOR	0x00000c00
+#define TRDX_CFG_SECTOR_SIZE	4096
+#define TRDX_CFG_ARG_PART_OFF	((int64_t)TRDX_CFG_ARG_PART_SECTOR * TRDX_CFG_SECTOR_SIZE)
+/* Offset in the 1st MTD partition of NAND based modules */
+#define TRDX_CFG_NAND_OFF	0x800
+
+struct toradex_tag {
+	uint16_t	len_flags;	/* length in 32-bit words (14 bits), flags (2 bits) */
+	uint16_t	id;
+} __packed;
+
+#define TORADEX_TAG_FIELDS(F)					\
+	F(toradex_tag, len_flags,		16)		\
+	F(toradex_tag, id,			16)
+TORADEX_TAG_FIELDS(APALIS_FIELD_GETTERS)
+
+static inline unsigned int toradex_tag_len(const struct toradex_tag *tag)
+{
+	return toradex_tag_len_flags(tag) & 0x3fff;
+}
+
+static inline unsigned int toradex_tag_flags(const struct toradex_tag *tag)
+{
+	return toradex_tag_len_flags(tag) >> 14;
+}
+
+#define TAG_VALID	0xcf01
+#define TAG_MAC		0x0000
+#define TAG_HW		0x0008
+#define TAG_FLAG_VALID	0x1
+
+/* In struct trdx_cfgblock, the fields are in host byte order */
+struct toradex_hw {
+	uint16_t ver_major;
+	uint16_t ver_minor;
+	uint16_t ver_assembly;
+	uint16_t prodid;
+} __packed;
+
+#define TORADEX_HW_FIELDS(F)					\
+	F(toradex_hw, ver_major,		16)		\
+	F(toradex_hw, ver_minor,		16)		\
+	F(toradex_hw, ver_assembly,		16)		\
+	F(toradex_hw, prodid,			16)
+TORADEX_HW_FIELDS(APALIS_FIELD_GETTERS)
+
+struct toradex_eth_addr {
+	uint32_t oui:24;
+	uint32_t nic:24;
+} __packed;
+
+#define TRDX_CB_MAX_UNKNOWN	8
+
+struct trdx_cfgblock {
+	uint32_t		serial;
+	struct toradex_hw	hw;
+	struct toradex_eth_addr	eth_addr;
+	bool			has_hw;
+	bool			has_mac;
+	bool			truncated;	/* tag truncated_id exceeds the block */
+	uint16_t		truncated_id;
+	/* ids of tags which were skipped, the first TRDX_CB_MAX_UNKNOWN are kept */
+	unsigned int		num_unknown;
+	uint16_t		unknown_ids[TRDX_CB_MAX_UNKNOWN];
+};
+
+/*
+ * Parse the config block in the len bytes at buf (at most
+ * TRDX_CFG_BLOCK_MAX_SIZE are looked at). Tags are decoded until the first one
+ * not marked valid.
+ */
+int trdx_cfgblock_parse(const void *buf, size_t len, struct trdx_cfgblock *cb);
+
+/* Name of module with product id prodid, "unknown module" if not known */
+const char *trdx_module_name(uint16_t prodid);
+
+/* Whether prodid is the product id of a known module */
+bool trdx_module_known(uint16_t prodid);
+
+/* Get the 6 byte MAC address from a parsed config block */
+void trdx_cfgblock_mac(const struct trdx_cfgblock *cb, uint8_t *mac);
+
+#define TRDX_OUI		0x00142d	/* Toradex OUI, the NIC part is the serial */
+#define TRDX_SERIAL_MAX		0xffffff
+
+/* Set the serial number and the MAC address derived from it */
+void trdx_cfgblock_set_serial(struct trdx_cfgblock *cb, uint32_t serial);
+
+/*
+ * Build the config block described by cb (its TAG_HW and TAG_MAC tags, if
+ * present) into the TRDX_CFG_BLOCK_MAX_SIZE bytes at buf. Unused space is
+ * filled with 0xff, like erased flash.
+ */
+int trdx_cfgblock_build(const struct trdx_cfgblock *cb, void *buf, size_t len);
+
+#endif /* LIBAPALIS_H */
@@ -15,482 +15,1843 @@
 
 #define _BSD_SOURCE
 #define _LARGEFILE64_SOURCE
-#include <byteswap.h>
-#include <ctype.h>
 #include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <glob.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <uchar.h>
 #include <unistd.h>
-#include <wchar.h>
+
+#include <pthread.h>
 
 #include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/types.h>
 
-#define __packed	__attribute__((packed))
+#include "extract.h"
+#include "image.h"
+#include "json.h"
+#include "layout.h"
+#include "libapalis.h"
+#include "outbuf.h"
+#include "record.h"
+#include "resolve.h"
+#include "ring.h"
+#include "stats.h"
+#include "text.h"
+#include "tool.h"
+#include "verify.h"
 
 #define VERSION		0x00010000
-#define MAX_NUM_PARTS	24	/* Could there be more in principle? In reality
-				   this should be sufficient */
-#define MAX_SIZE	4096	/* partition table repeats after 0x1000 */
-
-#define PT_VERSION	0x00000100
-#define BCT_ID		2
-
-#define GPT_BLOCK_SIZE	512	/* GPT logical block size */
-
-static const uint8_t PT_BCT_NAME[4] = { 'B', 'C', 'T', '\0' };
-static const uint8_t PT_GPT_NAME[4] = { 'G', 'P', 'T', '\0' };
-
-static const uint8_t GPT_SIGNATURE[8] = { 'E', 'F', 'I', ' ', 'P', 'A', 'R', 'T' };
-
-#define err(fmt, args...)	fprintf(stderr, "Error: " fmt, ##args)
-
-struct nvtegra_partinfo {
-	uint32_t	id;
-	char		name[4];
-	uint32_t	allocation_policy;
-	uint32_t	__unknown1;		/* 0x03000000 (some kind of version?) */
-	uint32_t	__unknown2;		/* 0x00000000 */
-	char		name2[4];
-	uint32_t	fs_type;		/* filesystem type */
-	uint32_t	__unknown3[3];		/* 0x00000000 */
-	uint32_t 	virt_start_sector;	/* virtual start sector */
-	uint32_t	__unknown4;
-	uint32_t 	virt_size;		/* virtual size */
-	uint32_t	__unknown5;
-	uint32_t	start_sector;
-	uint32_t	__unknown6;
-	uint32_t	end_sector;
-	uint32_t	__unknown7;
-	uint32_t	 type;
-	uint32_t 	__unknown8;
-} __packed;
-
-struct nvtegra_ptable {
-	uint32_t	__unknown1;	/* 0x8b8d9e8 */
-	uint32_t	__unknown2;	/* 0xfffffff */
-	uint32_t	version;	/* always 0x00010000 */
-	uint32_t	table_size;	/* actual size of the partition table in bytes */
-	uint8_t		__unknown3[16];	/* looks like a signature or checksum */
-	uint8_t		__unknown4[16];	/* always zero? */
-	uint8_t		__unknown5[16];	/* copy (backup?) of the first 16 bytes */
-	uint32_t	num_parts;	/* number of partitions (TODO: is this really 32 bit?) */
-	uint8_t		__unknown6[4];	/* always zero? */
-	struct nvtegra_partinfo partitions[MAX_NUM_PARTS];
-} __packed;
-
-typedef struct {
-	uint32_t 	time_low;
-	uint16_t 	time_mid;
-	uint16_t 	time_hi_and_version;
-	uint8_t		clock_seq_hi_and_reserved;
-	uint8_t		clock_seq_low;
-	uint8_t		node[6];
-} __packed uuid_t;
-
-struct gpt_header {
-	uint8_t		signature[8];	/* EFI PART */
-	uint32_t	version;
-	uint32_t	size;
-	uint32_t	crc_self;
-	uint32_t	__reserved;
-	uint64_t	lba_self;
-	uint64_t	lba_alt;
-	uint64_t	lba_start;
-	uint64_t	lba_end;
-	uuid_t		uuid;
-	uint64_t	lba_table;
-	uint32_t	num_entries;
-	uint32_t	entry_size;
-	uint32_t	crc_table;
-} __packed;
-
-struct gpt_entry {
-	uuid_t		type;
-	uuid_t		uuid;
-	uint64_t	lba_start;
-	uint64_t	lba_end;
-	uint64_t	attr;
-	uint16_t	name[36];
-} __packed;
-
-static const char *short_opts = "hv";
+
+#define OPT_STATS	0x100
+#define OPT_VERIFY	0x101
+#define OPT_EXTRACT	0x102
+#define OPT_EXTRACT_FMT	0x103
+#define OPT_SKIP_ZERO	0x104
+#define OPT_INDEX	0x105
+#define OPT_COMPARE	0x106
+#define OPT_ALL		0x107
+#define OPT_RESOLVE	0x108
+
+static const char *short_opts = "bcDf:j:uqrhvz";
 static const struct option long_opts[] = {
+	{ "format",	required_argument,	NULL,	'f' },
+	{ "check-gpt",	no_argument,	NULL,	'c' },
+	{ "check-copy",	no_argument,	NULL,	'r' },
+	{ "direct",	no_argument,	NULL,	'D' },
+	{ "batch",	no_argument,	NULL,	'b' },
+	{ "jobs",	required_argument,	NULL,	'j' },
+	{ "unordered",	no_argument,	NULL,	'u' },
+	{ "quiet",	no_argument,	NULL,	'q' },
 	{ "help",	no_argument,	NULL,	'h' },
 	{ "verbose",	no_argument,	NULL,	'v' },
+	{ "nonzero",	no_argument,	NULL,	'z' },
+	{ "all",	no_argument,	NULL,	OPT_ALL },
+	{ "stats",	optional_argument,	NULL,	OPT_STATS },
+	{ "verify",	required_argument,	NULL,	OPT_VERIFY },
+	{ "extract",	required_argument,	NULL,	OPT_EXTRACT },
+	{ "extract-format", required_argument,	NULL,	OPT_EXTRACT_FMT },
+	{ "skip-zero",	no_argument,	NULL,	OPT_SKIP_ZERO },
+	{ "index",	required_argument,	NULL,	OPT_INDEX },
+	{ "compare",	required_argument,	NULL,	OPT_COMPARE },
+	{ "resolve",	no_argument,	NULL,	OPT_RESOLVE },
 	{ NULL, 	0,		NULL, 	0 }
 };
 
-static void usage_and_exit(int ret)
+static void __attribute__((noreturn)) usage_and_exit(int ret)
 {
 	printf("Usage: nvtegraparts [OPTIONS...] [BOOTDEV [GPTDEV]]\n"
+	       "       nvtegraparts -b [OPTIONS...] [INPUT...]\n"
 	       "\n"
 	       "Options:\n"
+	       "  -b, --batch    Batch mode, probe all INPUTs in one process\n"
+	       "  -j, --jobs N   Read and parse N INPUTs in parallel (0: one per CPU),\n"
+	       "                 implies --batch\n"
+	       "  -u, --unordered  Write results as they complete, not in input order\n"
+	       "  -c, --check-gpt  Also verify the primary GPT and cross-check it with the backup\n"
+	       "  -r, --check-copy  Also verify the copy of the PT repeated after 0x1000\n"
+	       "  -D, --direct   Read with O_DIRECT, bypassing the page cache\n"
+	       "      --verify MANIFEST  Verify the contents of the GPT partitions against\n"
+	       "                 the SHA-256 hashes in MANIFEST (sha256sum format, one\n"
+	       "                 partition name per line). -j N hashes N partitions in\n"
+	       "                 parallel and doesn't imply --batch here\n"
+	       "      --extract FILE  Copy the GPT and the allocated GPT partitions of GPTDEV\n"
+	       "                 to FILE, leaving out everything else\n"
+	       "      --extract-format FMT  raw (default, a sparse file with the same\n"
+	       "                 layout as GPTDEV) or android (Android sparse image)\n"
+	       "      --skip-zero  With --extract, also leave out blocks which are all zero\n"
+	       "      --index FILE  Add the layout (PT and GPT) fingerprints of the probed\n"
+	       "                 inputs to the index FILE\n"
+	       "      --compare KEY  With --index, don't probe but compare the layouts of all\n"
+	       "                 units in the index to the one of input KEY\n"
+	       "      --resolve  Read LBAs (or kernel log lines with \"sector N\") from\n"
+	       "                 stdin and print the PT and GPT partitions containing them\n"
+	       "  -f, --format FMT  Output format: text (default), json (one object per\n"
+	       "                 input) or binary (fixed-layout records, see record.h)\n"
+	       "  -q, --quiet    Only validate, don't print the partition tables\n"
 	       "  -v, --verbose  Verbose mode (show hexdump of partition tables)\n"
-	       "  -h, --help     Show this message and exit\n");
+	       "  -z, --nonzero  With -v, only dump GPT entries which are not all zero\n"
+	       "      --all      Also print the unused GPT entries (with a zero type GUID)\n"
+	       "      --stats[=FMT]  Print per-stage timings and I/O counters to stderr\n"
+	       "                 as text (default) or json, needs a build with STATS=1\n"
+	       "  -h, --help     Show this message and exit\n"
+	       "\n"
+	       "In batch mode each INPUT is BOOTDEV[,GPTDEV] or a glob pattern matching\n"
+	       "BOOTDEVs. If INPUT is omitted or -, the inputs are read from stdin, one per line.\n");
 	exit(ret);
 }
 
-static void nvtegra_partition_print(unsigned int n, const struct nvtegra_partinfo *p)
+/* Check whether all len bytes at buf are zero */
+static bool mem_is_zero(const void *buf, size_t len)
 {
-	printf("  #%02u id=%02u [%-3.3s] policy=%u fs=%u virt=0x%08x+0x%08x sectors=0x%08x-0x%08x type=%u\n",
-	       n, p->id, p->name, p->allocation_policy, p->fs_type,
-	       p->virt_start_sector, p->virt_size,
-	       p->start_sector, p->end_sector, p->type);
+	const uint8_t *p = buf;
+
+	return len == 0 || (p[0] == 0 && memcmp(p, p + 1, len - 1) == 0);
 }
 
-static void c16_to_string(char16_t *buf, char *str, size_t len)
-{
-	mbstate_t mbs;
-	char mbbuf[MB_CUR_MAX];
-	size_t pos = 0;
+/* -j is limited to this many jobs per CPU */
+#define JOBS_PER_CPU	4
+
+#define probe_err(pr, fmt, args...)	outbuf_printf(&(pr)->errs, "Error: " fmt, ##args)
 
-	mbrlen(NULL, 0, &mbs);
+enum output_format {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+	FORMAT_BINARY,
+};
 
-	while (buf) {
-		size_t ret, i;
+/* Layout index shared by all probes */
+struct probe_index {
+	struct layout_index	idx;
+	pthread_mutex_t		lock;
+};
 
-		ret = c16rtomb(mbbuf, *buf, &mbs);
-		if (ret == 0 || ret > MB_CUR_MAX)
-			break;
-		for (i = 0; i < ret && pos < len - 1; i++, pos++) {
-			str[pos] = mbbuf[i];
-		}
-		if (pos >= len - 1)
-			break;
-		buf++;
+struct probe_buf {
+	char *data;
+	size_t size;
+};
+
+enum {
+	GPT_BUF_BACKUP,		/* device tail: backup header and usually its table */
+	GPT_BUF_BACKUP_TABLE,	/* backup table if not adjacent to its header */
+	GPT_BUF_PRIMARY,	/* LBA 1: primary header and usually its table */
+	GPT_BUF_PRIMARY_TABLE,	/* primary table if not adjacent to its header */
+	GPT_BUF_MAX,
+};
+
+/*
+ * Probing state, one per batch job. Everything needed on the hot path is owned
+ * by the probe so that several of them can run in parallel without sharing
+ * anything. Output is staged in out/errs and only written by the caller.
+ */
+struct probe {
+	struct probe_buf pt_buf;	/* PT buffer, grown to the table size as needed */
+	struct probe_buf pt_copy_buf;	/* for the repeated copy of the PT */
+	struct probe_buf gpt_buf[GPT_BUF_MAX];	/* GPT buffers, grown as needed */
+	char *input;		/* current batch input, BOOTDEV[,GPTDEV] */
+	size_t input_size;
+	struct outbuf out;	/* staged stdout output */
+	struct outbuf errs;	/* staged stderr output */
+	struct image_io *io;	/* of the thread running the probe */
+	bool verbose;
+	bool dump_nonzero;	/* only dump GPT entries which are not all zero */
+	bool all_entries;	/* also print unused GPT entries */
+	bool quiet;		/* only validate, don't print the tables */
+	bool check_gpt;		/* also verify the primary GPT and cross-check */
+	bool check_copy;	/* also verify the repeated copy of the PT */
+	unsigned int image_flags;	/* flags for image_open_flags() */
+	const struct verify_manifest *manifest;	/* --verify, or NULL */
+	unsigned int verify_jobs;	/* partitions hashed in parallel */
+	const char *extract_path;	/* --extract, or NULL */
+	struct probe_index *index;	/* --index, or NULL */
+	bool resolve;		/* --resolve */
+	enum extract_format extract_format;
+	unsigned int extract_flags;
+	enum output_format format;
+	/*
+	 * Results of the last probe_finish() call, the pointers are only valid
+	 * until it returns.
+	 */
+	const struct nvtegra_ptable *pt;
+	unsigned int num_parts;
+	const struct gpt_info *gpt;	/* the (backup) GPT, if found */
+	unsigned int num_gpt_entries;
+	uint64_t *gpt_used;	/* bitmap of the used GPT entries */
+	size_t gpt_used_words;	/* allocated size of gpt_used */
+	unsigned int num_gpt_used;
+	bool gpt_found;
+	bool gpt_checked;
+};
+
+/* Next GPT entry at or after i to print, all of them with --all */
+static unsigned int probe_next_entry(const struct probe *pr, unsigned int i)
+{
+	if (pr->all_entries)
+		return i;
+	return gpt_next_used(pr->gpt_used, pr->num_gpt_entries, i);
+}
+
+static int probe_buf_reserve(struct probe_buf *pb, size_t len)
+{
+	if (len > pb->size) {
+		char *new_data = realloc(pb->data, len);
+		if (!new_data)
+			return -1;
+		pb->data = new_data;
+		pb->size = len;
 	}
-	str[pos] = '\0';
+	return 0;
 }
 
-static void le_uuid_dec(const void *buf, uuid_t *uuid)
+/*
+ * Get request r for len bytes at off ready, using GPT buffer idx as the
+ * destination. Mapped images are read in place and need no buffer.
+ */
+static int probe_gpt_req(struct probe *pr, struct image *img, unsigned int idx,
+			 struct image_req *r, uint64_t off, size_t len)
 {
-	*((uint32_t *)uuid + 0) = bswap_32(*((const uint32_t *)buf + 0));
-	*((uint16_t *)uuid + 2) = bswap_16(*((const uint16_t *)buf + 2));
-	*((uint16_t *)uuid + 3) = bswap_16(*((const uint16_t *)buf + 3));
-	*((uint64_t *)uuid + 1) = 	  (*((const uint64_t *)buf + 1));
+	struct probe_buf *pb = &pr->gpt_buf[idx];
+
+	r->img = img;
+	r->off = off;
+	r->len = len;
+	r->buf = NULL;
+
+	if (img->map)
+		return 0;
+
+	if (probe_buf_reserve(pb, len) != 0)
+		return -1;
+
+	r->buf = pb->data;
+	return 0;
 }
 
-#define UUID_FMT 	"%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x"
-#define UUID_ARGS(u)	u.time_low, u.time_mid, u.time_hi_and_version, \
-			u.clock_seq_hi_and_reserved, u.clock_seq_low, \
-			u.node[0], u.node[1], u.node[2], u.node[3], \
-			u.node[4], u.node[5]
+/* One copy (primary or backup) of the GPT */
+struct gpt_copy {
+	const char *prefix;		/* for error messages */
+	const uint8_t *region;		/* data read around the header */
+	uint64_t region_off;
+	size_t region_len;
+	uint64_t hdr_off;
+	struct gpt_info info;
+	const uint8_t *table;		/* table data, once read */
+	uint64_t table_off;
+	size_t table_count;		/* table_size rounded up to full sectors */
+};
+
+static int gpt_check_header(struct probe *pr, const struct image *img, struct gpt_copy *g)
+{
+	const uint8_t *hdr = g->region + (g->hdr_off - g->region_off);
+	struct gpt_info *info = &g->info;
+	uint64_t t;
+	int ret;
+
+	t = stats_start();
+	ret = gpt_header_parse(hdr, g->region_len - (g->hdr_off - g->region_off), img->size, info);
+	stats_stop(STATS_CRC, t, 0, ret == APALIS_OK ? info->hdr_size : 0);
+	switch (ret) {
+	case APALIS_OK:
+		return 0;
+	case APALIS_E_GPT_SIGNATURE:
+		probe_err(pr, "Invalid %sGPT signature\n", g->prefix);
+		break;
+	case APALIS_E_GPT_HDR_SIZE:
+		probe_err(pr, "Invalid %sGPT header size %u\n", g->prefix, info->hdr_size);
+		break;
+	case APALIS_E_GPT_HDR_CRC:
+		probe_err(pr, "Invalid %sGPT header CRC 0x%04x, calculated 0x%04x\n",
+			  g->prefix, info->crc_stored, info->crc_calc);
+		break;
+	case APALIS_E_GPT_ENTRY_SIZE:
+		probe_err(pr, "Invalid %sGPT entry size %u\n", g->prefix, info->entry_size);
+		break;
+	case APALIS_E_GPT_TABLE_SIZE:
+		probe_err(pr, "%sGPT table of %u entries of %u bytes too large\n", g->prefix,
+			  info->num_entries, info->entry_size);
+		break;
+	default:
+		probe_err(pr, "%s (%sGPT)\n", apalis_strerror(ret), g->prefix);
+		break;
+	}
+	return -1;
+}
 
-static void gpt_partition_print(unsigned int n, const struct gpt_entry *e)
+/*
+ * Locate the table of GPT copy g. If it lies within the data already read
+ * around the header, point to it and return 0. Otherwise set up request r
+ * for it and return 1.
+ */
+static int gpt_locate_table(struct probe *pr, struct image *img, struct gpt_copy *g,
+			    int sector_size, unsigned int idx, struct image_req *r)
 {
-	char name[20];
-	uuid_t type, uuid;
-	uint64_t start = le64toh(e->lba_start);
-	uint64_t size = le64toh(e->lba_end) - start + 1;
+	size_t blocks, table_size = g->info.table_size;
 
-	c16_to_string((char16_t *)e->name, name, sizeof(name));
-	le_uuid_dec(&e->type, &type);
-	le_uuid_dec(&e->uuid, &uuid);
+	blocks = table_size / sector_size + ((table_size % sector_size) ? 1 : 0);
+	g->table_count = blocks * sector_size;
+	g->table_off = g->info.lba_table * sector_size;
 
-	printf("  #%02u name=%s type=" UUID_FMT " uuid=" UUID_FMT " attr=0x%" PRIx64 " start=0x%" PRIx64 " size=%" PRIu64 "\n",
-	       n, name, UUID_ARGS(type), UUID_ARGS(uuid), le64toh(e->attr), start, size);
+	if (g->table_off >= g->region_off &&
+	    g->table_off + g->table_count <= g->region_off + g->region_len) {
+		g->table = g->region + (g->table_off - g->region_off);
+		return 0;
+	}
+
+	if (probe_gpt_req(pr, img, idx, r, g->table_off, g->table_count) != 0) {
+		probe_err(pr, "Failed to allocate memory\n");
+		return -1;
+	}
+	return 1;
 }
 
-static void hexdump(const uint8_t *buf, size_t len)
+static int gpt_check_table(struct probe *pr, struct gpt_copy *g)
 {
-	unsigned int i, j;
+	uint64_t t = stats_start();
+	int ret;
+
+	ret = gpt_table_parse(&g->info, g->table, g->table_count);
+	stats_stop(STATS_CRC, t, 0, g->info.table_size);
+	if (ret != APALIS_OK) {
+		probe_err(pr, "Invalid %sGPT table CRC 0x%04x, calculated 0x%04x\n",
+			  g->prefix, g->info.crc_stored, g->info.crc_calc);
+		return -1;
+	}
 
-	for (i = 0, j = 0; i < len; i++) {
-		if ((i & 0x0F) == 0)
-			printf("%08x", i);
-		if ((i & 0x07) == 0)
-			printf(" ");
-		printf(" %02x", buf[i]);
+	return 0;
+}
 
-		if ((i & 0x0F) == 0x0F) {
-			printf("  |");
-			for ( ; j <= i; j++) {
-				uint8_t c = buf[j];
-				if (!isprint(c)) {
-					c = '.';
-				}
-				printf("%c", c);
-			}
-			printf("|\n");
-		}
-	}
+/* Cross-check the primary and backup GPT, they should describe the same layout */
+static int gpt_cross_check(struct probe *pr, const struct gpt_copy *prim,
+			   const struct gpt_copy *back)
+{
+	unsigned int diff, bit;
+
+	if (gpt_compare(&prim->info, &back->info, &diff) == APALIS_OK)
+		return 0;
+
+	for (bit = 1; bit < GPT_DIFF_MAX; bit <<= 1)
+		if (diff & bit)
+			probe_err(pr, "Primary and backup GPT differ: %s\n", gpt_diff_str(bit));
+	return -1;
 }
 
-static const uint32_t crc32_tab[] = {
-	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-	0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-	0xf3b97148, 0x84be41de,	0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec,	0x14015c4f, 0x63066cd9,
-	0xfa0f3d63, 0x8d080df5,	0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,	0x35b5a8fa, 0x42b2986c,
-	0xdbbbc9d6, 0xacbcf940,	0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-	0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,	0x76dc4190, 0x01db7106,
-	0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-	0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-	0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-	0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-	0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-	0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-	0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-	0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-	0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-	0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-	0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-	0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-	0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-	0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-	0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-	0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+/* State of a GPT probe between gpt_plan() and probe_gpt() */
+struct gpt_probe {
+	struct image img;
+	bool opened;
+	enum {
+		GPT_PLAN_OK,
+		GPT_PLAN_OPEN,		/* failed to open, errno in plan_errno */
+		GPT_PLAN_SIZE,		/* too small to hold a GPT */
+		GPT_PLAN_PRIMARY,	/* too small to hold the primary GPT */
+		GPT_PLAN_NOMEM,
+	} plan_err;
+	int plan_errno;
+	int sector_size;
+	bool sector_size_guessed;
+	struct gpt_copy back, prim;
 };
 
-static uint32_t crc32(const void *buf, size_t len)
+/*
+ * Open gpt_dev and set up the requests for the first batch of GPT reads in
+ * reqs, so they can be submitted along with other reads. Since the tables
+ * usually directly precede (backup) or follow (primary) their header, a
+ * default sized table is read along with each header. The backup GPT header
+ * in the last sector is always read, the primary one at LBA 1 only if
+ * pr->check_gpt is set. Returns the number of requests (0 on error, which is
+ * reported by probe_gpt()).
+ */
+static unsigned int gpt_plan(struct probe *pr, struct gpt_probe *gp, const char *gpt_dev,
+			     struct image_req *reqs)
 {
-	const uint8_t *p = buf;
-	uint32_t crc = ~0U;
+	struct gpt_copy *back = &gp->back, *prim = &gp->prim;
+	struct image *img = &gp->img;
+	unsigned int n = 0;
+	size_t spec_len;
+	uint64_t t;
+	int ret;
+
+	memset(gp, 0, sizeof(*gp));
+	back->prefix = "";
+	prim->prefix = "primary ";
+
+	if (image_open_flags(img, gpt_dev, pr->image_flags) != 0) {
+		gp->plan_err = GPT_PLAN_OPEN;
+		gp->plan_errno = errno;
+		return 0;
+	}
+	gp->opened = true;
+
+	if (img->size < GPT_BLOCK_SIZE) {
+		gp->plan_err = GPT_PLAN_SIZE;
+		return 0;
+	}
+
+	t = stats_start();
+	ret = ioctl(img->fd, BLKSSZGET, &gp->sector_size);
+	stats_stop(STATS_IOCTL, t, 1, 0);
+	if (ret != 0) {
+		gp->sector_size = 512;
+		gp->sector_size_guessed = true;
+	}
+
+	spec_len = (GPT_DEFAULT_TABLE_SIZE + gp->sector_size - 1) / gp->sector_size * gp->sector_size;
+
+	back->region_len = GPT_BLOCK_SIZE + spec_len;
+	if (back->region_len > img->size)
+		back->region_len = img->size;
+	back->region_off = img->size - back->region_len;
+	if (probe_gpt_req(pr, img, GPT_BUF_BACKUP, &reqs[n++], back->region_off,
+			  back->region_len) != 0)
+		goto err_nomem;
+
+	if (pr->check_gpt) {
+		prim->region_off = gp->sector_size;
+		prim->region_len = gp->sector_size + spec_len;
+		if (prim->region_off + prim->region_len > img->size)
+			prim->region_len = img->size > prim->region_off ? img->size - prim->region_off : 0;
+		if (prim->region_len < GPT_BLOCK_SIZE) {
+			gp->plan_err = GPT_PLAN_PRIMARY;
+			return 0;
+		}
+		if (probe_gpt_req(pr, img, GPT_BUF_PRIMARY, &reqs[n++], prim->region_off,
+				  prim->region_len) != 0)
+			goto err_nomem;
+	}
 
-	while (len--)
-		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return n;
 
-	return crc ^ ~0U;
+err_nomem:
+	gp->plan_err = GPT_PLAN_NOMEM;
+	return 0;
 }
 
-int main(int argc, char **argv)
+/*
+ * Validate (and print) the GPT read by the requests set up in gpt_plan().
+ * Tables not located next to their header are read in a second batch.
+ */
+static int probe_gpt(struct probe *pr, struct gpt_probe *gp, const char *gpt_dev,
+		     const struct image_req *plan_reqs)
 {
-	int c, ret = -1;
-	bool verbose = false;
-	char *boot_dev = "/dev/mmcblk0boot1", *gpt_dev = "/dev/mmcblk0";
-	FILE *fp;
-	char *buf = NULL, *gpt_buf = NULL;
-	ssize_t len;
-	struct nvtegra_ptable *pt;
-	struct nvtegra_partinfo *p, *gpt;
-	unsigned int i;
+	struct image *img = &gp->img;
+	struct gpt_copy *back = &gp->back, *prim = &gp->prim;
+	struct image_req reqs[2];
+	int sector_size = gp->sector_size, ret = -1;
+	unsigned int i, n, num_entries;
+
+	switch (gp->plan_err) {
+	case GPT_PLAN_OK:
+		break;
+	case GPT_PLAN_OPEN:
+		probe_err(pr, "Failed to open file %s: %s\n", gpt_dev, strerror(gp->plan_errno));
+		return -1;
+	case GPT_PLAN_SIZE:
+		probe_err(pr, "Failed to seek to GPT header block: %s\n", strerror(EINVAL));
+		return -1;
+	case GPT_PLAN_PRIMARY:
+		probe_err(pr, "Failed to read primary GPT header: %s\n", strerror(EIO));
+		return -1;
+	case GPT_PLAN_NOMEM:
+		probe_err(pr, "Failed to allocate memory\n");
+		return -1;
+	}
 
-	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
-		switch (c) {
-		case 'h':
-			usage_and_exit(EXIT_SUCCESS);
-		case 'v':
-			verbose = true;
-			break;
-		default:
-			usage_and_exit(EXIT_FAILURE);
+	if (gp->sector_size_guessed && !pr->quiet)
+		outbuf_printf(&pr->out, "Failed to get block size, assuming default value 512\n");
+
+	for (i = 0; i < (pr->check_gpt ? 2U : 1U); i++) {
+		if (plan_reqs[i].error) {
+			probe_err(pr, "Failed to read %u bytes of GPT header: %s\n", GPT_BLOCK_SIZE,
+				  strerror(plan_reqs[i].error));
+			return -1;
 		}
 	}
 
-	if (optind < argc)
-		boot_dev = argv[optind];
-	if (optind + 1 < argc)
-		gpt_dev = argv[optind + 1];
+	back->region = plan_reqs[0].data;
+	back->hdr_off = img->size - GPT_BLOCK_SIZE;
+	if (gpt_check_header(pr, img, back) != 0)
+		return -1;
 
-	printf("Using boot device %s, GPT device %s\n", boot_dev, gpt_dev);
+	if (pr->verbose && !pr->quiet)
+		outbuf_printf(&pr->out, "Valid GPT header found at 0x%" PRIx64 "\n", back->hdr_off);
 
-	buf = malloc(MAX_SIZE);
-	if (!buf) {
-		err("Failed to allocate memory\n");
+	n = 0;
+	ret = gpt_locate_table(pr, img, back, sector_size, GPT_BUF_BACKUP_TABLE, &reqs[n]);
+	if (ret < 0)
 		return -1;
+	n += ret;
+
+	if (pr->check_gpt) {
+		prim->region = plan_reqs[1].data;
+		prim->hdr_off = prim->region_off;
+		if (gpt_check_header(pr, img, prim) != 0)
+			return -1;
+		ret = gpt_locate_table(pr, img, prim, sector_size, GPT_BUF_PRIMARY_TABLE, &reqs[n]);
+		if (ret < 0)
+			return -1;
+		n += ret;
 	}
+	ret = -1;
 
-	fp = fopen(boot_dev, "r");
-	if (!fp) {
-		err("Failed to open file %s: %s\n", boot_dev, strerror(errno));
-		goto err_free;
+	if (n > 0 && image_io_read(pr->io, reqs, n) != 0) {
+		for (i = 0; i < n && !reqs[i].error; i++)
+			;
+		probe_err(pr, "Failed to to read GPT table: %s\n", strerror(reqs[i].error));
+		return -1;
 	}
+	i = 0;
+	if (!back->table)
+		back->table = reqs[i++].data;
+	if (pr->check_gpt && !prim->table)
+		prim->table = reqs[i++].data;
 
-	len = fread(buf, 1, MAX_SIZE, fp);
-	fclose(fp);
-	if (len != MAX_SIZE) {
-		err("Failed to read %u bytes from file: %s\n", MAX_SIZE,
-		    strerror(errno));
-		goto err_free;
-	}
+	if (gpt_check_table(pr, back) != 0)
+		return -1;
 
-	pt = (struct nvtegra_ptable *) buf;
+	num_entries = back->info.num_entries;
+	pr->gpt = &back->info;
+	pr->gpt_found = true;
+	pr->num_gpt_entries = num_entries;
 
-	if (pt->version != PT_VERSION) {
-		err("Invalid partition table version 0x%08x, expected 0x%08x\n",
-		    pt->version, PT_VERSION);
-		goto err_free;
+	/* only the used entries are decoded from here on (unless --all) */
+	if (GPT_BITMAP_WORDS(num_entries) > pr->gpt_used_words) {
+		uint64_t *used = realloc(pr->gpt_used, GPT_BITMAP_WORDS(num_entries) * sizeof(*used));
+
+		if (!used) {
+			probe_err(pr, "Failed to allocate memory\n");
+			return -1;
+		}
+		pr->gpt_used = used;
+		pr->gpt_used_words = GPT_BITMAP_WORDS(num_entries);
 	}
+	pr->num_gpt_used = gpt_used_entries(&back->info, pr->gpt_used);
 
-	printf("nvtegra partition table (%u partitions, size=%u)\n", pt->num_parts, pt->table_size);
+	if (!pr->quiet) {
+		if (pr->verbose) {
+			outbuf_printf(&pr->out, "\nGPT header dump:\n");
+			outbuf_hexdump(&pr->out, (const uint8_t *)back->info.hdr, GPT_BLOCK_SIZE);
+		}
+
+		outbuf_printf(&pr->out, "\nGUID partition table (%u partitions, %u used, size=%zu, sector=0x%" PRIx64 ", offset=0x%" PRIx64 ")\n",
+			      num_entries, pr->num_gpt_used, back->info.table_size, back->info.lba_table,
+			      back->table_off);
 
-	p = &pt->partitions[0];
-	nvtegra_partition_print(0, p);
+		for (i = probe_next_entry(pr, 0); i < num_entries; i = probe_next_entry(pr, i + 1)) {
+			const struct gpt_entry *gpt_e = gpt_entry_get(&back->info, i);
 
-	/* Validate partitioning information (as far as possible) */
-	if (p->id != BCT_ID) {
-		err("Invalid partition id in BCT, expected %u\n", BCT_ID);
-		goto err_free;
+			if (pr->verbose && !(pr->dump_nonzero && mem_is_zero(gpt_e, sizeof(*gpt_e)))) {
+				outbuf_printf(&pr->out, "\nGPT block %u dump:\n", i);
+				outbuf_hexdump(&pr->out, (const uint8_t *)gpt_e, sizeof(*gpt_e));
+			}
+			text_gpt_entry(&pr->out, i, gpt_e);
+		}
 	}
 
-	if ((memcmp(p->name, PT_BCT_NAME, sizeof(PT_BCT_NAME)) != 0) ||
-	    (memcmp(p->name2, PT_BCT_NAME, sizeof(PT_BCT_NAME)) != 0)) {
-		err("Invalid name for BCT, expected %s\n", PT_BCT_NAME);
-		goto err_free;
+	if (pr->check_gpt) {
+		if (gpt_check_table(pr, prim) != 0)
+			return -1;
+
+		if (pr->verbose && !pr->quiet) {
+			outbuf_printf(&pr->out, "\nPrimary GPT header dump:\n");
+			outbuf_hexdump(&pr->out, (const uint8_t *)prim->info.hdr, GPT_BLOCK_SIZE);
+		}
+		if (!pr->quiet)
+			outbuf_printf(&pr->out, "\nValid primary GPT header found at 0x%" PRIx64 " (table at sector=0x%" PRIx64 ")\n",
+				      prim->hdr_off, prim->info.lba_table);
+
+		if (gpt_cross_check(pr, prim, back) != 0)
+			return -1;
+		pr->gpt_checked = true;
+		if (!pr->quiet)
+			outbuf_printf(&pr->out, "Primary and backup GPT match\n");
+	}
+
+	return 0;
+}
+
+static void digest_to_str(const uint8_t *digest, char *str)
+{
+	unsigned int i;
+
+	for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+		sprintf(str + 2 * i, "%02x", digest[i]);
+}
+
+/*
+ * Hash the GPT partitions listed in the manifest and compare them to the
+ * expected hashes. The partitions are located using the (backup) GPT found
+ * by probe_gpt().
+ */
+static int probe_verify(struct probe *pr, struct gpt_probe *gp, const char *gpt_dev)
+{
+	const struct verify_manifest *m = pr->manifest;
+	struct verify_part *parts;
+	char (*names)[GPT_NAME_STR_LEN + 1];
+	char expected[2 * SHA256_DIGEST_SIZE + 1], actual[2 * SHA256_DIGEST_SIZE + 1];
+	unsigned int i, j, n = 0;
+	int failed, ret = -1;
+
+	parts = calloc(m->num, sizeof(*parts));
+	names = malloc(pr->num_gpt_entries * sizeof(*names));
+	if (!parts || !names) {
+		probe_err(pr, "Failed to allocate memory\n");
+		goto out;
 	}
 
-	if (p->start_sector != 0) {
-		err("Invalid start sector, expected 0\n");
-		goto err_free;
+	/* decode the names of the used entries once instead of for every manifest entry */
+	for (j = 0; j < pr->num_gpt_entries; j++) {
+		names[j][0] = '\0';
+		if (gpt_entry_used(pr->gpt_used, j))
+			gpt_entry_name(gpt_entry_get(pr->gpt, j), names[j], sizeof(names[j]));
 	}
 
-	gpt = NULL;
-	for (i = 1; (i < MAX_NUM_PARTS) && (i < pt->num_parts); i++) {
-		p = &pt->partitions[i];
-		if (p->id >= 128) {
-			err("Invalid id %u\n", p->id);
+	for (i = 0; i < m->num; i++) {
+		const struct verify_entry *ve = &m->entries[i];
+
+		for (j = 0; j < pr->num_gpt_entries; j++) {
+			const struct gpt_entry *e = gpt_entry_get(pr->gpt, j);
+			uint64_t start = gpt_entry_lba_start(e), end = gpt_entry_lba_end(e);
+
+			if (strcmp(names[j], ve->name) != 0)
+				continue;
+
+			if (end < start || end >= gp->img.size / gp->sector_size) {
+				probe_err(pr, "Partition %s exceeds the size of %s\n", ve->name, gpt_dev);
+				goto out;
+			}
+			parts[n].entry = ve;
+			parts[n].off = start * gp->sector_size;
+			parts[n].len = (end - start + 1) * gp->sector_size;
+			n++;
 			break;
 		}
-		nvtegra_partition_print(i, p);
-		if ((memcmp(p->name, PT_GPT_NAME, sizeof(PT_GPT_NAME) - 1) == 0) &&
-		    (memcmp(p->name2, PT_GPT_NAME, sizeof(PT_GPT_NAME) - 1) == 0))
-			gpt = p;
-	}
-
-	if (gpt) {
-		int fd;
-		uint8_t gpt_block[GPT_BLOCK_SIZE];
-		struct gpt_header *gpt_h;
-		uint32_t crc, crc_self;
-		int sector_size;
-		unsigned int num_entries;
-		size_t gpt_size, blocks, count;
-		off64_t ofs;
-
-		fd = open(gpt_dev, O_RDONLY);
-		if (fd < 0) {
-			err("Failed to open file %s: %s\n", gpt_dev, strerror(errno));
-			goto err_free;
+		if (j == pr->num_gpt_entries) {
+			probe_err(pr, "Partition %s from manifest not found in GPT\n", ve->name);
+			goto out;
 		}
+	}
 
-		ofs = lseek64(fd, -GPT_BLOCK_SIZE, SEEK_END);
-		if (ofs == (off_t)-1) {
-			err("Failed to seek to GPT header block: %s\n", strerror(errno));
-			close(fd);
-			goto err_free;
+	if (!pr->quiet) {
+		outbuf_printf(&pr->out, "\nVerifying %u partitions", n);
+		if (pr->verbose)
+			outbuf_printf(&pr->out, " (sha256 implementation %s)", sha256_impl_name());
+		outbuf_printf(&pr->out, "\n");
+	}
+
+	failed = verify_parts(gpt_dev, pr->image_flags, parts, n, pr->verify_jobs);
+	if (failed < 0) {
+		probe_err(pr, "Failed to open file %s: %s\n", gpt_dev, strerror(errno));
+		goto out;
+	}
+
+	ret = 0;
+	for (i = 0; i < n; i++) {
+		const struct verify_part *p = &parts[i];
+
+		if (p->error) {
+			probe_err(pr, "Failed to read partition %s: %s\n", p->entry->name,
+				  strerror(p->error));
+			ret = -1;
+			continue;
 		}
 
-		len = read(fd, gpt_block, GPT_BLOCK_SIZE);
-		if (len != GPT_BLOCK_SIZE) {
-			err("Failed to read %u bytes of GPT header: %s\n", GPT_BLOCK_SIZE,
-			    strerror(errno));
-			close(fd);
-			goto err_free;
+		if (memcmp(p->digest, p->entry->digest, SHA256_DIGEST_SIZE) != 0) {
+			digest_to_str(p->entry->digest, expected);
+			digest_to_str(p->digest, actual);
+			probe_err(pr, "Partition %s: SHA-256 mismatch, expected %s, got %s\n",
+				  p->entry->name, expected, actual);
+			ret = -1;
+			continue;
 		}
 
-		gpt_h = (struct gpt_header *) gpt_block;
+		if (!pr->quiet)
+			outbuf_printf(&pr->out, "  %s: OK\n", p->entry->name);
+	}
+out:
+	free(names);
+	free(parts);
+	return ret;
+}
+
+/*
+ * Copy the primary and backup GPT and all used GPT partitions to
+ * pr->extract_path.
+ */
+static int probe_extract(struct probe *pr, struct gpt_probe *gp, const char *gpt_dev)
+{
+	const struct gpt_header *hdr = pr->gpt->hdr;
+	uint64_t sector_size = gp->sector_size, num_sectors = gp->img.size / sector_size;
+	uint64_t first = gpt_header_lba_start(hdr), last = gpt_header_lba_end(hdr);
+	struct extract_range *ranges;
+	struct extract_result res;
+	unsigned int i, n = 0, num_parts = 0;
+	int ret = -1;
+
+	ranges = calloc(pr->num_gpt_entries + 2, sizeof(*ranges));
+	if (!ranges) {
+		probe_err(pr, "Failed to allocate memory\n");
+		return -1;
+	}
 
-		/* Validate GPT header */
-		if (memcmp(gpt_h->signature, GPT_SIGNATURE, sizeof(GPT_SIGNATURE)) != 0) {
-			err("Invalid GPT signature\n");
-			close(fd);
-			goto err_free;
+	/* protective MBR, primary GPT and the backup GPT at the end */
+	ranges[n].off = 0;
+	ranges[n++].len = (first < num_sectors ? first : num_sectors) * sector_size;
+	if (last + 1 < num_sectors) {
+		ranges[n].off = (last + 1) * sector_size;
+		ranges[n].len = gp->img.size - ranges[n].off;
+		n++;
+	}
+
+	for (i = gpt_next_used(pr->gpt_used, pr->num_gpt_entries, 0); i < pr->num_gpt_entries;
+	     i = gpt_next_used(pr->gpt_used, pr->num_gpt_entries, i + 1)) {
+		const struct gpt_entry *e = gpt_entry_get(pr->gpt, i);
+		uint64_t start = gpt_entry_lba_start(e), end = gpt_entry_lba_end(e);
+
+		if (end < start || end >= num_sectors) {
+			probe_err(pr, "GPT entry %u exceeds the size of %s\n", i, gpt_dev);
+			goto out;
 		}
+		ranges[n].off = start * sector_size;
+		ranges[n++].len = (end - start + 1) * sector_size;
+		num_parts++;
+	}
+	n = extract_ranges_merge(ranges, n);
+
+	if (extract_image(gpt_dev, pr->image_flags, pr->extract_path, pr->extract_format,
+			  pr->extract_flags, ranges, n, &res) != 0) {
+		probe_err(pr, "Failed to extract %s to %s (%s): %s\n", gpt_dev, pr->extract_path,
+			  res.what, strerror(res.error));
+		goto out;
+	}
+
+	if (!pr->quiet)
+		outbuf_printf(&pr->out, "\nExtracted %u partitions to %s, %" PRIu64 " of %" PRIu64
+			      " bytes copied, %" PRIu64 " zero bytes skipped\n", num_parts,
+			      pr->extract_path, res.copied, res.size, res.zero);
+	ret = 0;
+out:
+	free(ranges);
+	return ret;
+}
+
+/* Add the layout of the last probed device to the index, keyed by the input */
+static int probe_index(struct probe *pr, const char *boot_dev, const char *gpt_dev)
+{
+	size_t size = strlen(boot_dev) + (gpt_dev ? strlen(gpt_dev) + 1 : 0) + 1;
+	struct layout l;
+	char *key;
+	int len, ret;
+
+	key = malloc(size);
+	if (!key) {
+		probe_err(pr, "Failed to allocate memory\n");
+		return -1;
+	}
+	len = snprintf(key, size, gpt_dev ? "%s,%s" : "%s", boot_dev, gpt_dev);
+
+	ret = layout_build(&l, key, len, pr->pt, pr->num_parts, pr->gpt_found ? pr->gpt : NULL,
+			   pr->num_gpt_entries);
+	free(key);
+	if (ret == 0) {
+		pthread_mutex_lock(&pr->index->lock);
+		ret = layout_index_add(&pr->index->idx, &l);
+		pthread_mutex_unlock(&pr->index->lock);
+		if (ret != 0)
+			layout_free(&l);
+	}
+	if (ret != 0) {
+		probe_err(pr, "Failed to allocate memory\n");
+		return -1;
+	}
+
+	if (pr->verbose && !pr->quiet)
+		outbuf_printf(&pr->out, "Layout fingerprint %016" PRIx64 "\n", l.fingerprint);
+	return 0;
+}
+
+static void probe_record_json(struct probe *pr, const char *boot_dev, const char *gpt_dev,
+			      int ret, size_t errs_mark)
+{
+	struct outbuf *ob = &pr->out;
+
+	outbuf_puts(ob, "{");
+	json_key_str(ob, "boot_dev", boot_dev);
+	outbuf_puts(ob, ",");
+	json_key_str(ob, "gpt_dev", gpt_dev);
+	outbuf_printf(ob, ",\"status\":\"%s\",", ret == 0 ? "ok" : "error");
+	json_errors(ob, pr->errs.buf + errs_mark, pr->errs.len - errs_mark);
+
+	if (pr->pt) {
+		outbuf_puts(ob, ",\"ptable\":");
+		json_ptable(ob, pr->pt, pr->num_parts);
+	}
+
+	if (pr->gpt_found) {
+		outbuf_puts(ob, ",\"gpt\":");
+		json_gpt(ob, pr->gpt, pr->all_entries ? NULL : pr->gpt_used, pr->gpt_checked);
+	}
+
+	outbuf_puts(ob, "}\n");
+}
+
+_Static_assert(REC_GPT_NAME_SIZE >= GPT_NAME_STR_LEN + 1, "record GPT name size");
+
+static void probe_record_binary(struct probe *pr, const char *boot_dev, const char *gpt_dev,
+				int ret)
+{
+	struct outbuf *ob = &pr->out;
+	struct rec_ptable rec;
+	size_t start = ob->len, boot_len = strlen(boot_dev), gpt_len = gpt_dev ? strlen(gpt_dev) : 0;
+	static const uint8_t pad[REC_ALIGN];
+	unsigned int i;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.hdr.magic = htole32(REC_MAGIC_PTABLE);
+	rec.hdr.version = htole16(REC_VERSION);
+	rec.hdr.status = htole32(ret);
+	rec.flags = htole32((pr->gpt_found ? REC_PT_F_GPT : 0) |
+			    (pr->gpt_checked ? REC_PT_F_GPT_CHECKED : 0));
+	if (pr->pt) {
+		rec.pt_version = htole32(nvtegra_ptable_version(pr->pt));
+		rec.table_size = htole32(nvtegra_ptable_table_size(pr->pt));
+		rec.num_parts = htole32(pr->num_parts);
+	}
+	if (pr->gpt_found) {
+		rec.num_gpt_entries = htole32(pr->num_gpt_entries);
+		rec.gpt_lba_table = htole64(pr->gpt->lba_table);
+		memcpy(rec.disk_guid, &pr->gpt->hdr->uuid, sizeof(rec.disk_guid));
+	}
+	rec.boot_path_len = htole16(boot_len);
+	rec.gpt_path_len = htole16(gpt_len);
+	outbuf_write(ob, &rec, sizeof(rec));
+
+	for (i = 0; pr->pt && i < pr->num_parts; i++) {
+		const struct nvtegra_partinfo *p = &pr->pt->partitions[i];
+		struct rec_pt_part part;
+
+		memset(&part, 0, sizeof(part));
+		part.id = htole32(nvtegra_partinfo_id(p));
+		memcpy(part.name, p->name, sizeof(part.name));
+		part.allocation_policy = htole32(nvtegra_partinfo_allocation_policy(p));
+		part.fs_type = htole32(nvtegra_partinfo_fs_type(p));
+		part.virt_start_sector = htole32(nvtegra_partinfo_virt_start_sector(p));
+		part.virt_size = htole32(nvtegra_partinfo_virt_size(p));
+		part.start_sector = htole32(nvtegra_partinfo_start_sector(p));
+		part.end_sector = htole32(nvtegra_partinfo_end_sector(p));
+		part.type = htole32(nvtegra_partinfo_type(p));
+		outbuf_write(ob, &part, sizeof(part));
+	}
+
+	for (i = 0; i < pr->num_gpt_entries; i++) {
+		const struct gpt_entry *e = gpt_entry_get(pr->gpt, i);
+		struct rec_gpt_entry ent;
+
+		memset(&ent, 0, sizeof(ent));
+		memcpy(ent.type, &e->type, sizeof(ent.type));
+		memcpy(ent.uuid, &e->uuid, sizeof(ent.uuid));
+		ent.lba_start = htole64(gpt_entry_lba_start(e));
+		ent.lba_end = htole64(gpt_entry_lba_end(e));
+		ent.attr = htole64(gpt_entry_attr(e));
+		if (pr->all_entries || gpt_entry_used(pr->gpt_used, i))
+			gpt_entry_name(e, ent.name, sizeof(ent.name));
+		outbuf_write(ob, &ent, sizeof(ent));
+	}
+
+	outbuf_write(ob, boot_dev, boot_len);
+	if (gpt_dev)
+		outbuf_write(ob, gpt_dev, gpt_len);
+	outbuf_write(ob, pad, (REC_ALIGN - (ob->len - start) % REC_ALIGN) % REC_ALIGN);
+
+	/* patch in the final record size */
+	if (!ob->error) {
+		uint32_t rec_size = htole32(ob->len - start);
+		memcpy(ob->buf + start + offsetof(struct rec_hdr, rec_size), &rec_size, sizeof(rec_size));
+	}
+}
+
+/* Resolve the LBAs read from stdin to the partitions of the last probed device */
+static int probe_resolve(struct probe *pr)
+{
+	struct resolve res;
+	unsigned long skipped;
+	int ret;
+
+	if (resolve_init(&res, pr->pt, pr->num_parts, pr->gpt_found ? pr->gpt : NULL) != 0) {
+		probe_err(pr, "Failed to allocate memory\n");
+		return -1;
+	}
+
+	/* anything staged so far goes before the results */
+	outbuf_flush(&pr->out, STDOUT_FILENO);
+	outbuf_flush(&pr->errs, STDERR_FILENO);
+	ret = resolve_stream(&res, stdin, STDOUT_FILENO, pr->format == FORMAT_JSON, &skipped);
+	if (ret != 0)
+		probe_err(pr, "Failed to write output: %s\n", strerror(errno));
+	else if (skipped)
+		outbuf_printf(&pr->errs, "Warning: skipped %lu lines without an LBA\n", skipped);
+
+	resolve_free(&res);
+	return ret;
+}
+
+/* Stage the machine readable record for the last probed input */
+static void probe_record(struct probe *pr, const char *boot_dev, const char *gpt_dev,
+			 int ret, size_t errs_mark)
+{
+	/* the resolved LBAs replace the record */
+	if (pr->resolve)
+		return;
+
+	switch (pr->format) {
+	case FORMAT_TEXT:
+		break;
+	case FORMAT_JSON:
+		probe_record_json(pr, boot_dev, gpt_dev, ret, errs_mark);
+		break;
+	case FORMAT_BINARY:
+		probe_record_binary(pr, boot_dev, gpt_dev, ret);
+		break;
+	}
+}
+
+/*
+ * Get the whole PT whose first r->len bytes were read by request r, reading
+ * the rest if needed. *size is set to the number of bytes returned.
+ */
+static const void *probe_pt_read(struct probe *pr, struct image *img,
+				 const struct image_req *r, size_t *size)
+{
+	const void *rest;
+
+	*size = r->len;
+	if (nvtegra_ptable_size(r->data, r->len, size) != APALIS_OK || *size <= r->len) {
+		/* let the parser report what's wrong */
+		*size = r->len;
+		return r->data;
+	}
+
+	if (img->map)
+		return image_read(img, 0, *size, NULL);
+
+	if (probe_buf_reserve(&pr->pt_buf, *size) != 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	rest = image_read(img, r->len, *size - r->len, pr->pt_buf.data + r->len);
+	return rest ? pr->pt_buf.data : NULL;
+}
+
+/* Verify the copy of the PT following it at the next 0x1000 boundary */
+static int probe_pt_copy(struct probe *pr, struct image *img,
+			 const struct nvtegra_ptable_info *info)
+{
+	uint64_t off = nvtegra_ptable_copy_off(info);
+	const void *copy;
+
+	if (!img->map && probe_buf_reserve(&pr->pt_copy_buf, info->size) != 0) {
+		probe_err(pr, "Failed to allocate memory\n");
+		return -1;
+	}
+	errno = EINVAL;
+	if (off + info->size > img->size ||
+	    !(copy = image_read(img, off, info->size, pr->pt_copy_buf.data))) {
+		probe_err(pr, "Failed to read partition table copy at 0x%" PRIx64 ": %s\n", off,
+			  strerror(errno));
+		return -1;
+	}
+
+	if (nvtegra_ptable_compare_copy(info, copy, info->size) != APALIS_OK) {
+		probe_err(pr, "Partition table copy at 0x%" PRIx64 " differs\n", off);
+		return -1;
+	}
+	if (!pr->quiet)
+		outbuf_printf(&pr->out, "Partition table copy at 0x%" PRIx64 " matches\n", off);
+	return 0;
+}
+
+/* Requests of the first batch of a device probe: the PT start and the GPT */
+#define PROBE_REQS_MAX	3
+
+/* State of a device probe between probe_start() and probe_finish() */
+struct probe_dev {
+	const char *boot_dev, *gpt_dev;
+	struct image img;
+	bool opened;
+	struct gpt_probe gp;
+	size_t errs_mark;
+	struct image_req reqs[PROBE_REQS_MAX];
+	unsigned int num_reqs;
+};
+
+/*
+ * Open boot_dev (and gpt_dev) and set up the first batch of reads in pd->reqs:
+ * the start of the PT and the GPT (if there is one), the rest of the PT
+ * follows in probe_finish() if it doesn't fit. The requests can be submitted
+ * along with those of other probes.
+ */
+static void probe_start(struct probe *pr, struct probe_dev *pd, const char *boot_dev,
+			const char *gpt_dev)
+{
+	struct image_req *reqs = pd->reqs;
+
+	pd->boot_dev = boot_dev;
+	pd->gpt_dev = gpt_dev;
+	pd->opened = false;
+	pd->gp.opened = false;
+	pd->num_reqs = 0;
+
+	pr->pt = NULL;
+	pr->num_parts = 0;
+	pr->gpt = NULL;
+	pr->num_gpt_entries = 0;
+	pr->num_gpt_used = 0;
+	pr->gpt_found = false;
+	pr->gpt_checked = false;
+	pd->errs_mark = pr->errs.len;
+
+	if (image_open_flags(&pd->img, boot_dev, pr->image_flags) != 0) {
+		probe_err(pr, "Failed to open file %s: %s\n", boot_dev, strerror(errno));
+		return;
+	}
+	pd->opened = true;
+
+	memset(reqs, 0, sizeof(pd->reqs));
+	reqs[0].img = &pd->img;
+	reqs[0].off = 0;
+	reqs[0].len = NVTEGRA_PT_MIN_READ;
+	reqs[0].buf = pr->pt_buf.data;
+	pd->num_reqs = 1;
+	if (gpt_dev)
+		pd->num_reqs += gpt_plan(pr, &pd->gp, gpt_dev, &reqs[1]);
+}
+
+/*
+ * Validate the PT read by the requests of probe_start() and, if the PT
+ * contains a GPT partition and gpt_dev is given, the GPT on gpt_dev.
+ */
+static int probe_finish(struct probe *pr, struct probe_dev *pd)
+{
+	const char *boot_dev = pd->boot_dev, *gpt_dev = pd->gpt_dev;
+	struct image *img = &pd->img;
+	struct image_req *reqs = pd->reqs;
+	struct nvtegra_ptable_info info;
+	const struct nvtegra_ptable *pt;
+	const void *data;
+	unsigned int i;
+	size_t size;
+	int ret = -1;
 
-		crc_self = le32toh(gpt_h->crc_self);
-		gpt_h->crc_self = 0;
-		crc = crc32(gpt_h, le32toh(gpt_h->size));
-		if (crc != crc_self) {
-			err("Invalid GPT header CRC 0x%04x, calculated 0x%04x\n", crc_self, crc);
-			close(fd);
-			goto err_free;
+	if (!pd->opened) {
+		probe_record(pr, boot_dev, gpt_dev, -1, pd->errs_mark);
+		return -1;
+	}
+
+	if (!reqs[0].data) {
+		probe_err(pr, "Failed to read %u bytes from file: %s\n", NVTEGRA_PT_MIN_READ,
+			  strerror(reqs[0].error));
+		goto out;
+	}
+
+	data = probe_pt_read(pr, img, &reqs[0], &size);
+	if (!data) {
+		probe_err(pr, "Failed to read %zu bytes from file: %s\n", size, strerror(errno));
+		goto out;
+	}
+
+	ret = nvtegra_ptable_parse(data, size, &info);
+	pt = info.pt;
+	pr->pt = pt;
+
+	if (ret == APALIS_E_PT_VERSION) {
+		probe_err(pr, "Invalid partition table version 0x%08x, expected 0x%08x\n",
+			  nvtegra_ptable_version(pt), NVTEGRA_PT_VERSION);
+		goto err;
+	}
+
+	if (!pr->quiet) {
+		outbuf_printf(&pr->out, "nvtegra partition table (%u partitions, size=%u)\n",
+			      nvtegra_ptable_num_parts(pt), nvtegra_ptable_table_size(pt));
+		text_pt_entry(&pr->out, 0, &pt->partitions[0]);
+	}
+
+	switch (ret) {
+	case APALIS_OK:
+		break;
+	case APALIS_E_PT_BCT_ID:
+		probe_err(pr, "Invalid partition id in BCT, expected %u\n", NVTEGRA_BCT_ID);
+		goto err;
+	case APALIS_E_PT_BCT_NAME:
+		probe_err(pr, "Invalid name for BCT, expected BCT\n");
+		goto err;
+	case APALIS_E_PT_BCT_START:
+		probe_err(pr, "Invalid start sector, expected 0\n");
+		goto err;
+	case APALIS_E_PT_PART_ID:
+		/* not fatal, the entries preceding it are still used */
+		probe_err(pr, "Invalid id %u\n", info.bad_id);
+		break;
+	default:
+		probe_err(pr, "%s\n", apalis_strerror(ret));
+		goto err;
+	}
+
+	for (i = 1; !pr->quiet && i < info.num_parts; i++)
+		text_pt_entry(&pr->out, i, &pt->partitions[i]);
+	pr->num_parts = info.num_parts;
+
+	if (pr->check_copy && probe_pt_copy(pr, img, &info) != 0)
+		goto err;
+
+	if (info.gpt && gpt_dev) {
+		ret = probe_gpt(pr, &pd->gp, gpt_dev, &reqs[1]);
+		if (ret == 0 && pr->manifest)
+			ret = probe_verify(pr, &pd->gp, gpt_dev);
+		if (ret == 0 && pr->extract_path)
+			ret = probe_extract(pr, &pd->gp, gpt_dev);
+	} else if (pr->manifest || pr->extract_path) {
+		probe_err(pr, "No GPT found or no block device file specified, can't %s partitions\n",
+			  pr->manifest ? "verify" : "extract");
+		ret = -1;
+	} else {
+		if (!pr->quiet)
+			outbuf_printf(&pr->out, "No GPT found or no block device file specified\n");
+		ret = 0;
+	}
+	goto out;
+err:
+	ret = -1;
+out:
+	if (ret == 0 && pr->index && probe_index(pr, boot_dev, gpt_dev) != 0)
+		ret = -1;
+	if (ret == 0 && pr->resolve && probe_resolve(pr) != 0)
+		ret = -1;
+	probe_record(pr, boot_dev, gpt_dev, ret, pd->errs_mark);
+	if (pd->gp.opened)
+		image_close(&pd->gp.img);
+	image_close(img);
+	return ret;
+}
+
+/*
+ * Read and validate the PT on boot_dev and, if the PT contains a GPT partition
+ * and gpt_dev is given, the GPT on gpt_dev.
+ */
+static int probe_device(struct probe *pr, const char *boot_dev, const char *gpt_dev)
+{
+	struct probe_dev pd;
+
+	probe_start(pr, &pd, boot_dev, gpt_dev);
+	image_io_read(pr->io, pd.reqs, pd.num_reqs);
+	return probe_finish(pr, &pd);
+}
+
+static int probe_init(struct probe *pr)
+{
+	memset(pr, 0, sizeof(*pr));
+	outbuf_init(&pr->out);
+	outbuf_init(&pr->errs);
+
+	return probe_buf_reserve(&pr->pt_buf, NVTEGRA_PT_MIN_READ);
+}
+
+static void probe_free(struct probe *pr)
+{
+	unsigned int i;
+
+	free(pr->pt_buf.data);
+	free(pr->pt_copy_buf.data);
+	for (i = 0; i < GPT_BUF_MAX; i++)
+		free(pr->gpt_buf[i].data);
+	free(pr->input);
+	free(pr->gpt_used);
+	outbuf_free(&pr->out);
+	outbuf_free(&pr->errs);
+}
+
+static void probe_flush(struct probe *pr)
+{
+	outbuf_flush(&pr->out, STDOUT_FILENO);
+	outbuf_flush(&pr->errs, STDERR_FILENO);
+}
+
+static int batch_copy_input(struct probe *pr, const char *input)
+{
+	size_t len = strlen(input) + 1;
+
+	if (len > pr->input_size) {
+		char *new_input = realloc(pr->input, len);
+		if (!new_input)
+			return -1;
+		pr->input = new_input;
+		pr->input_size = len;
+	}
+	memcpy(pr->input, input, len);
+	return 0;
+}
+
+/*
+ * Split a batch input of the form BOOTDEV[,GPTDEV] in place and stage its
+ * header. Returns GPTDEV, or NULL if not given.
+ */
+static char *batch_input_start(struct probe *pr, char *input)
+{
+	char *gpt_dev;
+
+	gpt_dev = strchr(input, ',');
+	if (gpt_dev)
+		*gpt_dev++ = '\0';
+
+	if (pr->format == FORMAT_TEXT && !pr->quiet)
+		outbuf_printf(&pr->out, "==> %s\n", input);
+	return gpt_dev;
+}
+
+/* Stage the per-file result line of a batch input */
+static void batch_input_finish(struct probe *pr, const char *input, int ret)
+{
+	if (pr->format != FORMAT_TEXT)
+		return;
+
+	if (ret == 0) {
+		outbuf_printf(&pr->out, "%s: OK (%u partitions", input, pr->num_parts);
+		if (pr->gpt_found)
+			outbuf_printf(&pr->out, ", %u GPT entries", pr->num_gpt_entries);
+		outbuf_printf(&pr->out, ")\n");
+	} else
+		outbuf_printf(&pr->out, "%s: FAILED\n", input);
+
+	if (!pr->quiet)
+		outbuf_printf(&pr->out, "\n");
+}
+
+/*
+ * Batch mode is a pipeline like the one of trdx-configblock: the inputs are
+ * dealt round-robin to a number of lanes, each with a reader thread (opening
+ * the inputs and reading the start of their PT and GPT, everything queued at
+ * once) and a parser thread (validating them, reading the rest of large
+ * tables and verifying partitions). A single writer thread takes the results
+ * from the lanes in turn, so they are written in input order. Unordered, the
+ * parsers write the results as soon as they are done and the writer only
+ * recycles the jobs. Each job is a probe of its own, the pool of jobs is
+ * passed around by SPSC rings:
+ *
+ *   feeder -> todo -> reader -> read -> parser -> done -> writer -> free -> feeder
+ */
+
+/* Jobs per lane, inputs read ahead of the writer */
+#define PIPE_DEPTH	IMAGE_BATCH_MAX
+
+struct probe_job {
+	struct probe		pr;	/* input in pr.input, output staged in pr.out/errs */
+	struct probe_dev	pd;
+	int			ret;
+};
+
+struct pipe_lane {
+	struct pipe		*p;
+	struct ring		todo, read, done, free;
+	struct image_io		reader_io, parser_io;
+	pthread_t		reader, parser;
+	struct probe_job	jobs[PIPE_DEPTH];
+};
+
+struct pipe {
+	struct pipe_lane	*lanes;
+	unsigned int		num_lanes;
+	unsigned long		seq;		/* inputs fed so far */
+	unsigned int		failed;
+	bool			ordered;	/* write results in input order */
+	pthread_mutex_t		out_lock;	/* output of the parsers if unordered */
+	pthread_t		writer;
+};
+
+static void *pipe_reader(void *arg)
+{
+	struct pipe_lane *l = arg;
+	struct probe_job *jobs[IMAGE_BATCH_MAX];
+	struct image_req reqs[IMAGE_BATCH_MAX];
+	unsigned int i, n, nreqs;
+	void *p;
+
+	do {
+		/* read everything queued (but at least one input) in one batch */
+		n = 0;
+		nreqs = 0;
+		p = ring_pop(&l->todo);
+		while (p) {
+			struct probe_job *j = p;
+			char *gpt_dev = batch_input_start(&j->pr, j->pr.input);
+
+			probe_start(&j->pr, &j->pd, j->pr.input, gpt_dev);
+			memcpy(&reqs[nreqs], j->pd.reqs, j->pd.num_reqs * sizeof(*reqs));
+			nreqs += j->pd.num_reqs;
+			jobs[n++] = j;
+			if (nreqs + PROBE_REQS_MAX > IMAGE_BATCH_MAX || !ring_trypop(&l->todo, &p))
+				break;
 		}
+		image_io_read(&l->reader_io, reqs, nreqs);
 
-		if (verbose)
-			printf("Valid GPT header found at 0x%" PRIx64 "\n", ofs);
+		for (i = 0, nreqs = 0; i < n; i++) {
+			memcpy(jobs[i]->pd.reqs, &reqs[nreqs], jobs[i]->pd.num_reqs * sizeof(*reqs));
+			nreqs += jobs[i]->pd.num_reqs;
+			ring_push(&l->read, jobs[i]);
+		}
+	} while (p);
 
-		if (ioctl(fd, BLKSSZGET, &sector_size) != 0) {
-			printf("Failed to get block size, assuming default value 512\n");
-			sector_size = 512;
+	ring_push(&l->read, NULL);
+	return NULL;
+}
+
+static void *pipe_parser(void *arg)
+{
+	struct pipe_lane *l = arg;
+	struct probe_job *j;
+
+	while ((j = ring_pop(&l->read))) {
+		j->pr.io = &l->parser_io;
+		j->ret = probe_finish(&j->pr, &j->pd);
+		batch_input_finish(&j->pr, j->pd.boot_dev, j->ret);
+		if (!l->p->ordered) {
+			pthread_mutex_lock(&l->p->out_lock);
+			probe_flush(&j->pr);
+			pthread_mutex_unlock(&l->p->out_lock);
 		}
+		ring_push(&l->done, j);
+	}
+
+	ring_push(&l->done, NULL);
+	return NULL;
+}
+
+static void *pipe_writer(void *arg)
+{
+	struct pipe *p = arg;
+	struct probe_job *j;
+	unsigned long seq;
+
+	for (seq = 0; ; seq++) {
+		struct pipe_lane *l = &p->lanes[seq % p->num_lanes];
+
+		j = ring_pop(&l->done);
+		if (!j)
+			break;
+
+		if (p->ordered)
+			probe_flush(&j->pr);
+		if (j->ret != 0)
+			p->failed++;
+		ring_push(&l->free, j);
+	}
+
+	return NULL;
+}
+
+/* Hand input to the next lane, once it has a free job */
+static int pipe_feed(struct pipe *p, const char *input)
+{
+	struct pipe_lane *l = &p->lanes[p->seq % p->num_lanes];
+	struct probe_job *j = ring_pop(&l->free);
 
-		num_entries = le32toh(gpt_h->num_entries);
-		gpt_size = num_entries * le32toh(gpt_h->entry_size);
-		blocks = gpt_size / sector_size + ((gpt_size % sector_size) ? 1 : 0);
-		count = blocks * sector_size;
+	if (batch_copy_input(&j->pr, input) != 0) {
+		err("Failed to allocate memory\n");
+		ring_push(&l->free, j);
+		return -1;
+	}
+
+	ring_push(&l->todo, j);
+	p->seq++;
+	return 0;
+}
+
+static int pipe_lane_init(struct pipe_lane *l, const struct probe *tmpl)
+{
+	unsigned int i;
+	int ret = 0;
+
+	image_io_init(&l->reader_io);
+	image_io_init(&l->parser_io);
+	for (i = 0; i < PIPE_DEPTH; i++) {
+		struct probe *pr = &l->jobs[i].pr;
+
+		if (probe_init(pr) != 0)
+			ret = -1;
+		pr->verbose = tmpl->verbose;
+		pr->dump_nonzero = tmpl->dump_nonzero;
+		pr->all_entries = tmpl->all_entries;
+		pr->quiet = tmpl->quiet;
+		pr->check_gpt = tmpl->check_gpt;
+		pr->check_copy = tmpl->check_copy;
+		pr->image_flags = tmpl->image_flags;
+		pr->manifest = tmpl->manifest;
+		pr->index = tmpl->index;
+		pr->verify_jobs = 1;
+		pr->format = tmpl->format;
+	}
+	if (ret != 0)
+		return -1;
+
+	/* room for all jobs plus the end marker */
+	if (ring_init(&l->todo, 2 * PIPE_DEPTH) != 0 || ring_init(&l->read, 2 * PIPE_DEPTH) != 0 ||
+	    ring_init(&l->done, 2 * PIPE_DEPTH) != 0 || ring_init(&l->free, 2 * PIPE_DEPTH) != 0)
+		return -1;
+
+	for (i = 0; i < PIPE_DEPTH; i++)
+		ring_push(&l->free, &l->jobs[i]);
+	return 0;
+}
 
-		gpt_buf = malloc(count);
-		if (!gpt_buf) {
+static void pipe_lane_free(struct pipe_lane *l)
+{
+	unsigned int i;
+
+	for (i = 0; i < PIPE_DEPTH; i++)
+		probe_free(&l->jobs[i].pr);
+	image_io_exit(&l->reader_io);
+	image_io_exit(&l->parser_io);
+	ring_free(&l->todo);
+	ring_free(&l->read);
+	ring_free(&l->done);
+	ring_free(&l->free);
+}
+
+/* Start the threads of up to num_lanes lanes and the writer */
+static int pipe_start(struct pipe *p, const struct probe *tmpl, unsigned int num_lanes)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < num_lanes; i++) {
+		struct pipe_lane *l = &p->lanes[i];
+
+		l->p = p;
+		if (pipe_lane_init(l, tmpl) != 0) {
 			err("Failed to allocate memory\n");
-			close(fd);
-			goto err_free;
+			pipe_lane_free(l);
+			break;
 		}
-
-		ofs = le64toh(gpt_h->lba_table) * sector_size;
-		if (lseek64(fd, ofs, SEEK_SET) != ofs) {
-			err("Failed to seek to GPT table: %s\n", strerror(errno));
-			close(fd);
-			goto err_free;
+		ret = pthread_create(&l->reader, NULL, pipe_reader, l);
+		if (ret != 0) {
+			err("Failed to create reader thread: %s\n", strerror(ret));
+			pipe_lane_free(l);
+			break;
 		}
+		ret = pthread_create(&l->parser, NULL, pipe_parser, l);
+		if (ret != 0) {
+			err("Failed to create parser thread: %s\n", strerror(ret));
+			ring_push(&l->todo, NULL);
+			pthread_join(l->reader, NULL);
+			pipe_lane_free(l);
+			break;
+		}
+		p->num_lanes++;
+	}
+	if (p->num_lanes == 0)
+		return -1;
+
+	ret = pthread_create(&p->writer, NULL, pipe_writer, p);
+	if (ret != 0) {
+		err("Failed to create writer thread: %s\n", strerror(ret));
+		return -1;
+	}
+	return 0;
+}
 
-		if (read(fd, gpt_buf, count) != (ssize_t)count) {
-			err("Failed to to read GPT table: %s\n", strerror(errno));
-			close(fd);
-			goto err_free;
+/* Feed the end marker to all lanes and wait for the pipeline to drain */
+static void pipe_stop(struct pipe *p, bool writer)
+{
+	unsigned int i;
+
+	for (i = 0; i < p->num_lanes; i++)
+		ring_push(&p->lanes[i].todo, NULL);
+	if (writer)
+		pthread_join(p->writer, NULL);
+	for (i = 0; i < p->num_lanes; i++) {
+		pthread_join(p->lanes[i].reader, NULL);
+		pthread_join(p->lanes[i].parser, NULL);
+		pipe_lane_free(&p->lanes[i]);
+	}
+}
+
+/*
+ * Probe all batch inputs with a pipeline of num_lanes lanes, each job with
+ * the options of tmpl. Arguments are expanded as glob patterns, with no
+ * arguments (or a single "-") the inputs are read from stdin, one per line.
+ * Returns the number of failed inputs or -1 on setup failure.
+ */
+static int probe_batch(const struct probe *tmpl, unsigned int num_lanes,
+		       bool ordered, int argc, char **argv)
+{
+	struct pipe p;
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned int failed = 0;
+	glob_t g;
+	int i;
+
+	memset(&p, 0, sizeof(p));
+	p.ordered = ordered;
+
+	p.lanes = calloc(num_lanes, sizeof(*p.lanes));
+	if (!p.lanes) {
+		err("Failed to allocate memory\n");
+		return -1;
+	}
+	pthread_mutex_init(&p.out_lock, NULL);
+	if (pipe_start(&p, tmpl, num_lanes) != 0) {
+		pipe_stop(&p, false);
+		pthread_mutex_destroy(&p.out_lock);
+		free(p.lanes);
+		return -1;
+	}
+
+	if (argc == 0 || (argc == 1 && strcmp(argv[0], "-") == 0)) {
+		ssize_t len;
+
+		while ((len = getline(&line, &line_size, stdin)) != -1) {
+			if (len > 0 && line[len - 1] == '\n')
+				line[--len] = '\0';
+			if (len == 0)
+				continue;
+			if (pipe_feed(&p, line) != 0)
+				failed++;
 		}
+		free(line);
+		goto out;
+	}
 
-		close(fd);
+	for (i = 0; i < argc; i++) {
+		size_t j;
 
-		crc_self = le32toh(gpt_h->crc_table);
-		crc = crc32(gpt_buf, gpt_size);
-		if (crc != crc_self) {
-			err("Invalid GPT table CRC 0x%04x, calculated 0x%04x\n", crc_self, crc);
-			goto err_free;
+		if (glob(argv[i], GLOB_NOCHECK, NULL, &g) != 0) {
+			err("Failed to expand %s\n", argv[i]);
+			globfree(&g);
+			failed++;
+			continue;
 		}
+		for (j = 0; j < g.gl_pathc; j++) {
+			if (pipe_feed(&p, g.gl_pathv[j]) != 0)
+				failed++;
+		}
+		globfree(&g);
+	}
+
+out:
+	pipe_stop(&p, true);
+	pthread_mutex_destroy(&p.out_lock);
+	free(p.lanes);
+	return (int)(failed + p.failed);
+}
+
+struct index_mismatch {
+	uint64_t	fingerprint;
+	unsigned int	unit;
+};
+
+static int index_mismatch_cmp(const void *a, const void *b)
+{
+	const struct index_mismatch *ma = a, *mb = b;
+
+	if (ma->fingerprint != mb->fingerprint)
+		return ma->fingerprint < mb->fingerprint ? -1 : 1;
+	return ma->unit < mb->unit ? -1 : ma->unit > mb->unit;
+}
 
-		if (verbose) {
-			printf("\nGPT header dump:\n");
-			hexdump(gpt_block, len);
+/*
+ * Compare the fingerprints of all units in the index to the one of unit
+ * ref_key. Only one unit per differing fingerprint is diffed field by field.
+ */
+static int index_compare(struct layout_index *idx, const char *ref_key)
+{
+	struct index_mismatch *mm;
+	struct layout *ref, *u;
+	struct outbuf ob;
+	unsigned int i, j, n = 0;
+	int ret = -1;
+
+	ref = layout_index_find(idx, ref_key, strlen(ref_key));
+	if (!ref) {
+		err("Reference %s not found in index\n", ref_key);
+		return -1;
+	}
+
+	mm = calloc(idx->num ? idx->num : 1, sizeof(*mm));
+	if (!mm) {
+		err("Failed to allocate memory\n");
+		return -1;
+	}
+	for (i = 0; i < idx->num; i++) {
+		if (idx->units[i].fingerprint == ref->fingerprint)
+			continue;
+		mm[n].fingerprint = idx->units[i].fingerprint;
+		mm[n++].unit = i;
+	}
+	qsort(mm, n, sizeof(*mm), index_mismatch_cmp);
+
+	outbuf_init(&ob);
+	outbuf_printf(&ob, "Reference %s (fingerprint %016" PRIx64 "): %u of %u units match\n",
+		      ref_key, ref->fingerprint, idx->num - n, idx->num);
+
+	for (i = 0; i < n; i = j) {
+		for (j = i; j < n && mm[j].fingerprint == mm[i].fingerprint; j++)
+			;
+		outbuf_printf(&ob, "\nLayout %016" PRIx64 " (%u units):\n", mm[i].fingerprint, j - i);
+		for (; i < j; i++) {
+			u = layout_index_get(idx, mm[i].unit);
+			if (!u)
+				goto corrupt;
+			outbuf_printf(&ob, "  %.*s\n", (int)u->key_len, u->key);
 		}
+		/* a unit of this layout, identical fingerprints aren't diffed again */
+		u = layout_index_get(idx, mm[j - 1].unit);
+		outbuf_printf(&ob, "Differences:\n");
+		layout_diff(&ob, ref, u);
+	}
+
+	ret = n == 0 ? 0 : -1;
+	goto out;
+corrupt:
+	err("Invalid unit %u in index\n", mm[i].unit);
+out:
+	outbuf_flush(&ob, STDOUT_FILENO);
+	outbuf_free(&ob);
+	free(mm);
+	return ret;
+}
 
-		printf("\nGUID partition table (%u partitions, size=%zu, sector=0x%" PRIx64 ", offset=0x%" PRIx64 ")\n",
-		       num_entries, gpt_size, le64toh(gpt_h->lba_table), ofs);
+int TOOL_MAIN(nvtegraparts)(int argc, char **argv)
+{
+	int c, ret = -1;
+	bool batch = false, jobs_set = false, ordered = true;
+	unsigned long jobs = 1;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	char *end;
+	const char *manifest_path = NULL, *index_path = NULL, *compare_key = NULL;
+	struct verify_manifest manifest = { NULL, 0 };
+	struct probe_index index;
+	bool index_loaded = false;
+	unsigned int line;
+	char *boot_dev = "/dev/mmcblk0boot1", *gpt_dev = "/dev/mmcblk0";
+	enum stats_format stats_format = STATS_TEXT;
+	struct image_io io;
+	struct probe pr;
+
+	image_io_init(&io);
+	if (probe_init(&pr) != 0) {
+		err("Failed to allocate memory\n");
+		goto out;
+	}
+	pr.io = &io;
+	if (ncpus < 1)
+		ncpus = 1;
 
-		for (i = 0; i < num_entries; i++) {
-			struct gpt_entry *gpt_e = (void *)(gpt_buf + i * le32toh(gpt_h->entry_size));
-			if (verbose) {
-				printf("\nGPT block %u dump:\n", i);
-				hexdump((uint8_t *)gpt_e, sizeof(*gpt_e));
+	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			batch = true;
+			break;
+		case 'j':
+			errno = 0;
+			jobs = strtoul(optarg, &end, 0);
+			if (errno || *end || end == optarg || jobs > (unsigned long)ncpus * JOBS_PER_CPU) {
+				err("Invalid number of jobs: %s (at most %ld)\n", optarg,
+				    ncpus * JOBS_PER_CPU);
+				goto out;
 			}
-			gpt_partition_print(i, gpt_e);
+			if (jobs == 0)
+				jobs = ncpus;
+			jobs_set = true;
+			break;
+		case 'u':
+			ordered = false;
+			break;
+		case 'c':
+			pr.check_gpt = true;
+			break;
+		case 'r':
+			pr.check_copy = true;
+			break;
+		case 'D':
+			pr.image_flags |= IMAGE_DIRECT;
+			break;
+		case 'f':
+			if (strcmp(optarg, "text") == 0)
+				pr.format = FORMAT_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				pr.format = FORMAT_JSON;
+			else if (strcmp(optarg, "binary") == 0)
+				pr.format = FORMAT_BINARY;
+			else
+				usage_and_exit(EXIT_FAILURE);
+			break;
+		case 'q':
+			pr.quiet = true;
+			break;
+		case 'h':
+			usage_and_exit(EXIT_SUCCESS);
+		case 'v':
+			pr.verbose = true;
+			break;
+		case 'z':
+			pr.dump_nonzero = true;
+			break;
+		case OPT_ALL:
+			pr.all_entries = true;
+			break;
+		case OPT_STATS:
+			if (!optarg || strcmp(optarg, "text") == 0)
+				stats_format = STATS_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				stats_format = STATS_JSON;
+			else
+				usage_and_exit(EXIT_FAILURE);
+			if (stats_enable() != 0) {
+				err("Built without statistics support, rebuild with STATS=1\n");
+				goto out;
+			}
+			break;
+		case OPT_VERIFY:
+			manifest_path = optarg;
+			break;
+		case OPT_EXTRACT:
+			pr.extract_path = optarg;
+			break;
+		case OPT_EXTRACT_FMT:
+			if (strcmp(optarg, "raw") == 0)
+				pr.extract_format = EXTRACT_RAW;
+			else if (strcmp(optarg, "android") == 0)
+				pr.extract_format = EXTRACT_ANDROID;
+			else
+				usage_and_exit(EXIT_FAILURE);
+			break;
+		case OPT_SKIP_ZERO:
+			pr.extract_flags |= EXTRACT_SKIP_ZERO;
+			break;
+		case OPT_INDEX:
+			index_path = optarg;
+			break;
+		case OPT_COMPARE:
+			compare_key = optarg;
+			break;
+		case OPT_RESOLVE:
+			pr.resolve = true;
+			break;
+		default:
+			usage_and_exit(EXIT_FAILURE);
 		}
-	} else {
-		printf("No GPT found or no block device file specified\n");
 	}
 
-	ret = 0;
-err_free:
-	free(buf);
-	free(gpt_buf);
+	/* Machine readable formats (and resolved LBAs) replace the text output */
+	if (pr.format != FORMAT_TEXT || pr.resolve)
+		pr.quiet = true;
+
+	if (manifest_path) {
+		if (verify_manifest_load(&manifest, manifest_path, &line) != 0) {
+			if (line)
+				err("Invalid line %u in manifest %s\n", line, manifest_path);
+			else
+				err("Failed to read manifest %s: %s\n", manifest_path, strerror(errno));
+			goto out;
+		}
+		pr.manifest = &manifest;
+		pr.verify_jobs = jobs;
+	}
+
+	/* -j hashes partitions in parallel with --verify, else it implies -b */
+	if (jobs_set && !manifest_path)
+		batch = true;
+	if (!batch)
+		jobs = 1;
+
+	if (batch && pr.extract_path) {
+		err("--extract can't be used in batch mode\n");
+		goto out;
+	}
+
+	if (pr.resolve && (batch || pr.format == FORMAT_BINARY)) {
+		err("--resolve can't be used in batch mode or with -f binary\n");
+		goto out;
+	}
+
+	if (compare_key && !index_path) {
+		err("--compare needs --index\n");
+		goto out;
+	}
+	if (index_path) {
+		if (layout_index_load(&index.idx, index_path) != 0) {
+			err("Failed to load index %s: %s\n", index_path, strerror(errno));
+			goto out;
+		}
+		pthread_mutex_init(&index.lock, NULL);
+		index_loaded = true;
+		pr.index = &index;
+	}
+
+	if (compare_key) {
+		if (index_compare(&index.idx, compare_key) == 0)
+			ret = EXIT_SUCCESS;
+		goto out;
+	}
+
+	if (batch) {
+		int failed = probe_batch(&pr, jobs, ordered, argc - optind, argv + optind);
+
+		ret = failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+		goto out_index;
+	}
+
+	if (optind < argc)
+		boot_dev = argv[optind];
+	if (optind + 1 < argc)
+		gpt_dev = argv[optind + 1];
+
+	if (pr.format == FORMAT_TEXT && !pr.resolve)
+		outbuf_printf(&pr.out, "Using boot device %s, GPT device %s\n", boot_dev, gpt_dev);
+
+	if (probe_device(&pr, boot_dev, gpt_dev) == 0)
+		ret = 0;
+	probe_flush(&pr);
+out_index:
+	/* failed inputs are left out, the others are kept */
+	if (index_loaded && layout_index_save(&index.idx, index_path) != 0) {
+		err("Failed to write index %s: %s\n", index_path, strerror(errno));
+		ret = EXIT_FAILURE;
+	}
+out:
+	stats_report(STDERR_FILENO, stats_format);
+	verify_manifest_free(&manifest);
+	if (index_loaded) {
+		layout_index_free(&index.idx);
+		pthread_mutex_destroy(&index.lock);
+	}
+	probe_free(&pr);
+	image_io_exit(&io);
 	return ret;
 }
@@ -0,0 +1,234 @@
+/*
+ * Growable output staging buffer, flushed with a single write()
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+#include "stats.h"
+
+#define OUTBUF_MIN_SIZE	4096
+
+void outbuf_init(struct outbuf *ob)
+{
+	memset(ob, 0, sizeof(*ob));
+}
+
+void outbuf_free(struct outbuf *ob)
+{
+	free(ob->buf);
+	outbuf_init(ob);
+}
+
+/* Make sure there is room for at least len more bytes (plus a '\0') */
+int outbuf_reserve(struct outbuf *ob, size_t len)
+{
+	size_t size;
+	char *buf;
+
+	if (ob->len + len < ob->size)
+		return 0;
+
+	size = ob->size ? ob->size : OUTBUF_MIN_SIZE;
+	while (size <= ob->len + len)
+		size *= 2;
+
+	buf = realloc(ob->buf, size);
+	if (!buf) {
+		ob->error = true;
+		return -1;
+	}
+
+	ob->buf = buf;
+	ob->size = size;
+	return 0;
+}
+
+void outbuf_write(struct outbuf *ob, const void *data, size_t len)
+{
+	if (outbuf_reserve(ob, len) != 0)
+		return;
+	memcpy(ob->buf + ob->len, data, len);
+	ob->len += len;
+}
+
+void outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (outbuf_reserve(ob, 128) != 0)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+
+	if ((size_t)len >= ob->size - ob->len) {
+		if (outbuf_reserve(ob, len) != 0)
+			return;
+		va_start(ap, fmt);
+		vsnprintf(ob->buf + ob->len, ob->size - ob->len, fmt, ap);
+		va_end(ap);
+	}
+
+	ob->len += len;
+}
+
+/* Write out the buffered data to fd and reset the buffer */
+int outbuf_flush(struct outbuf *ob, int fd)
+{
+	size_t off = 0;
+	int ret = 0;
+
+	while (off < ob->len) {
+		uint64_t t = stats_start();
+		ssize_t n = write(fd, ob->buf + off, ob->len - off);
+
+		stats_stop(STATS_PRINT, t, 1, n > 0 ? n : 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -1;
+			break;
+		}
+		off += n;
+	}
+
+	if (ob->error)
+		ret = -1;
+	outbuf_reset(ob);
+	return ret;
+}
+
+static const char hex_digits[16] = "0123456789abcdef";
+
+void outbuf_json_str(struct outbuf *ob, const char *str, size_t len)
+{
+	size_t i;
+	char *p;
+
+	/* worst case every character needs a \u00XX escape */
+	if (outbuf_reserve(ob, len * 6 + 2) != 0)
+		return;
+
+	p = ob->buf + ob->len;
+	*p++ = '"';
+	for (i = 0; i < len; i++) {
+		unsigned char c = str[i];
+
+		if (c == '"' || c == '\\') {
+			*p++ = '\\';
+			*p++ = c;
+		} else if (c < 0x20) {
+			*p++ = '\\';
+			*p++ = 'u';
+			*p++ = '0';
+			*p++ = '0';
+			*p++ = hex_digits[c >> 4];
+			*p++ = hex_digits[c & 0xf];
+		} else
+			*p++ = c;
+	}
+	*p++ = '"';
+
+	ob->len = p - ob->buf;
+}
+
+/*
+ * Order in which the on-disk GUID bytes are printed: the first three fields
+ * are little endian, the remaining 8 bytes are stored as is. A 0xff entry
+ * marks a '-' separator.
+ */
+static const uint8_t guid_str_order[] = {
+	3, 2, 1, 0, 0xff, 5, 4, 0xff, 7, 6, 0xff, 8, 9, 0xff, 10, 11, 12, 13, 14, 15,
+};
+
+void guid_to_str(const uint8_t *guid, char *str)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(guid_str_order); i++) {
+		uint8_t idx = guid_str_order[i];
+
+		if (idx == 0xff) {
+			*str++ = '-';
+		} else {
+			*str++ = hex_digits[guid[idx] >> 4];
+			*str++ = hex_digits[guid[idx] & 0xf];
+		}
+	}
+	*str = '\0';
+}
+
+/* "000102...ff": two hex digits for every byte value */
+#define HEX_ROW(h)	h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" \
+			h "8" h "9" h "a" h "b" h "c" h "d" h "e" h "f"
+static const char hex_pairs[512 + 1] =
+	HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3")
+	HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+	HEX_ROW("8") HEX_ROW("9") HEX_ROW("a") HEX_ROW("b")
+	HEX_ROW("c") HEX_ROW("d") HEX_ROW("e") HEX_ROW("f");
+
+/* Character shown in the ASCII column for every byte value */
+#define DOTS8		"........"
+#define DOTS32		DOTS8 DOTS8 DOTS8 DOTS8
+static const char ascii_col[256 + 1] =
+	DOTS32
+	" !\"#$%&'()*+,-./0123456789:;<=>?"
+	"@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_"
+	"`abcdefghijklmnopqrstuvwxyz{|}~."
+	DOTS32 DOTS32 DOTS32 DOTS32;
+
+/* "xxxxxxxx  xx xx xx xx xx xx xx xx  xx xx xx xx xx xx xx xx  |................|\n" */
+#define HEXDUMP_LINE_LEN	(8 + 1 + 16 * 3 + 1 + 3 + 16 + 2)
+
+void outbuf_hexdump(struct outbuf *ob, const uint8_t *buf, size_t len)
+{
+	size_t off;
+	char *p;
+
+	if (outbuf_reserve(ob, (len + 15) / 16 * HEXDUMP_LINE_LEN) != 0)
+		return;
+
+	p = ob->buf + ob->len;
+	for (off = 0; off < len; off += 16) {
+		size_t i, n = len - off < 16 ? len - off : 16;
+		uint32_t o = off;
+
+		for (i = 0; i < 4; i++, o <<= 8)
+			memcpy(p + 2 * i, &hex_pairs[2 * (o >> 24)], 2);
+		p += 8;
+
+		for (i = 0; i < 16; i++) {
+			if ((i & 0x07) == 0)
+				*p++ = ' ';
+			*p++ = ' ';
+			if (i < n)
+				memcpy(p, &hex_pairs[2 * buf[off + i]], 2);
+			else
+				memset(p, ' ', 2);
+			p += 2;
+		}
+
+		memcpy(p, "  |", 3);
+		p += 3;
+		for (i = 0; i < n; i++)
+			*p++ = ascii_col[buf[off + i]];
+		*p++ = '|';
+		*p++ = '\n';
+	}
+
+	ob->len = p - ob->buf;
+}
@@ -0,0 +1,61 @@
+/*
+ * Growable output staging buffer, flushed with a single write()
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct outbuf {
+	char	*buf;
+	size_t	len;
+	size_t	size;
+	bool	error;		/* an allocation failed, output is truncated */
+};
+
+void outbuf_init(struct outbuf *ob);
+void outbuf_free(struct outbuf *ob);
+
+static inline void outbuf_reset(struct outbuf *ob)
+{
+	ob->len = 0;
+	ob->error = false;
+}
+
+int outbuf_reserve(struct outbuf *ob, size_t len);
+void outbuf_write(struct outbuf *ob, const void *data, size_t len);
+void outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+int outbuf_flush(struct outbuf *ob, int fd);
+
+static inline void outbuf_puts(struct outbuf *ob, const char *str)
+{
+	outbuf_write(ob, str, strlen(str));
+}
+
+/* Append str (of len bytes) as a JSON string literal, including the quotes */
+void outbuf_json_str(struct outbuf *ob, const char *str, size_t len);
+
+/*
+ * Append a hexdump of len bytes at buf, 16 bytes per line with offset, hex and
+ * ASCII columns.
+ */
+void outbuf_hexdump(struct outbuf *ob, const uint8_t *buf, size_t len);
+
+#define GUID_STR_LEN	36
+
+/*
+ * Format the 16 byte on-disk (mixed endian, as used by GPT) representation of
+ * a GUID as a string of GUID_STR_LEN characters plus terminating '\0'.
+ */
+void guid_to_str(const uint8_t *guid, char *str);
+
+#endif /* OUTBUF_H */
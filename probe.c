@@ -0,0 +1,184 @@
+/*
+ * Probe a device for its PT, GPT and config block
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+
+#include "probe.h"
+
+static int dev_probe_batch(struct dev_probe *dp, struct image_req *reqs, unsigned int n)
+{
+	unsigned int i;
+	int failed;
+
+	if (dp->read)
+		failed = dp->read(dp->read_arg, dp->io, reqs, n);
+	else
+		failed = image_io_read(dp->io, reqs, n);
+
+	for (i = 0; i < n && failed; i++)
+		if (reqs[i].error && !dp->error)
+			dp->error = reqs[i].error;
+	return failed;
+}
+
+/* Read a single range of the image, into a newly allocated buffer if needed */
+static const void *dev_probe_read(struct dev_probe *dp, uint64_t off, size_t len, void **mem)
+{
+	struct image_req req;
+
+	if (off > dp->img.size || len > dp->img.size - off)
+		return NULL;
+
+	memset(&req, 0, sizeof(req));
+	req.img = &dp->img;
+	req.off = off;
+	req.len = len;
+	if (!dp->img.map) {
+		*mem = req.buf = malloc(len);
+		if (!req.buf) {
+			dp->error = ENOMEM;
+			return NULL;
+		}
+	}
+
+	if (dev_probe_batch(dp, &req, 1) != 0)
+		return NULL;
+	return req.data;
+}
+
+/* Parse the PT starting with the data of request r, reading the rest if needed */
+static void dev_probe_ptable(struct dev_probe *dp, const struct image_req *r)
+{
+	const void *data = r->data;
+	size_t size;
+
+	if (nvtegra_ptable_size(r->data, r->len, &size) != APALIS_OK)
+		return;
+	if (size > r->len) {
+		data = dev_probe_read(dp, 0, size, &dp->pt_mem);
+		if (!data)
+			return;
+	}
+
+	switch (nvtegra_ptable_parse(data, size, &dp->pt)) {
+	case APALIS_OK:
+	case APALIS_E_PT_PART_ID:
+		dp->pt_found = true;
+		break;
+	default:
+		break;
+	}
+}
+
+static void dev_probe_gpt(struct dev_probe *dp, const void *hdr)
+{
+	int sector_size = GPT_BLOCK_SIZE;
+	const void *table;
+
+	if (gpt_header_parse(hdr, GPT_BLOCK_SIZE, dp->img.size, &dp->gpt) != APALIS_OK)
+		return;
+
+	if (!dp->img.map && ioctl(dp->img.fd, BLKSSZGET, &sector_size) != 0)
+		sector_size = GPT_BLOCK_SIZE;
+	table = dev_probe_read(dp, dp->gpt.lba_table * sector_size, dp->gpt.table_size,
+			       &dp->gpt_mem);
+	if (!table || gpt_table_parse(&dp->gpt, table, dp->gpt.table_size) != APALIS_OK)
+		return;
+
+	dp->gpt_used = calloc(GPT_BITMAP_WORDS(dp->gpt.num_entries), sizeof(uint64_t));
+	if (!dp->gpt_used) {
+		dp->error = ENOMEM;
+		return;
+	}
+	dp->gpt_num_used = gpt_used_entries(&dp->gpt, dp->gpt_used);
+	dp->gpt_found = true;
+}
+
+static bool dev_probe_cfgblock(struct dev_probe *dp, const struct image_req *r)
+{
+	if (!r || trdx_cfgblock_parse(r->data, r->len, &dp->cb) != APALIS_OK)
+		return false;
+	dp->cb_found = true;
+	dp->cb_off = r->off;
+	return true;
+}
+
+void dev_probe(struct dev_probe *dp, const char *path, struct image_io *io,
+	       dev_probe_read_fn read, void *read_arg)
+{
+	struct image_req reqs[3], *tail_req, *pt_req = NULL, *arg_req = NULL;
+	unsigned int n = 0;
+
+	memset(dp, 0, offsetof(struct dev_probe, pt_buf));
+	dp->io = io;
+	dp->read = read;
+	dp->read_arg = read_arg;
+
+	if (image_open(&dp->img, path) != 0) {
+		dp->error = errno;
+		return;
+	}
+	dp->opened = true;
+	dp->size = dp->img.size;
+
+	memset(reqs, 0, sizeof(reqs));
+	if (dp->img.size < GPT_BLOCK_SIZE)
+		return;
+
+	tail_req = &reqs[n++];
+	tail_req->img = &dp->img;
+	tail_req->off = dp->img.size - GPT_BLOCK_SIZE;
+	tail_req->len = GPT_BLOCK_SIZE;
+	tail_req->buf = dp->tail_buf;
+
+	if (dp->img.size >= NVTEGRA_PT_MIN_READ) {
+		pt_req = &reqs[n++];
+		pt_req->img = &dp->img;
+		pt_req->off = 0;
+		pt_req->len = NVTEGRA_PT_MIN_READ;
+		pt_req->buf = dp->pt_buf;
+	}
+
+	if (TRDX_CFG_ARG_PART_OFF + TRDX_CFG_BLOCK_MAX_SIZE <= dp->img.size) {
+		arg_req = &reqs[n++];
+		arg_req->img = &dp->img;
+		arg_req->off = TRDX_CFG_ARG_PART_OFF;
+		arg_req->len = TRDX_CFG_BLOCK_MAX_SIZE;
+		arg_req->buf = dp->arg_buf;
+	}
+
+	if (dev_probe_batch(dp, reqs, n) != 0)
+		return;
+
+	if (pt_req)
+		dev_probe_ptable(dp, pt_req);
+	/* a device with the config block in its ARG partition also holds a GPT */
+	if (!dev_probe_cfgblock(dp, tail_req)) {
+		dev_probe_gpt(dp, tail_req->data);
+		dev_probe_cfgblock(dp, arg_req);
+	}
+}
+
+void dev_probe_free(struct dev_probe *dp)
+{
+	if (dp->opened)
+		image_close(&dp->img);
+	dp->opened = false;
+	free(dp->pt_mem);
+	free(dp->gpt_mem);
+	free(dp->gpt_used);
+	dp->pt_mem = dp->gpt_mem = NULL;
+	dp->gpt_used = NULL;
+}
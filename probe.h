@@ -0,0 +1,67 @@
+/*
+ * Probe a device for all the metadata it may hold (PT, GPT and config block)
+ * with as few reads as possible, shared by apalis-scan and apalis-tools report
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image.h"
+#include "libapalis.h"
+
+/*
+ * Issue a batch of reads like image_io_read(), e.g. to limit the requests in
+ * flight or to time them. Returns the number of failed requests.
+ */
+typedef int (*dev_probe_read_fn)(void *arg, struct image_io *io, struct image_req *reqs,
+				 unsigned int n);
+
+/* Everything found on a device */
+struct dev_probe {
+	int			error;		/* errno of a failed open or read */
+	uint64_t		size;
+	struct image		img;
+	bool			opened;
+	struct nvtegra_ptable_info pt;
+	bool			pt_found;
+	struct gpt_info		gpt;
+	uint64_t		*gpt_used;	/* bitmap of the entries in use */
+	unsigned int		gpt_num_used;
+	bool			gpt_found;
+	struct trdx_cfgblock	cb;
+	uint64_t		cb_off;
+	bool			cb_found;
+
+	dev_probe_read_fn	read;
+	void			*read_arg;
+	struct image_io		*io;
+	void			*pt_mem, *gpt_mem;
+
+	uint8_t			pt_buf[NVTEGRA_PT_MIN_READ];
+	uint8_t			tail_buf[GPT_BLOCK_SIZE];
+	uint8_t			arg_buf[TRDX_CFG_BLOCK_MAX_SIZE];
+};
+
+/*
+ * Probe the device at path: the PT at 0, the last sector (config block in
+ * the 1st boot area, or backup GPT header) and the config block in the ARG
+ * partition are read in a single batch, only the rest of a large PT and the
+ * GPT table need another read. The GPT is only looked for if the last sector
+ * is not a config block. Reads go through read (with read_arg and io), or
+ * image_io_read(io, ...) if read is NULL.
+ *
+ * The PT and GPT entries (pt.pt, gpt and gpt_used) are only valid until
+ * dev_probe_free(), the other results are kept.
+ */
+void dev_probe(struct dev_probe *dp, const char *path, struct image_io *io,
+	       dev_probe_read_fn read, void *read_arg);
+void dev_probe_free(struct dev_probe *dp);
+
+#endif /* PROBE_H */
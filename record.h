@@ -0,0 +1,127 @@
+/*
+ * Fixed-layout binary output records (--format=binary)
+ *
+ * All fields are little endian. Each record starts with a struct rec_hdr,
+ * rec_size allows to skip records of unknown type. Records are padded to a
+ * multiple of 8 bytes.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+
+#define REC_MAGIC_PTABLE	0x5450564e	/* "NVPT" */
+#define REC_MAGIC_CFGBLOCK	0x42434454	/* "TDCB" */
+#define REC_VERSION		1
+
+#define REC_ALIGN		8
+
+struct rec_hdr {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	__reserved;
+	uint32_t	rec_size;	/* total size of the record including this header */
+	int32_t		status;		/* 0 on success, -1 on error */
+} __attribute__((packed));
+
+/*
+ * nvtegraparts record: followed by num_parts struct rec_pt_part, then
+ * num_gpt_entries struct rec_gpt_entry, then the boot and GPT device paths
+ * (not NUL terminated).
+ */
+#define REC_PT_F_GPT		0x1	/* a valid GPT was found */
+#define REC_PT_F_GPT_CHECKED	0x2	/* primary and backup GPT verified */
+
+struct rec_ptable {
+	struct rec_hdr	hdr;
+	uint32_t	flags;
+	uint32_t	pt_version;
+	uint32_t	table_size;
+	uint32_t	num_parts;
+	uint32_t	num_gpt_entries;
+	uint16_t	boot_path_len;
+	uint16_t	gpt_path_len;
+	uint64_t	gpt_lba_table;
+	uint8_t		disk_guid[16];
+} __attribute__((packed));
+
+struct rec_pt_part {
+	uint32_t	id;
+	char		name[4];
+	uint32_t	allocation_policy;
+	uint32_t	fs_type;
+	uint32_t	virt_start_sector;
+	uint32_t	virt_size;
+	uint32_t	start_sector;
+	uint32_t	end_sector;
+	uint32_t	type;
+	uint32_t	__reserved;
+} __attribute__((packed));
+
+/* GPT_NAME_STR_LEN (36 UTF-16 units of up to 3 UTF-8 bytes) + NUL, padded */
+#define REC_GPT_NAME_SIZE	112
+
+struct rec_gpt_entry {
+	uint8_t		type[16];	/* on-disk GUID representation */
+	uint8_t		uuid[16];
+	uint64_t	lba_start;
+	uint64_t	lba_end;
+	uint64_t	attr;
+	char		name[REC_GPT_NAME_SIZE];	/* UTF-8, NUL padded, empty for
+							 * unused entries unless --all is given */
+} __attribute__((packed));
+
+/* trdx-configblock record: followed by the device path (not NUL terminated) */
+#define REC_CB_F_VALID		0x1	/* a valid config block was found */
+#define REC_CB_F_ERROR		0x2	/* the device couldn't be read (columnar only) */
+
+struct rec_cfgblock {
+	struct rec_hdr	hdr;
+	uint32_t	flags;
+	uint32_t	serial;
+	uint64_t	offset;
+	uint16_t	prodid;
+	uint16_t	ver_major;
+	uint16_t	ver_minor;
+	uint16_t	ver_assembly;
+	uint8_t		mac[6];
+	uint16_t	path_len;
+} __attribute__((packed));
+
+/*
+ * trdx-configblock columnar file (--format=columnar): a struct rec_cb_columns
+ * followed by one array per column, each holding a value for every row and
+ * starting at the offset given in col_off (a multiple of 8). Paths are stored
+ * as num_rows + 1 offsets into the column of concatenated path bytes.
+ */
+#define REC_MAGIC_CB_COLUMNS	0x43434454	/* "TDCC" */
+
+enum {
+	REC_CB_COL_FLAGS,	/* uint32_t, REC_CB_F_* */
+	REC_CB_COL_SERIAL,	/* uint32_t */
+	REC_CB_COL_OFFSET,	/* uint64_t, offset of the config block */
+	REC_CB_COL_PRODID,	/* uint16_t */
+	REC_CB_COL_VER_MAJOR,	/* uint16_t */
+	REC_CB_COL_VER_MINOR,	/* uint16_t */
+	REC_CB_COL_VER_ASSEMBLY, /* uint16_t */
+	REC_CB_COL_MAC,		/* uint8_t[6] */
+	REC_CB_COL_PATH_OFF,	/* uint64_t, num_rows + 1 offsets into REC_CB_COL_PATH */
+	REC_CB_COL_PATH,	/* char, not NUL terminated */
+	REC_CB_COL_MAX,
+};
+
+struct rec_cb_columns {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	num_cols;	/* REC_CB_COL_MAX */
+	uint64_t	num_rows;
+	uint64_t	col_off[REC_CB_COL_MAX];	/* from the start of the file */
+	uint64_t	size;		/* of the whole file */
+} __attribute__((packed));
+
+#endif /* RECORD_H */
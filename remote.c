@@ -0,0 +1,750 @@
+/*
+ * Remote image source: images served over HTTP (with Range requests) or NBD
+ *
+ * Only the byte ranges actually needed are fetched, so probing a multi-GB
+ * dump on a web server or object store moves a few KiB. Reads are rounded out
+ * to REMOTE_BLOCK_SIZE blocks which are kept in a small LRU cache, so e.g. the
+ * last sector (read for the backup GPT header and again for the config block)
+ * is only fetched once. A run of adjacent blocks missing from the cache is
+ * fetched with a single request, reads larger than the cache bypass it.
+ *
+ * HTTP connections are kept alive and reopened if the server closed them, the
+ * size of the image is taken from the Content-Range of the first request
+ * (which also fills the cache with the block holding the PT). NBD servers are
+ * spoken to using the fixed newstyle (NBD_OPT_EXPORT_NAME) or oldstyle
+ * handshake and simple replies.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "remote.h"
+#include "stats.h"
+
+#define REMOTE_BLOCK_SIZE	4096
+#define REMOTE_CACHE_BLOCKS	16
+#define REMOTE_HDR_MAX		8192	/* HTTP response headers */
+#define REMOTE_TIMEOUT		30	/* seconds, for connect, send and receive */
+
+#define HTTP_DEFAULT_PORT	"80"
+#define NBD_DEFAULT_PORT	"10809"
+
+/* NBD protocol, see https://github.com/NetworkBlockDevice/nbd/blob/master/doc/proto.md */
+#define NBD_MAGIC		0x4e42444d41474943ULL	/* "NBDMAGIC" */
+#define NBD_OLDSTYLE_MAGIC	0x0000420281861253ULL
+#define NBD_OPTS_MAGIC		0x49484156454f5054ULL	/* "IHAVEOPT" */
+#define NBD_REQUEST_MAGIC	0x25609513
+#define NBD_REPLY_MAGIC		0x67446698
+#define NBD_FLAG_FIXED_NEWSTYLE	(1 << 0)
+#define NBD_FLAG_NO_ZEROES	(1 << 1)
+#define NBD_OPT_EXPORT_NAME	1
+#define NBD_CMD_READ		0
+#define NBD_CMD_DISC		2
+
+struct nbd_request {
+	uint32_t	magic;
+	uint16_t	flags;
+	uint16_t	type;
+	uint64_t	handle;
+	uint64_t	offset;
+	uint32_t	length;
+} __attribute__((packed));
+
+struct nbd_reply {
+	uint32_t	magic;
+	uint32_t	error;
+	uint64_t	handle;
+} __attribute__((packed));
+
+enum remote_proto {
+	REMOTE_HTTP,
+	REMOTE_NBD,
+};
+
+struct remote_block {
+	uint64_t	blk;
+	uint64_t	used;		/* LRU tick of the last use, 0 if empty */
+	uint8_t		data[REMOTE_BLOCK_SIZE];
+};
+
+struct remote {
+	enum remote_proto	proto;
+	char			*host;
+	char			*port;
+	char			*path;		/* HTTP path and query, or NBD export */
+	char			*req_hdr;	/* HTTP request up to the Range header */
+	int			fd;		/* -1 if not connected */
+	uint64_t		size;
+	uint64_t		handle;		/* of the last NBD request */
+	/* received part of an HTTP response not consumed yet */
+	char			rbuf[REMOTE_HDR_MAX];
+	size_t			rpos, rlen;
+	uint64_t		tick;
+	struct remote_block	cache[REMOTE_CACHE_BLOCKS];
+};
+
+bool remote_is_url(const char *path)
+{
+	return strncmp(path, "http://", 7) == 0 || strncmp(path, "nbd://", 6) == 0;
+}
+
+/* Split [user@]HOST[:PORT] (HOST may be a bracketed IPv6 address) */
+static int parse_authority(struct remote *r, const char *s, size_t len, const char *def_port)
+{
+	const char *at = memchr(s, '@', len), *end = s + len, *colon;
+
+	if (at) {
+		len -= at + 1 - s;
+		s = at + 1;
+	}
+
+	if (len > 0 && s[0] == '[') {
+		const char *b = memchr(s, ']', len);
+
+		if (!b || (b + 1 < end && b[1] != ':'))
+			return -1;
+		r->host = strndup(s + 1, b - s - 1);
+		colon = b + 1 < end ? b + 1 : NULL;
+	} else {
+		colon = memchr(s, ':', len);
+		r->host = strndup(s, colon ? (size_t)(colon - s) : len);
+	}
+
+	r->port = colon ? strndup(colon + 1, end - colon - 1) : strdup(def_port);
+	if (!r->host || !r->port)
+		return -1;
+	return r->host[0] && r->port[0] ? 0 : -1;
+}
+
+static int parse_url(struct remote *r, const char *url)
+{
+	const char *def_port, *s, *slash;
+
+	if (strncmp(url, "http://", 7) == 0) {
+		r->proto = REMOTE_HTTP;
+		def_port = HTTP_DEFAULT_PORT;
+		s = url + 7;
+	} else {
+		r->proto = REMOTE_NBD;
+		def_port = NBD_DEFAULT_PORT;
+		s = url + 6;
+	}
+
+	slash = strchr(s, '/');
+	if (parse_authority(r, s, slash ? (size_t)(slash - s) : strlen(s), def_port) != 0)
+		return -1;
+
+	if (r->proto == REMOTE_HTTP)
+		r->path = strdup(slash ? slash : "/");
+	else
+		r->path = strdup(slash ? slash + 1 : "");
+	return r->path ? 0 : -1;
+}
+
+static void sock_close(struct remote *r)
+{
+	if (r->fd >= 0)
+		close(r->fd);
+	r->fd = -1;
+	r->rpos = r->rlen = 0;
+}
+
+static int sock_write(struct remote *r, struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	while (iovcnt > 0) {
+		ssize_t n;
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		n = sendmsg(r->fd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+/* Read exactly len bytes, starting with the buffered part of the response */
+static int sock_read(struct remote *r, void *buf, size_t len)
+{
+	size_t done = 0;
+
+	if (r->rpos < r->rlen) {
+		done = r->rlen - r->rpos < len ? r->rlen - r->rpos : len;
+		memcpy(buf, r->rbuf + r->rpos, done);
+		r->rpos += done;
+	}
+
+	while (done < len) {
+		ssize_t n = read(r->fd, (uint8_t *)buf + done, len - done);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+static int sock_readv(struct remote *r, const struct iovec *iov, int iovcnt, size_t len)
+{
+	for (; iovcnt > 0 && len > 0; iov++, iovcnt--) {
+		size_t n = iov->iov_len < len ? iov->iov_len : len;
+
+		if (sock_read(r, iov->iov_base, n) != 0)
+			return -1;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int nbd_handshake(struct remote *r, uint64_t *size)
+{
+	uint8_t zeroes[124];
+	struct {
+		uint64_t	magic;
+		uint64_t	magic2;
+	} __attribute__((packed)) hello;
+	struct {
+		uint64_t	magic;
+		uint32_t	opt;
+		uint32_t	len;
+	} __attribute__((packed)) opt;
+	uint64_t export_size;
+	uint32_t cflags;
+	uint16_t flags, tflags;
+	struct iovec iov[3];
+
+	if (sock_read(r, &hello, sizeof(hello)) != 0)
+		return -1;
+	if (be64toh(hello.magic) != NBD_MAGIC)
+		goto proto;
+
+	if (be64toh(hello.magic2) == NBD_OLDSTYLE_MAGIC) {
+		uint32_t oflags;
+
+		if (sock_read(r, &export_size, sizeof(export_size)) != 0 ||
+		    sock_read(r, &oflags, sizeof(oflags)) != 0 ||
+		    sock_read(r, zeroes, sizeof(zeroes)) != 0)
+			return -1;
+		*size = be64toh(export_size);
+		return 0;
+	}
+	if (be64toh(hello.magic2) != NBD_OPTS_MAGIC)
+		goto proto;
+
+	if (sock_read(r, &flags, sizeof(flags)) != 0)
+		return -1;
+	flags = be16toh(flags);
+	cflags = htobe32(flags & (NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES));
+
+	opt.magic = htobe64(NBD_OPTS_MAGIC);
+	opt.opt = htobe32(NBD_OPT_EXPORT_NAME);
+	opt.len = htobe32(strlen(r->path));
+	iov[0] = (struct iovec) { &cflags, sizeof(cflags) };
+	iov[1] = (struct iovec) { &opt, sizeof(opt) };
+	iov[2] = (struct iovec) { r->path, strlen(r->path) };
+	if (sock_write(r, iov, 3) != 0)
+		return -1;
+
+	/* the server closes the connection if there is no such export */
+	if (sock_read(r, &export_size, sizeof(export_size)) != 0) {
+		if (errno == ECONNRESET)
+			errno = ENOENT;
+		return -1;
+	}
+	if (sock_read(r, &tflags, sizeof(tflags)) != 0 ||
+	    (!(flags & NBD_FLAG_NO_ZEROES) && sock_read(r, zeroes, sizeof(zeroes)) != 0))
+		return -1;
+
+	*size = be64toh(export_size);
+	return 0;
+proto:
+	errno = EPROTO;
+	return -1;
+}
+
+static int remote_connect(struct remote *r)
+{
+	struct timeval tv = { .tv_sec = REMOTE_TIMEOUT };
+	struct addrinfo hints, *res, *ai;
+	uint64_t t = stats_start(), size;
+	int one = 1, ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	ret = getaddrinfo(r->host, r->port, &hints, &res);
+	if (ret != 0) {
+		errno = ret == EAI_SYSTEM ? errno : EHOSTUNREACH;
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		r->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (r->fd < 0)
+			continue;
+		setsockopt(r->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(r->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		if (connect(r->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		ret = errno;
+		close(r->fd);
+		r->fd = -1;
+		errno = ret;
+	}
+	freeaddrinfo(res);
+	stats_stop(STATS_OPEN, t, 2, 0);
+	if (r->fd < 0)
+		return -1;
+
+	/* requests are small and answered right away */
+	setsockopt(r->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (r->proto == REMOTE_NBD) {
+		t = stats_start();
+		ret = nbd_handshake(r, &size);
+		stats_stop(STATS_OPEN, t, 1, 0);
+		if (ret != 0) {
+			sock_close(r);
+			return -1;
+		}
+		/* a reconnect must get the same export */
+		if (r->size && size != r->size) {
+			sock_close(r);
+			errno = ESTALE;
+			return -1;
+		}
+		r->size = size;
+	}
+
+	return 0;
+}
+
+static int nbd_read(struct remote *r, uint64_t off, size_t len, const struct iovec *iov, int iovcnt)
+{
+	struct nbd_request req = {
+		.magic	= htobe32(NBD_REQUEST_MAGIC),
+		.type	= htobe16(NBD_CMD_READ),
+		.handle	= htobe64(++r->handle),
+		.offset	= htobe64(off),
+		.length	= htobe32(len),
+	};
+	struct nbd_reply reply;
+	struct iovec riov = { &req, sizeof(req) };
+
+	if (sock_write(r, &riov, 1) != 0 || sock_read(r, &reply, sizeof(reply)) != 0)
+		return -1;
+
+	if (be32toh(reply.magic) != NBD_REPLY_MAGIC || be64toh(reply.handle) != r->handle) {
+		sock_close(r);
+		errno = EPROTO;
+		return -1;
+	}
+	if (reply.error) {
+		errno = be32toh(reply.error);
+		return -1;
+	}
+
+	return sock_readv(r, iov, iovcnt, len);
+}
+
+/* Case insensitive match of header name at line, returns the value or NULL */
+static const char *http_header(const char *line, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (strncasecmp(line, name, len) != 0 || line[len] != ':')
+		return NULL;
+	line += len + 1;
+	while (*line == ' ' || *line == '\t')
+		line++;
+	return line;
+}
+
+static int http_status_errno(int status)
+{
+	switch (status) {
+	case 200:
+		return EOPNOTSUPP;	/* Range not supported */
+	case 401:
+	case 403:
+		return EACCES;
+	case 404:
+	case 410:
+		return ENOENT;
+	default:
+		return EIO;
+	}
+}
+
+/*
+ * GET up to len bytes at off. The number of bytes received (which is less than
+ * len only at the end of the image) is returned in got, the size of the image
+ * in total.
+ */
+static int http_get(struct remote *r, uint64_t off, size_t len, const struct iovec *iov,
+		    int iovcnt, size_t *got, uint64_t *total)
+{
+	char range[64], *hdr_end = NULL, *line, *next;
+	struct iovec req[2];
+	uint64_t first = 0, last = 0, clen = UINT64_MAX;
+	bool have_range = false, close_conn = false, chunked = false;
+	int status = 0;
+
+	r->rpos = r->rlen = 0;
+	req[0] = (struct iovec) { r->req_hdr, strlen(r->req_hdr) };
+	req[1] = (struct iovec) { range, snprintf(range, sizeof(range),
+					"Range: bytes=%" PRIu64 "-%" PRIu64 "\r\n\r\n",
+					off, off + len - 1) };
+	if (sock_write(r, req, 2) != 0)
+		return -1;
+
+	while (!hdr_end) {
+		ssize_t n;
+
+		if (r->rlen == sizeof(r->rbuf) - 1) {
+			errno = EPROTO;
+			goto err;
+		}
+		n = read(r->fd, r->rbuf + r->rlen, sizeof(r->rbuf) - 1 - r->rlen);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			if (n == 0)
+				errno = ECONNRESET;
+			return -1;
+		}
+		r->rlen += n;
+		r->rbuf[r->rlen] = '\0';
+		hdr_end = strstr(r->rbuf, "\r\n\r\n");
+	}
+	r->rpos = hdr_end + 4 - r->rbuf;
+	*hdr_end = '\0';
+
+	if (sscanf(r->rbuf, "HTTP/%*u.%*u %d", &status) != 1) {
+		errno = EPROTO;
+		goto err;
+	}
+
+	for (line = strstr(r->rbuf, "\r\n"); line; line = next) {
+		const char *val;
+
+		line += 2;
+		next = strstr(line, "\r\n");
+		if (next)
+			*next = '\0';
+
+		if ((val = http_header(line, "Content-Length")))
+			clen = strtoull(val, NULL, 10);
+		else if ((val = http_header(line, "Content-Range")))
+			have_range = sscanf(val, "bytes %" SCNu64 "-%" SCNu64 "/%" SCNu64,
+					    &first, &last, total) == 3;
+		else if ((val = http_header(line, "Connection")))
+			close_conn = strncasecmp(val, "close", 5) == 0;
+		else if ((val = http_header(line, "Transfer-Encoding")))
+			chunked = strncasecmp(val, "identity", 8) != 0;
+	}
+
+	if (status != 206) {
+		errno = http_status_errno(status);
+		goto err;
+	}
+	if (!have_range || chunked || first != off || last < first || last - first >= len ||
+	    (clen != UINT64_MAX && clen != last - first + 1)) {
+		errno = EPROTO;
+		goto err;
+	}
+	/* the object was replaced */
+	if (r->size && *total != r->size) {
+		errno = ESTALE;
+		goto err;
+	}
+
+	*got = last - first + 1;
+	if (sock_readv(r, iov, iovcnt, *got) != 0)
+		return -1;
+	if (close_conn)
+		sock_close(r);
+	return 0;
+err:
+	/* the rest of the response is not read, so the connection can't be reused */
+	sock_close(r);
+	return -1;
+}
+
+/*
+ * Fetch len bytes at off into iov. A kept-alive connection may have been
+ * closed by the server in the meantime, so the request is retried once on a
+ * new connection.
+ */
+static ssize_t remote_fetch(struct remote *r, uint64_t off, size_t len, const struct iovec *iov,
+			    int iovcnt, uint64_t *total)
+{
+	uint64_t t = stats_start(), size;
+	size_t got = len;
+	int tries, ret = -1;
+
+	for (tries = 0; tries < 2 && ret != 0; tries++) {
+		bool reused = r->fd >= 0;
+
+		if (!reused && remote_connect(r) != 0)
+			break;
+
+		if (r->proto == REMOTE_HTTP)
+			ret = http_get(r, off, len, iov, iovcnt, &got, total ? total : &size);
+		else
+			ret = nbd_read(r, off, len, iov, iovcnt);
+
+		if (ret != 0) {
+			if (!reused || (errno != ECONNRESET && errno != EPIPE))
+				break;
+			sock_close(r);
+		}
+	}
+	stats_stop(STATS_READ, t, tries, ret == 0 ? got : 0);
+	if (ret != 0)
+		return -1;
+
+	/* only the first request of an HTTP image may be short */
+	if (got != len && !total) {
+		errno = EIO;
+		return -1;
+	}
+	return got;
+}
+
+static struct remote_block *cache_find(struct remote *r, uint64_t blk)
+{
+	unsigned int i;
+
+	for (i = 0; i < REMOTE_CACHE_BLOCKS; i++)
+		if (r->cache[i].used && r->cache[i].blk == blk)
+			return &r->cache[i];
+	return NULL;
+}
+
+static struct remote_block *cache_evict(struct remote *r)
+{
+	struct remote_block *b = &r->cache[0];
+	unsigned int i;
+
+	for (i = 1; i < REMOTE_CACHE_BLOCKS; i++)
+		if (r->cache[i].used < b->used)
+			b = &r->cache[i];
+	return b;
+}
+
+static size_t block_len(const struct remote *r, uint64_t blk)
+{
+	uint64_t off = blk * REMOTE_BLOCK_SIZE;
+
+	return r->size - off < REMOTE_BLOCK_SIZE ? r->size - off : REMOTE_BLOCK_SIZE;
+}
+
+/*
+ * Fetch the run of blocks missing from the cache starting with blk (which is
+ * missing) up to at most last into the least recently used slots
+ */
+static int cache_fill(struct remote *r, uint64_t blk, uint64_t last)
+{
+	struct remote_block *slots[REMOTE_CACHE_BLOCKS];
+	struct iovec iov[REMOTE_CACHE_BLOCKS];
+	uint64_t start = blk;
+	size_t len = 0;
+	int i, n = 0;
+
+	do {
+		struct remote_block *b = cache_evict(r);
+
+		b->blk = blk;
+		b->used = ++r->tick;
+		slots[n] = b;
+		iov[n].iov_base = b->data;
+		iov[n].iov_len = block_len(r, blk);
+		len += iov[n].iov_len;
+		n++;
+	} while (++blk <= last && !cache_find(r, blk));
+
+	if (remote_fetch(r, start * REMOTE_BLOCK_SIZE, len, iov, n, NULL) < 0) {
+		for (i = 0; i < n; i++)
+			slots[i]->used = 0;
+		return -1;
+	}
+	return n;
+}
+
+int remote_readv(struct remote *r, uint64_t off, const struct iovec *iov, int iovcnt)
+{
+	uint64_t first, last, blk;
+	size_t len = 0;
+	int i, n;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (len == 0)
+		return 0;
+	if (off > r->size || len > r->size - off) {
+		errno = EIO;
+		return -1;
+	}
+
+	first = off / REMOTE_BLOCK_SIZE;
+	last = (off + len - 1) / REMOTE_BLOCK_SIZE;
+	if (last - first >= REMOTE_CACHE_BLOCKS)
+		return remote_fetch(r, off, len, iov, iovcnt, NULL) < 0 ? -1 : 0;
+
+	/*
+	 * Mark the cached blocks as used first, so the ones missing are never
+	 * put in place of a block of the same read.
+	 */
+	for (blk = first; blk <= last; blk++) {
+		struct remote_block *b = cache_find(r, blk);
+
+		if (b)
+			b->used = ++r->tick;
+	}
+
+	for (blk = first; blk <= last; blk++) {
+		if (cache_find(r, blk))
+			continue;
+		n = cache_fill(r, blk, last);
+		if (n < 0)
+			return -1;
+		blk += n - 1;
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		size_t done = 0;
+
+		while (done < iov[i].iov_len) {
+			const struct remote_block *b = cache_find(r, off / REMOTE_BLOCK_SIZE);
+			size_t in_blk = off % REMOTE_BLOCK_SIZE;
+			size_t m = REMOTE_BLOCK_SIZE - in_blk;
+
+			if (m > iov[i].iov_len - done)
+				m = iov[i].iov_len - done;
+			memcpy((uint8_t *)iov[i].iov_base + done, b->data + in_blk, m);
+			done += m;
+			off += m;
+		}
+	}
+
+	return 0;
+}
+
+struct remote *remote_open(const char *url, uint64_t *size)
+{
+	struct remote *r = calloc(1, sizeof(*r));
+	ssize_t ret;
+
+	if (!r)
+		return NULL;
+	r->fd = -1;
+
+	if (parse_url(r, url) != 0) {
+		if (errno != ENOMEM)
+			errno = EINVAL;
+		goto err;
+	}
+
+	if (r->proto == REMOTE_NBD) {
+		if (remote_connect(r) != 0)
+			goto err;
+	} else {
+		struct iovec iov = { r->cache[0].data, REMOTE_BLOCK_SIZE };
+		size_t len = strlen(r->path) + strlen(r->host) + strlen(r->port) + 64;
+		bool ipv6 = strchr(r->host, ':');
+		uint64_t total = 0;
+
+		r->req_hdr = malloc(len);
+		if (!r->req_hdr)
+			goto err;
+		snprintf(r->req_hdr, len, "GET %s HTTP/1.1\r\nHost: %s%s%s:%s\r\nUser-Agent: apalis-tools\r\n",
+			 r->path, ipv6 ? "[" : "", r->host, ipv6 ? "]" : "", r->port);
+
+		/* the first block comes with the size of the image */
+		ret = remote_fetch(r, 0, REMOTE_BLOCK_SIZE, &iov, 1, &total);
+		if (ret < 0)
+			goto err;
+		r->size = total;
+		if ((uint64_t)ret != block_len(r, 0)) {
+			errno = EPROTO;
+			goto err;
+		}
+		r->cache[0].blk = 0;
+		r->cache[0].used = ++r->tick;
+	}
+
+	*size = r->size;
+	return r;
+err:
+	ret = errno;
+	remote_close(r);
+	errno = ret;
+	return NULL;
+}
+
+void remote_close(struct remote *r)
+{
+	if (!r)
+		return;
+
+	if (r->proto == REMOTE_NBD && r->fd >= 0) {
+		struct nbd_request req = {
+			.magic	= htobe32(NBD_REQUEST_MAGIC),
+			.type	= htobe16(NBD_CMD_DISC),
+		};
+		struct iovec iov = { &req, sizeof(req) };
+
+		sock_write(r, &iov, 1);
+	}
+
+	sock_close(r);
+	free(r->host);
+	free(r->port);
+	free(r->path);
+	free(r->req_hdr);
+	free(r);
+}
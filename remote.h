@@ -0,0 +1,36 @@
+/*
+ * Remote image source: images served over HTTP (with Range requests) or NBD
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/uio.h>
+
+struct remote;
+
+/* Whether path is an http:// or nbd:// URL */
+bool remote_is_url(const char *path);
+
+/*
+ * Connect to the image at url (http://HOST[:PORT]/PATH or
+ * nbd://HOST[:PORT][/EXPORT]) and get its size. Returns NULL and sets errno on
+ * error.
+ */
+struct remote *remote_open(const char *url, uint64_t *size);
+void remote_close(struct remote *r);
+
+/*
+ * Read the bytes at off into the iovcnt buffers at iov, with a single request
+ * for each run of blocks not in the cache. Returns -1 and sets errno on error.
+ */
+int remote_readv(struct remote *r, uint64_t off, const struct iovec *iov, int iovcnt);
+
+#endif /* REMOTE_H */
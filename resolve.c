@@ -0,0 +1,192 @@
+/*
+ * Resolve LBAs read from a stream to the partitions containing them
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "outbuf.h"
+#include "resolve.h"
+
+/* Output is written in blocks of this size */
+#define RESOLVE_FLUSH_SIZE	(1024 * 1024)
+
+static const char * const lba_source_names[] = {
+	[LBA_SRC_PT]		= "pt",
+	[LBA_SRC_PT_VIRT]	= "pt-virt",
+	[LBA_SRC_GPT]		= "gpt",
+};
+
+int resolve_init(struct resolve *res, const struct nvtegra_ptable *pt, unsigned int num_parts,
+		 const struct gpt_info *gpt)
+{
+	size_t len = LBA_INDEX_MAX_RANGES(pt ? num_parts : 0, gpt ? gpt->num_entries : 0);
+	struct lba_range *ranges;
+	struct outbuf tmp;
+	unsigned int i;
+
+	memset(res, 0, sizeof(*res));
+	arena_init(&res->arena);
+	outbuf_init(&tmp);
+
+	ranges = calloc(len ? len : 1, sizeof(*ranges));
+	if (!ranges)
+		return -1;
+	lba_index_build(&res->idx, ranges, len, pt, num_parts, gpt);
+	res->idx.ranges = ranges;
+
+	/* the output for each range is formatted once, only the offsets vary */
+	res->labels = calloc(res->idx.num ? res->idx.num : 1, sizeof(*res->labels));
+	res->json = calloc(res->idx.num ? res->idx.num : 1, sizeof(*res->json));
+	if (!res->labels || !res->json)
+		goto err;
+
+	for (i = 0; i < res->idx.num; i++) {
+		const struct lba_range *r = &ranges[i];
+		const char *src = lba_source_names[r->source];
+		char name[GPT_NAME_STR_LEN + 1];
+
+		if (r->source == LBA_SRC_GPT)
+			gpt_entry_name(gpt_entry_get(gpt, r->index), name, sizeof(name));
+		else
+			snprintf(name, sizeof(name), "%.4s", pt->partitions[r->index].name);
+
+		outbuf_printf(&tmp, "%s:%u:%s:", src, r->index, name);
+		res->labels[i] = arena_strndup(&res->arena, tmp.buf, tmp.len);
+		outbuf_reset(&tmp);
+
+		outbuf_printf(&tmp, "{\"source\":\"%s\",\"index\":%u,\"name\":", src, r->index);
+		outbuf_json_str(&tmp, name, strlen(name));
+		outbuf_printf(&tmp, ",\"start\":%" PRIu64 ",\"end\":%" PRIu64 ",\"offset\":",
+			      r->start, r->end);
+		res->json[i] = arena_strndup(&res->arena, tmp.buf, tmp.len);
+
+		if (tmp.error || !res->labels[i] || !res->json[i])
+			goto err;
+		outbuf_reset(&tmp);
+	}
+
+	outbuf_free(&tmp);
+	return 0;
+err:
+	outbuf_free(&tmp);
+	resolve_free(res);
+	return -1;
+}
+
+void resolve_free(struct resolve *res)
+{
+	free(res->idx.ranges);
+	free(res->labels);
+	free(res->json);
+	arena_free(&res->arena);
+	memset(res, 0, sizeof(*res));
+}
+
+/*
+ * Get the LBA of line: the number after "sector ", or at the start. It is
+ * decimal, or hex with 0x, and has to end at whitespace, a comma or the end
+ * of the line.
+ */
+static bool resolve_parse(const char *line, uint64_t *lba)
+{
+	const char *p = strstr(line, "sector ");
+	int base = 10;
+	char *end;
+
+	p = p ? p + strlen("sector ") : line;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+		base = 16;
+		p += 2;
+		if (!isxdigit((unsigned char)*p))
+			return false;
+	} else if (!isdigit((unsigned char)*p)) {
+		return false;
+	}
+
+	errno = 0;
+	*lba = strtoull(p, &end, base);
+	if (errno != 0 || end == p)
+		return false;
+	return *end == '\0' || *end == ',' || isspace((unsigned char)*end);
+}
+
+static void put_u64(struct outbuf *ob, uint64_t v)
+{
+	char buf[20], *p = buf + sizeof(buf);
+
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	outbuf_write(ob, p, buf + sizeof(buf) - p);
+}
+
+int resolve_stream(struct resolve *res, FILE *in, int fd, bool json, unsigned long *skipped)
+{
+	const struct lba_range *m[RESOLVE_MAX_MATCHES];
+	struct outbuf ob;
+	char *line = NULL;
+	size_t line_size = 0;
+	int ret = 0;
+
+	outbuf_init(&ob);
+	*skipped = 0;
+
+	while (getline(&line, &line_size, in) != -1) {
+		unsigned int i, n;
+		uint64_t lba;
+
+		if (!resolve_parse(line, &lba)) {
+			(*skipped)++;
+			continue;
+		}
+
+		n = lba_index_lookup(&res->idx, lba, m, RESOLVE_MAX_MATCHES);
+		if (n > RESOLVE_MAX_MATCHES)
+			n = RESOLVE_MAX_MATCHES;
+
+		if (json) {
+			outbuf_puts(&ob, "{\"lba\":");
+			put_u64(&ob, lba);
+			outbuf_puts(&ob, ",\"partitions\":[");
+			for (i = 0; i < n; i++) {
+				if (i)
+					outbuf_puts(&ob, ",");
+				outbuf_puts(&ob, res->json[m[i] - res->idx.ranges]);
+				put_u64(&ob, lba - m[i]->start);
+				outbuf_puts(&ob, "}");
+			}
+			outbuf_puts(&ob, "]}\n");
+		} else {
+			put_u64(&ob, lba);
+			for (i = 0; i < n; i++) {
+				outbuf_puts(&ob, " ");
+				outbuf_puts(&ob, res->labels[m[i] - res->idx.ranges]);
+				put_u64(&ob, lba - m[i]->start);
+			}
+			outbuf_puts(&ob, n ? "\n" : " -\n");
+		}
+
+		if (ob.len >= RESOLVE_FLUSH_SIZE && outbuf_flush(&ob, fd) != 0) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret == 0 && outbuf_flush(&ob, fd) != 0)
+		ret = -1;
+	free(line);
+	outbuf_free(&ob);
+	return ret;
+}
@@ -0,0 +1,43 @@
+/*
+ * Resolve LBAs read from a stream (e.g. kernel log lines with I/O errors) to
+ * the partitions containing them
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "libapalis.h"
+
+/* Matches printed per LBA at most */
+#define RESOLVE_MAX_MATCHES	16
+
+struct resolve {
+	struct lba_index	idx;
+	const char		**labels;	/* text output of each range, by position */
+	const char		**json;		/* JSON object prefix of each range */
+	struct arena		arena;
+};
+
+/* Set up res for the PT and GPT (either may be NULL). Returns -1 on failure. */
+int resolve_init(struct resolve *res, const struct nvtegra_ptable *pt, unsigned int num_parts,
+		 const struct gpt_info *gpt);
+void resolve_free(struct resolve *res);
+
+/*
+ * Resolve the LBAs in, one per line, and write a line (text or JSON) for each
+ * to fd. A line containing "sector N" (as in the kernel's I/O error
+ * messages) is resolved for N, others have to start with the LBA (decimal, or
+ * hex with 0x). *skipped is set to the number of lines without an LBA.
+ * Returns -1 if writing the output failed.
+ */
+int resolve_stream(struct resolve *res, FILE *in, int fd, bool json, unsigned long *skipped);
+
+#endif /* RESOLVE_H */
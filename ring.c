@@ -0,0 +1,106 @@
+/*
+ * Bounded single-producer/single-consumer ring of pointers
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "ring.h"
+
+/* Times an empty (or full) ring is checked again before going to sleep */
+#define RING_SPIN	256
+
+int ring_init(struct ring *r, unsigned int size)
+{
+	memset(r, 0, sizeof(*r));
+	if (size == 0 || (size & (size - 1)) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	r->slots = calloc(size, sizeof(*r->slots));
+	if (!r->slots)
+		return -1;
+	r->mask = size - 1;
+	return 0;
+}
+
+void ring_free(struct ring *r)
+{
+	free(r->slots);
+	r->slots = NULL;
+}
+
+/* Wait until *idx no longer is val */
+static void ring_wait(uint32_t *idx, uint32_t val, uint32_t *waiting)
+{
+	unsigned int i;
+
+	for (i = 0; i < RING_SPIN; i++)
+		if (__atomic_load_n(idx, __ATOMIC_ACQUIRE) != val)
+			return;
+
+	/*
+	 * Pairs with the store of the index and the load of the flag in
+	 * ring_wake(): either the other side sees the flag or we see the
+	 * new index (and the futex doesn't sleep).
+	 */
+	__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(idx, __ATOMIC_SEQ_CST) == val)
+		syscall(SYS_futex, idx, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+	__atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
+/* Publish the new value val of *idx and wake the other side if it sleeps */
+static void ring_wake(uint32_t *idx, uint32_t val, uint32_t *waiting)
+{
+	__atomic_store_n(idx, val, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, idx, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+void ring_push(struct ring *r, void *p)
+{
+	uint32_t head = r->head, tail;
+
+	while (head - (tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) > r->mask)
+		ring_wait(&r->tail, tail, &r->tail_wait);
+
+	r->slots[head & r->mask] = p;
+	ring_wake(&r->head, head + 1, &r->head_wait);
+}
+
+bool ring_trypop(struct ring *r, void **p)
+{
+	uint32_t tail = r->tail;
+
+	if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+		return false;
+
+	*p = r->slots[tail & r->mask];
+	ring_wake(&r->tail, tail + 1, &r->tail_wait);
+	return true;
+}
+
+void *ring_pop(struct ring *r)
+{
+	uint32_t tail = r->tail, head;
+	void *p;
+
+	while ((head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) == tail)
+		ring_wait(&r->head, head, &r->head_wait);
+
+	p = r->slots[tail & r->mask];
+	ring_wake(&r->tail, tail + 1, &r->tail_wait);
+	return p;
+}
@@ -0,0 +1,44 @@
+/*
+ * Bounded single-producer/single-consumer ring of pointers, connecting the
+ * stages of a pipeline
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * head is only written by the producer, tail only by the consumer, each on
+ * its own cache line. A side which finds the ring empty (or full) spins
+ * briefly, then sleeps on the other side's index with a futex, setting its
+ * *_wait flag so the other side knows to wake it.
+ */
+struct ring {
+	void		**slots;
+	uint32_t	mask;
+	uint32_t	head __attribute__((aligned(64)));	/* next slot to fill */
+	uint32_t	head_wait;	/* consumer waits for head to move */
+	uint32_t	tail __attribute__((aligned(64)));	/* next slot to take */
+	uint32_t	tail_wait;	/* producer waits for tail to move */
+};
+
+/* Set up r for size (a power of 2) entries. Returns -1 on failure. */
+int ring_init(struct ring *r, unsigned int size);
+void ring_free(struct ring *r);
+
+/* Append p (which may be NULL), waiting for a free slot if the ring is full */
+void ring_push(struct ring *r, void *p);
+
+/* Take the oldest entry, waiting for one if the ring is empty */
+void *ring_pop(struct ring *r);
+
+/* Take the oldest entry into *p if there is one, without waiting */
+bool ring_trypop(struct ring *r, void **p);
+
+#endif /* RING_H */
@@ -0,0 +1,247 @@
+/*
+ * SHA-256 with runtime selected implementation
+ *
+ * The portable implementation is the reference and the fallback, on x86 the
+ * SHA extensions (SHA-NI) are used if the CPU supports them.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#include <endian.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HAVE_SHA256_SHANI
+#endif
+
+#include "sha256.h"
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+	0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+	0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+	0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+	0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+	0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *p, size_t nblocks);
+
+static inline uint32_t ror32(uint32_t x, unsigned int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_blocks_generic(uint32_t state[8], const uint8_t *p, size_t nblocks)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	unsigned int i;
+
+	while (nblocks--) {
+		for (i = 0; i < 16; i++) {
+			uint32_t v;
+
+			memcpy(&v, p + 4 * i, sizeof(v));
+			w[i] = be32toh(v);
+		}
+		for (i = 16; i < 64; i++) {
+			uint32_t s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+		for (i = 0; i < 64; i++) {
+			t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) +
+			     ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) +
+			     ((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		p += SHA256_BLOCK_SIZE;
+	}
+}
+
+#ifdef HAVE_SHA256_SHANI
+/*
+ * Four rounds per iteration using the SHA-NI instructions, which keep the
+ * state as ABEF/CDGH and need the message schedule words in groups of four.
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *p, size_t nblocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, tmp, wk, w[4];
+	unsigned int i;
+
+	tmp = _mm_loadu_si128((const __m128i *)&state[0]);	/* ABCD */
+	state1 = _mm_loadu_si128((const __m128i *)&state[4]);	/* EFGH */
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);			/* CDAB */
+	state1 = _mm_shuffle_epi32(state1, 0x1b);		/* HGFE */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);		/* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);		/* CDGH */
+
+	while (nblocks--) {
+		abef = state0;
+		cdgh = state1;
+
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16 * i)),
+							bswap);
+			} else {
+				/* w[i & 3] holds W[i - 4], w[(i + 1) & 3] W[i - 3] etc. */
+				tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+				w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+			}
+
+			wk = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&sha256_k[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+			wk = _mm_shuffle_epi32(wk, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, wk);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+		p += SHA256_BLOCK_SIZE;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);			/* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xb1);		/* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);		/* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);		/* HGFE */
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static bool sha256_shani_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+static const struct sha256_impl {
+	const char		*name;
+	sha256_blocks_fn	fn;
+	bool			(*supported)(void);
+} sha256_impls[] = {
+	/* in order of preference */
+#ifdef HAVE_SHA256_SHANI
+	{ "shani",	sha256_blocks_shani,	sha256_shani_supported },
+#endif
+	{ "generic",	sha256_blocks_generic,	NULL },
+};
+
+static const struct sha256_impl *sha256_cur = &sha256_impls[sizeof(sha256_impls) / sizeof(sha256_impls[0]) - 1];
+
+int sha256_select(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(sha256_impls) / sizeof(sha256_impls[0]); i++) {
+		const struct sha256_impl *impl = &sha256_impls[i];
+
+		if (name && strcmp(name, impl->name) != 0)
+			continue;
+		if (impl->supported && !impl->supported())
+			continue;
+		sha256_cur = impl;
+		return 0;
+	}
+
+	return -1;
+}
+
+const char *sha256_impl_name(void)
+{
+	return sha256_cur->name;
+}
+
+__attribute__((constructor))
+static void sha256_select_init(void)
+{
+	sha256_select(NULL);
+}
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+	static const uint32_t iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(ctx->state, iv, sizeof(iv));
+	ctx->len = 0;
+	ctx->buf_len = 0;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	ctx->len += len;
+
+	if (ctx->buf_len > 0) {
+		size_t n = SHA256_BLOCK_SIZE - ctx->buf_len;
+
+		if (n > len)
+			n = len;
+		memcpy(ctx->buf + ctx->buf_len, p, n);
+		ctx->buf_len += n;
+		p += n;
+		len -= n;
+		if (ctx->buf_len < SHA256_BLOCK_SIZE)
+			return;
+		sha256_cur->fn(ctx->state, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+
+	if (len >= SHA256_BLOCK_SIZE) {
+		sha256_cur->fn(ctx->state, p, len / SHA256_BLOCK_SIZE);
+		p += len & ~(size_t)(SHA256_BLOCK_SIZE - 1);
+		len &= SHA256_BLOCK_SIZE - 1;
+	}
+
+	memcpy(ctx->buf, p, len);
+	ctx->buf_len = len;
+}
+
+void sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	uint64_t bits = htobe64(ctx->len * 8);
+	unsigned int i;
+
+	ctx->buf[ctx->buf_len++] = 0x80;
+	if (ctx->buf_len > SHA256_BLOCK_SIZE - sizeof(bits)) {
+		memset(ctx->buf + ctx->buf_len, 0, SHA256_BLOCK_SIZE - ctx->buf_len);
+		sha256_cur->fn(ctx->state, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+	memset(ctx->buf + ctx->buf_len, 0, SHA256_BLOCK_SIZE - sizeof(bits) - ctx->buf_len);
+	memcpy(ctx->buf + SHA256_BLOCK_SIZE - sizeof(bits), &bits, sizeof(bits));
+	sha256_cur->fn(ctx->state, ctx->buf, 1);
+
+	for (i = 0; i < 8; i++) {
+		uint32_t v = htobe32(ctx->state[i]);
+
+		memcpy(digest + 4 * i, &v, sizeof(v));
+	}
+}
@@ -0,0 +1,37 @@
+/*
+ * SHA-256 with runtime selected implementation
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BLOCK_SIZE	64
+#define SHA256_DIGEST_SIZE	32
+
+struct sha256_ctx {
+	uint32_t	state[8];
+	uint64_t	len;		/* total number of bytes hashed */
+	uint8_t		buf[SHA256_BLOCK_SIZE];
+	size_t		buf_len;
+};
+
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len);
+void sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/*
+ * Select the implementation by name ("generic", "shani") or pick the fastest
+ * supported one if name is NULL. Returns -1 if the named implementation is
+ * unknown or not supported on this CPU.
+ */
+int sha256_select(const char *name);
+const char *sha256_impl_name(void);
+
+#endif /* SHA256_H */
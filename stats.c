@@ -0,0 +1,107 @@
+/*
+ * Per-stage timing and I/O counters
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#include <stdint.h>
+
+#include "outbuf.h"
+#include "stats.h"
+
+#ifdef STATS
+struct stats_counter {
+	uint64_t	calls;
+	uint64_t	syscalls;
+	uint64_t	bytes;
+	uint64_t	ns;
+};
+
+static const char *const stats_names[STATS_MAX] = {
+	[STATS_OPEN]	= "open",
+	[STATS_SEEK]	= "lseek64",
+	[STATS_READ]	= "read",
+	[STATS_CRC]	= "crc32",
+	[STATS_IOCTL]	= "ioctl",
+	[STATS_PRINT]	= "print",
+	[STATS_HASH]	= "sha256",
+	[STATS_WRITE]	= "write",
+};
+
+bool stats_enabled;
+static uint64_t stats_start_ns;
+static struct stats_counter counters[STATS_MAX];
+
+/* Callable from several threads, e.g. nvtegraparts -j */
+void stats_add(enum stats_stage stage, uint64_t ns, unsigned int syscalls, uint64_t bytes)
+{
+	struct stats_counter *c = &counters[stage];
+
+	__atomic_fetch_add(&c->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->syscalls, syscalls, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->ns, ns, __ATOMIC_RELAXED);
+}
+
+int stats_enable(void)
+{
+	stats_enabled = true;
+	stats_start_ns = stats_now();
+	return 0;
+}
+
+void stats_report(int fd, enum stats_format format)
+{
+	uint64_t total_ns, syscalls = 0;
+	struct outbuf ob;
+	unsigned int i;
+
+	if (!stats_enabled)
+		return;
+
+	total_ns = stats_now() - stats_start_ns;
+	for (i = 0; i < STATS_MAX; i++)
+		syscalls += counters[i].syscalls;
+
+	outbuf_init(&ob);
+	if (format == STATS_JSON) {
+		outbuf_puts(&ob, "{\"stats\":{");
+		for (i = 0; i < STATS_MAX; i++) {
+			const struct stats_counter *c = &counters[i];
+
+			outbuf_printf(&ob, "\"%s\":{\"calls\":%ju,\"syscalls\":%ju,\"bytes\":%ju,"
+				      "\"time_us\":%.1f},", stats_names[i], (uintmax_t)c->calls,
+				      (uintmax_t)c->syscalls, (uintmax_t)c->bytes, c->ns / 1e3);
+		}
+		outbuf_printf(&ob, "\"syscalls\":%ju,\"total_us\":%.1f}}\n", (uintmax_t)syscalls,
+			      total_ns / 1e3);
+	} else {
+		outbuf_printf(&ob, "%-8s %10s %10s %12s %12s\n", "stage", "calls", "syscalls",
+			      "bytes", "time(us)");
+		for (i = 0; i < STATS_MAX; i++) {
+			const struct stats_counter *c = &counters[i];
+
+			outbuf_printf(&ob, "%-8s %10ju %10ju %12ju %12.1f\n", stats_names[i],
+				      (uintmax_t)c->calls, (uintmax_t)c->syscalls,
+				      (uintmax_t)c->bytes, c->ns / 1e3);
+		}
+		outbuf_printf(&ob, "%-8s %10s %10ju %12s %12.1f\n", "total", "", (uintmax_t)syscalls,
+			      "", total_ns / 1e3);
+	}
+	outbuf_flush(&ob, fd);
+	outbuf_free(&ob);
+}
+#else
+int stats_enable(void)
+{
+	return -1;
+}
+
+void stats_report(int fd, enum stats_format format)
+{
+	(void) fd;
+	(void) format;
+}
+#endif
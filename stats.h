@@ -0,0 +1,85 @@
+/*
+ * Per-stage timing and I/O counters, compiled in with STATS=1
+ *
+ * Without STATS defined stats_start() and stats_stop() are empty inline
+ * functions, so the instrumentation costs nothing.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum stats_stage {
+	STATS_OPEN,		/* open(), fstat(), mmap(), close() */
+	STATS_SEEK,		/* lseek64() */
+	STATS_READ,		/* pread(), preadv(), io_uring_enter() and mapped reads */
+	STATS_CRC,		/* CRC32 validation of the GPT */
+	STATS_IOCTL,		/* BLKSSZGET and BLKGETSIZE64 */
+	STATS_PRINT,		/* writing the output */
+	STATS_HASH,		/* SHA-256 of partition contents (--verify) */
+	STATS_WRITE,		/* pwrite() and copy_file_range() of --extract */
+	STATS_MAX,
+};
+
+enum stats_format {
+	STATS_TEXT,
+	STATS_JSON,
+};
+
+#ifdef STATS
+#include <time.h>
+
+extern bool stats_enabled;
+
+void stats_add(enum stats_stage stage, uint64_t ns, unsigned int syscalls, uint64_t bytes);
+
+static inline uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t stats_start(void)
+{
+	return stats_enabled ? stats_now() : 0;
+}
+
+/* Account the time since start and syscalls/bytes to stage */
+static inline void stats_stop(enum stats_stage stage, uint64_t start, unsigned int syscalls,
+			      uint64_t bytes)
+{
+	if (stats_enabled)
+		stats_add(stage, stats_now() - start, syscalls, bytes);
+}
+#else
+static inline uint64_t stats_start(void)
+{
+	return 0;
+}
+
+static inline void stats_stop(enum stats_stage stage, uint64_t start, unsigned int syscalls,
+			      uint64_t bytes)
+{
+	(void) stage;
+	(void) start;
+	(void) syscalls;
+	(void) bytes;
+}
+#endif
+
+/*
+ * Start collecting, returns -1 if built without STATS. The summary is written
+ * to fd by stats_report().
+ */
+int stats_enable(void);
+void stats_report(int fd, enum stats_format format);
+
+#endif /* STATS_H */
@@ -0,0 +1,51 @@
+/*
+ * Text output of the parsed partition tables and config block, shared by the
+ * tools
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _DEFAULT_SOURCE
+#include <endian.h>
+#include <inttypes.h>
+
+#include "text.h"
+
+void text_pt_entry(struct outbuf *ob, unsigned int n, const struct nvtegra_partinfo *p)
+{
+	outbuf_printf(ob, "  #%02u id=%02u [%-3.3s] policy=%u fs=%u virt=0x%08x+0x%08x sectors=0x%08x-0x%08x type=%u\n",
+		      n, nvtegra_partinfo_id(p), p->name, nvtegra_partinfo_allocation_policy(p),
+		      nvtegra_partinfo_fs_type(p), nvtegra_partinfo_virt_start_sector(p),
+		      nvtegra_partinfo_virt_size(p), nvtegra_partinfo_start_sector(p),
+		      nvtegra_partinfo_end_sector(p), nvtegra_partinfo_type(p));
+}
+
+void text_gpt_entry(struct outbuf *ob, unsigned int n, const struct gpt_entry *e)
+{
+	char name[GPT_NAME_STR_LEN + 1];
+	char type[GUID_STR_LEN + 1], uuid[GUID_STR_LEN + 1];
+	uint64_t start = gpt_entry_lba_start(e);
+	uint64_t size = gpt_entry_lba_end(e) - start + 1;
+
+	gpt_entry_name(e, name, sizeof(name));
+	guid_to_str((const uint8_t *)&e->type, type);
+	guid_to_str((const uint8_t *)&e->uuid, uuid);
+
+	outbuf_printf(ob, "  #%02u name=%s type=%s uuid=%s attr=0x%" PRIx64 " start=0x%" PRIx64 " size=%" PRIu64 "\n",
+		      n, name, type, uuid, gpt_entry_attr(e), start, size);
+}
+
+void text_cfgblock(struct outbuf *ob, const struct trdx_cfgblock *cb)
+{
+	const struct toradex_hw *hw = &cb->hw;
+	uint8_t mac[6];
+
+	trdx_cfgblock_mac(cb, mac);
+	outbuf_printf(ob, "Model:  Toradex %s V%d.%d%c\n", trdx_module_name(hw->prodid),
+		      hw->ver_major, hw->ver_minor, (char)hw->ver_assembly + 'A');
+	outbuf_printf(ob, "Serial: %08d\n", cb->serial);
+	outbuf_printf(ob, "MAC:    %02x:%02x:%02x:%02x:%02x:%02x\n",
+		      mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
@@ -0,0 +1,25 @@
+/*
+ * Text output of the parsed partition tables and config block, shared by the
+ * tools
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef TEXT_H
+#define TEXT_H
+
+#include "libapalis.h"
+#include "outbuf.h"
+
+/* Append a line describing PT partition n */
+void text_pt_entry(struct outbuf *ob, unsigned int n, const struct nvtegra_partinfo *p);
+
+/* Append a line describing GPT entry n */
+void text_gpt_entry(struct outbuf *ob, unsigned int n, const struct gpt_entry *e);
+
+/* Append the model, serial and MAC lines of the parsed config block */
+void text_cfgblock(struct outbuf *ob, const struct trdx_cfgblock *cb);
+
+#endif /* TEXT_H */
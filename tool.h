@@ -0,0 +1,32 @@
+/*
+ * Definitions shared by the command line tools
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef TOOL_H
+#define TOOL_H
+
+#include <stdio.h>
+
+#define err(fmt, args...)	fprintf(stderr, "Error: " fmt, ##args)
+#define warn(fmt, args...)	fprintf(stderr, "Warning: " fmt, ##args)
+
+/*
+ * Entry point of a tool: main() of its own binary, or <tool>_main() when
+ * built into the apalis-tools multi-call binary (MULTICALL).
+ */
+#ifdef MULTICALL
+# define TOOL_MAIN(name)	name##_main
+#else
+# define TOOL_MAIN(name)	main
+#endif
+
+int nvtegraparts_main(int argc, char **argv);
+int trdx_configblock_main(int argc, char **argv);
+int apalisd_main(int argc, char **argv);
+int apalis_scan_main(int argc, char **argv);
+
+#endif /* TOOL_H */
@@ -1,5 +1,5 @@
 /*
- * Read/write the Toradex configuration block from eMMC
+ * Read/write the Toradex configuration block from eMMC or NAND
  *
  * Copyright (C) 2018 Tobias Klauser <tklauser@distanz.ch>
  *
@@ -11,10 +11,17 @@
  * License: GNU General Public License, version 2
  */
 
+#define _GNU_SOURCE
 #define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <ctype.h>
+#include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -22,217 +29,1261 @@
 #include <string.h>
 #include <unistd.h>
 
-#include <arpa/inet.h>
-
-#define __packed		__attribute__((packed))
-
-#define ARRAY_SIZE(a)		(sizeof(a) / sizeof(a[0]))
-
-#define err(fmt, args...)	fprintf(stderr, "Error: " fmt, ##args)
-#define warn(fmt, args...)	fprintf(stderr, "Warning: " fmt, ##args)
-
-#define TRDX_CFG_BLOCK_MAX_SIZE	512
-/* Default offset of the 'ARG' partition (for pre v2.3 BSP releases) */
-#define DEFAULT_ARG_PART_OFF	0x00000c00
-#define DEFAULT_SECTOR_SIZE	4096
-/* Config block offset inside the 1st eMMC boot area partition (>= BSP v2.3) */
-#define DEFAULT_EMMC_BOOT_OFF	(-512)
-
-struct toradex_tag {
-	uint16_t	len:14;
-	uint8_t		flags:2;
-	uint16_t	id;
-} __packed;
-
-#define TAG_VALID	0xcf01
-#define TAG_MAC		0x0000
-#define TAG_HW		0x0008
-#define TAG_FLAG_VALID	0x1
-
-struct toradex_hw {
-	uint16_t ver_major;
-	uint16_t ver_minor;
-	uint16_t ver_assembly;
-	uint16_t prodid;
-} __packed;
-
-struct toradex_eth_addr {
-	uint32_t oui:24;
-	uint32_t nic:24;
-} __packed;
-
-static const char* const toradex_modules[] = {
-	 [0] = "unknown module",
-	 [1] = "Colibri PXA270 312MHz",
-	 [2] = "Colibri PXA270 520MHz",
-	 [3] = "Colibri PXA320 806MHz",
-	 [4] = "Colibri PXA300 208MHz",
-	 [5] = "Colibri PXA310 624MHz",
-	 [6] = "Colibri PXA320 806MHz IT",
-	 [7] = "Colibri PXA300 208MHz XT",
-	 [8] = "Colibri PXA270 312MHz",
-	 [9] = "Colibri PXA270 520MHz",
-	[10] = "Colibri VF50 128MB", /* not currently on sale */
-	[11] = "Colibri VF61 256MB",
-	[12] = "Colibri VF61 256MB IT",
-	[13] = "Colibri VF50 128MB IT",
-	[14] = "Colibri iMX6 Solo 256MB",
-	[15] = "Colibri iMX6 DualLite 512MB",
-	[16] = "Colibri iMX6 Solo 256MB IT",
-	[17] = "Colibri iMX6 DualLite 512MB IT",
-	[18] = "unknown module",
-	[19] = "unknown module",
-	[20] = "Colibri T20 256MB",
-	[21] = "Colibri T20 512MB",
-	[22] = "Colibri T20 512MB IT",
-	[23] = "Colibri T30 1GB",
-	[24] = "Colibri T20 256MB IT",
-	[25] = "Apalis T30 2GB",
-	[26] = "Apalis T30 1GB",
-	[27] = "Apalis iMX6 Quad 1GB",
-	[28] = "Apalis iMX6 Quad 2GB IT",
-	[29] = "Apalis iMX6 Dual 512MB",
-	[30] = "Colibri T30 1GB IT",
-	[31] = "Apalis T30 1GB IT",
-	[32] = "Colibri iMX7 Solo 256MB",
-	[33] = "Colibri iMX7 Dual 512MB",
-	[34] = "Apalis TK1 2GB",
-	[35] = "Apalis iMX6 Dual 1GB IT",
-	[36] = "Colibri iMX6ULL 256MB",
-	[37] = "Apalis iMX8 QuadMax 4GB Wi-Fi / Bluetooth",
-	[38] = "Colibri iMX8X",
-	[39] = "Colibri iMX7 Dual 1GB (eMMC)",
-	[40] = "Colibri iMX6ULL 512MB Wi-Fi / Bluetooth IT",
-	[41] = "Colibri iMX7 Dual 512MB EPDC",
-	[42] = "Apalis TK1 4GB",
-};
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "arena.h"
+#include "image.h"
+#include "json.h"
+#include "libapalis.h"
+#include "outbuf.h"
+#include "record.h"
+#include "ring.h"
+#include "stats.h"
+#include "text.h"
+#include "tool.h"
+
+#define OPT_STATS	0x100
+#define OPT_SCAN	0x101
+#define OPT_FORCE	0x102
+
+/* -j is limited to this many jobs per CPU */
+#define JOBS_PER_CPU		4
+
+/* Devices are read in chunks of this size with --scan */
+#define SCAN_CHUNK_SIZE		(8 * 1024 * 1024)
+/* CSV and columnar output is written in blocks of this size */
+#define BULK_FLUSH_SIZE		(1024 * 1024)
+
+static enum {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+	FORMAT_BINARY,
+	FORMAT_CSV,
+	FORMAT_COLUMNAR,
+} output_format = FORMAT_TEXT;
 
-static const char *short_opts = "s:h";
+/* flags for image_open_flags(), IMAGE_DIRECT with --direct */
+static unsigned int image_flags;
+
+static const char *short_opts = "bf:j:s:wDh";
 static const struct option long_opts[] = {
+	{ "batch",	no_argument,		NULL, 'b' },
+	{ "format",	required_argument,	NULL, 'f' },
+	{ "jobs",	required_argument,	NULL, 'j' },
 	{ "skip",	required_argument,	NULL, 's' },
+	{ "write",	no_argument,		NULL, 'w' },
+	{ "direct",	no_argument,		NULL, 'D' },
+	{ "serial",	required_argument,	NULL, 'S' },
+	{ "prodid",	required_argument,	NULL, 'P' },
+	{ "hw-version",	required_argument,	NULL, 'V' },
+	{ "force",	no_argument,		NULL, OPT_FORCE },
+	{ "scan",	no_argument,		NULL, OPT_SCAN },
+	{ "stats",	optional_argument,	NULL, OPT_STATS },
 	{ "help",	no_argument,		NULL, 'h' },
 	{ NULL, 	0,			NULL, 0 }
 };
 
-static void usage_and_exit(int ret)
+static void __attribute__((noreturn)) usage_and_exit(int ret)
 {
 	printf("Usage: trdx-configblock [OPTIONS...] [BLOCKDEV]\n"
+	       "       trdx-configblock -b [OPTIONS...] [INPUT...]\n"
 	       "\n"
 	       "Options:\n"
+	       "  -b, --batch               Read the config block of every INPUT (a path or glob\n"
+	       "                            pattern, read from stdin one per line if omitted)\n"
+	       "  -f, --format FMT          Output format: text (default), json, binary\n"
+	       "                            (fixed-layout record, see record.h), csv or columnar\n"
+	       "                            (column arrays of all inputs, see record.h)\n"
+	       "  -j N, --jobs N            With -b, read and parse N inputs in parallel\n"
+	       "                            (0: one per CPU), output stays in input order\n"
 	       "  -s N[s|b], --skip N[s|b]  Set partition offset to N sectors/bytes\n"
+	       "  -w, --write               Write the config block, fields not given are kept\n"
+	       "  -D, --direct              Read and write with O_DIRECT, bypassing the page cache\n"
+	       "      --scan                Search the whole device for config blocks\n"
+	       "      --serial N            Serial number (also sets the MAC address)\n"
+	       "      --prodid N            Product id of the module\n"
+	       "      --hw-version V        Hardware version, e.g. V1.1A\n"
+	       "      --force               Write a product id of an unknown module\n"
+	       "      --stats[=FMT]         Print per-stage timings and I/O counters to stderr\n"
+	       "                            as text (default) or json, needs a build with STATS=1\n"
 	       "  -h, --help                Show this message and exit\n"
 	       "\n"
-	       "If BLOCKDEV is omitted, the default locations (according to the BSP release) are searched.\n");
+	       "If BLOCKDEV is omitted, the default locations (according to the BSP release) are searched.\n"
+	       "When writing, the default location is the last sector of /dev/mmcblk0boot0.\n");
 	exit(ret);
 }
 
-static int read_config_block(const char *devfile, off64_t skip)
+/* A candidate location of the config block */
+struct cfg_block_loc {
+	const char	*devfile;
+	off64_t		skip;
+	bool		default_skip;	/* skip wasn't given, use the NAND one for MTD */
+	struct image	img;
+	bool		opened;
+	int		error;		/* errno of the failed open or seek */
+	off64_t		pos;
+	uint8_t		buf[TRDX_CFG_BLOCK_MAX_SIZE];
+};
+
+/* Open the device of loc and set up the request to read it */
+static int cfg_block_plan(struct cfg_block_loc *loc, struct image_req *r)
 {
-	int fd, ret = -1;
-	size_t read_size, len;
-	off64_t tag_off = 0, pos;
-	uint8_t *config_block = NULL;
-	uint32_t serial = 0;
-	struct toradex_tag *tag;
-	struct toradex_hw hw;
-	struct toradex_eth_addr eth_addr;
-
-	fd = open(devfile, O_RDONLY);
-	if (fd < 0) {
-		err("Failed to open file %s: %s\n", devfile, strerror(errno));
+	loc->opened = false;
+	loc->error = 0;
+
+	if (image_open_flags(&loc->img, loc->devfile, image_flags) != 0) {
+		loc->error = errno;
+		return 0;
+	}
+	loc->opened = true;
+
+	if (image_is_mtd(&loc->img) && loc->default_skip)
+		loc->skip = TRDX_CFG_NAND_OFF;
+	loc->pos = loc->skip < 0 ? (off64_t)loc->img.size + loc->skip : loc->skip;
+	if (loc->pos < 0) {
+		loc->error = EINVAL;
+		return 0;
+	}
+
+	r->img = &loc->img;
+	r->off = loc->pos;
+	r->len = TRDX_CFG_BLOCK_MAX_SIZE;
+	r->buf = loc->buf;
+	return 1;
+}
+
+#define cb_err(ob, fmt, args...)	outbuf_printf(ob, "Error: " fmt, ##args)
+#define cb_warn(ob, fmt, args...)	outbuf_printf(ob, "Warning: " fmt, ##args)
+
+/*
+ * Parse the config block at buf into cb. Returns false if there is no valid
+ * config block, anything odd found along the way is warned about in errs.
+ */
+static bool parse_config_block(const uint8_t *buf, struct trdx_cfgblock *cb, struct outbuf *errs)
+{
+	unsigned int i;
+
+	if (trdx_cfgblock_parse(buf, TRDX_CFG_BLOCK_MAX_SIZE, cb) != APALIS_OK)
+		return false;
+
+	for (i = 0; i < cb->num_unknown && i < TRDX_CB_MAX_UNKNOWN; i++)
+		cb_warn(errs, "Unknown tag id 0x%04x found in Toradex config block\n", cb->unknown_ids[i]);
+	if (cb->num_unknown > TRDX_CB_MAX_UNKNOWN)
+		cb_warn(errs, "%u more unknown tags found in Toradex config block\n",
+			cb->num_unknown - TRDX_CB_MAX_UNKNOWN);
+	if (cb->truncated)
+		cb_warn(errs, "Truncated tag 0x%04x found in Toradex config block\n", cb->truncated_id);
+	return true;
+}
+
+#define MAC_FMT		"%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC_ARGS(m)	m[0], m[1], m[2], m[3], m[4], m[5]
+
+static void print_config_block_text(struct outbuf *ob, const char *devfile, off64_t pos,
+				    const struct trdx_cfgblock *cb, bool valid)
+{
+	if (!valid) {
+		warn("No valid Toradex config block found on %s at 0x%08jx\n",
+		     devfile, (intmax_t) pos);
+		return;
+	}
+
+	outbuf_printf(ob, "Toradex config block found on %s at 0x%08jx\n", devfile,
+		      (intmax_t) pos);
+	text_cfgblock(ob, cb);
+}
+
+static void print_config_block_json(struct outbuf *ob, const char *devfile, off64_t pos,
+				    const struct trdx_cfgblock *cb, bool valid, int status)
+{
+	outbuf_puts(ob, "{\"device\":");
+	outbuf_json_str(ob, devfile, strlen(devfile));
+	outbuf_printf(ob, ",\"offset\":%jd,\"status\":\"%s\",\"valid\":%s", (intmax_t) pos,
+		      status == 0 ? "ok" : "error", valid ? "true" : "false");
+	if (valid) {
+		outbuf_puts(ob, ",");
+		json_cfgblock(ob, cb);
+	}
+	outbuf_puts(ob, "}\n");
+}
+
+static void print_config_block_binary(struct outbuf *ob, const char *devfile, off64_t pos,
+				      const struct trdx_cfgblock *cb, bool valid, int status)
+{
+	static const uint8_t pad[REC_ALIGN];
+	struct rec_cfgblock rec;
+	size_t path_len = strlen(devfile), size;
+
+	size = sizeof(rec) + path_len;
+	size += (REC_ALIGN - size % REC_ALIGN) % REC_ALIGN;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.hdr.magic = htole32(REC_MAGIC_CFGBLOCK);
+	rec.hdr.version = htole16(REC_VERSION);
+	rec.hdr.rec_size = htole32(size);
+	rec.hdr.status = htole32(status);
+	rec.offset = htole64(pos);
+	rec.path_len = htole16(path_len);
+	if (valid) {
+		rec.flags = htole32(REC_CB_F_VALID);
+		rec.serial = htole32(cb->serial);
+		rec.prodid = htole16(cb->hw.prodid);
+		rec.ver_major = htole16(cb->hw.ver_major);
+		rec.ver_minor = htole16(cb->hw.ver_minor);
+		rec.ver_assembly = htole16(cb->hw.ver_assembly);
+		trdx_cfgblock_mac(cb, rec.mac);
+	}
+
+	outbuf_write(ob, &rec, sizeof(rec));
+	outbuf_write(ob, devfile, path_len);
+	outbuf_write(ob, pad, size - sizeof(rec) - path_len);
+}
+
+/*
+ * The CSV output, and the rows of the columnar output which can only be
+ * written once all inputs are read. Rows and their paths are allocated from
+ * an arena.
+ */
+struct bulk_row {
+	struct bulk_row	*next;
+	const char	*path;
+	size_t		path_len;
+	uint64_t	offset;
+	uint32_t	flags;		/* REC_CB_F_* */
+	uint32_t	serial;
+	uint16_t	prodid;
+	uint16_t	ver_major;
+	uint16_t	ver_minor;
+	uint16_t	ver_assembly;
+	uint8_t		mac[6];
+};
+
+static struct {
+	struct outbuf	out;
+	struct arena	arena;
+	struct bulk_row	*head;
+	struct bulk_row	**tail;
+	uint64_t	num_rows;
+	uint64_t	path_len;	/* of all rows */
+	bool		failed;		/* writing or an allocation failed */
+} bulk = { .tail = &bulk.head };
+
+static void bulk_flush(size_t min)
+{
+	if (bulk.out.len >= min && outbuf_flush(&bulk.out, STDOUT_FILENO) != 0)
+		bulk.failed = true;
+}
+
+static void csv_str(struct outbuf *ob, const char *str, size_t len)
+{
+	size_t i;
+
+	if (strcspn(str, ",\"\r\n") >= len) {
+		outbuf_write(ob, str, len);
+		return;
+	}
+
+	outbuf_puts(ob, "\"");
+	for (i = 0; i < len; i++) {
+		if (str[i] == '"')
+			outbuf_puts(ob, "\"");
+		outbuf_write(ob, &str[i], 1);
+	}
+	outbuf_puts(ob, "\"");
+}
+
+static void print_config_block_csv(struct outbuf *ob, const char *devfile, off64_t pos,
+				   const struct trdx_cfgblock *cb, bool valid, int status)
+{
+	const struct toradex_hw *hw = &cb->hw;
+	uint8_t mac[6];
+
+	csv_str(ob, devfile, strlen(devfile));
+	outbuf_printf(ob, ",%jd,%s,%d", (intmax_t) pos, status == 0 ? "ok" : "error", valid);
+	if (valid) {
+		trdx_cfgblock_mac(cb, mac);
+		outbuf_printf(ob, ",%08u," MAC_FMT ",%u,%u,%u,%u\n", cb->serial, MAC_ARGS(mac),
+			      hw->prodid, hw->ver_major, hw->ver_minor, hw->ver_assembly);
+	} else {
+		outbuf_puts(ob, ",,,,,,\n");
+	}
+}
+
+static void bulk_add_row(const char *devfile, off64_t pos, const struct trdx_cfgblock *cb,
+			 bool valid, int status)
+{
+	size_t path_len = strlen(devfile);
+	struct bulk_row *row = arena_alloc(&bulk.arena, sizeof(*row));
+	const char *path = arena_strndup(&bulk.arena, devfile, path_len);
+
+	if (!row || !path) {
+		if (!bulk.failed)
+			err("Failed to allocate memory\n");
+		bulk.failed = true;
+		return;
+	}
+
+	memset(row, 0, sizeof(*row));
+	row->path = path;
+	row->path_len = path_len;
+	row->offset = pos;
+	row->flags = (valid ? REC_CB_F_VALID : 0) | (status != 0 ? REC_CB_F_ERROR : 0);
+	if (valid) {
+		row->serial = cb->serial;
+		row->prodid = cb->hw.prodid;
+		row->ver_major = cb->hw.ver_major;
+		row->ver_minor = cb->hw.ver_minor;
+		row->ver_assembly = cb->hw.ver_assembly;
+		trdx_cfgblock_mac(cb, row->mac);
+	}
+
+	*bulk.tail = row;
+	bulk.tail = &row->next;
+	bulk.num_rows++;
+	bulk.path_len += path_len;
+}
+
+/* Size of the values of each column, the paths are variable length */
+static const uint8_t bulk_col_width[REC_CB_COL_MAX] = {
+	[REC_CB_COL_FLAGS]		= sizeof(uint32_t),
+	[REC_CB_COL_SERIAL]		= sizeof(uint32_t),
+	[REC_CB_COL_OFFSET]		= sizeof(uint64_t),
+	[REC_CB_COL_PRODID]		= sizeof(uint16_t),
+	[REC_CB_COL_VER_MAJOR]		= sizeof(uint16_t),
+	[REC_CB_COL_VER_MINOR]		= sizeof(uint16_t),
+	[REC_CB_COL_VER_ASSEMBLY]	= sizeof(uint16_t),
+	[REC_CB_COL_MAC]		= 6,
+	[REC_CB_COL_PATH_OFF]		= sizeof(uint64_t),
+};
+
+/* Length of column col in bytes, without padding */
+static uint64_t bulk_col_len(unsigned int col)
+{
+	if (col == REC_CB_COL_PATH)
+		return bulk.path_len;
+	if (col == REC_CB_COL_PATH_OFF)
+		return (bulk.num_rows + 1) * bulk_col_width[col];
+	return bulk.num_rows * bulk_col_width[col];
+}
+
+static void bulk_put(const void *val, size_t len)
+{
+	outbuf_write(&bulk.out, val, len);
+	bulk_flush(BULK_FLUSH_SIZE);
+}
+
+static void bulk_put16(uint16_t val)
+{
+	val = htole16(val);
+	bulk_put(&val, sizeof(val));
+}
+
+static void bulk_put32(uint32_t val)
+{
+	val = htole32(val);
+	bulk_put(&val, sizeof(val));
+}
+
+static void bulk_put64(uint64_t val)
+{
+	val = htole64(val);
+	bulk_put(&val, sizeof(val));
+}
+
+/* Append column col of all rows, padded to REC_ALIGN */
+static void bulk_write_column(unsigned int col)
+{
+	static const uint8_t pad[REC_ALIGN];
+	const struct bulk_row *row;
+	uint64_t path_off = 0;
+
+	for (row = bulk.head; row; row = row->next) {
+		switch (col) {
+		case REC_CB_COL_FLAGS:
+			bulk_put32(row->flags);
+			break;
+		case REC_CB_COL_SERIAL:
+			bulk_put32(row->serial);
+			break;
+		case REC_CB_COL_OFFSET:
+			bulk_put64(row->offset);
+			break;
+		case REC_CB_COL_PRODID:
+			bulk_put16(row->prodid);
+			break;
+		case REC_CB_COL_VER_MAJOR:
+			bulk_put16(row->ver_major);
+			break;
+		case REC_CB_COL_VER_MINOR:
+			bulk_put16(row->ver_minor);
+			break;
+		case REC_CB_COL_VER_ASSEMBLY:
+			bulk_put16(row->ver_assembly);
+			break;
+		case REC_CB_COL_MAC:
+			bulk_put(row->mac, sizeof(row->mac));
+			break;
+		case REC_CB_COL_PATH_OFF:
+			bulk_put64(path_off);
+			path_off += row->path_len;
+			break;
+		case REC_CB_COL_PATH:
+			bulk_put(row->path, row->path_len);
+			break;
+		}
+	}
+	if (col == REC_CB_COL_PATH_OFF)
+		bulk_put64(path_off);
+
+	bulk_put(pad, (REC_ALIGN - bulk_col_len(col) % REC_ALIGN) % REC_ALIGN);
+}
+
+static void bulk_write_columns(void)
+{
+	struct rec_cb_columns hdr;
+	uint64_t off = sizeof(hdr);
+	unsigned int col;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = htole32(REC_MAGIC_CB_COLUMNS);
+	hdr.version = htole16(REC_VERSION);
+	hdr.num_cols = htole16(REC_CB_COL_MAX);
+	hdr.num_rows = htole64(bulk.num_rows);
+	for (col = 0; col < REC_CB_COL_MAX; col++) {
+		hdr.col_off[col] = htole64(off);
+		off += (bulk_col_len(col) + REC_ALIGN - 1) / REC_ALIGN * REC_ALIGN;
+	}
+	hdr.size = htole64(off);
+
+	bulk_put(&hdr, sizeof(hdr));
+	for (col = 0; col < REC_CB_COL_MAX; col++)
+		bulk_write_column(col);
+}
+
+/* Write out what's left of the CSV or columnar output */
+static int bulk_finish(void)
+{
+	int ret = 0;
+
+	if (output_format == FORMAT_COLUMNAR && !bulk.failed)
+		bulk_write_columns();
+	bulk_flush(0);
+	if (bulk.failed) {
+		err("Failed to write output\n");
+		ret = -1;
+	}
+	outbuf_free(&bulk.out);
+	arena_free(&bulk.arena);
+	return ret;
+}
+
+static void print_config_block(const char *devfile, off64_t pos, const struct trdx_cfgblock *cb,
+			       bool valid, int status)
+{
+	struct outbuf ob;
+
+	if (output_format == FORMAT_CSV) {
+		print_config_block_csv(&bulk.out, devfile, pos, cb, valid, status);
+		bulk_flush(BULK_FLUSH_SIZE);
+		return;
+	}
+	if (output_format == FORMAT_COLUMNAR) {
+		bulk_add_row(devfile, pos, cb, valid, status);
+		return;
+	}
+
+	outbuf_init(&ob);
+
+	switch (output_format) {
+	case FORMAT_TEXT:
+		print_config_block_text(&ob, devfile, pos, cb, valid);
+		break;
+	case FORMAT_JSON:
+		print_config_block_json(&ob, devfile, pos, cb, valid, status);
+		break;
+	case FORMAT_BINARY:
+		print_config_block_binary(&ob, devfile, pos, cb, valid, status);
+		break;
+	default:
+		break;
+	}
+
+	outbuf_flush(&ob, STDOUT_FILENO);
+	outbuf_free(&ob);
+}
+
+/*
+ * Check the result of reading loc (with request r), errors are staged in
+ * errs. Returns the config block data or NULL.
+ */
+static const uint8_t *cfg_block_data(const struct cfg_block_loc *loc, const struct image_req *r,
+				     struct outbuf *errs)
+{
+	if (!loc->opened) {
+		cb_err(errs, "Failed to open file %s: %s\n", loc->devfile, strerror(loc->error));
+		return NULL;
+	}
+
+	if (loc->error) {
+		cb_err(errs, "Failed to seek to offset %jd: %s\n", (intmax_t) loc->skip,
+		       strerror(loc->error));
+		return NULL;
+	}
+
+	if (!r->data) {
+		cb_err(errs, "Failed to read %u bytes from file: %s\n", TRDX_CFG_BLOCK_MAX_SIZE,
+		       strerror(r->error));
+		return NULL;
+	}
+
+	return r->data;
+}
+
+/* Report the result of reading loc (with request r), parse and print it */
+static int read_config_block(struct cfg_block_loc *loc, const struct image_req *r)
+{
+	struct trdx_cfgblock cb;
+	struct outbuf errs;
+	const uint8_t *data;
+	bool valid = false;
+
+	outbuf_init(&errs);
+	data = cfg_block_data(loc, r, &errs);
+	if (data)
+		valid = parse_config_block(data, &cb, &errs);
+	outbuf_flush(&errs, STDERR_FILENO);
+	outbuf_free(&errs);
+
+	if (!data)
 		return -1;
+	print_config_block(loc->devfile, loc->pos, &cb, valid, 0);
+	return 0;
+}
+
+/*
+ * Read all candidate locations at once, then use the first one which could
+ * be read.
+ */
+static int read_config_blocks(struct cfg_block_loc *locs, unsigned int n)
+{
+	struct image_req reqs[IMAGE_BATCH_MAX];
+	struct image_req *loc_req[IMAGE_BATCH_MAX];
+	struct image_io io;
+	unsigned int i, nreqs = 0;
+	int ret = -1;
+
+	for (i = 0; i < n; i++) {
+		loc_req[i] = &reqs[nreqs];
+		nreqs += cfg_block_plan(&locs[i], &reqs[nreqs]);
 	}
 
-	pos = lseek64(fd, skip, skip < 0 ? SEEK_END : SEEK_SET);
-	if (pos == -1) {
-		err("Failed to seek to offset %jd: %s\n", (intmax_t) skip, strerror(errno));
-		goto out;
+	image_io_init(&io);
+	image_io_read(&io, reqs, nreqs);
+	image_io_exit(&io);
+
+	for (i = 0; i < n && ret != 0; i++)
+		ret = read_config_block(&locs[i], loc_req[i]);
+
+	/* Machine readable formats always get a record, even on failure */
+	if (ret != 0 && output_format != FORMAT_TEXT) {
+		struct trdx_cfgblock cb;
+
+		memset(&cb, 0, sizeof(cb));
+		print_config_block(locs[n - 1].devfile, locs[n - 1].pos, &cb, false, ret);
 	}
 
-	config_block = malloc(TRDX_CFG_BLOCK_MAX_SIZE);
-	if (!config_block) {
+	for (i = 0; i < n; i++)
+		if (locs[i].opened)
+			image_close(&locs[i].img);
+
+	return ret;
+}
+
+/*
+ * Header of a config block (the TAG_VALID tag) as a little endian 32-bit word,
+ * the length of the tag is not part of the mask.
+ */
+#define CFG_HDR_MASK	0xffffc000
+#define CFG_HDR_VALUE	((uint32_t)TAG_VALID << 16 | TAG_FLAG_VALID << 14)
+
+static inline uint32_t cfg_hdr_word(const uint8_t *p)
+{
+	uint32_t w;
+
+	memcpy(&w, p, sizeof(w));
+	return le32toh(w);
+}
+
+/*
+ * Find the config block headers at the 512 byte boundaries of the len bytes at
+ * data. Eight boundaries are compared at once without branches (which the
+ * compiler can vectorize), only a match is looked at one by one. Returns the
+ * number of offsets stored to hits, at most max.
+ */
+static unsigned int scan_chunk(const uint8_t *data, size_t len, size_t *hits, unsigned int max)
+{
+	const size_t stride = TRDX_CFG_BLOCK_MAX_SIZE;
+	size_t off = 0;
+	unsigned int i, n = 0;
+
+	for (; off + 8 * stride <= len && n + 8 <= max; off += 8 * stride) {
+		uint32_t match = 0;
+
+		for (i = 0; i < 8; i++)
+			match |= (uint32_t)((cfg_hdr_word(data + off + i * stride) & CFG_HDR_MASK) ==
+					    CFG_HDR_VALUE) << i;
+		for (i = 0; match; i++, match >>= 1)
+			if (match & 1)
+				hits[n++] = off + i * stride;
+	}
+
+	for (; off + 4 <= len && n < max; off += stride)
+		if ((cfg_hdr_word(data + off) & CFG_HDR_MASK) == CFG_HDR_VALUE)
+			hits[n++] = off;
+
+	return n;
+}
+
+/*
+ * Search all of devfile for config blocks and print every valid one found. The
+ * device is read sequentially in large chunks, candidates are validated by
+ * parsing their tags, which have to include the MAC address and hardware
+ * version.
+ */
+static int scan_config_blocks(const char *devfile)
+{
+	struct image img;
+	struct trdx_cfgblock cb;
+	static size_t hits[SCAN_CHUNK_SIZE / TRDX_CFG_BLOCK_MAX_SIZE];
+	uint8_t *buf = NULL;
+	uint64_t off;
+	size_t chunk;
+	unsigned int found = 0;
+	int ret = -1;
+
+	if (image_open_flags(&img, devfile, image_flags) != 0) {
+		err("Failed to open file %s: %s\n", devfile, strerror(errno));
+		return -1;
+	}
+	posix_fadvise(img.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	if (!img.map && posix_memalign((void **)&buf, 4096, SCAN_CHUNK_SIZE) != 0) {
 		err("Failed to allocate memory\n");
+		buf = NULL;
 		goto out;
 	}
 
-	/* TODO: NAND flash size is different, try to detect which one it is */
-	read_size = TRDX_CFG_BLOCK_MAX_SIZE;
-	len = read(fd, config_block, read_size);
-	close(fd);
-	if (len < read_size) {
-		err("Failed to read %zu bytes from file: %s\n", read_size, strerror(errno));
-		goto out;
+	/* MTD devices are read by erase block, up to the last good one */
+	chunk = image_is_mtd(&img) && img.erasesize < SCAN_CHUNK_SIZE ? img.erasesize
+								       : SCAN_CHUNK_SIZE;
+	for (off = 0; off < img.size; off += chunk) {
+		size_t len = img.size - off > chunk ? chunk : img.size - off;
+		const uint8_t *data = image_read(&img, off, len, buf);
+		unsigned int i, n;
+
+		if (!data && image_is_mtd(&img) && errno == ENXIO)
+			break;
+		if (!data) {
+			err("Failed to read %zu bytes at offset 0x%08" PRIx64 " from %s: %s\n", len, off,
+			    devfile, strerror(errno));
+			goto out;
+		}
+
+		n = scan_chunk(data, len, hits, sizeof(hits) / sizeof(hits[0]));
+		for (i = 0; i < n; i++) {
+			/* chunks are a multiple of the block size, only the last one can be short */
+			if (trdx_cfgblock_parse(data + hits[i], len - hits[i], &cb) != APALIS_OK ||
+			    !cb.has_mac || !cb.has_hw || cb.truncated)
+				continue;
+			print_config_block(devfile, off + hits[i], &cb, true, 0);
+			found++;
+		}
 	}
 
+	if (found == 0) {
+		warn("No valid Toradex config block found on %s\n", devfile);
+		goto out;
+	}
 	ret = 0;
+out:
+	/* Machine readable formats always get a record, even on failure */
+	if (ret != 0 && output_format != FORMAT_TEXT) {
+		memset(&cb, 0, sizeof(cb));
+		print_config_block(devfile, 0, &cb, false, ret);
+	}
+	free(buf);
+	image_close(&img);
+	return ret;
+}
 
-	tag = (struct toradex_tag *) config_block;
-	if (tag->flags != TAG_FLAG_VALID || tag->id != TAG_VALID) {
-		warn("No valid Toradex config block found on %s at 0x%08jx\n",
-		     devfile, (intmax_t) pos);
-		goto out;
+/*
+ * Batch mode is a pipeline: the inputs are dealt round-robin to a number of
+ * lanes, each with a reader thread (opening the inputs and reading their
+ * config blocks, everything queued at once) and a parser thread (checking and
+ * parsing them). A single writer thread takes the results from the lanes in
+ * turn, so they are printed in input order. The stages are connected by SPSC
+ * rings passing a fixed pool of jobs around, so memory use doesn't depend on
+ * the number of inputs and a stage only waits if the next one is behind:
+ *
+ *   feeder -> todo -> reader -> read -> parser -> done -> writer -> free -> feeder
+ */
+
+/* Jobs per lane, inputs read ahead of the writer */
+#define PIPE_DEPTH	IMAGE_BATCH_MAX
+
+struct cfg_block_job {
+	char			*path;
+	size_t			path_size;
+	struct cfg_block_loc	loc;
+	struct image_req	req;
+	struct trdx_cfgblock	cb;
+	bool			valid;
+	int			ret;
+	struct outbuf		errs;		/* errors and warnings, staged for the writer */
+};
+
+struct pipe_lane {
+	struct pipe		*p;
+	struct ring		todo, read, done, free;
+	struct image_io		io;
+	pthread_t		reader, parser;
+	struct cfg_block_job	jobs[PIPE_DEPTH];
+};
+
+struct pipe {
+	struct pipe_lane	*lanes;
+	unsigned int		num_lanes;
+	unsigned long		seq;		/* inputs fed so far */
+	unsigned int		failed;
+	off64_t			skip;
+	bool			default_skip;
+	pthread_t		writer;
+};
+
+static void *pipe_reader(void *arg)
+{
+	struct pipe_lane *l = arg;
+	struct cfg_block_job *jobs[IMAGE_BATCH_MAX];
+	struct image_req reqs[IMAGE_BATCH_MAX];
+	unsigned int planned[IMAGE_BATCH_MAX];
+	unsigned int i, n, nreqs;
+	void *p;
+
+	do {
+		/* read everything queued (but at least one input) in one batch */
+		n = 0;
+		p = ring_pop(&l->todo);
+		while (p) {
+			jobs[n++] = p;
+			if (n == IMAGE_BATCH_MAX || !ring_trypop(&l->todo, &p))
+				break;
+		}
+
+		for (i = 0, nreqs = 0; i < n; i++) {
+			struct cfg_block_loc *loc = &jobs[i]->loc;
+
+			loc->devfile = jobs[i]->path;
+			loc->skip = l->p->skip;
+			loc->default_skip = l->p->default_skip;
+			loc->pos = 0;
+			planned[i] = cfg_block_plan(loc, &reqs[nreqs]);
+			nreqs += planned[i];
+		}
+		image_io_read(&l->io, reqs, nreqs);
+
+		for (i = 0, nreqs = 0; i < n; i++) {
+			if (planned[i])
+				jobs[i]->req = reqs[nreqs++];
+			ring_push(&l->read, jobs[i]);
+		}
+	} while (p);
+
+	ring_push(&l->read, NULL);
+	return NULL;
+}
+
+static void *pipe_parser(void *arg)
+{
+	struct pipe_lane *l = arg;
+	struct cfg_block_job *j;
+
+	while ((j = ring_pop(&l->read))) {
+		const uint8_t *data = cfg_block_data(&j->loc, &j->req, &j->errs);
+
+		j->valid = data && parse_config_block(data, &j->cb, &j->errs);
+		j->ret = data ? 0 : -1;
+		if (j->loc.opened)
+			image_close(&j->loc.img);
+		ring_push(&l->done, j);
 	}
-	tag_off = 4;
 
-	printf("Toradex config block found on %s at 0x%08jx\n", devfile,
-               (intmax_t) pos);
+	ring_push(&l->done, NULL);
+	return NULL;
+}
+
+static void *pipe_writer(void *arg)
+{
+	struct pipe *p = arg;
+	struct cfg_block_job *j;
+	unsigned long seq;
 
-	memset(&hw, 0, sizeof(hw));
-	memset(&eth_addr, 0, sizeof(eth_addr));
+	for (seq = 0; ; seq++) {
+		struct pipe_lane *l = &p->lanes[seq % p->num_lanes];
 
-	while (true) {
-		tag = (struct toradex_tag *)(config_block + tag_off);
-		if (tag->flags != TAG_FLAG_VALID)
+		j = ring_pop(&l->done);
+		if (!j)
 			break;
 
-		tag_off += 4;
-		switch (tag->id) {
-		case TAG_MAC:
-			memcpy(&eth_addr, config_block + tag_off, sizeof(eth_addr));
-			/* NIC part of MAC address is serial number */
-			serial = ntohl(eth_addr.nic) >> 8;
+		outbuf_flush(&j->errs, STDERR_FILENO);
+		if (j->ret == 0) {
+			print_config_block(j->path, j->loc.pos, &j->cb, j->valid, 0);
+		} else {
+			p->failed++;
+			/* Machine readable formats always get a record, even on failure */
+			if (output_format != FORMAT_TEXT) {
+				memset(&j->cb, 0, sizeof(j->cb));
+				print_config_block(j->path, j->loc.pos, &j->cb, false, j->ret);
+			}
+		}
+		ring_push(&l->free, j);
+	}
+
+	return NULL;
+}
+
+/* Hand path to the next lane, once it has a free job */
+static int pipe_feed(struct pipe *p, const char *path)
+{
+	struct pipe_lane *l = &p->lanes[p->seq % p->num_lanes];
+	struct cfg_block_job *j = ring_pop(&l->free);
+	size_t len = strlen(path) + 1;
+
+	if (len > j->path_size) {
+		char *new_path = realloc(j->path, len);
+
+		if (!new_path) {
+			err("Failed to allocate memory\n");
+			ring_push(&l->free, j);
+			return -1;
+		}
+		j->path = new_path;
+		j->path_size = len;
+	}
+	memcpy(j->path, path, len);
+
+	ring_push(&l->todo, j);
+	p->seq++;
+	return 0;
+}
+
+static int pipe_lane_init(struct pipe_lane *l)
+{
+	unsigned int i;
+
+	image_io_init(&l->io);
+	for (i = 0; i < PIPE_DEPTH; i++)
+		outbuf_init(&l->jobs[i].errs);
+
+	/* room for all jobs plus the end marker */
+	if (ring_init(&l->todo, 2 * PIPE_DEPTH) != 0 || ring_init(&l->read, 2 * PIPE_DEPTH) != 0 ||
+	    ring_init(&l->done, 2 * PIPE_DEPTH) != 0 || ring_init(&l->free, 2 * PIPE_DEPTH) != 0)
+		return -1;
+
+	for (i = 0; i < PIPE_DEPTH; i++)
+		ring_push(&l->free, &l->jobs[i]);
+	return 0;
+}
+
+static void pipe_lane_free(struct pipe_lane *l)
+{
+	unsigned int i;
+
+	for (i = 0; i < PIPE_DEPTH; i++) {
+		free(l->jobs[i].path);
+		outbuf_free(&l->jobs[i].errs);
+	}
+	image_io_exit(&l->io);
+	ring_free(&l->todo);
+	ring_free(&l->read);
+	ring_free(&l->done);
+	ring_free(&l->free);
+}
+
+/* Start the threads of up to num_lanes lanes and the writer */
+static int pipe_start(struct pipe *p, unsigned int num_lanes)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < num_lanes; i++) {
+		struct pipe_lane *l = &p->lanes[i];
+
+		l->p = p;
+		if (pipe_lane_init(l) != 0) {
+			err("Failed to allocate memory\n");
+			pipe_lane_free(l);
 			break;
-		case TAG_HW:
-			memcpy(&hw, config_block + tag_off, sizeof(hw));
+		}
+		ret = pthread_create(&l->reader, NULL, pipe_reader, l);
+		if (ret != 0) {
+			err("Failed to create reader thread: %s\n", strerror(ret));
+			pipe_lane_free(l);
 			break;
-		default:
-			warn("Unknown tag id 0x%04x found in Toradex config block\n", tag->id);
+		}
+		ret = pthread_create(&l->parser, NULL, pipe_parser, l);
+		if (ret != 0) {
+			err("Failed to create parser thread: %s\n", strerror(ret));
+			ring_push(&l->todo, NULL);
+			pthread_join(l->reader, NULL);
+			pipe_lane_free(l);
 			break;
 		}
+		p->num_lanes++;
+	}
+	if (p->num_lanes == 0)
+		return -1;
 
-		tag_off += tag->len * 4;
+	ret = pthread_create(&p->writer, NULL, pipe_writer, p);
+	if (ret != 0) {
+		err("Failed to create writer thread: %s\n", strerror(ret));
+		return -1;
 	}
+	return 0;
+}
+
+/* Feed the end marker to all lanes and wait for the pipeline to drain */
+static void pipe_stop(struct pipe *p, bool writer)
+{
+	unsigned int i;
+
+	for (i = 0; i < p->num_lanes; i++)
+		ring_push(&p->lanes[i].todo, NULL);
+	if (writer)
+		pthread_join(p->writer, NULL);
+	for (i = 0; i < p->num_lanes; i++) {
+		pthread_join(p->lanes[i].reader, NULL);
+		pthread_join(p->lanes[i].parser, NULL);
+		pipe_lane_free(&p->lanes[i]);
+	}
+}
 
-	printf("Model:  Toradex %s V%d.%d%c\n", toradex_modules[hw.prodid],
-	       hw.ver_major, hw.ver_minor, (char)hw.ver_assembly + 'A');
-	printf("Serial: %08d\n", serial);
-	printf("MAC:    %02x:%02x:%02x:%02x:%02x:%02x\n",
-	       (uint8_t)((eth_addr.oui & 0x0000ff) >> 0),
-	       (uint8_t)((eth_addr.oui & 0x00ff00) >> 8),
-	       (uint8_t)((eth_addr.oui & 0xff0000) >> 16),
-	       (uint8_t)((eth_addr.nic & 0x0000ff) >> 0),
-	       (uint8_t)((eth_addr.nic & 0x00ff00) >> 8),
-	       (uint8_t)((eth_addr.nic & 0xff0000) >> 16));
+/*
+ * Read the config block of every input, each a path or a glob pattern. With
+ * no inputs (or a single "-") they are read from stdin, one per line. The
+ * inputs are processed by a pipeline with num_lanes readers and parsers.
+ */
+static int read_config_block_batch(char **inputs, int n, off64_t skip, bool skip_set,
+				   unsigned int num_lanes)
+{
+	struct pipe p;
+	char *line = NULL;
+	size_t line_size = 0;
+	glob_t g;
+	unsigned int failed = 0;
+	int i;
 
+	memset(&p, 0, sizeof(p));
+	p.skip = skip;
+	p.default_skip = !skip_set;
+
+	p.lanes = calloc(num_lanes, sizeof(*p.lanes));
+	if (!p.lanes) {
+		err("Failed to allocate memory\n");
+		return -1;
+	}
+	if (pipe_start(&p, num_lanes) != 0) {
+		pipe_stop(&p, false);
+		free(p.lanes);
+		return -1;
+	}
+
+	if (n == 0 || (n == 1 && strcmp(inputs[0], "-") == 0)) {
+		ssize_t len;
+
+		while ((len = getline(&line, &line_size, stdin)) != -1) {
+			if (len > 0 && line[len - 1] == '\n')
+				line[--len] = '\0';
+			if (len == 0)
+				continue;
+			if (pipe_feed(&p, line) != 0)
+				failed++;
+		}
+		free(line);
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		size_t j;
+
+		if (glob(inputs[i], GLOB_NOCHECK, NULL, &g) != 0) {
+			err("Failed to expand %s\n", inputs[i]);
+			globfree(&g);
+			failed++;
+			continue;
+		}
+		for (j = 0; j < g.gl_pathc; j++) {
+			if (pipe_feed(&p, g.gl_pathv[j]) != 0)
+				failed++;
+		}
+		globfree(&g);
+	}
+
+out:
+	pipe_stop(&p, true);
+	free(p.lanes);
+	return failed || p.failed ? -1 : 0;
+}
+
+/* Fields to set when writing the config block */
+struct cfg_block_update {
+	bool		serial_set;
+	uint32_t	serial;
+	bool		prodid_set;
+	uint16_t	prodid;
+	bool		version_set;
+	struct toradex_hw version;	/* only the ver_* fields are used */
+};
+
+/*
+ * Parse an unsigned number of at most max, rejecting empty input, signs,
+ * trailing characters and overflow
+ */
+static int parse_ulong(const char *str, int base, unsigned long max, unsigned long *val)
+{
+	char *end;
+
+	if (!isdigit((unsigned char)*str))
+		return -1;
+	errno = 0;
+	*val = strtoul(str, &end, base);
+	if (errno || *end || *val > max)
+		return -1;
+	return 0;
+}
+
+/* Parse a hardware version like V1.1A */
+static int parse_hw_version(const char *str, struct toradex_hw *hw)
+{
+	unsigned int major, minor;
+	char assembly;
+
+	if (*str == 'V' || *str == 'v')
+		str++;
+	if (sscanf(str, "%u.%u%c", &major, &minor, &assembly) != 3 ||
+	    major > UINT16_MAX || minor > UINT16_MAX || assembly < 'A' || assembly > 'Z')
+		return -1;
+
+	hw->ver_major = major;
+	hw->ver_minor = minor;
+	hw->ver_assembly = assembly - 'A';
+	return 0;
+}
+
+/*
+ * Set sysfs attribute force_ro of the block device st refers to, store the
+ * previous value in old. Returns -1 if there is no such attribute.
+ */
+static int set_force_ro(const struct stat *st, char val, char *old)
+{
+	char path[64], cur;
+	int fd, ret = -1;
+
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/force_ro",
+		 major(st->st_rdev), minor(st->st_rdev));
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (pread(fd, &cur, 1, 0) == 1) {
+		*old = cur;
+		ret = 0;
+		if (cur != val && pwrite(fd, &val, 1, 0) != 1)
+			ret = -1;
+	}
+	close(fd);
+	return ret;
+}
+
+/*
+ * Write the config block at skip (relative to the end if negative) of devfile,
+ * updating the fields in upd and keeping the others. The block is built in
+ * memory and written with a single pwrite() of the logical sectors covering
+ * it. Nothing is written if the device already contains the same bytes.
+ */
+static int write_config_block(const char *devfile, off64_t skip, const struct cfg_block_update *upd)
+{
+	struct trdx_cfgblock cb;
+	uint8_t new_block[TRDX_CFG_BLOCK_MAX_SIZE];
+	uint8_t *buf = NULL;
+	struct stat st;
+	uint64_t size;
+	off64_t pos, start;
+	size_t len;
+	int fd = -1, sector_size, ret = -1;
+	ssize_t n;
+	uint64_t t;
+	char force_ro = '0';
+	bool ro_toggled = false;
+
+	if (stat(devfile, &st) != 0) {
+		err("Failed to open file %s: %s\n", devfile, strerror(errno));
+		return -1;
+	}
+	/* NAND pages would have to be erased first */
+	if (S_ISCHR(st.st_mode)) {
+		err("Writing to character device %s is not supported\n", devfile);
+		return -1;
+	}
+
+	/* eMMC boot partitions are read-only by default */
+	if (S_ISBLK(st.st_mode) && set_force_ro(&st, '0', &force_ro) == 0)
+		ro_toggled = force_ro != '0';
+
+	t = stats_start();
+	fd = open(devfile, O_RDWR | O_CLOEXEC | (image_flags & IMAGE_DIRECT ? O_DIRECT : 0));
+	stats_stop(STATS_OPEN, t, 1, 0);
+	if (fd < 0) {
+		err("Failed to open file %s for writing: %s\n", devfile, strerror(errno));
+		goto out;
+	}
+
+	if (S_ISBLK(st.st_mode)) {
+		t = stats_start();
+		if (ioctl(fd, BLKGETSIZE64, &size) != 0 || ioctl(fd, BLKSSZGET, &sector_size) != 0) {
+			stats_stop(STATS_IOCTL, t, 2, 0);
+			err("Failed to get size of %s: %s\n", devfile, strerror(errno));
+			goto out;
+		}
+		stats_stop(STATS_IOCTL, t, 2, 0);
+	} else {
+		size = st.st_size;
+		/* st_blksize is a multiple of the logical block size for O_DIRECT */
+		sector_size = image_flags & IMAGE_DIRECT && st.st_blksize > 512 ? st.st_blksize : 512;
+	}
+
+	pos = skip < 0 ? (off64_t)size + skip : skip;
+	if (pos < 0 || (uint64_t)pos + TRDX_CFG_BLOCK_MAX_SIZE > size) {
+		err("Failed to seek to offset %jd: %s\n", (intmax_t) skip, strerror(EINVAL));
+		goto out;
+	}
+
+	/* the logical sectors covering the config block */
+	start = pos / sector_size * sector_size;
+	len = (pos + TRDX_CFG_BLOCK_MAX_SIZE - start + sector_size - 1) / sector_size * sector_size;
+	if (posix_memalign((void **)&buf, sector_size, len) != 0) {
+		err("Failed to allocate memory\n");
+		buf = NULL;
+		goto out;
+	}
+	t = stats_start();
+	n = pread(fd, buf, len, start);
+	stats_stop(STATS_READ, t, 1, n > 0 ? n : 0);
+	if (n != (ssize_t)len) {
+		err("Failed to read %zu bytes from file: %s\n", len, strerror(errno ? errno : EIO));
+		goto out;
+	}
+
+	if (trdx_cfgblock_parse(buf + (pos - start), TRDX_CFG_BLOCK_MAX_SIZE, &cb) != APALIS_OK)
+		memset(&cb, 0, sizeof(cb));
+	if (cb.num_unknown > 0 || cb.truncated)
+		warn("Dropping unknown tags of the existing config block on %s\n", devfile);
+
+	if (upd->serial_set)
+		trdx_cfgblock_set_serial(&cb, upd->serial);
+	if (upd->prodid_set) {
+		cb.hw.prodid = upd->prodid;
+		cb.has_hw = true;
+	}
+	if (upd->version_set) {
+		cb.hw.ver_major = upd->version.ver_major;
+		cb.hw.ver_minor = upd->version.ver_minor;
+		cb.hw.ver_assembly = upd->version.ver_assembly;
+		cb.has_hw = true;
+	}
+	if (!cb.has_mac || !cb.has_hw) {
+		err("No valid config block on %s, --serial, --prodid and --hw-version are required\n",
+		    devfile);
+		goto out;
+	}
+
+	trdx_cfgblock_build(&cb, new_block, sizeof(new_block));
+
+	if (memcmp(buf + (pos - start), new_block, sizeof(new_block)) == 0) {
+		ret = 0;
+		if (output_format == FORMAT_TEXT)
+			printf("Toradex config block on %s at 0x%08jx is up to date\n", devfile,
+			       (intmax_t) pos);
+		goto print;
+	}
+
+	memcpy(buf + (pos - start), new_block, sizeof(new_block));
+	if (pwrite(fd, buf, len, start) != (ssize_t)len) {
+		err("Failed to write %zu bytes to %s: %s\n", len, devfile, strerror(errno ? errno : EIO));
+		goto out;
+	}
+	if (fsync(fd) != 0) {
+		err("Failed to sync %s: %s\n", devfile, strerror(errno));
+		goto out;
+	}
+	ret = 0;
+	if (output_format == FORMAT_TEXT)
+		printf("Toradex config block written to %s at 0x%08jx\n", devfile, (intmax_t) pos);
+print:
+	fflush(stdout);
+	print_config_block(devfile, pos, &cb, true, 0);
 out:
-	free(config_block);
+	free(buf);
+	if (fd >= 0)
+		close(fd);
+	if (ro_toggled && set_force_ro(&st, force_ro, &force_ro) != 0)
+		warn("Failed to restore force_ro of %s\n", devfile);
 	return ret;
 }
 
-int main(int argc, char **argv)
+int TOOL_MAIN(trdx_configblock)(int argc, char **argv)
 {
 	int c, ret;
-	off64_t skip = DEFAULT_ARG_PART_OFF;
+	enum stats_format stats_format = STATS_TEXT;
+	off64_t skip = TRDX_CFG_ARG_PART_SECTOR;
 	bool skip_set = false;
 	char *devfile = NULL;
+	struct cfg_block_loc locs[3];
+	struct cfg_block_update upd;
+	bool write = false, scan = false, batch = false, force = false;
+	unsigned int jobs = 1;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long n;
+	char *end;
 	enum {
 		UNIT_SECTORS,
 		UNIT_BYTES,
 	} units = UNIT_SECTORS;
 
+	memset(&upd, 0, sizeof(upd));
+	memset(locs, 0, sizeof(locs));
+	if (ncpus < 1)
+		ncpus = 1;
+
 	/* If arguments are given, use the specified device/offset */
 	while ((c = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
 		switch (c) {
+		case 'f':
+			if (strcmp(optarg, "text") == 0)
+				output_format = FORMAT_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				output_format = FORMAT_JSON;
+			else if (strcmp(optarg, "binary") == 0)
+				output_format = FORMAT_BINARY;
+			else if (strcmp(optarg, "csv") == 0)
+				output_format = FORMAT_CSV;
+			else if (strcmp(optarg, "columnar") == 0)
+				output_format = FORMAT_COLUMNAR;
+			else
+				usage_and_exit(EXIT_FAILURE);
+			break;
 		case 's':
 			if (optarg[strlen(optarg) - 1] == 'b')
 				units = UNIT_BYTES;
@@ -241,6 +1292,67 @@ int main(int argc, char **argv)
 			skip = (off64_t) strtoll(optarg, NULL, 0);
 			skip_set = true;
 			break;
+		case 'b':
+			batch = true;
+			break;
+		case 'j':
+			errno = 0;
+			n = strtoul(optarg, &end, 0);
+			if (errno || *end || end == optarg ||
+			    n > (unsigned long)ncpus * JOBS_PER_CPU) {
+				err("Invalid number of jobs: %s (at most %ld)\n", optarg,
+				    ncpus * JOBS_PER_CPU);
+				return EXIT_FAILURE;
+			}
+			jobs = n ? n : (unsigned long)ncpus;
+			break;
+		case 'w':
+			write = true;
+			break;
+		case 'D':
+			image_flags |= IMAGE_DIRECT;
+			break;
+		case OPT_SCAN:
+			scan = true;
+			break;
+		case OPT_STATS:
+			if (!optarg || strcmp(optarg, "text") == 0)
+				stats_format = STATS_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				stats_format = STATS_JSON;
+			else
+				usage_and_exit(EXIT_FAILURE);
+			if (stats_enable() != 0) {
+				err("Built without statistics support, rebuild with STATS=1\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			if (parse_ulong(optarg, 10, TRDX_SERIAL_MAX, &n) != 0) {
+				err("Invalid serial number %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			upd.serial = n;
+			upd.serial_set = true;
+			break;
+		case 'P':
+			if (parse_ulong(optarg, 0, UINT16_MAX, &n) != 0) {
+				err("Invalid product id %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			upd.prodid = n;
+			upd.prodid_set = true;
+			break;
+		case OPT_FORCE:
+			force = true;
+			break;
+		case 'V':
+			if (parse_hw_version(optarg, &upd.version) != 0) {
+				err("Invalid hardware version %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			upd.version_set = true;
+			break;
 		case 'h':
 			usage_and_exit(EXIT_SUCCESS);
 		default:
@@ -248,20 +1360,65 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (optind < argc)
+	if (optind < argc && !batch)
 		devfile = argv[optind];
 
 	if (units == UNIT_SECTORS)
-		skip *= DEFAULT_SECTOR_SIZE;
+		skip *= TRDX_CFG_SECTOR_SIZE;
 
-	if (!devfile) {
+	if (write && (scan || batch)) {
+		err("--write can't be combined with --scan or --batch\n");
+		return EXIT_FAILURE;
+	}
+	if (scan && (skip_set || batch)) {
+		err("--scan can't be combined with --skip or --batch\n");
+		return EXIT_FAILURE;
+	}
+	if (write && !upd.serial_set && !upd.prodid_set && !upd.version_set) {
+		err("Nothing to write, use --serial, --prodid or --hw-version\n");
+		return EXIT_FAILURE;
+	}
+	if (upd.prodid_set && !trdx_module_known(upd.prodid) && !force) {
+		err("Unknown product id %u, use --force to write it anyway\n", upd.prodid);
+		return EXIT_FAILURE;
+	}
+
+	if (output_format == FORMAT_CSV)
+		outbuf_puts(&bulk.out, "path,offset,status,valid,serial,mac,prodid,ver_major,ver_minor,ver_assembly\n");
+
+	if (batch) {
+		ret = read_config_block_batch(argv + optind, argc - optind, skip, skip_set, jobs);
+	} else if (scan) {
+		ret = scan_config_blocks(devfile ? devfile : "/dev/mmcblk0boot0");
+		if (!devfile && ret != 0)
+			ret = scan_config_blocks("/dev/mmcblk0");
+	} else if (write) {
+		if (!devfile)
+			ret = write_config_block("/dev/mmcblk0boot0",
+						 skip_set ? skip : TRDX_CFG_EMMC_BOOT_OFF, &upd);
+		else
+			ret = write_config_block(devfile, skip, &upd);
+	} else if (!devfile) {
 		/* Toradex BSP >= 2.3 stores the config block in the last sector
-		 * of the first boot partition */
-		ret = read_config_block("/dev/mmcblk0boot0", skip_set ? skip : DEFAULT_EMMC_BOOT_OFF);
-		if (ret != 0)
-			ret = read_config_block("/dev/mmcblk0", skip_set ? skip : (DEFAULT_ARG_PART_OFF * DEFAULT_SECTOR_SIZE));
-	} else
-		ret = read_config_block(devfile, skip);
+		 * of the first boot partition, older ones in the ARG partition,
+		 * NAND based modules in the first MTD partition. All are read
+		 * at once, the first one readable is used. */
+		locs[0].devfile = "/dev/mmcblk0boot0";
+		locs[0].skip = skip_set ? skip : TRDX_CFG_EMMC_BOOT_OFF;
+		locs[1].devfile = "/dev/mmcblk0";
+		locs[1].skip = skip_set ? skip : TRDX_CFG_ARG_PART_OFF;
+		locs[2].devfile = "/dev/mtd0";
+		locs[2].skip = skip_set ? skip : TRDX_CFG_NAND_OFF;
+		ret = read_config_blocks(locs, 3);
+	} else {
+		locs[0].devfile = devfile;
+		locs[0].skip = skip;
+		locs[0].default_skip = !skip_set;
+		ret = read_config_blocks(locs, 1);
+	}
 
+	if (bulk_finish() != 0)
+		ret = -1;
+	stats_report(STDERR_FILENO, stats_format);
 	return ret;
 }
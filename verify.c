@@ -0,0 +1,349 @@
+/*
+ * Verification of partition contents against a manifest of SHA-256 hashes
+ *
+ * Every job opens the image on its own and hashes one partition at a time.
+ * A reader thread per job fills two chunk buffers in turn, so reading the
+ * next chunk from the device overlaps hashing the current one.
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#define _LARGEFILE64_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "stats.h"
+#include "verify.h"
+
+static int hex_nibble(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = tolower((unsigned char)c);
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static int parse_manifest_line(char *line, struct verify_entry *e)
+{
+	char *name;
+	size_t len;
+	unsigned int i;
+
+	for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+		int hi = hex_nibble(line[2 * i]), lo;
+
+		if (hi < 0 || (lo = hex_nibble(line[2 * i + 1])) < 0)
+			return -1;
+		e->digest[i] = hi << 4 | lo;
+	}
+
+	/* "<digest>  <name>" or "<digest> *<name>" as written by sha256sum */
+	name = line + 2 * SHA256_DIGEST_SIZE;
+	if (*name != ' ' && *name != '\t')
+		return -1;
+	while (*name == ' ' || *name == '\t')
+		name++;
+	if (*name == '*')
+		name++;
+
+	len = strcspn(name, "\r\n");
+	if (len == 0 || len >= sizeof(e->name))
+		return -1;
+	memcpy(e->name, name, len);
+	e->name[len] = '\0';
+	return 0;
+}
+
+int verify_manifest_load(struct verify_manifest *m, const char *path, unsigned int *line)
+{
+	char buf[2 * SHA256_DIGEST_SIZE + sizeof(m->entries[0].name) + 8];
+	unsigned int size = 0;
+	FILE *fp;
+	int ret = -1;
+
+	m->entries = NULL;
+	m->num = 0;
+	*line = 0;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		const char *p = buf;
+
+		(*line)++;
+		while (isspace((unsigned char)*p))
+			p++;
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		if (m->num == size) {
+			struct verify_entry *entries;
+
+			size = size ? 2 * size : 16;
+			entries = realloc(m->entries, size * sizeof(*entries));
+			if (!entries)
+				goto out;
+			m->entries = entries;
+		}
+		if (parse_manifest_line(buf, &m->entries[m->num]) != 0) {
+			errno = EINVAL;
+			goto out;
+		}
+		m->num++;
+	}
+	if (ferror(fp)) {
+		*line = 0;
+		goto out;
+	}
+	*line = 0;
+	ret = 0;
+out:
+	fclose(fp);
+	if (ret != 0)
+		verify_manifest_free(m);
+	return ret;
+}
+
+void verify_manifest_free(struct verify_manifest *m)
+{
+	free(m->entries);
+	m->entries = NULL;
+	m->num = 0;
+}
+
+struct verify_chunk {
+	uint8_t		*buf;
+	const uint8_t	*data;	/* the chunk's data (into buf or the mapping) */
+	size_t		len;
+	int		error;
+	bool		full;
+};
+
+/* State shared by the jobs of a verify_parts() call */
+struct verify_run {
+	const char		*path;
+	unsigned int		image_flags;
+	struct verify_part	*parts;
+	unsigned int		n;
+	unsigned int		next;	/* next part to hash */
+	unsigned int		failed;
+};
+
+struct verify_job {
+	struct verify_run	*run;
+	struct image		img;
+	struct verify_part	*part;	/* the part being hashed */
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct verify_chunk	chunks[2];
+	int			error;	/* errno value of a failed setup */
+};
+
+/* Read the chunks of job->part in turn into the two chunk buffers */
+static void *verify_reader(void *arg)
+{
+	struct verify_job *job = arg;
+	struct verify_part *part = job->part;
+	uint64_t done = 0;
+	unsigned int i;
+
+	for (i = 0; done < part->len; i = !i) {
+		struct verify_chunk *c = &job->chunks[i];
+		size_t len = part->len - done > VERIFY_CHUNK_SIZE ? VERIFY_CHUNK_SIZE
+								   : part->len - done;
+		const void *data;
+		int error = 0;
+
+		pthread_mutex_lock(&job->lock);
+		while (c->full)
+			pthread_cond_wait(&job->cond, &job->lock);
+		pthread_mutex_unlock(&job->lock);
+
+		data = image_read(&job->img, part->off + done, len, c->buf);
+		if (!data)
+			error = errno;
+
+		pthread_mutex_lock(&job->lock);
+		c->data = data;
+		c->len = len;
+		c->error = error;
+		c->full = true;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+
+		if (error)
+			break;
+		done += len;
+	}
+
+	return NULL;
+}
+
+static void verify_part_hash(struct verify_job *job, struct verify_part *part)
+{
+	struct sha256_ctx ctx;
+	pthread_t reader;
+	uint64_t done = 0;
+	unsigned int i;
+	int ret;
+
+	job->part = part;
+	job->chunks[0].full = job->chunks[1].full = false;
+
+	ret = pthread_create(&reader, NULL, verify_reader, job);
+	if (ret != 0) {
+		part->error = ret;
+		return;
+	}
+
+	sha256_init(&ctx);
+	for (i = 0; done < part->len; i = !i) {
+		struct verify_chunk *c = &job->chunks[i];
+		uint64_t t;
+
+		pthread_mutex_lock(&job->lock);
+		while (!c->full)
+			pthread_cond_wait(&job->cond, &job->lock);
+		pthread_mutex_unlock(&job->lock);
+
+		if (c->error) {
+			part->error = c->error;
+			break;
+		}
+
+		t = stats_start();
+		sha256_update(&ctx, c->data, c->len);
+		stats_stop(STATS_HASH, t, 0, c->len);
+		done += c->len;
+
+		pthread_mutex_lock(&job->lock);
+		c->full = false;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	pthread_join(reader, NULL);
+	if (!part->error)
+		sha256_final(&ctx, part->digest);
+}
+
+static void *verify_worker(void *arg)
+{
+	struct verify_job *job = arg;
+	struct verify_run *run = job->run;
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->n) {
+		struct verify_part *part = &run->parts[i];
+
+		part->error = job->error;
+		if (!part->error)
+			verify_part_hash(job, part);
+		if (part->error)
+			__atomic_fetch_add(&run->failed, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static int verify_job_init(struct verify_job *job, struct verify_run *run)
+{
+	unsigned int i;
+
+	memset(job, 0, sizeof(*job));
+	job->run = run;
+	if (image_open_flags(&job->img, run->path, run->image_flags) != 0)
+		return -1;
+
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->cond, NULL);
+
+	/* mapped images are hashed straight from the mapping */
+	for (i = 0; !job->img.map && i < 2; i++) {
+		void *buf;
+
+		/* page aligned, as needed by O_DIRECT */
+		if (posix_memalign(&buf, 4096, VERIFY_CHUNK_SIZE) != 0) {
+			job->error = ENOMEM;
+			break;
+		}
+		job->chunks[i].buf = buf;
+	}
+
+	return 0;
+}
+
+static void verify_job_exit(struct verify_job *job)
+{
+	free(job->chunks[0].buf);
+	free(job->chunks[1].buf);
+	pthread_cond_destroy(&job->cond);
+	pthread_mutex_destroy(&job->lock);
+	image_close(&job->img);
+}
+
+int verify_parts(const char *path, unsigned int image_flags, struct verify_part *parts,
+		 unsigned int n, unsigned int jobs)
+{
+	struct verify_run run = {
+		.path		= path,
+		.image_flags	= image_flags,
+		.parts		= parts,
+		.n		= n,
+	};
+	struct verify_job *js;
+	pthread_t *threads;
+	unsigned int i, started = 0;
+	int ret = -1, saved_errno;
+
+	if (jobs > n)
+		jobs = n;
+	if (jobs == 0)
+		jobs = 1;
+
+	js = calloc(jobs, sizeof(*js));
+	threads = calloc(jobs, sizeof(*threads));
+	if (!js || !threads) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < jobs; i++) {
+		if (verify_job_init(&js[i], &run) != 0)
+			goto out_exit;
+		started++;
+	}
+
+	/* The first job runs on the calling thread */
+	for (i = 1; i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, verify_worker, &js[i]) != 0)
+			break;
+	}
+	verify_worker(&js[0]);
+	while (--i > 0)
+		pthread_join(threads[i], NULL);
+
+	ret = run.failed;
+out_exit:
+	saved_errno = errno;
+	for (i = 0; i < started; i++)
+		verify_job_exit(&js[i]);
+	errno = saved_errno;
+out:
+	free(threads);
+	free(js);
+	return ret;
+}
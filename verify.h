@@ -0,0 +1,58 @@
+/*
+ * Verification of partition contents against a manifest of SHA-256 hashes
+ *
+ * Copyright (C) 2026 Tobias Klauser <tklauser@distanz.ch>
+ *
+ * License: GNU General Public License, version 2
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+
+#include "sha256.h"
+
+#define VERIFY_NAME_MAX	36	/* GPT names are at most 36 UTF-16 characters */
+
+struct verify_entry {
+	char		name[4 * VERIFY_NAME_MAX + 1];
+	uint8_t		digest[SHA256_DIGEST_SIZE];
+};
+
+/* Expected hashes, one "<hex digest>  <partition name>" line each */
+struct verify_manifest {
+	struct verify_entry	*entries;
+	unsigned int		num;
+};
+
+/*
+ * Load the manifest at path (in sha256sum(1) format, lines starting with '#'
+ * are ignored). Returns -1 and sets errno on error, *line is set to the
+ * offending line number for malformed lines (0 otherwise).
+ */
+int verify_manifest_load(struct verify_manifest *m, const char *path, unsigned int *line);
+void verify_manifest_free(struct verify_manifest *m);
+
+/* A partition (byte range) to hash */
+struct verify_part {
+	const struct verify_entry *entry;
+	uint64_t	off;
+	uint64_t	len;
+	uint8_t		digest[SHA256_DIGEST_SIZE];	/* set on success */
+	int		error;		/* errno value if reading failed */
+};
+
+/*
+ * Hash the n parts of the image at path, using up to jobs partitions hashed in
+ * parallel. Each partition is read sequentially in VERIFY_CHUNK_SIZE chunks by
+ * a reader thread, overlapping the read of the next chunk with hashing the
+ * current one. Returns the number of parts which couldn't be read, or -1 and
+ * sets errno if the image can't be opened.
+ */
+#define VERIFY_CHUNK_SIZE	(1024 * 1024)
+
+int verify_parts(const char *path, unsigned int image_flags, struct verify_part *parts,
+		 unsigned int n, unsigned int jobs);
+
+#endif /* VERIFY_H */